@@ -21,12 +21,91 @@
  * The decision making algorithms in the remainder of the toolkit
  * generate these actions to get the game to take account of their
  * decisions.
+ *
+ * Actions that spend most of their time waiting (for a timer, or for
+ * something to happen in the game) can say so with
+ * Action::getWakeTime. The manager doesn't run them while they wait,
+ * and an ActionScheduler doesn't execute managers whose actions are
+ * all waiting, so thousands of characters standing around cost
+ * nothing each frame. See coaction.h for actions written as
+ * coroutines, which wait in the middle of their code.
  */
 #ifndef AICORE_ACTION_H
 #define AICORE_ACTION_H
 
+#include <stddef.h>
+#include <vector>
+
 namespace aicore
 {
+    // Forward declarations (see snapshot.h, and below)
+    class SnapshotWriter;
+    class SnapshotReader;
+    class ActionFactory;
+    class ActionScheduler;
+
+    /**
+     * Provides the memory for actions. Action lists are created and
+     * thrown away all the time (state machines build new lists of
+     * actions every time they are updated), so using the general
+     * purpose allocator for them is slow. Instead every Action (and
+     * any class derived from it) is allocated from this pool, by the
+     * operator new and delete in the Action class. This happens
+     * automatically, so there is normally no need to use the pool
+     * directly.
+     *
+     * The pool keeps a separate free list for each size of object,
+     * in steps of GRANULARITY bytes. Each thread has its own free
+     * lists, so allocation doesn't need any locks. Actions can be
+     * deleted on a different thread from the one that created them,
+     * and after a thread's free lists have gone (as the thread exits,
+     * or during static destruction), when the shared lists left by
+     * finished threads are used instead.
+     * Memory is taken from the system in chunks, and is kept for
+     * reuse rather than being given back, so once the program has
+     * reached its peak number of actions no more system allocations
+     * are made. Objects bigger than MAX_SIZE bytes go straight to
+     * the system allocator.
+     */
+    class ActionPool
+    {
+    public:
+        enum
+        {
+            /** The step between the sizes of object pooled. */
+            GRANULARITY = 16,
+
+            /** The largest object that is pooled. */
+            MAX_SIZE = 256,
+
+            /** The size of the chunks taken from the system. */
+            CHUNK_SIZE = 16*1024
+        };
+
+        /** Returns memory for an object of the given size. */
+        static void* allocate(size_t size);
+
+        /**
+         * Returns the given memory, which was allocated with the
+         * given size, to the pool.
+         */
+        static void release(void *memory, size_t size);
+
+        /**
+         * Makes sure the calling thread can allocate the given number
+         * of objects of the given size without the pool needing more
+         * memory from the system.
+         */
+        static void reserve(size_t size, unsigned count);
+
+        /**
+         * Returns the number of chunks that have been taken from the
+         * system so far. This can be used to check that a steady
+         * state loop isn't allocating.
+         */
+        static unsigned getChunkCount();
+    };
+
     /**
      * The action class is the base class for any request the AI makes
      * of the game. In some cases the AI is simple enough for this to
@@ -37,6 +116,30 @@ namespace aicore
     class Action
     {
     public:
+        /**
+         * Creates an action with zero priority, no next action, and
+         * no expiry time.
+         */
+        Action() : priority(0), next(NULL), expiryTime(0) {}
+
+        /**
+         * Destroys the action. This doesn't delete the rest of the
+         * list: use deleteList for that.
+         */
+        virtual ~Action() {}
+
+        /** Allocates actions from the ActionPool. */
+        static void* operator new(size_t size)
+        {
+            return ActionPool::allocate(size);
+        }
+
+        /** Returns actions to the ActionPool. */
+        static void operator delete(void *memory, size_t size)
+        {
+            ActionPool::release(memory, size);
+        }
+
         /**
          * The relative priority of this action. This allows actions
          * to prempt others.
@@ -49,11 +152,25 @@ namespace aicore
          */
         Action* next;
 
+        /**
+         * The time, on the action manager's clock, after which the
+         * action is no longer wanted if it is still waiting in the
+         * queue. Zero means the action never expires. Actions that
+         * have started aren't affected.
+         */
+        real expiryTime;
+
         /**
          * Retutns the last action in the list of actions.
          */
         Action* getLast();
 
+        /**
+         * Adds the second list of actions onto the end of the first,
+         * either of which may be empty, returning the combined list.
+         */
+        static Action* appendActions(Action *list, Action *more);
+
         /**
          * Checks if this action can be interrupt others. By default
          * no actions can be interrupt.
@@ -77,7 +194,9 @@ namespace aicore
         virtual bool isComplete();
 
         /**
-         * Requests that the action delete itself and its children.
+         * Requests that the action delete itself and the rest of the
+         * list that follows it. The list is deleted in a loop rather
+         * than recursively, so long lists are safe.
          */
         virtual void deleteList();
 
@@ -87,6 +206,106 @@ namespace aicore
          * nothing.
          */
         virtual void act();
+
+        /**
+         * Called by the action manager in place of act, with the
+         * time on its clock. The default just calls act: compound
+         * actions override it, so they can pass the time on and skip
+         * sub-actions that are still waiting.
+         */
+        virtual void actAt(real time);
+
+        /**
+         * A wake time for an action that is waiting for something
+         * other than the manager's clock. Whatever it is waiting for
+         * must wake the manager (see ActionManager::wake).
+         */
+        static const real WAIT_FOREVER;
+
+        /**
+         * Returns the time, on the manager's clock, before which the
+         * action has nothing to do. Until then the manager doesn't
+         * call act (or isComplete), and an ActionScheduler can leave
+         * the manager asleep. The default returns zero, so the action
+         * is run every time the manager is executed.
+         */
+        virtual real getWakeTime() const;
+
+        /** The types of action that can be saved in a snapshot. */
+        enum SnapshotType
+        {
+            /** An action that can't be saved. */
+            SNAPSHOT_NONE = 0,
+
+            /** An ActionCombination. */
+            SNAPSHOT_COMBINATION,
+
+            /** An ActionSequence. */
+            SNAPSHOT_SEQUENCE,
+
+            /** The first type number free for the game's own actions. */
+            SNAPSHOT_USER = 16
+        };
+
+        /**
+         * Returns the number that identifies this type of action in a
+         * snapshot, which an ActionFactory turns back into an action.
+         * The default gives SNAPSHOT_NONE, so the action is left out
+         * of snapshots.
+         */
+        virtual unsigned getSnapshotType() const;
+
+        /**
+         * Writes the action's state. The default writes its priority
+         * and expiry time: actions with their own state should call
+         * it, then write the rest.
+         */
+        virtual void writeSnapshot(SnapshotWriter &writer) const;
+
+        /**
+         * Reads the state written by writeSnapshot into a newly
+         * created action.
+         *
+         * @return False if the reader has failed.
+         */
+        virtual bool readSnapshot(SnapshotReader &reader,
+                                  ActionFactory &factory);
+
+        /**
+         * Writes the list of actions starting with the given one
+         * (which may be null), leaving out any that can't be saved.
+         */
+        static void writeSnapshotList(SnapshotWriter &writer,
+                                      const Action *list);
+
+        /**
+         * Reads a list of actions written by writeSnapshotList,
+         * creating them with the given factory.
+         *
+         * @return The new list, or null if it was empty or couldn't
+         * be read (in which case the reader has failed).
+         */
+        static Action* readSnapshotList(SnapshotReader &reader,
+                                        ActionFactory &factory);
+    };
+
+    /**
+     * Creates actions of the types given by getSnapshotType, when
+     * they are read from a snapshot. This default creates the
+     * compound actions: games with their own saveable actions derive
+     * from it, creating their actions and passing any other types on.
+     */
+    class ActionFactory
+    {
+    public:
+        virtual ~ActionFactory() {}
+
+        /**
+         * Creates a default constructed action of the given type, for
+         * its state to be read into, or returns null if it isn't a
+         * type this factory knows.
+         */
+        virtual Action* create(unsigned type);
     };
 
     /**
@@ -97,6 +316,56 @@ namespace aicore
      */
     class ActionManager
     {
+        /**
+         * Holds the run of actions in the queue that have the same
+         * priority.
+         */
+        struct PriorityBucket
+        {
+            real priority;
+            Action *first;
+            Action *last;
+        };
+
+        /**
+         * Holds one bucket for each different priority in the queue,
+         * highest priority first. The buckets point into the action
+         * queue, so new actions can be added at the end of their
+         * priority without walking the queue.
+         */
+        std::vector<PriorityBucket> buckets;
+
+        /** The number of actions in the queue. */
+        unsigned queueLength;
+
+        /** The scheduler the manager belongs to, or null. */
+        ActionScheduler *scheduler;
+
+        /** Set while the manager's scheduler has it asleep. */
+        bool asleep;
+
+        /**
+         * Counts the times the manager has been put to sleep, so its
+         * scheduler can tell which of its entries are out of date.
+         */
+        unsigned sleepCount;
+
+        friend class ActionScheduler;
+
+        /**
+         * Removes the given action from the queue. The previous
+         * action in the queue (or null if it is the first) and the
+         * action's bucket must be given.
+         */
+        void removeQueued(Action * previous, Action * action,
+                          unsigned bucket);
+
+        /** Checks if a queued action has expired. */
+        bool hasExpired(const Action * action) const
+        {
+            return action->expiryTime > 0 && action->expiryTime <= time;
+        }
+
     public:
         /**
          * Holds the highest priority value for all actions in the
@@ -107,7 +376,11 @@ namespace aicore
         /**
          * Holds the head of the action queue. This consists of
          * actions that have been scheduled, but are not yet being
-         * performed.
+         * performed. The queue is in order of priority, and actions
+         * with the same priority are in the order they were
+         * scheduled. The queue should only be read: use
+         * scheduleAction to add to it, and don't change the priority
+         * of an action while it is queued.
          */
         Action * actionQueue;
 
@@ -117,6 +390,13 @@ namespace aicore
          */
         Action * active;
 
+        /**
+         * The manager's clock, which is moved on each time the
+         * manager is executed. Queued actions whose expiry time has
+         * passed are deleted without being run.
+         */
+        real time;
+
     protected:
         /**
          * Runs all the active actions, deleting any that
@@ -148,38 +428,146 @@ namespace aicore
         ActionManager();
 
         /**
-         * Adds the given action to the queue.
+         * Adds the given action to the queue. This takes time
+         * proportional to the logarithm of the number of different
+         * priorities in the queue, rather than the length of the
+         * queue.
          */
         void scheduleAction(Action * newAction);
 
+        /** Returns the number of actions waiting in the queue. */
+        unsigned getQueueLength() const { return queueLength; }
+
+        /**
+         * Returns the time on the manager's clock when it next has
+         * something to do. This is the earliest wake time of the
+         * active actions, or the current time if any of them is
+         * awake, or there is anything in the queue (since queued
+         * actions are checked every time). A manager with nothing to
+         * do returns Action::WAIT_FOREVER.
+         */
+        real getWakeTime() const;
+
+        /**
+         * Tells the manager's scheduler to execute it again, if it
+         * was asleep. This is called when an action is scheduled, and
+         * should be called by anything that an action with a wake
+         * time of Action::WAIT_FOREVER is waiting for.
+         */
+        void wake();
+
+        /** Returns the scheduler the manager belongs to, or null. */
+        ActionScheduler * getScheduler() const { return scheduler; }
+
         /**
          * Runs the action manager, running the component actions in
          * turn. Note that the action manager deletes the action
          * objects it is done with.
+         *
+         * @param duration The time to move the manager's clock on
+         * by, before checking for expired actions.
+         */
+        void execute(real duration = 0);
+
+        /**
+         * Writes the manager's clock, and its active and queued
+         * actions. Actions that can't be saved are left out.
          */
-        void execute();
+        void writeSnapshot(SnapshotWriter &writer) const;
+
+        /**
+         * Deletes the manager's actions, and replaces them with those
+         * in the snapshot, created by the given factory.
+         *
+         * @return False if the snapshot couldn't be read, in which
+         * case the manager is left empty.
+         */
+        bool readSnapshot(SnapshotReader &reader, ActionFactory &factory);
     };
 
     /**
      * Compund actions are made up of sub-actions. This is a base
      * class that adds the sub-action management code that then has
      * sematics added in its sub-classes.
+     *
+     * The sub-actions are held in an array rather than a linked
+     * list, and the compound keeps count of how many have completed,
+     * so checking if the whole compound is complete doesn't need to
+     * look at any of them. The completed sub-actions are always at
+     * the start of the array.
      */
     class ActionCompound : public Action
     {
+    protected:
+        /**
+         * Holds the sub-actions, in the order they were added,
+         * except that completed ones are moved to the front.
+         * Subclasses may delete completed sub-actions, leaving null
+         * in their place.
+         */
+        std::vector<Action*> subActions;
+
+        /** The number of sub-actions at the front that have completed. */
+        unsigned completed;
+
     public:
-        Action * subActions;
+        /** Creates a compound action with no sub-actions. */
+        ActionCompound() : completed(0) {}
 
         /**
-         * Requests that the action delete itself and its children.
+         * Deletes the compound action and all its sub-actions. This
+         * doesn't recurse into compound sub-actions, so deep plans
+         * can't overflow the stack.
          */
-        virtual void deleteList();
+        virtual ~ActionCompound();
+
+        /**
+         * Adds the given action, and the rest of the list that
+         * follows it, to the end of the sub-actions. The compound
+         * takes ownership of them, and unlinks them from their list.
+         */
+        void addSubActions(Action * list);
+
+        /** Returns the number of sub-actions, including completed ones. */
+        unsigned getSubActionCount() const
+        {
+            return (unsigned)subActions.size();
+        }
+
+        /**
+         * Returns the sub-action with the given index. Completed
+         * sub-actions come first, and may be null if they have been
+         * deleted.
+         */
+        Action * getSubAction(unsigned index) const
+        {
+            return subActions[index];
+        }
+
+        /** Returns the number of sub-actions that have completed. */
+        unsigned getCompletedCount() const { return completed; }
+
+        /** Returns true when every one of the sub-actions has completed. */
+        virtual bool isComplete();
+
+        /**
+         * Returns the earliest wake time of the sub-actions that
+         * haven't completed.
+         */
+        virtual real getWakeTime() const;
 
         /**
          * Compound actions are compatible, only if all their
          * components are compatible.
          */
         virtual bool canDoBoth(const Action * other) const;
+
+        /** Writes the action's state, followed by its sub-actions. */
+        virtual void writeSnapshot(SnapshotWriter &writer) const;
+
+        /** Reads the action's state and its sub-actions. */
+        virtual bool readSnapshot(SnapshotReader &reader,
+                                  ActionFactory &factory);
     };
 
     /**
@@ -196,16 +584,22 @@ namespace aicore
         virtual bool canInterrupt();
 
         /**
-         * Returns true if all the sub-actions is done. Otherwise the
-         * manager keeps scheduling the action.
+         * Called to make the action do its stuff. It calls all its
+         * subactions that haven't completed, and moves those that
+         * complete to the front, keeping the rest in order. With no
+         * clock to go by, this runs sub-actions whatever their wake
+         * time.
          */
-        virtual bool isComplete();
+        virtual void act();
 
         /**
-         * Called to make the action do its stuff. It calls all its
-         * subactions.
+         * Does the same as act, but leaves sub-actions whose wake
+         * time is after the given time, as the action manager does.
          */
-        virtual void act();
+        virtual void actAt(real time);
+
+        /** Returns SNAPSHOT_COMBINATION. */
+        virtual unsigned getSnapshotType() const;
     };
 
     /**
@@ -222,16 +616,138 @@ namespace aicore
         virtual bool canInterrupt();
 
         /**
-         * Returns true if all the sub-actions are done. Otherwise the
-         * manager keeps scheduling the action.
+         * Called to make the action do its stuff. It calls the first
+         * sub-action that hasn't completed, and deletes it once it
+         * completes.
          */
-        virtual bool isComplete();
+        virtual void act();
 
         /**
-         * Called to make the action do its stuff. It calls all its
-         * subactions.
+         * Does the same as act, passing the given time on to the
+         * sub-action. The sequence's wake time is the sub-action's,
+         * so the manager only calls this once the sub-action is
+         * awake.
          */
-        virtual void act();
+        virtual void actAt(real time);
+
+        /** Returns the wake time of the sub-action being run. */
+        virtual real getWakeTime() const;
+
+        /** Returns SNAPSHOT_SEQUENCE. */
+        virtual unsigned getSnapshotType() const;
+    };
+
+    /**
+     * Executes a set of action managers, one for each character,
+     * skipping those with nothing to do. After executing a manager,
+     * the scheduler asks for its wake time: if that is in the future
+     * the manager is put to sleep, and isn't executed again until
+     * the scheduler's clock reaches it, or it is woken (by having
+     * an action scheduled, or by ActionManager::wake).
+     *
+     * Sleeping managers are held in a heap by wake time, so each
+     * execute only costs as much as the managers that are awake.
+     * The managers' clocks are kept in step with the scheduler's:
+     * when a manager is executed, its clock is moved on to the
+     * scheduler's time, however long it has been asleep.
+     */
+    class ActionScheduler
+    {
+        /** Holds a sleeping manager in the heap. */
+        struct Sleeper
+        {
+            real wakeTime;
+            ActionManager *manager;
+
+            /**
+             * The manager's sleep count when this was added. The
+             * entry is out of date if the manager has been woken or
+             * put to sleep again since.
+             */
+            unsigned sleepCount;
+
+            /** Orders the heap so the earliest wake time is on top. */
+            bool operator<(const Sleeper &other) const
+            {
+                return wakeTime > other.wakeTime;
+            }
+        };
+
+        /** The managers to execute next time. */
+        std::vector<ActionManager*> awake;
+
+        /** Holds the managers being executed. */
+        std::vector<ActionManager*> running;
+
+        /** The sleeping managers, as a heap. */
+        std::vector<Sleeper> sleeping;
+
+        /** The number of out of date entries in the heap. */
+        unsigned staleCount;
+
+        /** Returns true if the entry in the heap is out of date. */
+        static bool isStale(const Sleeper &sleeper);
+
+        /** Puts the given manager to sleep until the given time. */
+        void sleep(ActionManager *manager, real wakeTime);
+
+        /** Takes out of date entries out of the heap. */
+        void removeStale();
+
+    public:
+        /** The scheduler's clock. */
+        real time;
+
+        /** Creates a scheduler with no managers. */
+        ActionScheduler();
+
+        /**
+         * Removes the managers still in the scheduler, leaving them
+         * with no scheduler.
+         */
+        ~ActionScheduler();
+
+        /**
+         * Adds the given manager, which mustn't belong to another
+         * scheduler, and will be executed next time. Its clock is
+         * set to the scheduler's.
+         */
+        void add(ActionManager *manager);
+
+        /**
+         * Removes the given manager, which must be done before it is
+         * deleted. This takes time proportional to the number of
+         * managers asleep, and mustn't be called while the scheduler
+         * is executing.
+         */
+        void remove(ActionManager *manager);
+
+        /**
+         * Executes the given manager next time, if it is asleep. This
+         * is called by ActionManager::wake.
+         */
+        void wake(ActionManager *manager);
+
+        /** Returns the number of managers in the scheduler. */
+        unsigned getSize() const
+        {
+            return (unsigned)(awake.size() + sleeping.size()) - staleCount;
+        }
+
+        /** Returns the number of managers that will be executed next time. */
+        unsigned getAwakeCount() const { return (unsigned)awake.size(); }
+
+        /**
+         * Moves the clock on by the given duration, then executes the
+         * managers that are awake, or whose wake time has come.
+         * Managers woken while this runs are executed next time.
+         */
+        void execute(real duration);
+
+    private:
+        // The managers point back to the scheduler.
+        ActionScheduler(const ActionScheduler &);
+        ActionScheduler& operator=(const ActionScheduler &);
     };
 
 }; // end of namespace
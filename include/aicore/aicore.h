@@ -67,22 +67,40 @@
 
 #include "core.h"
 #include "timing.h"
+#include "profiler.h"
+#include "metrics.h"
 #include "aimath.h"
+#include "fastmath.h"
+#include "simd.h"
+#include "jobs.h"
 #include "primitives.h"
+#include "broadphase.h"
 
 #include "action.h"
+#include "coaction.h"
 
 #include "location.h"
+#include "snapshot.h"
 #include "kinematic.h"
+#include "batch.h"
+#include "lod.h"
+#include "spatial.h"
 #include "steering.h"
+#include "steercompose.h"
 #include "steerpipe.h"
+#include "flocking.h"
+#include "crowd.h"
 
 #include "dectree.h"
 #include "basesm.h"
 #include "sm.h"
 #include "markovsm.h"
+#include "hsm.h"
+#include "fuzzysm.h"
 
 #include "rules.h"
+#include "database.h"
+#include "rete.h"
 
 #include "learning.h"
 #include "qlearning.h"
@@ -32,11 +32,17 @@ namespace aicore
      * Holds a vector in 3 dimensions. This class has a whole series
      * of methods used to manipulate the vector.
      *
-     * Four real data members are allocated for the vector. When you
+     * The vector is a template over the type of its components, so
+     * the same program can hold vectors at more than one precision
+     * (for example float for bulk steering and double for world
+     * positions). Vector3 is the vector of the library's real type,
+     * and is what the rest of the library uses.
+     *
+     * Four T data members are allocated for the vector. When you
      * are working with single precision floating point values on a
      * PC, for example, having four members allocated allows the
      * Vector to site on a 16-byte alignment boundary, for improved
-     * memory performance. If you are using other types of real value
+     * memory performance. If you are using other types of T value
      * (IEEE extended precision floats, for example), then it makes no
      * sense to have this pad value here, so it can be safely removed.
      *
@@ -45,25 +51,26 @@ namespace aicore
      * file so that an intelligent compiler will inline them into the
      * compiled code.
      */
-    class Vector3
+    template <typename T>
+    class BasicVector3
     {
     public:
          /** Holds the value along the x axis. */
-        real x;
+        T x;
 
         /** Holds the value along the y axis. */
-        real y;
+        T y;
 
         /** Holds the value along the z axis. */
-        real z;
+        T z;
 
     private:
         /** Padding to ensure 4 word alignment. */
-        real _pad;
+        T _pad;
 
     public:
         /** The default constructor creates a zero vector. */
-        Vector3() : x(0), y(0), z(0) {}
+        constexpr BasicVector3() : x(0), y(0), z(0), _pad(0) {}
 
         /**
          * @name Default Directions
@@ -75,12 +82,12 @@ namespace aicore
          * with the Y axis pointing up and the X axis pointing right.
          */
         /* @{ */
-        const static Vector3 UP;
-        const static Vector3 RIGHT;
-        const static Vector3 OUT_OF_SCREEN;
-        const static Vector3 DOWN;
-        const static Vector3 LEFT;
-        const static Vector3 INTO_SCREEN;
+        const static BasicVector3 UP;
+        const static BasicVector3 RIGHT;
+        const static BasicVector3 OUT_OF_SCREEN;
+        const static BasicVector3 DOWN;
+        const static BasicVector3 LEFT;
+        const static BasicVector3 INTO_SCREEN;
         /* @} */
 
         /**
@@ -89,24 +96,33 @@ namespace aicore
          * These are convenience unit-vectors in the basis directions.
          */
         /* @{ */
-        const static Vector3 X;
-        const static Vector3 Y;
-        const static Vector3 Z;
+        const static BasicVector3 X;
+        const static BasicVector3 Y;
+        const static BasicVector3 Z;
         /* @} */
 
         /** A zero length vector. */
-        const static Vector3 ZERO;
+        const static BasicVector3 ZERO;
 
 
         /**
          * The explicit constructor creates a vector with the given
          * components.
          */
-        Vector3(const real x, const real y, const real z)
-            : x(x), y(y), z(z) {}
+        constexpr BasicVector3(const T x, const T y, const T z)
+            : x(x), y(y), z(z), _pad(0) {}
+
+        /**
+         * Creates a vector from one with components of a different
+         * type, converting each component.
+         */
+        template <typename U>
+        explicit BasicVector3(const BasicVector3<U>& other)
+            : x((T)other.x), y((T)other.y), z((T)other.z), _pad(0) {}
 
         /** Creates a vector between the given two points. */
-        Vector3(const Vector3& from, const Vector3& to)
+        BasicVector3(const BasicVector3& from, const BasicVector3& to)
+            : _pad(0)
         {
             x = to.x - from.x;
             y = to.y - from.y;
@@ -114,7 +130,7 @@ namespace aicore
         }
 
         /** Adds the given vector to this. */
-        void operator+=(const Vector3& v)
+        void operator+=(const BasicVector3& v)
         {
             x += v.x;
             y += v.y;
@@ -124,13 +140,13 @@ namespace aicore
         /**
          * Returns the value of the given vector added to this.
          */
-        Vector3 operator+(const Vector3& v) const
+        BasicVector3 operator+(const BasicVector3& v) const
         {
-            return Vector3(x+v.x, y+v.y, z+v.z);
+            return BasicVector3(x+v.x, y+v.y, z+v.z);
         }
 
         /** Subtracts the given vector from this. */
-        void operator-=(const Vector3& v)
+        void operator-=(const BasicVector3& v)
         {
             x -= v.x;
             y -= v.y;
@@ -140,13 +156,13 @@ namespace aicore
         /**
          * Returns the value of the given vector subtracted from this.
          */
-        Vector3 operator-(const Vector3& v) const
+        BasicVector3 operator-(const BasicVector3& v) const
         {
-            return Vector3(x-v.x, y-v.y, z-v.z);
+            return BasicVector3(x-v.x, y-v.y, z-v.z);
         }
 
         /** Multiplies this vector by the given scalar. */
-        void operator*=(const real value)
+        void operator*=(const T value)
         {
             x *= value;
             y *= value;
@@ -154,13 +170,13 @@ namespace aicore
         }
 
         /** Returns a copy of this vector scaled the given value. */
-        Vector3 operator*(const real value) const
+        BasicVector3 operator*(const T value) const
         {
-            return Vector3(x*value, y*value, z*value);
+            return BasicVector3(x*value, y*value, z*value);
         }
 
         /** Checks if the two vectors have identical components. */
-        bool operator==(const Vector3& other) const
+        bool operator==(const BasicVector3& other) const
         {
             return x == other.x &&
                 y == other.y &&
@@ -168,7 +184,7 @@ namespace aicore
         }
 
         /** Checks if the two vectors have non-identical components. */
-        bool operator!=(const Vector3& other) const
+        bool operator!=(const BasicVector3& other) const
         {
             return !(*this == other);
         }
@@ -180,7 +196,7 @@ namespace aicore
          * @note This does not behave like a single-value comparison:
          * !(a < b) does not imply (b >= a).
          */
-        bool operator<(const Vector3& other) const
+        bool operator<(const BasicVector3& other) const
         {
             return x < other.x && y < other.y && z < other.z;
         }
@@ -192,7 +208,7 @@ namespace aicore
          * @note This does not behave like a single-value comparison:
          * !(a < b) does not imply (b >= a).
          */
-        bool operator>(const Vector3& other) const
+        bool operator>(const BasicVector3& other) const
         {
             return x > other.x && y > other.y && z > other.z;
         }
@@ -204,7 +220,7 @@ namespace aicore
          * @note This does not behave like a single-value comparison:
          * !(a <= b) does not imply (b > a).
          */
-        bool operator<=(const Vector3& other) const
+        bool operator<=(const BasicVector3& other) const
         {
             return x <= other.x && y <= other.y && z <= other.z;
         }
@@ -216,7 +232,7 @@ namespace aicore
          * @note This does not behave like a single-value comparison:
          * !(a <= b) does not imply (b > a).
          */
-        bool operator>=(const Vector3& other) const
+        bool operator>=(const BasicVector3& other) const
         {
             return x >= other.x && y >= other.y && z >= other.z;
         }
@@ -225,16 +241,16 @@ namespace aicore
          * Calculates and returns a component-wise product of this
          * vector with the given vector.
          */
-        Vector3 componentProduct(const Vector3 &vector) const
+        BasicVector3 componentProduct(const BasicVector3 &vector) const
         {
-            return Vector3(x * vector.x, y * vector.y, z * vector.z);
+            return BasicVector3(x * vector.x, y * vector.y, z * vector.z);
         }
 
         /**
          * Performs a component-wise product with the given vector and
          * sets this vector to its result.
          */
-        void componentProductUpdate(const Vector3 &vector)
+        void componentProductUpdate(const BasicVector3 &vector)
         {
             x *= vector.x;
             y *= vector.y;
@@ -245,9 +261,9 @@ namespace aicore
          * Calculates and returns the vector product of this vector
          * with the given vector.
          */
-        Vector3 vectorProduct(const Vector3 &vector) const
+        BasicVector3 vectorProduct(const BasicVector3 &vector) const
         {
-            return Vector3(y*vector.z-z*vector.y,
+            return BasicVector3(y*vector.z-z*vector.y,
                            z*vector.x-x*vector.z,
                            x*vector.y-y*vector.x);
         }
@@ -256,7 +272,7 @@ namespace aicore
          * Updates this vector to be the vector product of its current
          * value and the given vector.
          */
-        void operator %=(const Vector3 &vector)
+        void operator %=(const BasicVector3 &vector)
         {
             *this = vectorProduct(vector);
         }
@@ -265,9 +281,9 @@ namespace aicore
          * Calculates and returns the vector product of this vector
          * with the given vector.
          */
-        Vector3 operator%(const Vector3 &vector) const
+        BasicVector3 operator%(const BasicVector3 &vector) const
         {
-            return Vector3(y*vector.z-z*vector.y,
+            return BasicVector3(y*vector.z-z*vector.y,
                            z*vector.x-x*vector.z,
                            x*vector.y-y*vector.x);
         }
@@ -276,7 +292,7 @@ namespace aicore
          * Calculates and returns the scalar product of this vector
          * with the given vector.
          */
-        real scalarProduct(const Vector3 &vector) const
+        T scalarProduct(const BasicVector3 &vector) const
         {
             return x*vector.x + y*vector.y + z*vector.z;
         }
@@ -285,7 +301,7 @@ namespace aicore
          * Calculates and returns the scalar product of this vector
          * with the given vector.
          */
-        real operator*(const Vector3 &vector) const
+        T operator*(const BasicVector3 &vector) const
         {
             return x*vector.x + y*vector.y + z*vector.z;
         }
@@ -293,7 +309,7 @@ namespace aicore
         /**
          * Adds the given vector to this, scaled by the given amount.
          */
-        void addScaledVector(const Vector3& vector, real scale)
+        void addScaledVector(const BasicVector3& vector, T scale)
         {
             x += vector.x * scale;
             y += vector.y * scale;
@@ -301,13 +317,13 @@ namespace aicore
         }
 
         /** Gets the magnitude of this vector. */
-        real magnitude() const
+        T magnitude() const
         {
             return real_sqrt(x*x+y*y+z*z);
         }
 
         /** Gets the squared magnitude of this vector. */
-        real squareMagnitude() const
+        T squareMagnitude() const
         {
             return x*x+y*y+z*z;
         }
@@ -315,22 +331,22 @@ namespace aicore
         /** Turns a non-zero vector into a vector of unit length. */
         void normalise()
         {
-            real l = magnitude();
+            T l = magnitude();
             if (l > 0)
             {
-                (*this) *= ((real)1)/l;
+                (*this) *= ((T)1)/l;
             }
         }
 
 		/** Returns a unit vector in the direction of this vector. */
-		Vector3 unit() const
+		BasicVector3 unit() const
 		{
-			Vector3 result = *this;
+			BasicVector3 result = *this;
 			result.normalise();
 			return result;
 		}
 
-        void setMagnitude(real magnitude)
+        void setMagnitude(T magnitude)
         {
             normalise();
             (*this) *= magnitude;
@@ -347,7 +363,7 @@ namespace aicore
         {
             x = -x;
             y = -y;
-            x = -z;
+            z = -z;
         }
 
 
@@ -358,12 +374,34 @@ namespace aicore
         }
 
         /** Finds this distance from this point to that given. */
-        real distance(const Vector3 &other) const
+        T distance(const BasicVector3 &other) const
         {
-            return Vector3(*this, other).magnitude();
+            return BasicVector3(*this, other).magnitude();
         }
     };
 
+    template <typename T> const BasicVector3<T> BasicVector3<T>::UP(0,1,0);
+    template <typename T> const BasicVector3<T> BasicVector3<T>::RIGHT(1,0,0);
+    template <typename T>
+    const BasicVector3<T> BasicVector3<T>::OUT_OF_SCREEN(0,0,1);
+    template <typename T> const BasicVector3<T> BasicVector3<T>::DOWN(0,-1,0);
+    template <typename T> const BasicVector3<T> BasicVector3<T>::LEFT(-1,0,0);
+    template <typename T>
+    const BasicVector3<T> BasicVector3<T>::INTO_SCREEN(0,0,-1);
+    template <typename T> const BasicVector3<T> BasicVector3<T>::X(1,0,0);
+    template <typename T> const BasicVector3<T> BasicVector3<T>::Y(0,1,0);
+    template <typename T> const BasicVector3<T> BasicVector3<T>::Z(0,0,1);
+    template <typename T> const BasicVector3<T> BasicVector3<T>::ZERO(0,0,0);
+
+    /** A vector of the library's real number type. */
+    typedef BasicVector3<real> Vector3;
+
+    /** A single precision vector. */
+    typedef BasicVector3<float> Vector3f;
+
+    /** A double precision vector. */
+    typedef BasicVector3<double> Vector3d;
+
 }; // end of namespace
 
 #endif // AICORE_AIMATH_H
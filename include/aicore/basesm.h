@@ -17,12 +17,129 @@
  * implementations. State machines have similarities regardless of the
  * specifics of the techniques that they use. The classes in this file
  * are then extended and used by other types of state machines.
+ *
+ * Normally every transition's condition is checked each time a
+ * machine is updated. When the values the conditions depend on are
+ * held in WatchedInteger objects (or other ChangeSource classes),
+ * conditions can report the values they depend on, and event driven
+ * machines (EventStateMachine and EventMarkovStateMachine) only check
+ * their transitions when one of those values changes.
  */
 #ifndef AICORE_BASESM_H
 #define AICORE_BASESM_H
 
+#include <vector>
+
 namespace aicore
 {
+    class ChangeSource;
+
+    /**
+     * A listener is told whenever any of the sources it is listening
+     * to changes.
+     */
+    class ChangeListener
+    {
+        friend class ChangeSource;
+
+        /** Holds the sources this listener is listening to. */
+        std::vector<ChangeSource*> sources;
+
+    public:
+        ChangeListener() {}
+
+        /** Stops listening to all sources. */
+        virtual ~ChangeListener();
+
+        /**
+         * Called when one of the sources changes. This must not start
+         * or stop listening to anything.
+         */
+        virtual void notifyChanged() = 0;
+
+        /** Stops listening to all sources. */
+        void stopListening();
+
+    private:
+        // Listeners are registered by address, so can't be copied.
+        ChangeListener(const ChangeListener &);
+        ChangeListener& operator=(const ChangeListener &);
+    };
+
+    /**
+     * A source is something that can change, and tells its listeners
+     * when it does.
+     */
+    class ChangeSource
+    {
+        friend class ChangeListener;
+
+        /** Holds the listeners to tell about changes. */
+        std::vector<ChangeListener*> listeners;
+
+    public:
+        ChangeSource() {}
+
+        /** Disconnects all the listeners. */
+        virtual ~ChangeSource();
+
+        /**
+         * Adds the given listener, if it isn't already listening.
+         */
+        void addListener(ChangeListener *listener);
+
+        /** Removes the given listener. */
+        void removeListener(ChangeListener *listener);
+
+        /** Returns the number of listeners. */
+        unsigned getListenerCount() const
+        {
+            return (unsigned)listeners.size();
+        }
+
+        /** Tells every listener that the source has changed. */
+        void notifyListeners();
+
+    private:
+        // Sources are registered by address, so can't be copied.
+        ChangeSource(const ChangeSource &);
+        ChangeSource& operator=(const ChangeSource &);
+    };
+
+    /**
+     * Holds an integer that tells its listeners when it is changed.
+     * The value must only be changed through set, or the listeners
+     * won't know.
+     */
+    class WatchedInteger : public ChangeSource
+    {
+        /** Holds the value. */
+        int value;
+
+    public:
+        /** Creates a value with the given starting value. */
+        WatchedInteger(int value = 0) : value(value) {}
+
+        /** Returns the value. */
+        int get() const { return value; }
+
+        /**
+         * Returns the address of the value, for conditions that read
+         * it directly. The value must not be changed through this.
+         */
+        int* getAddress() { return &value; }
+
+        /**
+         * Sets the value, telling the listeners if it has changed.
+         */
+        void set(int newValue)
+        {
+            if (newValue == value) return;
+            value = newValue;
+            notifyListeners();
+        }
+    };
+
     /**
      * The base transition is used for any kind of state machine. It
      * doesn't force a representation for the states or their
@@ -50,6 +167,18 @@ namespace aicore
          */
         virtual Action * getActions();
 
+        /**
+         * Asks the transition to make the given listener listen to
+         * everything that its isTriggered method depends on. The
+         * default implementation asks the condition of transitions
+         * that use ConditionalTransitionMixin.
+         *
+         * @return True if the listener will be told about every
+         * change that could make the transition trigger, false if the
+         * transition has to be checked every update.
+         */
+        virtual bool addListener(ChangeListener *listener);
+
         /**
          * Points to the next transition in the sequence. Transitions
          * are arranged in a singly linked list.
@@ -74,10 +203,25 @@ namespace aicore
     class Condition
     {
     public:
+        virtual ~Condition() {}
+
         /**
          * Performs the test for this condition.
          */
         virtual bool test() = 0;
+
+        /**
+         * Makes the given listener listen to everything the condition
+         * depends on, if it can.
+         *
+         * @return True if the listener will be told about every
+         * change that could change the result of the test. The
+         * default implementation returns false.
+         */
+        virtual bool addListener(ChangeListener * /*listener*/)
+        {
+            return false;
+        }
     };
 
     /**
@@ -98,6 +242,25 @@ namespace aicore
          */
         int target;
 
+        /**
+         * If this is set, it is the source that tells listeners when
+         * the watched value changes.
+         */
+        ChangeSource *source;
+
+        /** Creates a condition watching nothing. */
+        IntegerMatchCondition() : watch(0), target(0), source(0) {}
+
+        /**
+         * Watches the given value, so event driven machines only need
+         * to check the condition when it changes.
+         */
+        void watchValue(WatchedInteger *value)
+        {
+            watch = value->getAddress();
+            source = value;
+        }
+
         /**
          * Checks if the target matches the watch value.
          */
@@ -105,6 +268,43 @@ namespace aicore
         {
             return (*watch == target);
         }
+
+        /**
+         * Listens to the watched value, if it has a source.
+         */
+        virtual bool addListener(ChangeListener *listener);
+    };
+
+    /**
+     * A condition that checks if one of the current character's
+     * integer inputs matches a specified value. The inputs are an
+     * array of integers for each character: before testing, the
+     * calling code sets the pointer that inputs points to. This is
+     * the form of condition a CompiledStateMachine can check for a
+     * whole population of characters at once.
+     */
+    class IntegerInputMatchCondition : public Condition
+    {
+    public:
+        /** Points to the current character's array of inputs. */
+        const int **inputs;
+
+        /** The position of the value to check in the inputs. */
+        unsigned input;
+
+        /**
+         * The target value for the input. If this is matched, then
+         * the condition will be true.
+         */
+        int target;
+
+        /**
+         * Checks if the target matches the input.
+         */
+        virtual bool test()
+        {
+            return ((*inputs)[input] == target);
+        }
     };
 
     /**
@@ -129,6 +329,56 @@ namespace aicore
 
     /* @} */
 
+    /**
+     * Keeps track of whether a list of transitions needs checking,
+     * for event driven state machines.
+     */
+    class TransitionWatcher : public ChangeListener
+    {
+        /** The first transition being watched. */
+        BaseTransition *watching;
+
+        /** Set once watch has been called. */
+        bool started;
+
+        /** Set when something the transitions depend on has changed. */
+        bool dirty;
+
+        /** Set if some transitions have to be checked every time. */
+        bool polling;
+
+    public:
+        /** Creates a watcher that isn't watching anything. */
+        TransitionWatcher();
+
+        /**
+         * Starts watching the given list of transitions, if it isn't
+         * being watched already. Transitions are always checked the
+         * first time after they start being watched.
+         */
+        void watch(BaseTransition *first);
+
+        /** Returns the first transition being watched. */
+        BaseTransition *getWatched() const { return watching; }
+
+        /** Returns true if the transitions need checking. */
+        bool isDirty() const { return dirty || polling; }
+
+        /**
+         * Returns true if the transitions need checking, and notes
+         * that they have been checked.
+         */
+        bool check()
+        {
+            bool result = dirty || polling;
+            dirty = false;
+            return result;
+        }
+
+        /** Notes that something has changed. */
+        virtual void notifyChanged() { dirty = true; }
+    };
+
 }; // end of namespace
 
 #endif // AICORE_SM_H
@@ -0,0 +1,296 @@
+/*
+ * Defines the structure-of-arrays containers used for batch movement.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds containers for processing a large population of characters
+ * at once. The Kinematic and SteeringOutput structures in location.h
+ * are convenient when dealing with a single character, but when tens
+ * of thousands of characters are updated each frame, storing each
+ * one as a separate structure scatters the data that the integrator
+ * needs across memory. The containers in this file store each
+ * component of the state in its own contiguous array (a layout
+ * normally called structure-of-arrays), so that a whole population
+ * can be integrated in one tight loop that the compiler can
+ * vectorise.
+ *
+ * Helper methods are provided to copy data to and from the regular
+ * Kinematic and SteeringOutput structures, so the existing steering
+ * behaviours can still be used to generate the steering for each
+ * character.
+ */
+#ifndef AICORE_BATCH_H
+#define AICORE_BATCH_H
+
+namespace aicore
+{
+    /**
+     * Holds the steering output for a whole population of characters,
+     * with each component in its own array.
+     *
+     * The arrays are owned by the batch, and are reallocated when the
+     * batch is resized, so you should not keep hold of the array
+     * pointers across a call to resize().
+     */
+    class SteeringBatch
+    {
+        /** Holds the single block that all the arrays live in. */
+        real *data;
+
+        /** Holds the number of entries each array has room for. */
+        unsigned capacity;
+
+        /** Holds the number of entries in use. */
+        unsigned size;
+
+    public:
+        /** The x component of the linear steering for each character. */
+        real *linearX;
+
+        /** The y component of the linear steering for each character. */
+        real *linearY;
+
+        /** The z component of the linear steering for each character. */
+        real *linearZ;
+
+        /** The angular steering for each character. */
+        real *angular;
+
+        /** Creates a new empty batch. */
+        SteeringBatch();
+
+        /** Creates a batch with the given number of zeroed entries. */
+        SteeringBatch(unsigned count);
+
+        /** Releases the arrays. */
+        ~SteeringBatch();
+
+        /**
+         * Changes the number of entries in the batch. Existing
+         * entries are preserved, new entries are zeroed.
+         */
+        void resize(unsigned count);
+
+        /** Returns the number of entries in the batch. */
+        unsigned getSize() const { return size; }
+
+        /** Zeros every entry in the batch. */
+        void clear();
+
+        /** Copies the given steering output into the given entry. */
+        void set(unsigned index, const SteeringOutput& steer);
+
+        /** Copies the given entry into the given steering output. */
+        void get(unsigned index, SteeringOutput* steer) const;
+
+    private:
+        // Batches own their memory, so can't be copied.
+        SteeringBatch(const SteeringBatch &);
+        SteeringBatch& operator=(const SteeringBatch &);
+    };
+
+    /**
+     * Holds the kinematic data for a whole population of characters,
+     * with each component of the position, orientation, velocity and
+     * rotation in its own contiguous array.
+     *
+     * The integration methods mirror those of the Kinematic
+     * structure, but operate on every character in the batch in a
+     * single pass. They have been written without data-dependent
+     * branches and without calls to the maths library in their inner
+     * loops, so that an optimising compiler can process several
+     * characters at once with SIMD instructions.
+     *
+     * @note The orientation is wrapped into the range (-2pi, 2pi) in
+     * the same way as Kinematic::integrate, but using a multiply and
+     * truncation rather than an fmod call. The results can differ
+     * from the single character version in the last bit or so.
+     */
+    class KinematicBatch
+    {
+        /** Holds the single block that all the arrays live in. */
+        real *data;
+
+        /** Holds the number of entries each array has room for. */
+        unsigned capacity;
+
+        /** Holds the number of entries in use. */
+        unsigned size;
+
+    public:
+        /** The x coordinate of each character's position. */
+        real *positionX;
+
+        /** The y coordinate of each character's position. */
+        real *positionY;
+
+        /** The z coordinate of each character's position. */
+        real *positionZ;
+
+        /** The orientation of each character. */
+        real *orientation;
+
+        /** The x component of each character's velocity. */
+        real *velocityX;
+
+        /** The y component of each character's velocity. */
+        real *velocityY;
+
+        /** The z component of each character's velocity. */
+        real *velocityZ;
+
+        /** The angular velocity of each character. */
+        real *rotation;
+
+        /** Creates a new empty batch. */
+        KinematicBatch();
+
+        /** Creates a batch with the given number of zeroed entries. */
+        KinematicBatch(unsigned count);
+
+        /** Releases the arrays. */
+        ~KinematicBatch();
+
+        /**
+         * Changes the number of entries in the batch. Existing
+         * entries are preserved, new entries are zeroed.
+         */
+        void resize(unsigned count);
+
+        /** Returns the number of entries in the batch. */
+        unsigned getSize() const { return size; }
+
+        /** Zeros every entry in the batch. */
+        void clear();
+
+        /** Copies the given kinematic into the given entry. */
+        void set(unsigned index, const Kinematic& kinematic);
+
+        /** Copies the given entry into the given kinematic. */
+        void get(unsigned index, Kinematic* kinematic) const;
+
+        /**
+         * Resizes the batch to the given number of characters and
+         * copies the data from the given array of kinematics.
+         */
+        void loadFrom(const Kinematic* kinematics, unsigned count);
+
+        /**
+         * Resizes the batch to the given number of characters and
+         * copies the data from the kinematics pointed to by the given
+         * array of pointers.
+         */
+        void loadFrom(const Kinematic* const* kinematics, unsigned count);
+
+        /**
+         * Copies the data in the batch back out into the given array
+         * of kinematics, which must have room for getSize() entries.
+         */
+        void storeTo(Kinematic* kinematics) const;
+
+        /**
+         * Copies the data in the batch back out into the kinematics
+         * pointed to by the given array of getSize() pointers.
+         */
+        void storeTo(Kinematic* const* kinematics) const;
+
+        /**
+         * Performs a forward Euler integration of every character,
+         * applying their velocity and rotation. This is the batch
+         * equivalent of Kinematic::integrate(real).
+         *
+         * @param duration The number of simulation seconds to
+         * integrate over.
+         */
+        void integrate(real duration);
+
+        /**
+         * Performs a forward Euler integration of every character,
+         * applying the corresponding acceleration from the given
+         * steering batch. This is the batch equivalent of
+         * Kinematic::integrate(const SteeringOutput&, real).
+         *
+         * @param steer The accelerations to apply, this must have at
+         * least as many entries as this batch.
+         *
+         * @param duration The number of simulation seconds to
+         * integrate over.
+         */
+        void integrate(const SteeringBatch& steer, real duration);
+
+        /**
+         * Performs a forward Euler integration of every character,
+         * applying the corresponding acceleration from the given
+         * steering batch and isotropic drag. This is the batch
+         * equivalent of Kinematic::integrate(const SteeringOutput&,
+         * real, real).
+         *
+         * @param steer The accelerations to apply, this must have at
+         * least as many entries as this batch.
+         *
+         * @param drag The isotropic drag to apply to both velocity
+         * and rotation. This should be a value between 0 (complete
+         * drag) and 1 (no drag).
+         *
+         * @param duration The number of simulation seconds to
+         * integrate over.
+         */
+        void integrate(const SteeringBatch& steer, real drag, real duration);
+
+        /**
+         * Integrates every character as integrate(steer, duration),
+         * and trims their resulting speed to the given maximum, in a
+         * single pass through the data. This gives the same result
+         * as calling integrate followed by trimMaxSpeed, but only
+         * reads and writes each array once.
+         */
+        void integrateAndTrim(const SteeringBatch& steer,
+                              real duration, real maxSpeed);
+
+        /**
+         * Integrates every character as integrate(steer, drag,
+         * duration), and trims their resulting speed to the given
+         * maximum, in a single pass through the data.
+         */
+        void integrateAndTrim(const SteeringBatch& steer,
+                              real drag, real duration, real maxSpeed);
+
+        /**
+         * Trims the speed of every character to be no more than that
+         * given.
+         */
+        void trimMaxSpeed(real maxSpeed);
+
+        /**
+         * Sets the orientation of each character so it points along
+         * its own velocity vector. Characters that aren't moving keep
+         * their current orientation.
+         *
+         * @param fastMath Set to use fast_atan2 (see fastmath.h)
+         * rather than the C library.
+         *
+         * @note Unlike the other methods in this class, this calls
+         * the maths library for each character, so is unlikely to be
+         * vectorised unless fastMath is set.
+         */
+        void setOrientationFromVelocity(bool fastMath = false);
+
+    private:
+        // Batches own their memory, so can't be copied.
+        KinematicBatch(const KinematicBatch &);
+        KinematicBatch& operator=(const KinematicBatch &);
+    };
+
+}; // end of namespace
+
+#endif // AICORE_BATCH_H
@@ -0,0 +1,143 @@
+/*
+ * Defines the structures used to cull obstacles.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds a bounding volume hierarchy over a set of static spherical
+ * obstacles. Obstacle avoidance normally checks each character's
+ * movement against every obstacle. When a level has thousands of
+ * obstacles this is wasteful: almost all of them are nowhere near
+ * the character. The hierarchy allows the obstacles near a movement
+ * to be found by only looking at a few groups of obstacles.
+ */
+#ifndef AICORE_BROADPHASE_H
+#define AICORE_BROADPHASE_H
+
+#include <list>
+#include <vector>
+
+namespace aicore
+{
+    /**
+     * A bounding sphere hierarchy over a set of spheres. The
+     * hierarchy is a binary tree, each node of which has a bounding
+     * sphere that encloses all the spheres below it.
+     *
+     * The hierarchy is built once from a set of spheres and then
+     * doesn't change, so it is suitable for static level geometry.
+     * It holds pointers to the spheres rather than copies, and only
+     * reads from the tree during queries, so one hierarchy can be
+     * shared between any number of steering pipes. If the spheres
+     * move, then the hierarchy must be built again.
+     */
+    class SphereHierarchy
+    {
+        /** Holds one node of the tree. */
+        struct Node
+        {
+            /** The centre of the node's bounding sphere. */
+            Vector3 centre;
+
+            /** The radius of the node's bounding sphere. */
+            real radius;
+
+            /**
+             * For leaves this is the first sphere in the node, for
+             * other nodes it is the index of the first child node
+             * (the second child follows it).
+             */
+            unsigned first;
+
+            /** The number of spheres in a leaf, or zero otherwise. */
+            unsigned count;
+        };
+
+        /** Holds the nodes of the tree, the root is first. */
+        std::vector<Node> nodes;
+
+        /**
+         * Holds the spheres, ordered so that the spheres of each leaf
+         * are contiguous.
+         */
+        std::vector<Sphere*> spheres;
+
+        /** Counts the number of times the hierarchy has been built. */
+        unsigned version;
+
+        /** Builds the node for the given range of spheres. */
+        void buildNode(unsigned node, unsigned first, unsigned count);
+
+    public:
+        /**
+         * The largest number of spheres that will be stored in one
+         * leaf of the tree.
+         */
+        enum { LEAF_SIZE = 4 };
+
+        /** Creates an empty hierarchy. */
+        SphereHierarchy();
+
+        /** Creates a hierarchy over the given spheres. */
+        SphereHierarchy(const std::list<Sphere*>& spheres);
+
+        /**
+         * Builds the hierarchy from the given spheres, replacing
+         * whatever was there before.
+         */
+        void build(const std::list<Sphere*>& spheres);
+
+        /**
+         * Builds the hierarchy from the given array of spheres,
+         * replacing whatever was there before.
+         */
+        void build(Sphere* spheres, unsigned count);
+
+        /** Returns the number of spheres in the hierarchy. */
+        unsigned getCount() const { return (unsigned)spheres.size(); }
+
+        /**
+         * Returns a number that changes each time the hierarchy is
+         * built, so results worked out from it can tell when they are
+         * out of date.
+         */
+        unsigned getVersion() const { return version; }
+
+        /**
+         * Finds the spheres that could be within the given margin of
+         * a line segment, and appends them to the given list. This is
+         * conservative: some of the spheres returned may not actually
+         * be close enough, but every sphere that is close enough is
+         * returned.
+         *
+         * @param start The start of the segment.
+         *
+         * @param direction The unit vector along the segment.
+         *
+         * @param length The length of the segment.
+         *
+         * @param margin The extra distance around each sphere to
+         * consider.
+         *
+         * @param results The list to add to. It isn't cleared first.
+         *
+         * @return The number of spheres added to the list.
+         */
+        unsigned querySegment(const Vector3& start,
+                              const Vector3& direction,
+                              real length, real margin,
+                              std::vector<Sphere*>* results) const;
+    };
+
+}; // end of namespace
+
+#endif // AICORE_BROADPHASE_H
@@ -0,0 +1,374 @@
+/*
+ * Defines the classes used to write actions as coroutines.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds actions written as C++20 coroutines. A long action, such as
+ * a guard's patrol, is normally written as a state machine polled by
+ * act and isComplete. As a coroutine it is written straight through,
+ * waiting where it needs to:
+ *
+ * <pre>
+ * ActionTask patrol(Guard *guard, ActionEvent *alarm)
+ * {
+ *     for (;;)
+ *     {
+ *         guard->walkTo(guard->nextPost());
+ *         co_await sleepFor(30);
+ *         if (co_await waitFor(*alarm, 60)) break;
+ *     }
+ *     guard->raiseAlarm();
+ * }
+ *
+ * manager.scheduleAction(
+ *     new CoroutineAction(patrol(guard, &alarm), &manager, 1));
+ * </pre>
+ *
+ * The coroutine runs, each time the action acts, until it waits.
+ * While it waits the action gives its wake time to the manager (see
+ * Action::getWakeTime), so it isn't run again until the time comes,
+ * or the event it is waiting for is signalled. With the managers in
+ * an ActionScheduler, characters whose actions are all waiting
+ * aren't executed at all.
+ *
+ * The actions take part in priorities and interrupts like any
+ * other. An action that is interrupted is deleted, which destroys
+ * the coroutine wherever it is waiting, running the destructors of
+ * its local variables.
+ *
+ * The library itself is built as C++11, so everything here is in the
+ * header, and is only defined when the compiler supports coroutines
+ * (AICORE_HAVE_COROUTINES is then set to 1). Define
+ * AICORE_HAVE_COROUTINES as 0 to leave it out.
+ */
+#ifndef AICORE_COACTION_H
+#define AICORE_COACTION_H
+
+#ifndef AICORE_HAVE_COROUTINES
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define AICORE_HAVE_COROUTINES 1
+#endif
+#endif
+#endif
+
+#if AICORE_HAVE_COROUTINES
+
+#include <coroutine>
+#include <algorithm>
+#include <vector>
+
+namespace aicore
+{
+    class CoroutineAction;
+
+    /**
+     * The type returned by a coroutine that is run by a
+     * CoroutineAction. The coroutine doesn't start until the action
+     * first acts.
+     */
+    class ActionTask
+    {
+    public:
+        /** Connects the coroutine to the action running it. */
+        struct promise_type
+        {
+            /** The action running the coroutine. */
+            CoroutineAction *action;
+
+            promise_type() : action(NULL) {}
+
+            ActionTask get_return_object()
+            {
+                return ActionTask(Handle::from_promise(*this));
+            }
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_void() {}
+
+            /** Passes exceptions on to whatever made the action act. */
+            void unhandled_exception() { throw; }
+
+            /** Allocates the coroutine's state from the ActionPool. */
+            static void* operator new(size_t size)
+            {
+                return ActionPool::allocate(size);
+            }
+
+            /** Returns the coroutine's state to the ActionPool. */
+            static void operator delete(void *memory, size_t size)
+            {
+                ActionPool::release(memory, size);
+            }
+        };
+
+        /** The handle of the coroutine. */
+        typedef std::coroutine_handle<promise_type> Handle;
+
+        /** Creates a task with no coroutine. */
+        ActionTask() : handle() {}
+
+        /** Takes the coroutine from the given task. */
+        ActionTask(ActionTask &&other) noexcept : handle(other.handle)
+        {
+            other.handle = Handle();
+        }
+
+        /** Destroys the coroutine, if it hasn't been given to an action. */
+        ~ActionTask()
+        {
+            if (handle) handle.destroy();
+        }
+
+        /** Destroys this task's coroutine, and takes the given one's. */
+        ActionTask& operator=(ActionTask &&other) noexcept
+        {
+            if (this != &other)
+            {
+                if (handle) handle.destroy();
+                handle = other.handle;
+                other.handle = Handle();
+            }
+            return *this;
+        }
+
+        /** Returns true if the coroutine has run to its end. */
+        bool isDone() const { return !handle || handle.done(); }
+
+    private:
+        explicit ActionTask(Handle handle) : handle(handle) {}
+
+        Handle handle;
+
+        friend class CoroutineAction;
+
+        // A coroutine can only be run by one action.
+        ActionTask(const ActionTask &);
+        ActionTask& operator=(const ActionTask &);
+    };
+
+    /**
+     * Something coroutines can wait for, such as an alarm being
+     * raised. Signalling the event wakes every action waiting for it
+     * at the time: actions that start waiting afterwards wait for
+     * the next signal.
+     */
+    class ActionEvent
+    {
+        /** The actions waiting for the event. */
+        std::vector<CoroutineAction*> waiters;
+
+        friend class CoroutineAction;
+        friend struct ActionEventWait;
+
+    public:
+        ActionEvent() {}
+
+        /** Wakes the actions still waiting, as if it were signalled. */
+        ~ActionEvent() { signal(); }
+
+        /**
+         * Wakes the actions waiting for the event. They run the next
+         * time their managers are executed.
+         */
+        void signal();
+
+        /** Returns the number of actions waiting for the event. */
+        unsigned getWaiterCount() const
+        {
+            return (unsigned)waiters.size();
+        }
+
+    private:
+        // The actions point back to the event.
+        ActionEvent(const ActionEvent &);
+        ActionEvent& operator=(const ActionEvent &);
+    };
+
+    /**
+     * An action that runs a coroutine, from where it last waited,
+     * each time it acts, and is complete when the coroutine ends.
+     */
+    class CoroutineAction : public Action
+    {
+        /** The coroutine. */
+        ActionTask task;
+
+        /**
+         * The time on the manager's clock when the coroutine should
+         * carry on, or WAIT_FOREVER.
+         */
+        real wakeTime;
+
+        /** The event being waited for, or null. */
+        ActionEvent *waitingFor;
+
+        /** Set if the last event waited for was signalled. */
+        bool signalled;
+
+        /** Stops waiting for the event, if there is one. */
+        void stopWaiting()
+        {
+            if (waitingFor == NULL) return;
+
+            std::vector<CoroutineAction*> &waiters = waitingFor->waiters;
+            waiters.erase(std::find(waiters.begin(), waiters.end(), this));
+            waitingFor = NULL;
+        }
+
+        friend class ActionEvent;
+        friend struct ActionSleep;
+        friend struct ActionEventWait;
+
+    public:
+        /**
+         * The manager whose clock the waits are timed by. This is
+         * normally the manager the action is scheduled on, since it
+         * is also woken when the events the action waits for are
+         * signalled.
+         */
+        ActionManager *manager;
+
+        /** Set if the action can interrupt the manager's active set. */
+        bool interrupts;
+
+        /**
+         * Creates an action running the given coroutine, with its
+         * waits timed by the given manager.
+         */
+        CoroutineAction(ActionTask task, ActionManager *manager,
+                        real priority = 0, bool interrupts = false)
+            :
+            task(static_cast<ActionTask&&>(task)),
+            wakeTime(0), waitingFor(NULL), signalled(false),
+            manager(manager), interrupts(interrupts)
+        {
+            this->priority = priority;
+            if (this->task.handle) this->task.handle.promise().action = this;
+        }
+
+        /** Destroys the coroutine, wherever it is waiting. */
+        virtual ~CoroutineAction() { stopWaiting(); }
+
+        /** Runs the coroutine until it next waits, or ends. */
+        virtual void act()
+        {
+            if (task.isDone() || manager->time < wakeTime) return;
+
+            // Waking on time after a wait with a timeout.
+            stopWaiting();
+            wakeTime = 0;
+            task.handle.resume();
+        }
+
+        /** Returns true when the coroutine has ended. */
+        virtual bool isComplete() { return task.isDone(); }
+
+        /** Returns the time the coroutine is waiting until. */
+        virtual real getWakeTime() const
+        {
+            return task.isDone() ? 0 : wakeTime;
+        }
+
+        /** Returns the interrupts flag. */
+        virtual bool canInterrupt() { return interrupts; }
+    };
+
+    /** The result of sleepFor and nextFrame. */
+    struct ActionSleep
+    {
+        real duration;
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(ActionTask::Handle handle) const noexcept
+        {
+            CoroutineAction *action = handle.promise().action;
+            action->wakeTime = action->manager->time + duration;
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    /** The result of waitFor. */
+    struct ActionEventWait
+    {
+        ActionEvent *event;
+        real timeout;
+        CoroutineAction *action;
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(ActionTask::Handle handle)
+        {
+            action = handle.promise().action;
+            action->signalled = false;
+            action->waitingFor = event;
+            action->wakeTime = timeout > 0 ?
+                action->manager->time + timeout : Action::WAIT_FOREVER;
+            event->waiters.push_back(action);
+        }
+
+        /** Returns true if the event was signalled. */
+        bool await_resume() const noexcept { return action->signalled; }
+    };
+
+    inline void ActionEvent::signal()
+    {
+        // Actions woken here may start waiting again as soon as they
+        // run, so take the list first.
+        std::vector<CoroutineAction*> woken;
+        woken.swap(waiters);
+        for (unsigned i = 0; i < woken.size(); i++)
+        {
+            CoroutineAction *action = woken[i];
+            action->waitingFor = NULL;
+            action->signalled = true;
+            action->wakeTime = 0;
+            action->manager->wake();
+        }
+    }
+
+    /**
+     * Waits until the manager's clock has moved on by the given
+     * time. Use as co_await sleepFor(duration).
+     */
+    inline ActionSleep sleepFor(real duration)
+    {
+        ActionSleep sleep = { duration };
+        return sleep;
+    }
+
+    /** Waits until the action next acts. */
+    inline ActionSleep nextFrame()
+    {
+        return sleepFor(0);
+    }
+
+    /**
+     * Waits until the given event is signalled, or the timeout
+     * passes if it isn't zero. The result of co_await is true if the
+     * event was signalled.
+     */
+    inline ActionEventWait waitFor(ActionEvent &event, real timeout = 0)
+    {
+        ActionEventWait wait = { &event, timeout, NULL };
+        return wait;
+    }
+
+}; // end of namespace
+
+#endif // AICORE_HAVE_COROUTINES
+
+#endif // AICORE_COACTION_H
@@ -20,6 +20,8 @@
 #ifndef AICORE_CORE_H
 #define AICORE_CORE_H
 
+#include <stdint.h>
+
 /**
  * Holds all classes and functions for AI-Core.
  *
@@ -34,22 +36,152 @@
  */
 namespace aicore
 {
+    /**
+     * A fast pseudo-random number generator, using the xoshiro128**
+     * algorithm. It has 128 bits of state, a period of 2^128-1, and
+     * generates a full 32 bits per call.
+     *
+     * Each engine is completely independent, so you can give each
+     * thread, or each character, its own engine. Engines constructed
+     * with the same seed and stream always produce the same sequence,
+     * whatever platform they are run on.
+     */
+    class RandomEngine
+    {
+        /** Holds the state of the generator. */
+        uint32_t state[4];
+
+    public:
+        /**
+         * Creates a new engine seeded with the given value and stream
+         * number. Engines with the same seed but different streams
+         * produce unrelated sequences, so giving each character the
+         * same seed and its index as a stream gives reproducible but
+         * independent values for each.
+         */
+        RandomEngine(uint64_t seed = 1, uint64_t stream = 0);
+
+        /**
+         * Reseeds the engine, as if it had been created with the
+         * given seed and stream.
+         */
+        void seed(uint64_t seed, uint64_t stream = 0);
+
+        /** Returns the next 32 random bits. */
+        uint32_t next()
+        {
+            const uint32_t result = rotate(state[1] * 5, 7) * 9;
+            const uint32_t t = state[1] << 9;
+
+            state[2] ^= state[0];
+            state[3] ^= state[1];
+            state[1] ^= state[2];
+            state[0] ^= state[3];
+            state[2] ^= t;
+            state[3] = rotate(state[3], 11);
+
+            return result;
+        }
+
+        /** Gets a random integer in the range [0, max). */
+        int randomInt(int max)
+        {
+            if (max <= 0) return 0;
+            return (int)(((uint64_t)next() * (uint32_t)max) >> 32);
+        }
+
+        /** Gets a random number in the range [0, max). */
+        real randomReal(real max = 1)
+        {
+            // Use the top 24 bits, which is all a float can hold.
+            return max * ((real)(next() >> 8) * (real)(1.0 / 16777216.0));
+        }
+
+        /** Gets a random binomial in the range (-max, max). */
+        real randomBinomial(real max = 1)
+        {
+            // The order the operands of - are worked out in is up to
+            // the compiler, so draw them one at a time.
+            real positive = randomReal(max);
+            return positive - randomReal(max);
+        }
+
+        /** Gets a random boolean value. */
+        bool randomBoolean()
+        {
+            return (next() >> 31) != 0;
+        }
+
+        /**
+         * Fills the given array with random numbers in the range
+         * [0, max).
+         */
+        void fillReal(real* values, unsigned count, real max = 1);
+
+        /**
+         * Fills the given array with random binomials in the range
+         * (-max, max).
+         */
+        void fillBinomial(real* values, unsigned count, real max = 1);
+
+        /**
+         * Fills the given array with random integers in the range
+         * [0, max).
+         */
+        void fillInt(int* values, unsigned count, int max);
+
+        /**
+         * Copies the four words of the generator's state into the
+         * given array, so it can be saved.
+         */
+        void getState(uint32_t *words) const
+        {
+            for (unsigned i = 0; i < 4; i++) words[i] = state[i];
+        }
+
+        /**
+         * Sets the generator's state from four words given by
+         * getState, so it carries on where the saved engine stopped.
+         */
+        void setState(const uint32_t *words)
+        {
+            for (unsigned i = 0; i < 4; i++) state[i] = words[i];
+        }
+
+    private:
+        static uint32_t rotate(const uint32_t x, int k)
+        {
+            return (x << k) | (x >> (32 - k));
+        }
+    };
+
+    /**
+     * Returns the random engine for the calling thread. Each thread
+     * has its own engine, so this never needs any locking. The
+     * engines are seeded differently for each thread, in the order
+     * they first ask for random numbers; if you need repeatable
+     * results with several threads, use your own engines instead.
+     */
+    RandomEngine& getRandomEngine();
+
     /**
      * @name Random Number Generators
+     *
+     * These use the calling thread's random engine.
      */
     /* @{ */
 
     /**
-     * Seeds the random number generator with the given value. If the
-     * value is 0 then a value taken from the current system clock is
-     * used.
+     * Seeds the calling thread's random number generator with the
+     * given value. If the value is 0 then a value taken from the
+     * current system clock is used.
      *
      * @param value The value to use to seed the random number generator.
      */
     void randomSeed(unsigned value);
 
     /**
-     * Gets a random integer in the range [0, max].
+     * Gets a random integer in the range [0, max).
      *
      * @param max The upper bound of the range to generate the random
      * number from.
@@ -59,7 +191,7 @@ namespace aicore
     int randomInt(int max=100);
 
     /**
-     * Gets a random number in the range [0, max].
+     * Gets a random number in the range [0, max).
      *
      * @param max The upper bound of the range to generate the random
      * number from.
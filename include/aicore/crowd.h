@@ -0,0 +1,334 @@
+/*
+ * Defines the classes used to simulate large crowds.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds a crowd simulation for very large numbers of background
+ * characters. Each character in the crowd blends separation,
+ * cohesion and alignment with its neighbours, seeking its own
+ * target and wandering, and is then integrated, all in one pass over
+ * the structure-of-arrays buffers in batch.h. The characters that
+ * matter to the game (the player's squad, characters in combat) stay
+ * outside the crowd, running their normal steering; the crowd can be
+ * given their kinematics, so the crowd members still avoid and flock
+ * with them.
+ *
+ * The work for a step is done by a CrowdBackend. Every character's
+ * step only reads the state from the last step and writes its own
+ * new state, so a backend can run the characters in any order, or
+ * all at once on another processor. The crowd keeps two buffers of
+ * state: while a backend is writing the next step into one, the game
+ * can go on reading (and drawing) the last step from the other. The
+ * buffers are swapped when the step is finished:
+ *
+ * <pre>
+ * crowd.beginStep(duration);
+ * // Update the important characters on this thread, reading the
+ * // crowd from crowd.getState().
+ * crowd.endStep();
+ * </pre>
+ *
+ * CpuCrowdBackend, which is used by default, runs the step on a
+ * JobSystem. A backend for a GPU or other compute device would copy
+ * the buffers to the device in beginStep, run the same per character
+ * step there, and read the results back in finish.
+ */
+#ifndef AICORE_CROWD_H
+#define AICORE_CROWD_H
+
+#include <stdint.h>
+#include <vector>
+
+namespace aicore
+{
+    /**
+     * Holds the parameters shared by every character in a crowd.
+     * Each behaviour's output is weighted, and the total is divided
+     * by the sum of the sizes of the weights, as in BlendedSteering.
+     */
+    struct CrowdSettings
+    {
+        /** The radius of each character's neighbourhood. */
+        real neighbourhoodSize;
+
+        /**
+         * The weight of steering away from the neighbours, with the
+         * closest counting the most (see
+         * NeighbourhoodSummary::separation).
+         */
+        real separationWeight;
+
+        /** The weight of steering towards the neighbourhood's center. */
+        real cohesionWeight;
+
+        /** The weight of matching the neighbourhood's velocity. */
+        real alignmentWeight;
+
+        /**
+         * The weight of seeking each character's target, when the
+         * crowd has targets. A negative weight flees the targets.
+         */
+        real seekWeight;
+
+        /** The weight of a random acceleration in the ground plane. */
+        real wanderWeight;
+
+        /** The most acceleration each behaviour can request. */
+        real maxAcceleration;
+
+        /** The fastest a character can move. */
+        real maxSpeed;
+
+        /**
+         * Set to use the approximations in fastmath.h for the lengths
+         * and facings, rather than the C library. A GPU backend may
+         * use its own approximations instead.
+         */
+        bool fastMath;
+
+        /** Creates settings for a loose flock with no targets. */
+        CrowdSettings();
+    };
+
+    /**
+     * Holds everything a backend needs to run one step of a crowd.
+     */
+    struct CrowdStep
+    {
+        /** The state of the crowd at the end of the last step. */
+        const KinematicBatch *current;
+
+        /**
+         * Receives the state at the end of this step. This is the
+         * same size as the current state.
+         */
+        KinematicBatch *next;
+
+        /**
+         * The target of each character, or null if the crowd doesn't
+         * seek targets.
+         */
+        const real *targetX;
+        const real *targetY;
+        const real *targetZ;
+
+        /**
+         * Characters outside the crowd that its members should treat
+         * as neighbours, but which aren't moved by the step.
+         */
+        const Kinematic * const *external;
+
+        /** The number of external characters. */
+        unsigned externalCount;
+
+        /** The parameters of the crowd. */
+        CrowdSettings settings;
+
+        /** The time the step covers. */
+        real duration;
+
+        /**
+         * The seed for the random wandering. Each character draws
+         * from its own stream for each step number, so the results
+         * don't depend on the order the characters are run in.
+         */
+        uint64_t seed;
+
+        /** The number of the step. */
+        unsigned long long number;
+    };
+
+    /**
+     * Runs the steps of a crowd. A step is started with begin, and
+     * its results must be in the next buffer once finish returns.
+     * The buffers and external characters mustn't be touched in
+     * between.
+     */
+    class CrowdBackend
+    {
+    public:
+        virtual ~CrowdBackend() {}
+
+        /** Starts running the given step. */
+        virtual void begin(const CrowdStep &step) = 0;
+
+        /** Waits for the step started by begin to finish. */
+        virtual void finish() = 0;
+    };
+
+    /**
+     * Runs the steps of a crowd on the processor. The neighbourhoods
+     * are found with a SpatialGrid, and the characters are shared out
+     * between the workers of a job system, or run on the calling
+     * thread if there is none. The whole step is done in begin.
+     */
+    class CpuCrowdBackend : public CrowdBackend
+    {
+        /** Runs the step for a range of characters. */
+        struct StepTask : public ParallelTask
+        {
+            CpuCrowdBackend *backend;
+            virtual void run(unsigned begin, unsigned end, unsigned worker);
+        };
+
+        /** The job system to use, or null. */
+        JobSystem *jobs;
+
+        /** Holds the positions of the crowd, then the external characters. */
+        SpatialGrid grid;
+
+        /** Holds the velocity of each external character. */
+        std::vector<Vector3> externalVelocity;
+
+        /** Holds the list of neighbours for each worker. */
+        std::vector< std::vector<unsigned> > neighbours;
+
+        /** The step being run. */
+        CrowdStep step;
+
+        /** Runs the step for one character. */
+        void runCharacter(unsigned index, std::vector<unsigned> *found);
+
+    public:
+        /**
+         * Creates a backend using the given job system, which must
+         * outlive it. With no job system the characters are run on
+         * the thread that begins the step.
+         *
+         * @param tableSize The number of slots in the spatial grid's
+         * hash table. Larger crowds spread over more cells need more
+         * slots.
+         */
+        CpuCrowdBackend(JobSystem *jobs = NULL, unsigned tableSize = 4096);
+
+        /** Runs the whole step. */
+        virtual void begin(const CrowdStep &step);
+
+        /** Does nothing, since begin has already done the work. */
+        virtual void finish();
+
+    private:
+        // The grid is tied to the crowd it was built for.
+        CpuCrowdBackend(const CpuCrowdBackend &);
+        CpuCrowdBackend& operator=(const CpuCrowdBackend &);
+    };
+
+    /**
+     * Holds the state of a crowd, and runs it with a backend.
+     */
+    class Crowd
+    {
+        /** The two buffers of state. */
+        KinematicBatch buffers[2];
+
+        /** The buffer holding the last finished step. */
+        unsigned front;
+
+        /** Set between beginStep and endStep. */
+        bool stepping;
+
+        /** The backend given when the crowd was created, or null. */
+        CrowdBackend *backend;
+
+        /** The backend used if none was given. */
+        CpuCrowdBackend cpu;
+
+        /** The targets, or null. */
+        const real *targetX;
+        const real *targetY;
+        const real *targetZ;
+
+        /** The external characters. */
+        const Kinematic * const *external;
+        unsigned externalCount;
+
+        /** The number of steps started. */
+        unsigned long long steps;
+
+    public:
+        /** The parameters of the crowd. */
+        CrowdSettings settings;
+
+        /** The seed for the characters' wandering. */
+        uint64_t seed;
+
+        /**
+         * Creates an empty crowd, run by the given backend. If this
+         * is null, a CpuCrowdBackend is used with the given job
+         * system (or none).
+         */
+        Crowd(CrowdBackend *backend = NULL, JobSystem *jobs = NULL);
+
+        /**
+         * Sets the number of characters. Existing characters keep
+         * their state, and new ones start at rest at the origin.
+         */
+        void resize(unsigned count);
+
+        /** Returns the number of characters. */
+        unsigned getSize() const { return buffers[front].getSize(); }
+
+        /**
+         * Returns the state of the crowd at the end of the last
+         * finished step. This can be read at any time, and changed
+         * (to place characters, for example) while no step is
+         * running.
+         */
+        KinematicBatch& getState() { return buffers[front]; }
+
+        /** Returns the state of the crowd at the end of the last step. */
+        const KinematicBatch& getState() const { return buffers[front]; }
+
+        /**
+         * Sets the arrays holding a target for each character, which
+         * must stay valid. Null arrays stop the crowd seeking.
+         */
+        void setTargets(const real *x, const real *y, const real *z);
+
+        /**
+         * Sets the characters outside the crowd that its members
+         * should flock with and steer around. The array, and the
+         * kinematics it points to, mustn't change while a step is
+         * running.
+         */
+        void setExternal(const Kinematic * const *characters,
+                         unsigned count);
+
+        /** Returns true if a step has been begun but not ended. */
+        bool isStepping() const { return stepping; }
+
+        /** Starts a step of the given duration. */
+        void beginStep(real duration);
+
+        /**
+         * Waits for the current step to finish, and makes its
+         * results the crowd's state.
+         */
+        void endStep();
+
+        /** Runs a whole step of the given duration. */
+        void step(real duration)
+        {
+            beginStep(duration);
+            endStep();
+        }
+
+    private:
+        // The crowd owns its buffers, so can't be copied.
+        Crowd(const Crowd &);
+        Crowd& operator=(const Crowd &);
+    };
+
+}; // end of namespace
+
+#endif // AICORE_CROWD_H
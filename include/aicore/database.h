@@ -0,0 +1,552 @@
+/*
+ * Defines the classes used to store and load rule databases.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds faster ways of creating and storing the databases used by the
+ * rule-based systems in rules.h.
+ *
+ * Building a database by allocating each DataNode on the heap means
+ * thousands of small allocations when the world state is rebuilt
+ * every frame, and leaves the nodes scattered through memory. The
+ * DatabaseArena places the nodes one after another in large blocks,
+ * and throws them all away at once.
+ *
+ * Large databases that don't change (such as a knowledge base shipped
+ * with the game) can be stored in the FlatDatabase format. This is a
+ * single array of plain nodes linked by index, which can be written
+ * to a file and then memory mapped with MappedFile, so it can be used
+ * without being parsed. It can then be turned into normal data nodes
+ * in an arena with a single allocation, for matching.
+ *
+ * Databases that mirror a changing world, fed by a stream of events,
+ * can be kept up to date with a DatabaseStream. This applies batches
+ * of changes to data found by its path through the groups, and tells
+ * a ReteNetwork which data has changed, so neither the database nor
+ * the matching has to be redone from scratch.
+ */
+#ifndef AICORE_DATABASE_H
+#define AICORE_DATABASE_H
+
+#include <stddef.h>
+#include <new>
+#include <vector>
+
+namespace aicore
+{
+    class ReteNetwork;
+
+    /**
+     * Allocates data nodes from large blocks of memory. Nodes created
+     * by the arena are never deleted individually: they are all
+     * destroyed together when the arena is reset or destroyed. The
+     * blocks are kept for reuse, so rebuilding a database of the same
+     * size each frame doesn't allocate any memory.
+     */
+    class DatabaseArena
+    {
+        /** Holds one block of memory. */
+        struct Block
+        {
+            char *memory;
+            size_t size;
+        };
+
+        /** Holds the blocks, in the order they were allocated. */
+        std::vector<Block> blocks;
+
+        /** The block currently being allocated from. */
+        unsigned current;
+
+        /** The number of bytes used in the current block. */
+        size_t used;
+
+        /** The size of new blocks, unless a bigger one is needed. */
+        size_t blockSize;
+
+        /**
+         * Holds the groups that have been created, which need their
+         * destructors calling (the index in a group owns memory).
+         */
+        std::vector<DataGroup*> groups;
+
+        /** Returns suitably aligned memory of the given size. */
+        void* allocate(size_t size);
+
+    public:
+        /**
+         * Creates an arena that allocates memory in blocks of the
+         * given size.
+         */
+        DatabaseArena(size_t blockSize = 64*1024);
+
+        /** Destroys all the nodes and frees the memory. */
+        ~DatabaseArena();
+
+        /**
+         * Destroys all the nodes created so far, keeping the memory
+         * for reuse.
+         */
+        void reset();
+
+        /**
+         * Makes sure there is at least this much memory available
+         * without allocating another block.
+         */
+        void reserve(size_t bytes);
+
+        /** Returns the total memory held by the arena, in bytes. */
+        size_t getCapacity() const;
+
+        /** Creates an empty group with the given identifier. */
+        DataGroup* createGroup(id identifier);
+
+        /**
+         * Creates a datum with the given identifier and value. The
+         * datum type must not need its destructor calling.
+         */
+        template <typename T>
+        Datum<T>* createDatum(id identifier, const T& value)
+        {
+            Datum<T> *datum = new (allocate(sizeof(Datum<T>))) Datum<T>;
+            datum->identifier = identifier;
+            datum->value = value;
+            return datum;
+        }
+
+    private:
+        // The arena owns its memory, so can't be copied.
+        DatabaseArena(const DatabaseArena &);
+        DatabaseArena& operator=(const DatabaseArena &);
+    };
+
+    /**
+     * Holds one node in a flat database. This is plain data, so it
+     * can be written straight to a file.
+     */
+    struct FlatNode
+    {
+        /** The identifier of the node. */
+        id identifier;
+
+        /** The kind of node, one of the FlatDatabase node types. */
+        unsigned type;
+
+        /**
+         * For groups, the index of the first child. Children of a
+         * group are stored one after another.
+         */
+        unsigned firstChild;
+
+        /** For groups, the number of children. */
+        unsigned childCount;
+
+        /** For data, the value. */
+        union
+        {
+            int integer;
+            real number;
+            real vector[3];
+        } value;
+    };
+
+    /**
+     * Gives access to a database stored as an array of FlatNode
+     * structures. The flat database doesn't own its memory: it is
+     * attached to a buffer (often a memory mapped file) which must
+     * stay valid as long as it is used.
+     *
+     * The format starts with a header, then the nodes. The root is
+     * the first node, and each group's children come one after
+     * another, in the same order as in the database they were written
+     * from. Files are written in the byte order and precision of the
+     * machine that wrote them: files written with a different real
+     * type won't attach.
+     *
+     * Only groups and integer, real and vector data can be stored.
+     */
+    class FlatDatabase
+    {
+    public:
+        /** The kinds of node that can be stored. */
+        enum NodeType
+        {
+            FLAT_GROUP,
+            FLAT_INTEGER,
+            FLAT_REAL,
+            FLAT_VECTOR
+        };
+
+        /** Marks a missing node. */
+        static const unsigned NONE = 0xffffffff;
+
+        /** Holds the start of the file. */
+        struct Header
+        {
+            /** Holds the characters 'AIDB'. */
+            char magic[4];
+
+            /** The version of the format. */
+            unsigned version;
+
+            /** The size of a real number, in bytes. */
+            unsigned realSize;
+
+            /** The number of nodes that follow. */
+            unsigned nodeCount;
+        };
+
+    private:
+        /** Holds the nodes. */
+        const FlatNode *nodes;
+
+        /** The number of nodes. */
+        unsigned count;
+
+    public:
+        /** Creates a flat database that isn't attached to anything. */
+        FlatDatabase();
+
+        /**
+         * Uses the given data as the database, checking it is in the
+         * right format. Nothing is copied. As well as the header, the
+         * links between the nodes are checked: the root must be a
+         * group, and each group's children must lie in the buffer,
+         * after the group and after the children of every group
+         * before it, as write lays them out. So a damaged or hostile
+         * buffer can't make the database read outside itself, or
+         * share nodes between groups.
+         *
+         * @return False if the data isn't a valid flat database.
+         */
+        bool attach(const void *data, size_t size);
+
+        /** Returns the number of nodes, or zero if not attached. */
+        unsigned getNodeCount() const { return count; }
+
+        /** Returns the node with the given index. */
+        const FlatNode& getNode(unsigned index) const
+        {
+            return nodes[index];
+        }
+
+        /**
+         * Finds the first child of the given group with the given
+         * identifier.
+         *
+         * @return The index of the child, or NONE.
+         */
+        unsigned findChild(unsigned group, id identifier) const;
+
+        /**
+         * Creates normal data nodes for the database in the given
+         * arena, so that it can be used for matching. Enough memory
+         * for the whole database is reserved first, so the arena
+         * makes at most one allocation. The nodes are linked without
+         * recursion, so any depth of groups can be built.
+         *
+         * @param indexGroups If true then groups with more than a few
+         * children are given an index (see DataGroup::enableIndex).
+         *
+         * @return The root of the database, or null if not attached.
+         */
+        Database* build(DatabaseArena *arena, bool indexGroups = false) const;
+
+        /**
+         * Converts the given database into the flat format, replacing
+         * the contents of the given buffer.
+         *
+         * @return False if the database holds data that can't be
+         * stored, in which case the buffer is left empty.
+         */
+        static bool write(const Database *database,
+                          std::vector<char> *buffer);
+
+        /**
+         * Converts the given database into the flat format and saves
+         * it to the given file.
+         *
+         * @return False if the database couldn't be converted or the
+         * file couldn't be written.
+         */
+        static bool save(const Database *database, const char *filename);
+    };
+
+    /**
+     * Maps a file into memory for reading. The operating system loads
+     * the parts of the file as they are used, and they can be shared
+     * between processes.
+     */
+    class MappedFile
+    {
+        /** The start of the mapped file. */
+        const void *data;
+
+        /** The size of the file in bytes. */
+        size_t size;
+
+        /** The operating system's handles for the file and mapping. */
+        void *fileHandle;
+        void *mappingHandle;
+
+    public:
+        /** Creates an object with no file open. */
+        MappedFile();
+
+        /** Closes the file if it is open. */
+        ~MappedFile();
+
+        /**
+         * Opens and maps the given file, closing any file that was
+         * already open.
+         *
+         * @return False if the file couldn't be mapped.
+         */
+        bool open(const char *filename);
+
+        /** Unmaps and closes the file. */
+        void close();
+
+        /** Returns the contents of the file, or null if not open. */
+        const void* getData() const { return data; }
+
+        /** Returns the size of the file. */
+        size_t getSize() const { return size; }
+
+    private:
+        // The object owns the mapping, so can't be copied.
+        MappedFile(const MappedFile &);
+        MappedFile& operator=(const MappedFile &);
+    };
+
+    /**
+     * Queues changes to a database and applies them in batches. Each
+     * change names its data by a path of identifiers from the root,
+     * so the path { soldier, health } is the health datum in the
+     * soldier group at the top level:
+     *
+     * <pre>
+     * id path[] = { soldier, health };
+     * stream.update(path, 2, 80);
+     * stream.apply();
+     * network.update(database);
+     * </pre>
+     *
+     * Changes are kept until apply is called, so events can be queued
+     * as they arrive and applied once a frame. Applying them marks the
+     * top level identifier of each change in the ReteNetwork, if one is
+     * given, so the next update of the network only checks the rules
+     * that could have been affected.
+     *
+     * Only integer, real and vector data can be inserted or updated,
+     * as for FlatDatabase. Removing works on data of any type, and on
+     * whole groups.
+     *
+     * The stream never frees memory. Nodes it creates come from its
+     * own arena, and nodes it removes (whoever created them) are kept
+     * to be reused by later inserts, so a stream that removes as many
+     * nodes as it inserts stops allocating. This means the nodes
+     * removed must not be deleted by the caller, and the database
+     * can't be used once the stream is destroyed, if the stream has
+     * added to it. The bindings found by Rule::check may point at a
+     * removed node, so they should be found again after each apply.
+     */
+    class DatabaseStream
+    {
+    public:
+        /** The kinds of change that can be queued. */
+        enum ChangeType
+        {
+            /** Adds a new node, even if one has the same identifier. */
+            CHANGE_INSERT,
+
+            /**
+             * Sets the value of the first node with the identifier,
+             * adding one if there is none.
+             */
+            CHANGE_UPDATE,
+
+            /** Removes the first node with the identifier. */
+            CHANGE_REMOVE
+        };
+
+    private:
+        /** Holds one queued change. */
+        struct Change
+        {
+            /** The kind of change. */
+            ChangeType type;
+
+            /** The kind of node, one of the FlatDatabase node types. */
+            unsigned nodeType;
+
+            /** The position of the change's path in the paths list. */
+            unsigned pathStart;
+
+            /** The number of identifiers in the path. */
+            unsigned pathLength;
+
+            /** For data, the value. */
+            union
+            {
+                int integer;
+                real number;
+                real vector[3];
+            } value;
+        };
+
+        /** The root of the database changed. */
+        DataGroup *database;
+
+        /** The network to tell about changes, or null. */
+        ReteNetwork *network;
+
+        /** Holds the queued changes, in order. */
+        std::vector<Change> changes;
+
+        /** Holds the paths of all the queued changes, one after another. */
+        std::vector<id> paths;
+
+        /** Holds the top level identifiers changed by the last apply. */
+        std::vector<id> changed;
+
+        /** The number of changes that couldn't be made by the last apply. */
+        unsigned failed;
+
+        /** Holds the memory for the nodes the stream creates. */
+        DatabaseArena arena;
+
+        /** Hold the removed nodes, ready to be reused. */
+        std::vector<DataGroup*> freeGroups;
+        std::vector<IntegerDatum*> freeIntegers;
+        std::vector<RealDatum*> freeReals;
+        std::vector<VectorDatum*> freeVectors;
+
+        /** Adds a change to the queue, returning it to be filled in. */
+        Change& queue(ChangeType type, unsigned nodeType,
+                      const id *path, unsigned length);
+
+        /**
+         * Makes the given change, returning false if it couldn't be
+         * made. Sets modified if the database was changed, which it
+         * can be even when the change fails part way.
+         */
+        bool applyChange(const Change &change, bool *modified);
+
+        /** Returns an empty group, reusing a removed one if possible. */
+        DataGroup* createGroup(id identifier);
+
+        /** Returns a new node holding the value of the given change. */
+        DataNode* createNode(const Change &change, id identifier);
+
+        /**
+         * Sets the value of an existing datum from the given change,
+         * returning false if it is a group or holds a different type
+         * of data.
+         */
+        static bool setValue(DataNode *node, const Change &change);
+
+        /** Keeps a removed node, and everything below it, for reuse. */
+        void recycle(DataNode *node);
+
+    public:
+        /**
+         * If set, every group the stream looks inside is given an
+         * index (see DataGroup::enableIndex), so finding a path
+         * doesn't walk long lists of children. Groups that are
+         * changed by hand once they have an index have to be changed
+         * with addChild and removeChild.
+         */
+        bool indexGroups;
+
+        /**
+         * Creates a stream that changes the given database, and tells
+         * the given network (if there is one) about the changes.
+         */
+        DatabaseStream(DataGroup *database, ReteNetwork *network = NULL,
+                       bool indexGroups = false);
+
+        /**
+         * Queues a new integer datum at the end of the given path.
+         * Any groups on the path that don't exist are created.
+         */
+        void insert(const id *path, unsigned length, int value);
+
+        /** Queues a new real datum at the end of the given path. */
+        void insert(const id *path, unsigned length, real value);
+
+        /** Queues a new vector datum at the end of the given path. */
+        void insert(const id *path, unsigned length, const Vector3 &value);
+
+        /** Queues a new, empty group at the end of the given path. */
+        void insertGroup(const id *path, unsigned length);
+
+        /**
+         * Queues setting the integer datum at the end of the given
+         * path. If there is no datum there, one is inserted. If there
+         * is a group there, or a datum holding another type of data,
+         * the change fails: matches such as RangeMatch expect the
+         * data with one identifier to always have the same type.
+         */
+        void update(const id *path, unsigned length, int value);
+
+        /** Queues setting the real datum at the end of the given path. */
+        void update(const id *path, unsigned length, real value);
+
+        /** Queues setting the vector datum at the end of the given path. */
+        void update(const id *path, unsigned length, const Vector3 &value);
+
+        /**
+         * Queues removing the node at the end of the given path, and
+         * everything below it if it is a group. The change fails if
+         * there is no such node.
+         */
+        void remove(const id *path, unsigned length);
+
+        /** Returns the number of changes waiting to be applied. */
+        unsigned getQueuedCount() const { return (unsigned)changes.size(); }
+
+        /** Throws away the changes waiting to be applied. */
+        void clear();
+
+        /**
+         * Makes the queued changes to the database, in the order they
+         * were queued, and marks the network.
+         *
+         * @return The number of changes made. Changes that fail (such
+         * as removing a node that isn't there) are skipped.
+         */
+        unsigned apply();
+
+        /**
+         * Returns the number of changes the last apply skipped
+         * because they couldn't be made.
+         */
+        unsigned getFailedCount() const { return failed; }
+
+        /**
+         * Returns the top level identifiers whose data was changed by
+         * the last apply, in increasing order with no repeats. These
+         * are the identifiers given to ReteNetwork::markChanged.
+         */
+        const std::vector<id>& getChanged() const { return changed; }
+
+    private:
+        // The stream owns the nodes it creates, so can't be copied.
+        DatabaseStream(const DatabaseStream &);
+        DatabaseStream& operator=(const DatabaseStream &);
+    };
+
+}; // end of namespace
+
+#endif // AICORE_DATABASE_H
@@ -17,12 +17,131 @@
  * tree. Decision trees consist of a series of decisions, arranged so
  * that the results of one decision lead to another, until finally a
  * decision is reached at the end of the tree.
+ *
+ * Trees made mostly of simple tests on numbers (ThresholdDecision and
+ * RangeDecision) can be compiled into a CompiledDecisionTree, which
+ * holds the whole tree in one array and makes decisions without any
+ * virtual function calls, for many characters at once.
+ *
+ * Decisions that remember what they decided (such as RandomDecision)
+ * can keep their memory in each character's DecisionBlackboard,
+ * rather than in the tree. This lets one tree be shared by every
+ * character, with only a few bytes of memory per decision for each
+ * character. To do this, number the decisions with
+ * DecisionBlackboard::assignSlots, and call makeDecisionFor with the
+ * character's blackboard instead of makeDecision.
  */
 #ifndef AICORE_DECTREE_H
 #define AICORE_DECTREE_H
 
+#include <vector>
+
 namespace aicore
 {
+    class DecisionTreeNode;
+
+    /**
+     * Holds what one decision remembers for one character, between
+     * the times it is made.
+     */
+    struct DecisionMemory
+    {
+        /** The frame the decision was last made in. */
+        unsigned lastFrame;
+
+        /** The frame the current decision was first made in. */
+        unsigned firstFrame;
+
+        /** The last result of the decision. */
+        bool decision;
+    };
+
+    /**
+     * Holds the memory of a shared decision tree for one character.
+     * Each decision that needs memory is given a slot number (see
+     * assignSlots), and uses that slot in the blackboard of whichever
+     * character it is making a decision for.
+     */
+    class DecisionBlackboard
+    {
+        /** Holds the memory for each slot. */
+        std::vector<DecisionMemory> memory;
+
+    public:
+        /**
+         * The random number generator used for this character's
+         * decisions. If this is null, the calling thread's engine is
+         * used.
+         */
+        RandomEngine *random;
+
+        /**
+         * Points to the frame counter used by decisions that remember
+         * what they decided over time, such as RandomDecision. If
+         * this is null, TimingData's frame number is used. For
+         * lockstep simulations, point it at the simulation's own tick
+         * counter, so the decisions don't depend on the frame rate.
+         */
+        const unsigned *frame;
+
+        /**
+         * Creates a blackboard with room for the given number of
+         * slots.
+         */
+        DecisionBlackboard(unsigned slots = 0);
+
+        /** Forgets everything that has been decided. */
+        void reset();
+
+        /** Returns the number of slots in the blackboard. */
+        unsigned getSlotCount() const { return (unsigned)memory.size(); }
+
+        /** Writes the memory in every slot. */
+        void writeSnapshot(SnapshotWriter &writer) const;
+
+        /**
+         * Replaces the memory with that written by writeSnapshot.
+         *
+         * @return False if the reader has failed, in which case the
+         * blackboard is unchanged.
+         */
+        bool readSnapshot(SnapshotReader &reader);
+
+        /**
+         * Returns the memory in the given slot, making room for it
+         * if needed.
+         */
+        DecisionMemory& getMemory(unsigned slot)
+        {
+            if (slot >= memory.size()) grow(slot + 1);
+            return memory[slot];
+        }
+
+        /** Returns the random number generator to use. */
+        RandomEngine& getRandom()
+        {
+            return random ? *random : getRandomEngine();
+        }
+
+        /** Returns the current frame number. */
+        unsigned getFrame() const
+        {
+            return frame ? *frame : TimingData::get().frameNumber;
+        }
+
+        /**
+         * Gives each decision in the tree with the given root that
+         * needs memory its own slot, numbered from zero.
+         *
+         * @return The number of slots used, which is the size of
+         * blackboard the tree needs.
+         */
+        static unsigned assignSlots(DecisionTreeNode *root);
+
+    private:
+        /** Adds cleared slots up to the given number. */
+        void grow(unsigned slots);
+    };
 
     /**
      * A decision tree node is a base class for anything that makes a
@@ -31,12 +150,34 @@ namespace aicore
     class DecisionTreeNode
     {
     public:
+        virtual ~DecisionTreeNode() {}
+
         /**
          * The make decision method carries out a decision making
          * process and returns the new decision tree node that we've
          * reached in the tree.
+         *
+         * @note Making a decision can change the tree: random
+         * decisions remember what they chose in their own members,
+         * and so do those a compiled tree calls without a blackboard.
+         * To share one tree between characters or threads, use
+         * makeDecisionFor with a blackboard for each character, and
+         * make sure any other decisions' getBranchFor methods only
+         * read shared data.
          */
         virtual DecisionTreeNode* makeDecision() = 0;
+
+        /**
+         * Makes a decision for the character with the given
+         * blackboard, keeping any memory the decisions need in the
+         * blackboard rather than the tree. The default implementation
+         * just calls makeDecision.
+         */
+        virtual DecisionTreeNode* makeDecisionFor(
+            DecisionBlackboard * /*board*/)
+        {
+            return makeDecision();
+        }
     };
 
     /**
@@ -72,12 +213,29 @@ namespace aicore
          */
         virtual bool getBranch() = 0;
 
+        /**
+         * Does the checking for the decision for the character with
+         * the given blackboard. Decisions that remember anything
+         * should override this to keep it in the blackboard. The
+         * default implementation calls getBranch.
+         */
+        virtual bool getBranchFor(DecisionBlackboard * /*board*/)
+        {
+            return getBranch();
+        }
+
         /**
          * This is where the decision tree algorithm is located: it
          * recursively walks down the tree until it reaches the final
          * item to return (which is an action).
          */
         virtual DecisionTreeNode* makeDecision();
+
+        /**
+         * Walks down the tree in the same way as makeDecision, using
+         * getBranchFor with the given blackboard at each decision.
+         */
+        virtual DecisionTreeNode* makeDecisionFor(DecisionBlackboard *board);
     };
 
     /**
@@ -85,9 +243,23 @@ namespace aicore
      * decision is reached at each frame, the decision will be made
      * the same way each time. Otherwise the decision will be made at
      * random.
+     *
+     * When the decision is made with makeDecision, its memory is held
+     * in the data members below, so each character needs its own
+     * copy of the tree. When it is made with makeDecisionFor, the
+     * memory is held in the given blackboard, in the decision's slot,
+     * and the decision itself isn't changed.
      */
     class RandomDecision : public Decision
     {
+    protected:
+        /**
+         * Makes the decision on the given frame, given what was
+         * remembered from the last time, and updates the memory.
+         */
+        virtual bool decide(DecisionMemory *memory, RandomEngine &random,
+                            unsigned thisFrame) const;
+
     public:
         /**
          * Holds the last decision that was made.
@@ -100,6 +272,12 @@ namespace aicore
          */
         unsigned lastDecisionFrame;
 
+        /**
+         * Holds the blackboard slot this decision keeps its memory
+         * in, when deciding for a blackboard.
+         */
+        unsigned slot;
+
         /** Creates a new random decision. */
         RandomDecision();
 
@@ -107,6 +285,25 @@ namespace aicore
          * Works out which branch to follow.
          */
         virtual bool getBranch();
+
+        /**
+         * Works out which branch to follow, using the memory in the
+         * given blackboard.
+         */
+        virtual bool getBranchFor(DecisionBlackboard *board);
+
+        /**
+         * Writes the memory held in the decision itself, for trees
+         * used with makeDecision.
+         */
+        virtual void writeSnapshot(SnapshotWriter &writer) const;
+
+        /**
+         * Reads the memory written by writeSnapshot.
+         *
+         * @return False if the reader has failed.
+         */
+        virtual bool readSnapshot(SnapshotReader &reader);
     };
 
     /**
@@ -117,6 +314,14 @@ namespace aicore
      */
     class RandomDecisionWithTimeOut : public RandomDecision
     {
+    protected:
+        /**
+         * Makes the decision on the given frame, given what was
+         * remembered from the last time, and updates the memory.
+         */
+        virtual bool decide(DecisionMemory *memory, RandomEngine &random,
+                            unsigned thisFrame) const;
+
     public:
         /**
          * Holds the frame number that the current decision was made
@@ -137,6 +342,190 @@ namespace aicore
          * Works out which branch to follow.
          */
         virtual bool getBranch();
+
+        /** Writes the memory, including when the decision was made. */
+        virtual void writeSnapshot(SnapshotWriter &writer) const;
+
+        /** Reads the memory written by writeSnapshot. */
+        virtual bool readSnapshot(SnapshotReader &reader);
+    };
+
+    /**
+     * A decision that checks if one of the current character's input
+     * values is above a threshold. The inputs are an array of real
+     * numbers for each character: before making a decision, the
+     * calling code sets the pointer that inputs points to, so that a
+     * whole tree can be pointed at a new character with one
+     * assignment.
+     */
+    class ThresholdDecision : public Decision
+    {
+    public:
+        /** Points to the current character's array of inputs. */
+        const real **inputs;
+
+        /** The position of the value to check in the inputs. */
+        unsigned input;
+
+        /** The true branch is taken if the value is above this. */
+        real threshold;
+
+        /** Creates a decision with no inputs. */
+        ThresholdDecision();
+
+        /**
+         * Works out which branch to follow.
+         */
+        virtual bool getBranch();
+    };
+
+    /**
+     * A decision that checks if one of the current character's input
+     * values is within a range (inclusive). See ThresholdDecision for
+     * how the inputs are given.
+     */
+    class RangeDecision : public Decision
+    {
+    public:
+        /** Points to the current character's array of inputs. */
+        const real **inputs;
+
+        /** The position of the value to check in the inputs. */
+        unsigned input;
+
+        /** The lowest value that takes the true branch. */
+        real minimum;
+
+        /** The highest value that takes the true branch. */
+        real maximum;
+
+        /** Creates a decision with no inputs. */
+        RangeDecision();
+
+        /**
+         * Works out which branch to follow.
+         */
+        virtual bool getBranch();
+    };
+
+    /**
+     * Holds a decision tree compiled into a single array of nodes,
+     * laid out breadth first and linked by index. ThresholdDecision
+     * and RangeDecision nodes are stored as plain data and checked
+     * directly against an array of inputs, so a decision is made in
+     * a simple loop with no virtual function calls. Any other
+     * decisions are kept, and their getBranch method is called as
+     * normal. Anything that isn't a Decision is a leaf of the tree.
+     *
+     * The compiled tree doesn't own the original nodes, which must
+     * stay in existence: the results of a decision are the original
+     * leaf nodes (normally actions). Changes to the original tree
+     * aren't seen until it is compiled again.
+     *
+     * The compiled nodes themselves are never changed by making
+     * decisions, but the decisions they call can be: a random
+     * decision called without a blackboard keeps its memory in its
+     * own members. So one tree can only be used from several threads
+     * if each call to decide is given its own blackboard.
+     */
+    class CompiledDecisionTree
+    {
+    public:
+        /** The kinds of node in a compiled tree. */
+        enum NodeKind
+        {
+            /** The end of the tree, giving a result. */
+            NODE_LEAF,
+
+            /** True if the input is above the first value. */
+            NODE_THRESHOLD,
+
+            /** True if the input is between the two values. */
+            NODE_RANGE,
+
+            /** Calls getBranch on the original decision. */
+            NODE_CUSTOM
+        };
+
+        /** Holds one node of the compiled tree. */
+        struct Node
+        {
+            /** The kind of node. */
+            NodeKind kind;
+
+            /**
+             * For tests, the position of the value in the inputs. For
+             * leaves, the index of the result, and for custom
+             * decisions, the index of the decision.
+             */
+            unsigned input;
+
+            /** The threshold, or the bottom of the range. */
+            real minimum;
+
+            /** The top of the range. */
+            real maximum;
+
+            /** The node to go to if the test fails, then if it passes. */
+            unsigned branch[2];
+        };
+
+    private:
+        /** Holds the nodes, with the root first. */
+        std::vector<Node> nodes;
+
+        /** Holds the leaves of the original tree. */
+        std::vector<DecisionTreeNode*> results;
+
+        /** Holds the decisions that have to be called. */
+        std::vector<Decision*> custom;
+
+    public:
+        /** Creates an empty tree, whose decisions return null. */
+        CompiledDecisionTree();
+
+        /**
+         * Compiles the tree with the given root, replacing anything
+         * compiled before. Parts of the tree that are reached by more
+         * than one route are only compiled once.
+         */
+        void compile(DecisionTreeNode *root);
+
+        /** Returns the number of nodes in the compiled tree. */
+        unsigned getNodeCount() const { return (unsigned)nodes.size(); }
+
+        /** Returns the node with the given index. */
+        const Node& getNode(unsigned index) const { return nodes[index]; }
+
+        /**
+         * Makes a decision for a character with the given inputs,
+         * returning the leaf of the original tree that was reached
+         * (which may be null). If a blackboard is given, it is passed
+         * to the getBranchFor method of any other kinds of decision.
+         */
+        DecisionTreeNode* decide(const real *inputs,
+                                 DecisionBlackboard *board = NULL) const;
+
+        /**
+         * Makes a decision for each of a set of characters.
+         *
+         * @param inputs The inputs for the first character.
+         *
+         * @param stride The number of reals from the start of one
+         * character's inputs to the next.
+         *
+         * @param count The number of characters.
+         *
+         * @param decisions An array of count entries to receive the
+         * leaf reached for each character.
+         *
+         * @param boards If this isn't null, an array of count
+         * blackboards, one for each character.
+         */
+        void decideMany(const real *inputs, unsigned stride,
+                        unsigned count,
+                        DecisionTreeNode **decisions,
+                        DecisionBlackboard *boards = NULL) const;
     };
 
 }; // end of namespace
@@ -0,0 +1,220 @@
+/*
+ * Defines approximations to the slower mathematical functions.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds approximations to sine, cosine, the two-part arctan and the
+ * inverse square root, for steering that doesn't need the accuracy
+ * of the C library. Each is a short polynomial (or, for the inverse
+ * square root, a bit trick and Newton's method) with no branches or
+ * table lookups, so loops over batches of characters that use them
+ * can be vectorised by the compiler, which it can't do for calls
+ * into the C library.
+ *
+ * The largest errors at single precision, measured over every float
+ * in the range given, are:
+ *
+ * - fast_sin, fast_cos, fast_sincos: 1.2e-7, for angles within
+ *   plus or minus 1000 radians (the C library's sinf manages 3e-8).
+ *   Beyond that the error grows with the size of the angle, to
+ *   1.1e-6 at 100000 radians.
+ * - fast_atan2: 6e-7 radians, for any arguments.
+ * - fast_rsqrt: 5e-6 of the result, for any positive value.
+ *
+ * The polynomials are the same at double precision, so the sine and
+ * cosine errors only get down to 3e-8, and the arctan's to 3e-7.
+ * The inverse square root takes more steps of Newton's method, and
+ * is accurate to 5e-16.
+ *
+ * None of the library uses these by default. Behaviours that spend
+ * their time in these functions have a fastMath flag to switch to
+ * them: Seek, Flee, Wander, KinematicSeek, KinematicFlee,
+ * KinematicWander and CrowdSettings, as well as the fastMath
+ * parameter of KinematicBatch::setOrientationFromVelocity. Since the
+ * results differ from the C library's, fast math should be left off
+ * in deterministic builds if any machine might run a version of the
+ * game without it.
+ */
+#ifndef AICORE_FASTMATH_H
+#define AICORE_FASTMATH_H
+
+#include <stdint.h>
+#include <string.h>
+
+namespace aicore
+{
+    /**
+     * Works out the sine and cosine of the given angle together,
+     * since they share most of the work.
+     */
+    inline void fast_sincos(real angle, real *sine, real *cosine)
+    {
+        // Reduce to within a quarter turn of the nearest multiple of a
+        // half pi. The half pi is split in two, so the product with
+        // the larger part is exact, and the reduction keeps its
+        // precision for large angles.
+        const real halfPiHigh = (real)1.5703125;
+        const real halfPiLow = (real)4.8382679489661923e-4;
+        real turns = angle * (real)0.63661977236758134;
+        int quadrant = (int)(turns + (turns >= 0 ? (real)0.5 : (real)-0.5));
+        real r = angle - (real)quadrant * halfPiHigh;
+        r -= (real)quadrant * halfPiLow;
+
+        // Taylor series for the reduced angle.
+        real r2 = r*r;
+        real s = r + r*r2*((real)-1.6666666666666667e-1 +
+            r2*((real)8.3333333333333333e-3 +
+            r2*((real)-1.9841269841269841e-4 +
+            r2*(real)2.7557319223985891e-6)));
+        real c = (real)1 + r2*((real)-0.5 +
+            r2*((real)4.1666666666666667e-2 +
+            r2*((real)-1.3888888888888889e-3 +
+            r2*(real)2.4801587301587302e-5)));
+
+        // Then rotate back by the quarter turns taken off. The signs
+        // are worked out arithmetically, and the only choices are
+        // between values already worked out, since the compiler won't
+        // vectorise anything else.
+        bool swap = (quadrant & 1) != 0;
+        real sineSign = (real)1 - (real)(quadrant & 2);
+        real cosineSign = (real)1 - (real)((quadrant + 1) & 2);
+        real sineValue = swap ? c : s;
+        real cosineValue = swap ? s : c;
+        *sine = sineValue * sineSign;
+        *cosine = cosineValue * cosineSign;
+    }
+
+    /** Works out an approximation to the sine of the given angle. */
+    inline real fast_sin(real angle)
+    {
+        real sine, cosine;
+        fast_sincos(angle, &sine, &cosine);
+        return sine;
+    }
+
+    /** Works out an approximation to the cosine of the given angle. */
+    inline real fast_cos(real angle)
+    {
+        real sine, cosine;
+        fast_sincos(angle, &sine, &cosine);
+        return cosine;
+    }
+
+    /**
+     * Works out an approximation to the angle of the vector (x, y),
+     * as real_atan2(y, x) does. Both being zero gives zero.
+     */
+    inline real fast_atan2(real y, real x)
+    {
+        // Find the arctan of the smaller over the larger part, which
+        // is between zero and one. Adding one to the larger part when
+        // both are zero avoids dividing by zero, without a choice
+        // between divisions the compiler won't vectorise.
+        real ax = real_abs(x);
+        real ay = real_abs(y);
+        bool steep = ay > ax;
+        real larger = steep ? ay : ax;
+        real smaller = steep ? ax : ay;
+        real a = smaller / (larger + (larger > 0 ? (real)0 : (real)1));
+
+        // Minimax polynomial for the arctan between zero and one.
+        real s = a*a;
+        real angle = a*((real)0.9999961117 + s*((real)-0.3331736823 +
+            s*((real)0.1980781619 + s*((real)-0.1323334267 +
+            s*((real)0.07962366384 + s*((real)-0.03360420316 +
+            s*(real)0.006811785432))))));
+
+        // Then move it to the right octant. As in fast_sincos, this
+        // only chooses between constants, so it can be vectorised.
+        real offset = steep ? (real)1.5707963267948966 : (real)0;
+        real sign = steep ? (real)-1 : (real)1;
+        angle = offset + sign*angle;
+        offset = x < 0 ? (real)3.1415926535897932 : (real)0;
+        sign = x < 0 ? (real)-1 : (real)1;
+        angle = offset + sign*angle;
+        sign = y < 0 ? (real)-1 : (real)1;
+        return sign*angle;
+    }
+
+    /**
+     * Works out an approximation to one over the square root of the
+     * given value, which must be positive.
+     */
+    inline real fast_rsqrt(real value)
+    {
+        // Halving the exponent in the bits of the value gives a first
+        // guess, which Newton's method then improves.
+        real half = value * (real)0.5;
+        real guess;
+#if defined(SINGLE_PRECISION)
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        bits = 0x5f375a86u - (bits >> 1);
+        memcpy(&guess, &bits, sizeof(guess));
+        guess *= (real)1.5 - half*guess*guess;
+        guess *= (real)1.5 - half*guess*guess;
+#else
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        bits = 0x5fe6eb50c7b537a9ull - (bits >> 1);
+        memcpy(&guess, &bits, sizeof(guess));
+        guess *= (real)1.5 - half*guess*guess;
+        guess *= (real)1.5 - half*guess*guess;
+        guess *= (real)1.5 - half*guess*guess;
+        guess *= (real)1.5 - half*guess*guess;
+#endif
+        return guess;
+    }
+
+    /**
+     * Turns a non-zero vector into a vector of approximately unit
+     * length, using fast_rsqrt.
+     */
+    inline void fast_normalise(Vector3 *vector)
+    {
+        real squareMagnitude = vector->squareMagnitude();
+        if (squareMagnitude > 0) *vector *= fast_rsqrt(squareMagnitude);
+    }
+
+    /**
+     * @name Batch Approximations
+     *
+     * These work out the approximations for whole arrays of values,
+     * in loops the compiler can vectorise. The arrays can't overlap,
+     * except where noted.
+     */
+    /* @{ */
+
+    /** Works out the sine and cosine of each of the given angles. */
+    void fastSinCosMany(const real *angles, real *sines, real *cosines,
+                        unsigned count);
+
+    /**
+     * Works out the angle of each of the given vectors, as fast_atan2
+     * does.
+     */
+    void fastAtan2Many(const real *y, const real *x, real *results,
+                       unsigned count);
+
+    /**
+     * Works out one over the square root of each of the given
+     * values, which must be positive. The results may be written
+     * over the values.
+     */
+    void fastRsqrtMany(const real *values, real *results, unsigned count);
+
+    /* @} */
+
+}; // end of namespace
+
+#endif // AICORE_FASTMATH_H
@@ -0,0 +1,249 @@
+/*
+ * Defines the classes used for flocking.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds the flock of characters and the steering behaviours that
+ * use it. Flocking behaviours steer each character based on the
+ * other characters in its neighbourhood: the characters within some
+ * distance and, optionally, some view cone. The flock finds each
+ * neighbourhood with a SpatialGrid, so the cost of a query depends
+ * on the number of nearby characters rather than the size of the
+ * whole flock.
+ */
+#ifndef AICORE_FLOCKING_H
+#define AICORE_FLOCKING_H
+
+#include <vector>
+
+namespace aicore
+{
+    /**
+     * Holds the totals gathered in a single pass over a
+     * neighbourhood, so the boid behaviours don't each need to walk
+     * the neighbours again.
+     */
+    struct NeighbourhoodSummary
+    {
+        /** The number of boids in the neighbourhood. */
+        unsigned count;
+
+        /** The geometric center of the neighbourhood. */
+        Vector3 center;
+
+        /** The average velocity of the neighbourhood. */
+        Vector3 averageVelocity;
+
+        /**
+         * The sum of the offsets from each neighbour to the boid at
+         * the center of the neighbourhood, each scaled by the inverse
+         * square of its length. This points away from nearby boids,
+         * with a magnitude that grows as they get closer.
+         */
+        Vector3 separation;
+
+        /** Sets the summary to represent an empty neighbourhood. */
+        void clear()
+        {
+            count = 0;
+            center.clear();
+            averageVelocity.clear();
+            separation.clear();
+        }
+    };
+
+    /**
+     * This class stores a flock of creatures, and can find the
+     * neighbourhood of any one of them.
+     *
+     * Characters are added by pushing pointers to their kinematic
+     * data onto the boids list. The flock keeps a spatial index of
+     * the boids, which should be brought up to date by calling
+     * update() once each frame, after the boids have moved. The index
+     * is rebuilt automatically if the number of boids changes.
+     *
+     * The last neighbourhood that was prepared is kept as a compact
+     * list of boid indices along with its summary. Preparing the same
+     * neighbourhood again before the next update() returns the
+     * stored result without querying the index.
+     */
+    class Flock
+    {
+        /** Holds the spatial index of the boids' positions. */
+        SpatialGrid grid;
+
+        /**
+         * Holds the indices of the boids in the last neighbourhood.
+         * This is cleared rather than released between queries, so
+         * once it has grown to fit the largest neighbourhood no more
+         * allocation is needed.
+         */
+        std::vector<unsigned> neighbours;
+
+        /** Holds the summary of the last neighbourhood. */
+        NeighbourhoodSummary summary;
+
+        /** Holds the boid the last neighbourhood was prepared for. */
+        const Kinematic *lastOf;
+
+        /** Holds the radius of the last neighbourhood. */
+        real lastSize;
+
+        /** Holds the view cone of the last neighbourhood. */
+        real lastMinDotProduct;
+
+        /**
+         * Holds the update count when the last neighbourhood was
+         * prepared.
+         */
+        unsigned lastGeneration;
+
+        /** Holds the number of times update() has been called. */
+        unsigned generation;
+
+    public:
+        /** Holds the characters in the flock. */
+        std::vector<Kinematic*> boids;
+
+        /**
+         * Creates a new empty flock. The cell size of the spatial
+         * index should be around the size of the most common
+         * neighbourhood.
+         */
+        Flock(real cellSize = 10);
+
+        /**
+         * Brings the spatial index up to date with the current
+         * positions of the boids. Only boids that have moved into a
+         * different cell of the index have any real work done.
+         */
+        void update();
+
+        /**
+         * Changes the cell size used in the spatial index.
+         */
+        void setCellSize(real cellSize);
+
+        /**
+         * Finds the boids in the neighbourhood of the given boid, and
+         * works out the summary of the neighbourhood in the same
+         * pass.
+         *
+         * @param of The boid whose neighbourhood is wanted. This boid
+         * is never part of its own neighbourhood.
+         *
+         * @param size The radius of the neighbourhood.
+         *
+         * @param minDotProduct The cosine of the half-angle of the
+         * view cone. Values of -1 or less include boids in every
+         * direction.
+         *
+         * @return The number of boids in the neighbourhood.
+         */
+        unsigned prepareNeighourhood(
+            const Kinematic* of,
+            real size,
+            real minDotProduct = -1.0
+            );
+
+        /**
+         * Returns the indices (into the boids list) of the boids in
+         * the last neighbourhood.
+         */
+        const std::vector<unsigned>& getNeighbours() const
+        {
+            return neighbours;
+        }
+
+        /**
+         * Returns the summary of the last neighbourhood.
+         */
+        const NeighbourhoodSummary& getNeighbourhoodSummary() const
+        {
+            return summary;
+        }
+
+        /**
+         * Returns the geometric center of the last neighbourhood.
+         */
+        Vector3 getNeighbourhoodCenter() const
+        {
+            return summary.center;
+        }
+
+        /**
+         * Returns the average velocity of the last neighbourhood.
+         */
+        Vector3 getNeighbourhoodAverageVelocity() const
+        {
+            return summary.averageVelocity;
+        }
+    };
+
+    /**
+     * The base class for steering behaviours that work from the
+     * neighbourhood of their character in a flock.
+     */
+    class BoidSteeringBehaviour : public SteeringBehaviour
+    {
+    public:
+        /** The flock the character belongs to. */
+        Flock *theFlock;
+
+        /** The radius of the neighbourhood to consider. */
+        real neighbourhoodSize;
+
+        /**
+         * The cosine of the half-angle of the view cone, or -1 to
+         * consider characters in every direction.
+         */
+        real neighbourhoodMinDP;
+
+        /** The maximum acceleration the behaviour can request. */
+        real maxAcceleration;
+    };
+
+    /**
+     * Steers away from the center of the neighbourhood.
+     */
+    class Separation : public BoidSteeringBehaviour
+    {
+        Flee flee;
+
+    public:
+        virtual void getSteering(SteeringOutput* output);
+    };
+
+    /**
+     * Steers towards the center of the neighbourhood.
+     */
+    class Cohesion : public BoidSteeringBehaviour
+    {
+        Seek seek;
+
+    public:
+        virtual void getSteering(SteeringOutput* output);
+    };
+
+    /**
+     * Steers to match the average velocity of the neighbourhood.
+     */
+    class VelocityMatchAndAlign : public BoidSteeringBehaviour
+    {
+    public:
+        virtual void getSteering(SteeringOutput* output);
+    };
+
+}; // end of namespace
+
+#endif // AICORE_FLOCKING_H
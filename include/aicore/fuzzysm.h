@@ -15,12 +15,295 @@
  *
  * Holds the implementation of a fuzzy logic decision maker that uses
  * fuzzy logic to make its decisions.
+ *
+ * A FuzzyRuleSet turns a character's crisp inputs (distance to the
+ * enemy, health, ammo and so on) into degrees of membership of a set
+ * of outputs. Each input is fuzzified by a number of trapezoidal
+ * membership sets, rules combine sets with fuzzy AND (the minimum of
+ * their degrees) scaled by a weight, and each output takes the
+ * largest degree of the rules that lead to it. Outputs can also be
+ * defuzzified into crisp values, by giving each a representative
+ * value and taking the average weighted by degree.
+ *
+ * Everything is held in flat arrays, so the same rule set can be
+ * evaluated for a whole population of characters in one call, four
+ * characters at a time when SIMD is enabled (see simd.h).
+ *
+ * A FuzzyStateMachine uses the outputs as states: the character is in
+ * each state to the degree of its output, and carries out the actions
+ * of every state it is in by more than a threshold. FuzzyCondition
+ * lets an output drive the transitions of an ordinary state machine.
  */
 #ifndef AICORE_FUZZYSM_H
 #define AICORE_FUZZYSM_H
 
+#include <vector>
+
 namespace aicore
 {
+    /**
+     * Holds a set of fuzzy rules, compiled into flat arrays.
+     */
+    class FuzzyRuleSet
+    {
+        /**
+         * For each membership set, the input it looks at, and the
+         * values that define its shape: the set is fully true between
+         * the two plateau values, and falls to zero at the given
+         * slopes outside them.
+         */
+        std::vector<unsigned> setInput;
+        std::vector<real> setPlateauStart;
+        std::vector<real> setPlateauEnd;
+        std::vector<real> setRise;
+        std::vector<real> setFall;
+
+        /** For each output, its variable and representative value. */
+        std::vector<unsigned> outputVariable;
+        std::vector<real> outputValue;
+
+        /**
+         * For each rule, the position of its first set in the terms
+         * array, the number of sets, its output and its weight.
+         */
+        std::vector<unsigned> ruleFirstTerm;
+        std::vector<unsigned> ruleTermCount;
+        std::vector<unsigned> ruleOutput;
+        std::vector<real> ruleWeight;
+
+        /** Holds the sets combined by each rule. */
+        std::vector<unsigned> terms;
+
+        /** The number of inputs and output variables used. */
+        unsigned inputCount;
+        unsigned variableCount;
+
+        /**
+         * Works out the crisp values of the output variables from the
+         * output degrees for one character.
+         */
+        void defuzzify(const real *degrees, real *crisp) const;
+
+    public:
+        /** Creates a rule set with no sets, outputs or rules. */
+        FuzzyRuleSet();
+
+        /**
+         * Adds a trapezoidal membership set on the given input. The
+         * set is zero below a, rises to one at b, stays at one until
+         * c, and falls to zero at d. If a equals b the set has no
+         * left edge, and is one for every value below c; if c equals
+         * d it is one for every value above b. This gives the
+         * "shoulder" sets used at the ends of a range.
+         *
+         * @return The index of the set.
+         */
+        unsigned addSet(unsigned input, real a, real b, real c, real d);
+
+        /**
+         * Adds an output, with the value it stands for when its
+         * variable is defuzzified. Outputs that are only used as
+         * states or decisions can leave both at zero.
+         *
+         * @return The index of the output.
+         */
+        unsigned addOutput(real value = 0, unsigned variable = 0);
+
+        /**
+         * Adds a rule: if all the given sets are true, then so is the
+         * given output, with the rule's degree scaled by the weight.
+         *
+         * @return The index of the rule.
+         */
+        unsigned addRule(const unsigned *sets, unsigned setCount,
+                         unsigned output, real weight = 1);
+
+        /** Adds a rule with one set. */
+        unsigned addRule(unsigned set, unsigned output, real weight = 1)
+        {
+            return addRule(&set, 1, output, weight);
+        }
+
+        /** Adds a rule combining two sets. */
+        unsigned addRule(unsigned set1, unsigned set2,
+                         unsigned output, real weight = 1)
+        {
+            unsigned sets[2] = {set1, set2};
+            return addRule(sets, 2, output, weight);
+        }
+
+        /** Returns the number of inputs the sets look at. */
+        unsigned getInputCount() const { return inputCount; }
+
+        /** Returns the number of membership sets. */
+        unsigned getSetCount() const { return (unsigned)setInput.size(); }
+
+        /** Returns the number of outputs. */
+        unsigned getOutputCount() const
+        {
+            return (unsigned)outputValue.size();
+        }
+
+        /** Returns the number of output variables. */
+        unsigned getVariableCount() const { return variableCount; }
+
+        /** Returns the number of rules. */
+        unsigned getRuleCount() const { return (unsigned)ruleOutput.size(); }
+
+        /**
+         * Works out the degree of membership of the given input value
+         * in the given set.
+         */
+        real getMembership(unsigned set, real value) const;
+
+        /**
+         * Evaluates the rules for one character.
+         *
+         * @param inputs The character's inputs, getInputCount() of
+         * them.
+         *
+         * @param degrees Receives the degree of each output.
+         *
+         * @param crisp If this isn't null, it receives the
+         * defuzzified value of each output variable. Variables with no
+         * true outputs are given zero.
+         */
+        void evaluate(const real *inputs, real *degrees,
+                      real *crisp = NULL) const;
+
+        /**
+         * Evaluates the rules for many characters. The results are the
+         * same as calling evaluate for each character.
+         *
+         * @param inputs The inputs of the first character. Each
+         * character's inputs start stride reals after the previous
+         * character's.
+         *
+         * @param degrees Receives getOutputCount() degrees for each
+         * character, one character after another.
+         *
+         * @param crisp If this isn't null, it receives
+         * getVariableCount() values for each character.
+         */
+        void evaluateMany(const real *inputs, unsigned stride,
+                          unsigned count, real *degrees,
+                          real *crisp = NULL) const;
+    };
+
+    /**
+     * A condition that is true when one of the current character's
+     * fuzzy outputs is at least a given degree. Before testing, the
+     * calling code sets the pointer that degrees points to, in the
+     * same way as IntegerInputMatchCondition.
+     */
+    class FuzzyCondition : public Condition
+    {
+    public:
+        /** Points to the current character's output degrees. */
+        const real **degrees;
+
+        /** The output to check. */
+        unsigned output;
+
+        /** The degree the output must reach. */
+        real threshold;
+
+        /** Checks the output's degree against the threshold. */
+        virtual bool test()
+        {
+            return (*degrees)[output] >= threshold;
+        }
+    };
+
+    /**
+     * A state machine where the character can be in any number of
+     * states at once, to different degrees. Each output of the rule
+     * set is a state, and the character is in the state when its
+     * degree is at least the threshold. Entering and leaving states
+     * gives their entry and exit actions, and the states the
+     * character stays in give their normal actions, so the results
+     * can be passed straight to an ActionManager. The degrees are
+     * available for the actions to use as priorities or weights.
+     *
+     * The transitions of the states aren't used: the rules decide
+     * which states the character is in.
+     */
+    class FuzzyStateMachine
+    {
+        /** The rules that give the degree of each state. */
+        const FuzzyRuleSet *rules;
+
+        /** The states, one for each output of the rules. */
+        std::vector<StateMachineState*> states;
+
+        /** The degree of each state at the last update. */
+        std::vector<real> degrees;
+
+        /** Whether the character was in each state after the last update. */
+        std::vector<bool> active;
+
+        /**
+         * Works out which states the character is in from the
+         * current degrees, and returns the actions.
+         */
+        Action* applyDegrees();
+
+    public:
+        /** The degree a state must reach for the character to be in it. */
+        real threshold;
+
+        /**
+         * Creates a machine using the given rules. The states should
+         * then be set, one for each output.
+         */
+        FuzzyStateMachine(const FuzzyRuleSet *rules = NULL,
+                          real threshold = (real)0.5);
+
+        /**
+         * Sets the rules to use, and leaves every state. The number
+         * of states is set to the rule set's number of outputs.
+         */
+        void setRules(const FuzzyRuleSet *rules);
+
+        /** Sets the state for the given output. */
+        void setState(unsigned output, StateMachineState *state)
+        {
+            states[output] = state;
+        }
+
+        /** Leaves every state, without carrying out any actions. */
+        void reset();
+
+        /** Returns the degree of each state at the last update. */
+        const real* getDegrees() const { return &degrees[0]; }
+
+        /** Checks if the character is in the given output's state. */
+        bool isInState(unsigned output) const { return active[output]; }
+
+        /**
+         * Evaluates the rules with the given inputs, and works out
+         * which states the character is in.
+         *
+         * @return A newly created list of actions: the exit actions
+         * of states left, then the entry actions of states entered,
+         * then the actions of states already in, each in the order of
+         * the outputs. The caller is responsible for deleting them.
+         */
+        Action* update(const real *inputs);
+
+        /**
+         * Updates many machines that share the same rules, evaluating
+         * the rules for all of them in one batch. The inputs are laid
+         * out as for FuzzyRuleSet::evaluateMany.
+         *
+         * @param actions An array with an entry for each machine,
+         * which receives the list of actions that update would have
+         * returned.
+         */
+        static void updateMany(FuzzyStateMachine **machines,
+                               const real *inputs, unsigned stride,
+                               unsigned count, Action **actions);
+    };
 
 }; // end of namespace
 
@@ -0,0 +1,282 @@
+/*
+ * Defines the classes used for hierarchical state machines.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds an implementation of a hierarchical state machine. States
+ * can contain other states: while a character is in a state, it is
+ * also in all the states that contain it, and the transitions of all
+ * of them can fire. A transition can lead to any state in the
+ * hierarchy, exiting the states between the current state and the
+ * lowest state that contains both ends of the transition, and
+ * entering those between there and the target.
+ *
+ * The hierarchy is compiled into a StateHierarchy once, which works
+ * out the states to exit and enter for every transition in advance.
+ * The hierarchy doesn't change as it is used, so many characters'
+ * HierarchicalStateMachine objects can share it.
+ *
+ * Rather than creating lists of new actions at each update, states
+ * and transitions in a hierarchy hold actions that belong to them,
+ * and the machine returns the actions to carry out in an array that
+ * is reused from one update to the next. This means a machine doesn't
+ * allocate memory once it has settled down, but it also means the
+ * actions are shared, so they shouldn't hold any state that belongs
+ * to one character.
+ */
+#ifndef AICORE_HSM_H
+#define AICORE_HSM_H
+
+#include <vector>
+
+namespace aicore
+{
+    /**
+     * A state in a hierarchical state machine. States with no parent
+     * are at the top of the hierarchy.
+     */
+    class HierarchicalState : public StateMachineState
+    {
+    public:
+        /** The state that contains this one, or null. */
+        HierarchicalState *parent;
+
+        /**
+         * For states that contain others, the state to enter when
+         * this state is entered. If this is null, the state can be
+         * the current state on its own.
+         */
+        HierarchicalState *initialState;
+
+        /** The action to carry out when entering the state, or null. */
+        Action *entryAction;
+
+        /** The action to carry out each update while in the state. */
+        Action *activeAction;
+
+        /** The action to carry out when leaving the state, or null. */
+        Action *exitAction;
+
+        /** Creates a state with no parent, actions or transitions. */
+        HierarchicalState();
+    };
+
+    /**
+     * A transition between two states of a hierarchical state
+     * machine, triggered by a condition. Transitions of other kinds
+     * can also be used in a hierarchy, but only transitions of this
+     * kind have an action.
+     */
+    class HierarchicalTransition :
+        public Transition,
+        public ConditionalTransitionMixin,
+        public FixedTargetTransitionMixin
+    {
+    public:
+        /** The action to carry out as the transition fires, or null. */
+        Action *action;
+
+        /** Creates a transition with no target, condition or action. */
+        HierarchicalTransition();
+
+        /** Checks the condition. */
+        virtual bool isTriggered();
+
+        /** Returns the target. */
+        virtual StateMachineState * getTargetState();
+    };
+
+    /**
+     * Holds a hierarchy of states compiled into flat arrays. For
+     * every transition, the number of states to exit and the list of
+     * states to enter are worked out in advance.
+     *
+     * Transitions always leave their source state: a transition from
+     * a state to itself, or to a state inside it, exits the state and
+     * enters it again.
+     */
+    class StateHierarchy
+    {
+    public:
+        /** Marks a missing state. */
+        static const unsigned NONE = 0xffffffff;
+
+    private:
+        /** Holds one compiled state. */
+        struct CompiledState
+        {
+            /** The original state. */
+            HierarchicalState *state;
+
+            /** The number of states above this one. */
+            unsigned depth;
+
+            /**
+             * The position in the paths array of this state's
+             * ancestors, starting with the top state and ending
+             * with this one (depth+1 entries).
+             */
+            unsigned ancestors;
+
+            /** The position of the state's first transition. */
+            unsigned firstTransition;
+
+            /** The number of transitions from the state. */
+            unsigned transitionCount;
+        };
+
+        /** Holds one compiled transition. */
+        struct CompiledTransition
+        {
+            /** The original transition. */
+            Transition *transition;
+
+            /** The transition's action. */
+            Action *action;
+
+            /**
+             * The number of states between the top of the hierarchy
+             * and the lowest state that contains both ends of the
+             * transition, which stays active. States below this are
+             * exited.
+             */
+            unsigned keepDepth;
+
+            /** The position in the paths array of the states to enter. */
+            unsigned entries;
+
+            /** The number of states to enter. */
+            unsigned entryCount;
+
+            /** The state the machine ends up in. */
+            unsigned target;
+        };
+
+        /** Holds the states. */
+        std::vector<CompiledState> states;
+
+        /** Holds the transitions, grouped by the state they leave. */
+        std::vector<CompiledTransition> transitions;
+
+        /** Holds lists of states, referred to by index from above. */
+        std::vector<unsigned> paths;
+
+        /** The states to enter when the machine starts. */
+        unsigned initialEntries;
+
+        /** The number of states to enter when the machine starts. */
+        unsigned initialEntryCount;
+
+        /**
+         * Adds the states entered on the way from (but not including)
+         * the given ancestor, down to the given state and into its
+         * initial states, to the paths array. Returns the state the
+         * machine ends up in.
+         */
+        unsigned addEntryPath(unsigned keepDepth, unsigned state);
+
+        friend class HierarchicalStateMachine;
+
+    public:
+        /** Creates an empty hierarchy. */
+        StateHierarchy();
+
+        /**
+         * Compiles the hierarchy that starts with the given state,
+         * replacing anything compiled before. Every state that can
+         * be reached from it (through transitions, parents and
+         * initial states) is included. All the states must be
+         * HierarchicalState objects.
+         */
+        void compile(HierarchicalState *initialState);
+
+        /** Returns the number of states in the hierarchy. */
+        unsigned getStateCount() const { return (unsigned)states.size(); }
+
+        /** Returns the state with the given index. */
+        HierarchicalState* getState(unsigned index) const
+        {
+            return states[index].state;
+        }
+
+        /**
+         * Returns the index of the given state, or NONE if it isn't
+         * part of the hierarchy.
+         */
+        unsigned getStateIndex(const StateMachineState *state) const;
+    };
+
+    /**
+     * Runs a compiled hierarchy for one character.
+     */
+    class HierarchicalStateMachine
+    {
+        /** The hierarchy being run. */
+        const StateHierarchy *hierarchy;
+
+        /** The index of the lowest current state, or NONE. */
+        unsigned current;
+
+        /** Holds the actions from the last update. */
+        std::vector<Action*> actions;
+
+        /** Adds the action to the list, if there is one. */
+        void addAction(Action *action)
+        {
+            if (action) actions.push_back(action);
+        }
+
+    public:
+        /**
+         * Creates a machine for the given hierarchy. It starts out of
+         * every state, and enters the initial state on its first
+         * update.
+         */
+        HierarchicalStateMachine(const StateHierarchy *hierarchy = NULL);
+
+        /** Sets the hierarchy to use, and resets the machine. */
+        void setHierarchy(const StateHierarchy *hierarchy);
+
+        /** Leaves every state, without carrying out any actions. */
+        void reset();
+
+        /**
+         * Returns the lowest state the machine is in, or null if it
+         * hasn't started.
+         */
+        HierarchicalState* getCurrentState() const;
+
+        /**
+         * Returns true if the machine is in the given state, or a
+         * state inside it.
+         */
+        bool isInState(const HierarchicalState *state) const;
+
+        /**
+         * Checks the transitions of the current state and all the
+         * states that contain it, starting at the top of the
+         * hierarchy, and fires the first that is triggered.
+         *
+         * @return The actions to carry out, in order. If a transition
+         * fired, these are the exit actions of the states left, the
+         * transition's action, and the entry actions of the states
+         * entered. Otherwise they are the active actions of the
+         * current states, from the top down. The array is reused
+         * by the next update.
+         */
+        const std::vector<Action*>& update();
+    };
+
+}; // end of namespace
+
+#endif // AICORE_HSM_H
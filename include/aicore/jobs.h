@@ -0,0 +1,189 @@
+/*
+ * Defines the classes used to run work in parallel.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds a simple work-stealing job system for updating many
+ * characters across all the processor cores.
+ *
+ * The normal pattern is to split each frame into phases. In the
+ * decision phase each character's AI (its steering behaviours, state
+ * machine, decision tree and so on) is run, writing its results into
+ * a per-character slot. Once every character is done, the
+ * integration phase applies the results. Because the job system
+ * joins all its workers before parallelFor returns, and each
+ * character only writes to its own slot, the results don't depend on
+ * the number of threads or the order the work was done in.
+ *
+ * @section threading Thread Safety
+ *
+ * Most classes in the library hold working state in their members
+ * (for example Wander updates its internal target, SteeringPipe
+ * stores its path, constraints store their suggestions, and state
+ * machines store their current state). The rules are:
+ *
+ * - Different objects can be used from different threads at the same
+ * time, as long as they don't share the objects they point to
+ * (characters' kinematics may be shared if they are only read).
+ *
+ * - A single behaviour, pipe, state machine or decision tree must
+ * only be used by one thread at a time. Give each worker its own
+ * copy of any shared behaviour objects, indexed by the worker number
+ * passed to ParallelTask::run.
+ *
+ * - The global random number functions are safe to call from any
+ * thread, as each thread has its own engine (see getRandomEngine).
+ * For results that don't depend on the scheduling, give each
+ * character its own RandomEngine. TimingData::get() is not
+ * thread-safe.
+ */
+#ifndef AICORE_JOBS_H
+#define AICORE_JOBS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace aicore
+{
+    /**
+     * A task is some work that can be done independently for each of
+     * a range of indices, normally one index per character.
+     */
+    class ParallelTask
+    {
+    public:
+        virtual ~ParallelTask() {}
+
+        /**
+         * Does the work for every index in the range [begin, end).
+         * This will be called from several threads at once with
+         * different ranges, so the implementation must not write to
+         * anything shared between indices.
+         *
+         * @param worker The number of the worker running this range,
+         * from zero to one less than JobSystem::getWorkerCount(). No
+         * two ranges are run at the same time with the same worker
+         * number, so this can be used to select per-thread scratch
+         * data.
+         */
+        virtual void run(unsigned begin, unsigned end, unsigned worker) = 0;
+    };
+
+    /**
+     * Runs tasks across a pool of worker threads. The work is split
+     * into chunks which are shared out between the workers. Each
+     * worker has its own queue of chunks, and when it runs out it
+     * steals chunks from the other workers, so the load balances
+     * itself when some characters take longer than others.
+     *
+     * The thread calling parallelFor does work too, as worker zero.
+     * Only one thread should call parallelFor at a time, and tasks
+     * shouldn't call parallelFor themselves.
+     */
+    class JobSystem
+    {
+        /** Holds a range of indices to process. */
+        struct Chunk
+        {
+            unsigned begin;
+            unsigned end;
+        };
+
+        /** Holds the chunks waiting to be run by one worker. */
+        struct WorkQueue
+        {
+            std::mutex lock;
+            std::deque<Chunk> chunks;
+        };
+
+        /** Holds the queue for each worker, including the caller. */
+        std::vector<WorkQueue*> queues;
+
+        /** Holds the background threads. */
+        std::vector<std::thread> threads;
+
+        /** Holds the task currently being run. */
+        ParallelTask *task;
+
+        /** Holds the number of chunks not yet completed. */
+        std::atomic<unsigned> remaining;
+
+        /** Guards the generation and quit flag. */
+        std::mutex stateLock;
+
+        /** Signals the workers that there is new work. */
+        std::condition_variable workReady;
+
+        /** Signals the caller that the last chunk is done. */
+        std::condition_variable workDone;
+
+        /** Incremented each time new work is added. */
+        unsigned generation;
+
+        /** Set when the workers should finish. */
+        bool quitting;
+
+        /** The main loop for each background thread. */
+        void workerLoop(unsigned worker);
+
+        /** Runs chunks until there are none left to find. */
+        void runChunks(unsigned worker);
+
+        /** Takes a chunk from the given worker's queue, or steals one. */
+        bool findChunk(unsigned worker, Chunk* chunk);
+
+    public:
+        /**
+         * Creates a job system with the given number of workers
+         * (including the calling thread). If this is zero, then one
+         * worker per hardware thread is used.
+         */
+        JobSystem(unsigned workers = 0);
+
+        /** Stops and joins all the background threads. */
+        ~JobSystem();
+
+        /** Returns the number of workers, including the caller. */
+        unsigned getWorkerCount() const
+        {
+            return (unsigned)queues.size();
+        }
+
+        /**
+         * Runs the given task for every index from zero to count-1,
+         * and waits for it all to finish.
+         *
+         * @param task The task to run.
+         *
+         * @param count The number of indices.
+         *
+         * @param grainSize The most indices to give a worker in one
+         * go. Smaller values balance the load better but have more
+         * overhead.
+         */
+        void parallelFor(ParallelTask* task, unsigned count,
+                         unsigned grainSize = 64);
+
+    private:
+        // The job system owns its threads, so can't be copied.
+        JobSystem(const JobSystem &);
+        JobSystem& operator=(const JobSystem &);
+    };
+
+}; // end of namespace
+
+#endif // AICORE_JOBS_H
@@ -21,12 +21,22 @@
  * is achieved by applying acceleration to change velocity. Kinematic
  * movement is very useful because human beings can accelerate very
  * rapidly and have a relatively small top speed.
+ *
+ * Each behaviour can also work out the steering for a whole batch of
+ * characters at once, reading their positions from a KinematicBatch
+ * and writing the results into a SteeringBatch. This walks through
+ * the arrays in one pass with no virtual calls or pointer chasing,
+ * and gives the same results as calling getSteering for each
+ * character in turn.
  */
 #ifndef AICORE_KINEMATIC_H
 #define AICORE_KINEMATIC_H
 
 namespace aicore
 {
+    class KinematicBatch;
+    class SteeringBatch;
+
     /**
      * The base class for all kinematic movement behaviours.
      */
@@ -74,11 +84,37 @@ namespace aicore
     class KinematicSeek : public TargetedKinematicMovement
     {
     public:
+        /**
+         * Set to use the approximations in fastmath.h rather than the
+         * C library, both in getSteering and getSteeringMany.
+         */
+        bool fastMath;
+
+        /** Creates a behaviour using exact maths. */
+        KinematicSeek() : fastMath(false) {}
+
         /**
          * Works out the desired steering and writes it into the given
          * steering output structure.
          */
         virtual void getSteering(SteeringOutput* output) const;
+
+        /**
+         * Works out the steering for every character in the given
+         * batch, each towards its own target, using this behaviour's
+         * maximum speed. The character and target members aren't
+         * used. The output is resized to the number of characters,
+         * and given no angular acceleration.
+         *
+         * @param targetX The x coordinate of each character's target,
+         * and similarly for targetY and targetZ. Each must have an
+         * entry for every character.
+         */
+        virtual void getSteeringMany(const KinematicBatch& characters,
+                                     const real *targetX,
+                                     const real *targetY,
+                                     const real *targetZ,
+                                     SteeringBatch *output) const;
     };
 
     /**
@@ -92,6 +128,17 @@ namespace aicore
          * steering output structure.
          */
         virtual void getSteering(SteeringOutput* output) const;
+
+        /**
+         * Works out the steering for every character in the given
+         * batch, each away from its own target. The parameters are
+         * the same as for KinematicSeek::getSteeringMany.
+         */
+        virtual void getSteeringMany(const KinematicBatch& characters,
+                                     const real *targetX,
+                                     const real *targetY,
+                                     const real *targetZ,
+                                     SteeringBatch *output) const;
     };
 
     /**
@@ -118,6 +165,17 @@ namespace aicore
          * steering output structure.
          */
         virtual void getSteering(SteeringOutput* output) const;
+
+        /**
+         * Works out the steering for every character in the given
+         * batch, each arriving at its own target. The parameters are
+         * the same as for KinematicSeek::getSteeringMany.
+         */
+        void getSteeringMany(const KinematicBatch& characters,
+                             const real *targetX,
+                             const real *targetY,
+                             const real *targetZ,
+                             SteeringBatch *output) const;
     };
 
     /**
@@ -132,11 +190,48 @@ namespace aicore
          */
         real maxRotation;
 
+        /**
+         * The random number generator used for the turns. If this is
+         * null, the calling thread's engine is used. Give each
+         * character its own engine for results that can be repeated.
+         */
+        RandomEngine *random;
+
+        /**
+         * Set to use the approximations in fastmath.h for the forward
+         * direction, rather than the C library.
+         */
+        bool fastMath;
+
+        /** Creates a behaviour using the calling thread's engine. */
+        KinematicWander() : random(NULL), fastMath(false) {}
+
+        /** Returns the random number generator to use. */
+        RandomEngine& getRandom() const
+        {
+            return random ? *random : getRandomEngine();
+        }
+
         /**
          * Works out the desired steering and writes it into the given
          * steering output structure.
          */
         virtual void getSteering(SteeringOutput* output) const;
+
+        /**
+         * Works out the steering for every character in the given
+         * batch, resizing the output to match. Rather than drawing a
+         * random number for each character, the turns for the whole
+         * batch are drawn from the given engine in one go (the random
+         * member isn't used).
+         *
+         * @note The forward direction of each character needs a sine
+         * and cosine, so this loop is unlikely to be vectorised unless
+         * fastMath is set.
+         */
+        void getSteeringMany(const KinematicBatch& characters,
+                             SteeringBatch *output,
+                             RandomEngine &engine = getRandomEngine()) const;
     };
 
 }; // end of namespace
@@ -118,6 +118,30 @@ namespace aicore
         virtual LearningProblemAction*
             getActions(LearningProblemState* state) = 0;
 
+        /**
+         * Returns the action with the given index from the given
+         * state, or null if it isn't valid there. The default
+         * implementation searches the list from getActions.
+         */
+        virtual LearningProblemAction*
+            getAction(LearningProblemState* state, unsigned index);
+
+        /**
+         * Returns the number of actions that are valid from the given
+         * state. The default implementation counts the list from
+         * getActions.
+         */
+        virtual unsigned getValidActionCount(LearningProblemState* state);
+
+        /**
+         * Returns the valid action at the given position (from zero
+         * to one less than getValidActionCount) in the list of
+         * actions for the given state. The default implementation
+         * walks the list from getActions.
+         */
+        virtual LearningProblemAction*
+            getValidAction(LearningProblemState* state, unsigned position);
+
         /**
          * Returns the result of taking the given action from the
          * given state.
@@ -133,6 +157,14 @@ namespace aicore
      * interface with a set of states in an array, each containing a
      * the same number of actions. It is mostly suitable for
      * relatively toy problems.
+     *
+     * The valid actions for every state are worked out when the
+     * problem is created, and stored one state after another in a
+     * single array (a compressed sparse row table), so the actions
+     * for a state are a fixed range of that array. The lists returned
+     * by getActions are linked up in advance and never change, so
+     * none of the methods write to the problem, and it can be used
+     * from several threads at once.
      */
     class ArrayBasedLearningProblem : public LearningProblem
     {
@@ -146,9 +178,22 @@ namespace aicore
         /** Holds the state objects */
         LearningProblemState *states;
 
-        /** Holds the actions */
+        /**
+         * Holds the valid actions for each state, in order of their
+         * index, with all the actions for the first state, then the
+         * second, and so on. Each state's actions are linked into a
+         * list in the same order.
+         */
         LearningProblemAction *actions;
 
+        /**
+         * Holds the position in the actions array of the first
+         * action for each state. There is one more entry than there
+         * are states, so the actions for state i run from
+         * actionStart[i] up to actionStart[i+1].
+         */
+        unsigned *actionStart;
+
         /**
          * Holds the transition information: this tells the problem
          * which state and action combinations map to which
@@ -196,6 +241,26 @@ namespace aicore
         virtual LearningProblemAction*
             getActions(LearningProblemState* state);
 
+        /**
+         * Returns the action with the given index, or null if it
+         * isn't valid from the given state.
+         */
+        virtual LearningProblemAction*
+            getAction(LearningProblemState* state, unsigned index);
+
+        /** Returns the number of actions valid from the given state. */
+        virtual unsigned getValidActionCount(LearningProblemState* state)
+        {
+            return actionStart[state->index+1] - actionStart[state->index];
+        }
+
+        /** Returns the valid action at the given position. */
+        virtual LearningProblemAction*
+            getValidAction(LearningProblemState* state, unsigned position)
+        {
+            return &actions[actionStart[state->index] + position];
+        }
+
         /**
          * Returns the result of taking the given action from the
          * given state.
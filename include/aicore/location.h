@@ -20,6 +20,14 @@
  * but two dimensional orientations. This file also includes a class
  * to represent what a movement algorithm wants to do with a
  * character.
+ *
+ * Each structure is a template over its scalar type, with the usual
+ * names (Location, Kinematic, SteeringOutput) standing for the
+ * library's real type, and f and d versions for float and double.
+ * Structures of one precision can be explicitly converted to the
+ * other, so, for example, world positions can be kept in double
+ * precision while steering is done in float for a batch of
+ * characters near the camera.
  */
 #ifndef AICORE_LOCATION_H
 #define AICORE_LOCATION_H
@@ -36,23 +44,24 @@ namespace aicore
      * case, neither force nor torque take account of mass, and so
      * should be thought of as linear and angular acceleration.
      */
-    struct SteeringOutput
+    template <typename T>
+    struct BasicSteeringOutput
     {
         /**
          * The linear component of the steering action.
          */
-        Vector3 linear;
+        BasicVector3<T> linear;
 
         /**
          * The angular component of the steering action.
          */
-        real angular;
+        T angular;
 
         /**
          * Creates a new steering action with zero linear and angular
          * changes.
          */
-        SteeringOutput() : angular(0)
+        BasicSteeringOutput() : angular(0)
         {}
 
         /**
@@ -65,10 +74,19 @@ namespace aicore
          * @param angular The initial angular change to give the
          * SteeringOutput.
          */
-        SteeringOutput(const Vector3& linear, real angular = 0)
+        BasicSteeringOutput(const BasicVector3<T>& linear, T angular = 0)
             : linear(linear), angular(angular)
         {}
 
+        /**
+         * Creates a steering action from one of a different
+         * precision, converting each component.
+         */
+        template <typename U>
+        explicit BasicSteeringOutput(const BasicSteeringOutput<U>& other)
+            : linear(other.linear), angular((T)other.angular)
+        {}
+
         /**
          * Zeros the linear and angular changes of this steering action.
          */
@@ -83,7 +101,7 @@ namespace aicore
          * SteeringOutputs are equal if their linear and angular
          * changes are equal.
          */
-        bool operator == (const SteeringOutput& other) const
+        bool operator == (const BasicSteeringOutput& other) const
         {
             return linear == other.linear &&  angular == other.angular;
         }
@@ -93,7 +111,7 @@ namespace aicore
          * SteeringOutputs are unequal if either their linear or
          * angular changes are unequal.
          */
-        bool operator != (const SteeringOutput& other) const
+        bool operator != (const BasicSteeringOutput& other) const
         {
             return linear != other.linear ||  angular != other.angular;
         }
@@ -102,7 +120,7 @@ namespace aicore
 		 * Returns the square of the magnitude of this steering output.
 		 * This includes the angular component.
 		 */
-		real squareMagnitude()
+		T squareMagnitude() const
 		{
 			return linear.squareMagnitude() + angular*angular;
 		}
@@ -111,9 +129,9 @@ namespace aicore
 		* Returns the magnitude of this steering output.
 		* This includes the angular component.
 		 */
-		real magnitude()
+		T magnitude() const
 		{
-			return real_sqrt(squareMagnitude());
+			return Precision<T>::sqrt(squareMagnitude());
 		}
     };
 
@@ -125,36 +143,37 @@ namespace aicore
      * stored as a vector, rotation is a planar rotation about the y
      * axis. This will be altered to be a quaternion in due course.
      */
-    struct Location
+    template <typename T>
+    struct BasicLocation
     {
         /**
          * The position in 3 space.
          */
-        Vector3 position;
+        BasicVector3<T> position;
 
         /**
          * The orientation, as a euler angle in radians around the
          * positive y axis (i.e. up) from the positive z axis.
          */
-        real orientation;
+        T orientation;
 
         /**
          * Creates a new location with a 0 position and orientation.
          */
-        Location() : orientation(0.0f)
+        BasicLocation() : orientation(0.0f)
         {}
 
         /**
          * Creates a location at the given position with no rotation.
          */
-        Location(const Vector3& position)
+        BasicLocation(const BasicVector3<T>& position)
             : position(position), orientation(0.0f)
         {}
 
         /**
          * Creates a location with the given position and orientation.
          */
-        Location(const Vector3& position, real orientation)
+        BasicLocation(const BasicVector3<T>& position, T orientation)
             : position(position), orientation(orientation)
         {}
 
@@ -162,14 +181,31 @@ namespace aicore
          * Creates a location with the position vector given as
          * components and the given orientation.
          */
-        Location(real x, real y, real z, real orientation)
+        BasicLocation(T x, T y, T z, T orientation)
             : position(x, y, z), orientation(orientation)
         {}
 
+        /**
+         * Copy constructor, declared alongside the assignment
+         * operator below.
+         */
+        BasicLocation(const BasicLocation& other)
+            : position(other.position), orientation(other.orientation)
+        {}
+
+        /**
+         * Creates a location from one of a different precision,
+         * converting each component.
+         */
+        template <typename U>
+        explicit BasicLocation(const BasicLocation<U>& other)
+            : position(other.position), orientation((T)other.orientation)
+        {}
+
         /**
          * Assignment operator.
          */
-        Location& operator = (const Location& other)
+        BasicLocation& operator = (const BasicLocation& other)
         {
             position = other.position;
             orientation = other.orientation;
@@ -189,7 +225,7 @@ namespace aicore
          * Checks that the given location is equal to this. Locations
          * are equal if their positions and orientations are equal.
          */
-        bool operator == (const Location& other) const
+        bool operator == (const BasicLocation& other) const
         {
             return position == other.position &&
                 orientation == other.orientation;
@@ -200,7 +236,7 @@ namespace aicore
          * this. Locations are unequal if either their positions or
          * orientations are unequal.
          */
-        bool operator != (const Location& other) const
+        bool operator != (const BasicLocation& other) const
         {
             return position != other.position ||
                 orientation != other.orientation;
@@ -221,19 +257,19 @@ namespace aicore
          * @param duration The number of simulation seconds to
          * integrate over.
          */
-        void integrate(const SteeringOutput& steer, real duration);
+        void integrate(const BasicSteeringOutput<T>& steer, T duration);
 
         /**
          * Sets the orientation of this location so it points along
          * the given velocity vector.
          */
-        void setOrientationFromVelocity(const Vector3& velocity);
+        void setOrientationFromVelocity(const BasicVector3<T>& velocity);
 
         /**
          * Returns a unit vector in the direction of the current
          * orientation.
          */
-        Vector3 getOrientationAsVector() const;
+        BasicVector3<T> getOrientationAsVector() const;
 
         /**
          * Fills the passed matrix with the Location's transformation.
@@ -250,23 +286,27 @@ namespace aicore
      * first derivative of orientation in the Location structure), this
      * will be altered to be a full 3D angular velocity in due course.
      */
-    struct Kinematic : public Location
+    template <typename T>
+    struct BasicKinematic : public BasicLocation<T>
     {
+        using BasicLocation<T>::position;
+        using BasicLocation<T>::orientation;
+
         /**
          * The linear velocity.
          */
-        Vector3 velocity;
+        BasicVector3<T> velocity;
 
         /**
          * The angular velocity.
          */
-        real rotation;
+        T rotation;
 
         /**
          * Creates a new Kinematic with zeroed data.
          */
-        Kinematic()
-            : Location(), velocity(), rotation(0)
+        BasicKinematic()
+            : BasicLocation<T>(), velocity(), rotation(0)
         {}
 
         /**
@@ -276,8 +316,9 @@ namespace aicore
          * @param position The position in space of the Kinematic.
          * @param velocity The linear velocity of the Kinematic.
          */
-        Kinematic(const Vector3& position, const Vector3& velocity)
-            : Location(position), velocity(velocity), rotation(0)
+        BasicKinematic(const BasicVector3<T>& position,
+                       const BasicVector3<T>& velocity)
+            : BasicLocation<T>(position), velocity(velocity), rotation(0)
         {}
 
         /**
@@ -287,8 +328,9 @@ namespace aicore
          * @param loc The location of the Kinematic.
          * @param velocity The linear velocity of the Kinematic.
          */
-        Kinematic(const Location& loc, const Vector3& velocity)
-            : Location(loc), velocity(velocity), rotation(0)
+        BasicKinematic(const BasicLocation<T>& loc,
+                       const BasicVector3<T>& velocity)
+            : BasicLocation<T>(loc), velocity(velocity), rotation(0)
         {}
 
         /**
@@ -297,8 +339,8 @@ namespace aicore
          *
          * @param loc The location of the Kinematic.
          */
-        Kinematic(const Location& loc)
-            : Location(loc), velocity(), rotation(0)
+        BasicKinematic(const BasicLocation<T>& loc)
+            : BasicLocation<T>(loc), velocity(), rotation(0)
         {}
 
         /**
@@ -310,18 +352,28 @@ namespace aicore
          * @param velocity The linear velocity of the Kinematic.
          * @param avel The angular velocity of the Kinematic.
          */
-        Kinematic(const Vector3& position, real orientation,
-                  const Vector3& velocity, real avel)
-            : Location(position, orientation),
+        BasicKinematic(const BasicVector3<T>& position, T orientation,
+                  const BasicVector3<T>& velocity, T avel)
+            : BasicLocation<T>(position, orientation),
               velocity(velocity), rotation(avel)
         {}
 
+        /**
+         * Creates a kinematic from one of a different precision,
+         * converting each component.
+         */
+        template <typename U>
+        explicit BasicKinematic(const BasicKinematic<U>& other)
+            : BasicLocation<T>(other), velocity(other.velocity),
+              rotation((T)other.rotation)
+        {}
+
         /**
          * Zeros the location and velocity of this Kinematic.
          */
         void clear()
         {
-            Location::clear();
+            BasicLocation<T>::clear();
             velocity.clear();
             rotation = 0.0f;
         }
@@ -331,7 +383,7 @@ namespace aicore
          * Kinematics are equal if their locations, velocities and
          * rotations are equal.
          */
-        bool operator == (const Kinematic& other) const
+        bool operator == (const BasicKinematic& other) const
         {
             return position == other.position &&
                    orientation == other.orientation &&
@@ -344,7 +396,7 @@ namespace aicore
          * Kinematics are unequal if any of their locations,
          * velocities or rotations are unequal.
          */
-        bool operator != (const Kinematic& other) const
+        bool operator != (const BasicKinematic& other) const
         {
             return position != other.position ||
                    orientation != other.orientation ||
@@ -357,7 +409,7 @@ namespace aicore
          * Kinematic is less than another Kinematic if its position
          * along the x-axis is less than that of the other Kinematic.
          */
-        bool operator < (const Kinematic& other) const
+        bool operator < (const BasicKinematic& other) const
         {
             return position.x < other.position.x;
         }
@@ -369,7 +421,7 @@ namespace aicore
          *
          * @param other The Location to set the Kinematic to.
          */
-        Kinematic& operator = (const Location& other)
+        BasicKinematic& operator = (const BasicLocation<T>& other)
         {
             orientation = other.orientation;
             position = other.position;
@@ -382,7 +434,7 @@ namespace aicore
          *
          * @param other Reference to Kinematic to copy.
          */
-        Kinematic& operator = (const Kinematic& other)
+        BasicKinematic& operator = (const BasicKinematic& other)
         {
             orientation = other.orientation;
             position = other.position;
@@ -395,13 +447,13 @@ namespace aicore
          * Modifies the value of this Kinematic by adding the given
          * Kinematic.  Additions are performed by component.
          */
-        void operator += (const Kinematic&);
+        void operator += (const BasicKinematic&);
 
         /**
          * Modifies the value of this Kinematic by subtracting the
          * given Kinematic.  Subtractions are performed by component.
          */
-        void operator -= (const Kinematic&);
+        void operator -= (const BasicKinematic&);
 
         /**
          * Scales the Kinematic by the given value.  All components
@@ -412,7 +464,7 @@ namespace aicore
          *
          * @param f The scaling factor.
          */
-        void operator *= (real f);
+        void operator *= (T f);
 
         /**
          * Performs a forward Euler integration of the Kinematic for
@@ -428,7 +480,7 @@ namespace aicore
          * @param duration The number of simulation seconds to
          * integrate over.
          */
-        void integrate(real duration);
+        void integrate(T duration);
 
         /**
          * Perfoms a forward Euler integration of the Kinematic for
@@ -445,7 +497,7 @@ namespace aicore
          * integration.  @param duration The number of simulation
          * seconds to integrate over.
          */
-        void integrate(const SteeringOutput& steer, real duration);
+        void integrate(const BasicSteeringOutput<T>& steer, T duration);
 
         /**
          * Perfoms a forward Euler integration of the Kinematic for
@@ -468,8 +520,8 @@ namespace aicore
          * @param duration The number of simulation seconds to
          * integrate over.
          */
-        void integrate(const SteeringOutput& steer,
-                       real drag, real duration);
+        void integrate(const BasicSteeringOutput<T>& steer,
+                       T drag, T duration);
 
         /**
          * Perfoms a forward Euler integration of the Kinematic for the given
@@ -492,15 +544,15 @@ namespace aicore
          * @param duration The number of simulation seconds to
          * integrate over.
          */
-        void integrate(const SteeringOutput& steer,
-                       const SteeringOutput& drag,
-                       real duration);
+        void integrate(const BasicSteeringOutput<T>& steer,
+                       const BasicSteeringOutput<T>& drag,
+                       T duration);
 
         /**
          * Trims the speed of the kinematic to be no more than that
          * given.
          */
-        void trimMaxSpeed(real speed);
+        void trimMaxSpeed(T speed);
 
         /**
          * Sets the orientation of this location so it points along
@@ -510,6 +562,30 @@ namespace aicore
     };
 
 
+    /** A steering output of the library's real number type. */
+    typedef BasicSteeringOutput<real> SteeringOutput;
+
+    /** A location of the library's real number type. */
+    typedef BasicLocation<real> Location;
+
+    /** A kinematic of the library's real number type. */
+    typedef BasicKinematic<real> Kinematic;
+
+    /** Single and double precision versions, for mixing precisions. */
+    typedef BasicSteeringOutput<float> SteeringOutputf;
+    typedef BasicSteeringOutput<double> SteeringOutputd;
+    typedef BasicLocation<float> Locationf;
+    typedef BasicLocation<double> Locationd;
+    typedef BasicKinematic<float> Kinematicf;
+    typedef BasicKinematic<double> Kinematicd;
+
+    // The methods that aren't inline are compiled in location.cpp,
+    // for float and double.
+    extern template struct BasicLocation<float>;
+    extern template struct BasicLocation<double>;
+    extern template struct BasicKinematic<float>;
+    extern template struct BasicKinematic<double>;
+
 }; // end of namespace
 
 #endif // AICORE_LOCATION_H
@@ -0,0 +1,227 @@
+/*
+ * Defines the classes used to schedule AI updates by level of detail.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds a scheduler that decides which characters get their AI
+ * updated each frame. Characters near the player need to think every
+ * frame, but those further away can get away with updating every few
+ * frames without anyone noticing. The scheduler sorts characters
+ * into levels of detail by their distance from a viewer, and each
+ * level has an interval: the number of frames between updates.
+ *
+ * Characters in the same level are staggered, so that rather than
+ * all updating on one frame and none on the next, an even share of
+ * them update each frame. Between updates the characters carry on
+ * moving along their current velocity, so their movement stays
+ * smooth.
+ *
+ * A typical frame looks like:
+ *
+ * <pre>
+ * scheduler.assignLevels(player.position, characters);
+ * const std::vector<unsigned> &due = scheduler.schedule();
+ * for (unsigned i = 0; i < due.size(); i++)
+ * {
+ *     // Run steering, state machines and so on for character due[i],
+ *     // writing its steering into steering[due[i]].
+ * }
+ * scheduler.integrate(characters, steering, duration);
+ * </pre>
+ */
+#ifndef AICORE_LOD_H
+#define AICORE_LOD_H
+
+#include <vector>
+
+namespace aicore
+{
+    /**
+     * Assigns characters to levels of detail, and works out which of
+     * them should be updated on each frame.
+     */
+    class UpdateScheduler
+    {
+        /** Holds the extent of one level of detail. */
+        struct Level
+        {
+            /** The square of the furthest distance in the level. */
+            real squareDistance;
+
+            /** The number of frames between updates. */
+            unsigned interval;
+        };
+
+        /** The levels, in order of increasing distance. */
+        std::vector<Level> levels;
+
+        /** The level of each character. */
+        std::vector<unsigned> agentLevels;
+
+        /** The frame each character was last updated on. */
+        std::vector<unsigned> lastUpdates;
+
+        /** The number of frames since each character's last update. */
+        std::vector<unsigned> elapsed;
+
+        /** Whether each character is due on the scheduled frame. */
+        std::vector<bool> due;
+
+        /** The characters due on the scheduled frame. */
+        std::vector<unsigned> dueList;
+
+        /**
+         * Returns the level for a character at the given square
+         * distance from the viewer.
+         */
+        unsigned findLevel(real squareDistance) const;
+
+    public:
+        /** Marks a character that has never been updated. */
+        static const unsigned NEVER = 0xffffffff;
+
+        /**
+         * Creates a scheduler with no levels, which updates every
+         * character every frame.
+         */
+        UpdateScheduler();
+
+        /**
+         * Adds a level of detail. Levels must be added in order of
+         * increasing distance. Characters further away than the last
+         * level's distance are put in the last level.
+         *
+         * @param distance The furthest a character can be from the
+         * viewer to be in this level.
+         *
+         * @param interval The number of frames between updates: 1
+         * updates every frame, 2 every other frame, and so on.
+         *
+         * @return The index of the level.
+         */
+        unsigned addLevel(real distance, unsigned interval);
+
+        /** Returns the number of levels of detail. */
+        unsigned getLevelCount() const { return (unsigned)levels.size(); }
+
+        /** Returns the number of frames between updates for the level. */
+        unsigned getInterval(unsigned level) const
+        {
+            return levels.empty() ? 1 : levels[level].interval;
+        }
+
+        /**
+         * Sets the number of characters. New characters are put in
+         * the first level. Like every other character, they are first
+         * updated on their own frame, so adding many characters at
+         * once doesn't put them all on the same frame.
+         */
+        void resize(unsigned count);
+
+        /** Returns the number of characters. */
+        unsigned getAgentCount() const
+        {
+            return (unsigned)agentLevels.size();
+        }
+
+        /** Puts a character in the given level. */
+        void setLevel(unsigned agent, unsigned level)
+        {
+            agentLevels[agent] = level;
+        }
+
+        /** Returns the level a character is in. */
+        unsigned getLevel(unsigned agent) const { return agentLevels[agent]; }
+
+        /**
+         * Puts each character in a level by its distance from the
+         * given viewer.
+         *
+         * @param agents An array of getAgentCount() characters.
+         */
+        void assignLevels(const Vector3 &viewer, const Kinematic *agents);
+
+        /**
+         * Puts each character in a level by its distance from the
+         * given viewer. The batch must have getAgentCount()
+         * characters.
+         */
+        void assignLevels(const Vector3 &viewer, const KinematicBatch &agents);
+
+        /**
+         * Checks if a character in its current level would be updated
+         * on the given frame. Each character is offset by its index,
+         * so consecutive characters in a level update on consecutive
+         * frames.
+         */
+        bool isDue(unsigned agent, unsigned frame) const
+        {
+            unsigned interval = getInterval(agentLevels[agent]);
+            return (frame + agent) % interval == 0;
+        }
+
+        /**
+         * Works out which characters are due on the given frame, and
+         * records that they have been updated.
+         *
+         * @return The indices of the due characters, in order. This
+         * is valid until the next call.
+         */
+        const std::vector<unsigned>& schedule(unsigned frame);
+
+        /**
+         * Works out which characters are due on the current frame,
+         * from TimingData::frameNumber. The timing data must have been
+         * initialised.
+         */
+        const std::vector<unsigned>& schedule();
+
+        /** Checks if the character was due on the last frame scheduled. */
+        bool wasScheduled(unsigned agent) const { return due[agent]; }
+
+        /**
+         * Returns the number of frames between the character's last
+         * two updates, which can be used to scale the time its AI
+         * works with. A character updated for the first time, or not
+         * yet updated, gives the interval of its level.
+         */
+        unsigned getElapsedFrames(unsigned agent) const
+        {
+            return elapsed[agent];
+        }
+
+        /**
+         * Moves every character on by the given duration. Characters
+         * that were due on the last frame scheduled are integrated
+         * with their steering. The others carry on at their current
+         * velocity and rotation, so they glide along until their next
+         * update rather than keep accelerating on an old decision.
+         *
+         * @param agents An array of getAgentCount() characters.
+         *
+         * @param steering An array holding the steering for each
+         * character. Only the entries of due characters are used.
+         */
+        void integrate(Kinematic *agents, const SteeringOutput *steering,
+                       real duration) const;
+
+        /**
+         * Returns the average number of characters that will be
+         * updated each frame with their current levels.
+         */
+        real getExpectedLoad() const;
+    };
+
+}; // end of namespace
+
+#endif // AICORE_LOD_H
@@ -15,10 +15,18 @@
  *
  * Holds a state machine implementation that updates a series of priority
  * or numerical values based on a Markov process.
+ *
+ * A character that has been asleep for many frames (see lod.h) can be
+ * brought up to date with MarkovStateMachine::skipFrames, which
+ * applies all the default transitions it missed at once, using
+ * MarkovPowers to raise the default transition's matrix to the right
+ * power.
  */
 #ifndef AICORE_MARKOVSM_H
 #define AICORE_MARKOVSM_H
 
+#include <vector>
+
 namespace aicore
 {
     /**
@@ -37,9 +45,190 @@ namespace aicore
          * @return The matrix as a linear array in row-major order
          * (i.e. its number of elements is the square of the size of
          * the state vector). The matrix will be pre-multiplied with
-         * the state vector.
+         * the state vector. Transitions that don't store a dense
+         * matrix may return null, as long as they override
+         * applyTransition.
          */
         virtual real* getMatrix()=0;
+
+        /**
+         * Applies the transition to the given state vector, writing
+         * the new state vector into the result. The default
+         * implementation multiplies by the matrix from getMatrix.
+         *
+         * @param stateVector The current state vector.
+         *
+         * @param result The array to hold the new state vector. This
+         * never overlaps the current state vector.
+         *
+         * @param size The number of values in the state vector.
+         */
+        virtual void applyTransition(const real *stateVector,
+                                     real *result, unsigned size);
+
+        /**
+         * Applies the transition the given number of times to the
+         * state vector, writing the final state vector into the
+         * result. The default implementation calls applyTransition
+         * once for each time.
+         *
+         * @param stateVector The current state vector.
+         *
+         * @param result The array to hold the new state vector. This
+         * never overlaps the current state vector.
+         *
+         * @param size The number of values in the state vector.
+         *
+         * @param times The number of times to apply the transition.
+         * If this is zero the state vector is copied unchanged.
+         */
+        virtual void applyTransitionRepeatedly(const real *stateVector,
+                                               real *result, unsigned size,
+                                               unsigned times);
+    };
+
+    /**
+     * Holds the powers of a markov matrix, so the matrix can be
+     * applied many times in one go. The matrix is squared again and
+     * again, giving its power for each power of two, and applying it
+     * k times multiplies the state vector by the power for each bit
+     * set in k. So k steps take about log k matrix-vector products
+     * rather than k.
+     *
+     * For most transitions the powers settle down to a fixed matrix,
+     * whose columns are all the steady state distribution: where the
+     * state vector ends up after enough steps, whatever it started
+     * as. Once this is reached no more powers are needed, and
+     * applying the matrix any greater number of times needs only one
+     * product.
+     *
+     * Because the products are done in a different order, the results
+     * are only as close to applying the matrix step by step as the
+     * precision of real numbers allows.
+     *
+     * All the powers are worked out when the matrix is set, which
+     * takes up to MAX_POWERS matrix products. After that the object
+     * is only read, so it can be used from any number of threads at
+     * once, as long as none of them sets the matrix.
+     */
+    class MarkovPowers
+    {
+        /** The matrix being raised to powers. */
+        const real *matrix;
+
+        /** The number of rows and columns in the matrix. */
+        unsigned size;
+
+        /** The tolerance used to find the steady state. */
+        real tolerance;
+
+        /**
+         * Holds the powers. The first is a copy of the matrix, and
+         * each after it is the square of the one before, up to
+         * MAX_POWERS or the steady state, whichever comes first.
+         */
+        std::vector< std::vector<real> > powers;
+
+        /**
+         * The index in powers of the steady state, or NONE if there
+         * isn't one.
+         */
+        unsigned steady;
+
+        /** Works out the next power, squaring the last one. */
+        void square();
+
+        /**
+         * Returns the largest change in any entry of the given power
+         * when the matrix is applied once more.
+         */
+        real getStepChange(const real *power) const;
+
+        /** Works out all the powers of the current matrix. */
+        void compute();
+
+    public:
+        /** The value of steady when there is no steady state. */
+        static const unsigned NONE = 0xffffffff;
+
+        /**
+         * The largest number of powers that are worked out: enough to
+         * apply the matrix any number of times that fits in an
+         * unsigned.
+         */
+        enum { MAX_POWERS = 32 };
+
+        /** Creates an object with no matrix. */
+        MarkovPowers();
+
+        /**
+         * Sets the matrix to raise to powers, and works out all its
+         * powers. The matrix must stay valid, and update must be
+         * called if its values change.
+         *
+         * @param matrix The matrix in row-major order, to be
+         * pre-multiplied with the state vector, as in
+         * MarkovTransition::getMatrix.
+         *
+         * @param size The number of values in the state vector.
+         *
+         * @param tolerance The largest change in any entry of the
+         * matrix, between one power and its square, for the powers
+         * to count as having reached the steady state.
+         */
+        void setMatrix(const real *matrix, unsigned size,
+                       real tolerance = (real)1e-5);
+
+        /**
+         * Works out the powers again, after the values in the matrix
+         * have been changed in place.
+         */
+        void update();
+
+        /** Returns the matrix being raised to powers. */
+        const real* getMatrix() const { return matrix; }
+
+        /** Returns the number of values in the state vector. */
+        unsigned getSize() const { return size; }
+
+        /**
+         * Returns the matrix raised to the power two to the power of
+         * the given index. Past the steady state, this is the steady
+         * state.
+         */
+        const real* getPower(unsigned index) const;
+
+        /**
+         * Applies the matrix the given number of times to the state
+         * vector, writing the final state vector into the result,
+         * which mustn't overlap it.
+         */
+        void apply(const real *stateVector, real *result,
+                   unsigned times) const;
+
+        /** Returns true if the powers reach a steady state. */
+        bool hasSteadyState() const { return steady != NONE; }
+
+        /**
+         * Returns the number of times the matrix must be applied to
+         * reach its steady state, or zero if there isn't one (as
+         * happens when the transition cycles around its states).
+         */
+        unsigned getSteadyStateTimes() const
+        {
+            return steady == NONE ? 0 : 1u << steady;
+        }
+
+        /**
+         * Works out where the given state vector ends up after enough
+         * steps, writing it into the result, which mustn't overlap
+         * it. For a state vector that adds up to one, this is the
+         * steady state distribution.
+         *
+         * @return False if there is no steady state, in which case
+         * the result isn't changed.
+         */
+        bool applySteadyState(const real *stateVector, real *result) const;
     };
 
     /**
@@ -49,10 +238,24 @@ namespace aicore
     {
     public:
         /**
-         * The matrix associated with this transition.
+         * The matrix associated with this transition. Set it with
+         * setMatrix, so its powers are worked out too. If it is set
+         * directly the transition still works, but is applied many
+         * times one step at a time.
          */
         real* matrix;
 
+        /**
+         * Holds the powers of the matrix, used to apply the
+         * transition many times. These are worked out by setMatrix,
+         * and only read when the transition is applied, so machines
+         * that share the transition can be updated in parallel.
+         */
+        MarkovPowers powers;
+
+        /** Creates a transition with no matrix. */
+        FixedMarkovTransition();
+
         /**
          * Returns the matrix defined in this instance.
          *
@@ -62,6 +265,73 @@ namespace aicore
          * the state vector.
          */
         virtual real* getMatrix();
+
+        /**
+         * Sets the matrix, and works out its powers for state
+         * vectors of the given size.
+         */
+        void setMatrix(real *matrix, unsigned size);
+
+        /**
+         * Works out the powers again. This must be called after the
+         * values in the matrix are changed in place, and not while
+         * the transition is being applied.
+         */
+        void invalidate();
+
+        /**
+         * Applies the matrix the given number of times using its
+         * powers. If the powers aren't for this matrix and size
+         * (because the matrix was set directly), the matrix is
+         * applied one step at a time instead.
+         */
+        virtual void applyTransitionRepeatedly(const real *stateVector,
+                                               real *result, unsigned size,
+                                               unsigned times);
+    };
+
+    /**
+     * A markov transition whose matrix is stored in compressed sparse
+     * row form. Only the non-zero entries are kept, so applying the
+     * transition takes time proportional to the number of non-zero
+     * entries, rather than the square of the state vector size. This
+     * is much faster for large state vectors where each state can
+     * only move to a few others.
+     */
+    class SparseMarkovTransition : public MarkovTransition
+    {
+    public:
+        /**
+         * Holds the index in the columns and values arrays of the
+         * first entry of each row, followed by the total number of
+         * entries. So the entries of row r are at indices
+         * rowStart[r] up to rowStart[r+1].
+         */
+        std::vector<unsigned> rowStart;
+
+        /** Holds the column of each entry. */
+        std::vector<unsigned> columns;
+
+        /** Holds the value of each entry. */
+        std::vector<real> values;
+
+        /**
+         * Sets the matrix from a dense row-major matrix with the
+         * given number of rows and columns, keeping only the entries
+         * whose size is greater than the given threshold.
+         */
+        void setMatrix(const real *matrix, unsigned size,
+                       real threshold = 0);
+
+        /** Returns the number of non-zero entries. */
+        unsigned getEntryCount() const { return (unsigned)values.size(); }
+
+        /** There is no dense matrix, so this returns null. */
+        virtual real* getMatrix();
+
+        /** Multiplies the state vector by the sparse matrix. */
+        virtual void applyTransition(const real *stateVector,
+                                     real *result, unsigned size);
     };
 
     /**
@@ -71,12 +341,33 @@ namespace aicore
      */
     class MarkovStateMachine
     {
+        /**
+         * Holds the new state vector while it is being calculated,
+         * so updates don't have to allocate memory.
+         */
+        std::vector<real> scratch;
+
         /**
          * This helper function does the state vector update.
          */
-        void updateStateVector(real * matrix);
+        void updateStateVector(MarkovTransition * transition);
+
+    protected:
+        /**
+         * Returns true if the transitions need to be checked in this
+         * update. The default implementation always returns true.
+         */
+        virtual bool shouldCheckTransitions() { return true; }
 
     public:
+        /**
+         * Creates a state machine with no state vector or
+         * transitions.
+         */
+        MarkovStateMachine();
+
+        virtual ~MarkovStateMachine() {}
+
         /**
          * Holds the values in the state vector. Note that there is no
          * separate set of initial values. Unlike a regular state
@@ -119,6 +410,152 @@ namespace aicore
          * transitions, applies them and returns a list of actions.
          */
         virtual Action * update();
+
+        /**
+         * Finds the transition to fire this frame, if any, counting
+         * the frame towards the default transition. This is the first
+         * half of update, and is used by MarkovBatch, which applies
+         * the transitions of many machines together.
+         */
+        MarkovTransition * findTransition();
+
+        /**
+         * Finishes firing the given transition, after the state
+         * vector has been updated, and returns its actions. This is
+         * the second half of update.
+         */
+        Action * finishTransition(MarkovTransition * transition);
+
+        /**
+         * Applies the given transition to the state vector the given
+         * number of times, without changing the frame count or
+         * running any actions.
+         */
+        void applyTransition(MarkovTransition * transition, unsigned times);
+
+        /**
+         * Brings the machine up to date after the given number of
+         * frames without updates, such as when a character wakes
+         * from sleeping at a low level of detail. This gives the
+         * same state as calling update once for each frame, if none
+         * of the other transitions would have been triggered: the
+         * default transition is applied as many times as it would
+         * have fired, all at once.
+         *
+         * @return The number of times the default transition would
+         * have fired. Its actions aren't returned, as the frames
+         * they would have been run in have gone.
+         */
+        unsigned skipFrames(unsigned frames);
+
+        /** Writes the state vector and the frames passed. */
+        void writeSnapshot(SnapshotWriter &writer) const;
+
+        /**
+         * Reads the state vector and frames passed. The state vector
+         * must already be set up with the same size as the one
+         * written.
+         *
+         * @return False if the reader has failed, or the sizes don't
+         * match, in which case the machine is unchanged.
+         */
+        bool readSnapshot(SnapshotReader &reader);
+    };
+
+    /**
+     * A markov state machine that only checks its transitions when
+     * something they depend on has changed, in the same way as
+     * EventStateMachine. Frames still count towards the default
+     * transition while nothing changes.
+     */
+    class EventMarkovStateMachine : public MarkovStateMachine
+    {
+        /** Keeps track of changes to the transitions. */
+        TransitionWatcher watcher;
+
+    protected:
+        /** Checks if anything has changed since the last check. */
+        virtual bool shouldCheckTransitions();
+
+    public:
+        /**
+         * Returns true if the next update will need to check the
+         * transitions.
+         */
+        bool isDirty();
+    };
+
+    /**
+     * Updates many markov state machines at once.
+     *
+     * When lots of characters use the same transitions, updating
+     * each machine on its own does one small matrix-vector product
+     * after another. The batch instead gathers together the state
+     * vectors of all the machines firing the same transition, and
+     * multiplies them all by its matrix in one go (see
+     * multiplyMatrixVectors), which makes much better use of the
+     * cache and the processor's vector units.
+     *
+     * The result is the same as calling update on each machine in
+     * turn, except that the transitions are checked for every
+     * machine before any state vectors change, and the actions are
+     * collected in order once all the vectors have been updated.
+     * Transitions without a dense matrix are applied one machine at
+     * a time.
+     *
+     * The batch keeps its working memory between updates, so once it
+     * has grown to fit it doesn't allocate.
+     */
+    class MarkovBatch
+    {
+        /** Holds the transition chosen by each machine. */
+        std::vector<MarkovTransition*> chosen;
+
+        /** Holds the index in transitions of each machine's choice. */
+        std::vector<unsigned> groupOf;
+
+        /** Holds the different transitions being fired. */
+        std::vector<MarkovTransition*> transitions;
+
+        /**
+         * Holds the index in order of the first machine firing each
+         * transition, followed by the total.
+         */
+        std::vector<unsigned> starts;
+
+        /** Holds where the next machine in each group goes. */
+        std::vector<unsigned> next;
+
+        /** Holds the firing machines, grouped by transition. */
+        std::vector<unsigned> order;
+
+        /** Holds the state vectors gathered for one transition. */
+        std::vector<real> gathered;
+
+        /** Holds the results for one transition. */
+        std::vector<real> results;
+
+        /** Applies one transition to the given group of machines. */
+        void applyGroup(MarkovStateMachine ** machines,
+                        MarkovTransition * transition,
+                        const unsigned * group, unsigned count);
+
+    public:
+        /**
+         * Updates each of the given machines.
+         *
+         * @param machines The machines to update.
+         *
+         * @param count The number of machines.
+         *
+         * @param actions If this isn't null, it should be an array of
+         * count pointers, which will be set to the actions returned
+         * by each machine (or null if it didn't fire a transition).
+         *
+         * @return The number of machines that fired a transition.
+         */
+        unsigned update(MarkovStateMachine ** machines, unsigned count,
+                        Action ** actions = NULL);
     };
 
 
@@ -0,0 +1,228 @@
+/*
+ * Defines the classes used to count what the AI is doing.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds a registry of named counters and histograms, cheap enough to
+ * leave running in a shipped game. Where the profiler (profiler.h)
+ * measures how long things take, metrics count how often they
+ * happen: how many transitions a state machine fires, how many
+ * constraint steps a steering pipe needs, how deep the action queues
+ * get.
+ *
+ * <pre>
+ * AICORE_METRIC_COUNT("Doors opened", 1);
+ * AICORE_METRIC_RECORD("Path length", path.size());
+ * </pre>
+ *
+ * Each thread adds to its own copy of every counter, so counting
+ * takes no lock and no locked instruction: the owning thread is the
+ * only one that writes to its copy. Metrics::getCounter adds up the
+ * copies from every thread on demand, and can be called at any time
+ * from any thread. A rate, such as updates per second, is found by
+ * reading a counter twice and dividing the change by the time
+ * between.
+ *
+ * Histograms group the values recorded into buckets by powers of
+ * two, so recording a value is as cheap as counting, and the
+ * percentiles they give are only accurate to within a factor of two.
+ *
+ * The library counts the following, unless it is built with
+ * AICORE_NO_METRICS defined (see the AICORE_METRICS option in the
+ * CMake build):
+ *
+ * - "StateMachine transitions": transitions fired by StateMachine.
+ * - "RuleBasedSystem matches": rules found to match in each pass.
+ * - "RuleBasedSystem fired": rules fired.
+ * - "ReteNetwork changes": rules whose match changed in an update.
+ * - "DatabaseStream changes": changes applied to a database.
+ * - "SteeringPipe steps" (histogram): constraint steps used by each
+ *   character.
+ * - "SteeringPipe fallbacks": characters that ran out of steps and
+ *   used the fallback behaviour.
+ * - "ActionManager queue" (histogram): the length of the queue each
+ *   time a manager is executed.
+ * - "ActionManager interrupts": queued actions that interrupted the
+ *   active ones.
+ * - "QLearner updates": learning iterations run.
+ */
+#ifndef AICORE_METRICS_H
+#define AICORE_METRICS_H
+
+#include <stdio.h>
+
+namespace aicore
+{
+    /**
+     * Holds the counters and histograms. All the methods are static,
+     * as there is one registry for the whole program.
+     */
+    class Metrics
+    {
+    public:
+        /**
+         * Returned when there is no room to register any more, and
+         * ignored when counting.
+         */
+        static const unsigned NONE = 0xffffffff;
+
+        /** The most counters that can be registered. */
+        static const unsigned MAX_COUNTERS = 256;
+
+        /** The most histograms that can be registered. */
+        static const unsigned MAX_HISTOGRAMS = 32;
+
+        /**
+         * The number of buckets in a histogram. The first holds
+         * zeros, and bucket b after it holds values from 2 to the
+         * power b-1 up to (but not including) 2 to the power b.
+         */
+        static const unsigned BUCKETS = 33;
+
+        /** Holds the totals for one histogram, from every thread. */
+        struct HistogramStats
+        {
+            /** The name of the histogram. */
+            const char *name;
+
+            /** The number of values recorded. */
+            unsigned long long count;
+
+            /** The total of the values recorded. */
+            unsigned long long sum;
+
+            /** The number of values recorded in each bucket. */
+            unsigned long long buckets[BUCKETS];
+
+            /** Returns the mean of the values, or zero if there are none. */
+            double getMean() const;
+
+            /**
+             * Returns a value that the given fraction of the values
+             * (0.99 for the 99th percentile) are below. This is the
+             * top of the bucket the percentile falls in.
+             */
+            unsigned long long getPercentile(double fraction) const;
+        };
+
+        /**
+         * Returns the index for the counter with the given name,
+         * adding it if it hasn't been seen before, or NONE if there
+         * is no room. The name must stay valid as long as the
+         * registry is used (normally it is a string literal). This
+         * takes a lock, so its result should be kept:
+         * AICORE_METRIC_COUNT does this in a static variable.
+         */
+        static unsigned registerCounter(const char *name);
+
+        /**
+         * Returns the index for the histogram with the given name, in
+         * the same way as registerCounter.
+         */
+        static unsigned registerHistogram(const char *name);
+
+        /** Returns the number of counters that have been registered. */
+        static unsigned getCounterCount();
+
+        /** Returns the number of histograms that have been registered. */
+        static unsigned getHistogramCount();
+
+        /** Returns the name of the given counter. */
+        static const char* getCounterName(unsigned counter);
+
+        /** Adds to the given counter, for the calling thread. */
+        static void add(unsigned counter, unsigned long long amount = 1);
+
+        /**
+         * Records a value in the given histogram, for the calling
+         * thread, the given number of times.
+         */
+        static void record(unsigned histogram, unsigned value,
+                           unsigned long long times = 1);
+
+        /**
+         * Returns the total of the given counter over every thread,
+         * since the last reset.
+         */
+        static unsigned long long getCounter(unsigned counter);
+
+        /** Returns the totals of the given histogram since the last reset. */
+        static HistogramStats getHistogram(unsigned histogram);
+
+        /**
+         * Sets every counter and histogram back to zero. Counting
+         * can carry on in other threads while this happens.
+         */
+        static void reset();
+
+        /**
+         * Writes a table of the counters, and the count, mean and
+         * percentiles of each histogram, to the given file.
+         */
+        static void report(FILE *file = stdout);
+
+    private:
+        // There is only one registry, use the static methods.
+        Metrics();
+    };
+
+}; // end of namespace
+
+#define AICORE_METRIC_JOIN2(a, b) a##b
+#define AICORE_METRIC_JOIN(a, b) AICORE_METRIC_JOIN2(a, b)
+
+/**
+ * Adds the given amount to the counter with the given name. This
+ * always counts, and is intended for game code.
+ */
+#define AICORE_METRIC_COUNT(name, amount) \
+    do { \
+        static const unsigned AICORE_METRIC_JOIN(aicoreCounter, __LINE__) = \
+            ::aicore::Metrics::registerCounter(name); \
+        ::aicore::Metrics::add( \
+            AICORE_METRIC_JOIN(aicoreCounter, __LINE__), (amount)); \
+    } while (0)
+
+/**
+ * Records the given value, the given number of times, in the
+ * histogram with the given name.
+ */
+#define AICORE_METRIC_RECORD_TIMES(name, value, times) \
+    do { \
+        static const unsigned AICORE_METRIC_JOIN(aicoreHistogram, __LINE__) = \
+            ::aicore::Metrics::registerHistogram(name); \
+        ::aicore::Metrics::record( \
+            AICORE_METRIC_JOIN(aicoreHistogram, __LINE__), \
+            (value), (times)); \
+    } while (0)
+
+/** Records the given value in the histogram with the given name. */
+#define AICORE_METRIC_RECORD(name, value) \
+    AICORE_METRIC_RECORD_TIMES(name, value, 1)
+
+/**
+ * Counts and records in the library itself, unless AICORE_NO_METRICS
+ * is defined.
+ */
+#ifndef AICORE_NO_METRICS
+#define AICORE_LIBRARY_COUNT(name, amount) AICORE_METRIC_COUNT(name, amount)
+#define AICORE_LIBRARY_RECORD(name, value) AICORE_METRIC_RECORD(name, value)
+#define AICORE_LIBRARY_RECORD_TIMES(name, value, times) \
+    AICORE_METRIC_RECORD_TIMES(name, value, times)
+#else
+#define AICORE_LIBRARY_COUNT(name, amount) do {} while (0)
+#define AICORE_LIBRARY_RECORD(name, value) do {} while (0)
+#define AICORE_LIBRARY_RECORD_TIMES(name, value, times) do {} while (0)
+#endif
+
+#endif // AICORE_METRICS_H
@@ -24,26 +24,46 @@
  *
  * <code>#define DOUBLE_PRECISION</code>
  *
+ * (or define DOUBLE_PRECISION on the compiler's command line).
+ *
  * If you want to do something more exotic, like using 20bit extended
  * doubles, or fixed point arithmetic, then you'll need to change most
  * of the definitions.
+ *
+ * The core mathematical types (see aimath.h and location.h) are also
+ * available as templates over their scalar type, so code can work at
+ * both precisions in the same program. Templates use the Precision
+ * class below in place of the real_ functions.
  */
 #ifndef AICORE_PRECISION_H
 #define AICORE_PRECISION_H
 
 // Change this to DOUBLE_PRECISION if you want.
+#if !defined(DOUBLE_PRECISION) && !defined(SINGLE_PRECISION)
 #define SINGLE_PRECISION
+#endif
+
+// Uncomment this (or define it on the compiler's command line) to use
+// SSE or NEON instructions for the vector helpers in simd.h. It only
+// has an effect at single precision.
+// #define AICORE_USE_SIMD
 
 
 
 // Import the mathematical functions for both precisions
 #include <math.h>
 
-// Work out which limits we need
-#if defined(SINGLE_PRECISION)
-    #include <float.h>
-#elif defined(DOUBLE_PRECISION)
-    #include <limits.h>
+// Import the limits for both precisions
+#include <float.h>
+
+// Work out which vector instructions we can use
+#if defined(AICORE_USE_SIMD) && defined(SINGLE_PRECISION)
+    #if defined(__SSE__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+        #define AICORE_SIMD_SSE
+    #elif defined(__ARM_NEON) && defined(__aarch64__)
+        #define AICORE_SIMD_NEON
+    #endif
 #endif
 
 #undef M_PI
@@ -121,13 +141,94 @@ namespace aicore
     #define real_pow pow
 
     /** Defines the precision of the two-part arctan operation. */
-    #define real_atan2 atan2f
+    #define real_atan2 atan2
 
     /** Defines the precision of the float modulo division operation. */
-    #define real_mode_real fmodf
+    #define real_mod_real fmod
 
 #endif
 
+    /**
+     * Gives the mathematical functions for a scalar type, for code
+     * that is a template over the type. This is specialised for float
+     * and double.
+     */
+    template <typename T> struct Precision;
+
+    /** Gives the single precision mathematical functions. */
+    template <> struct Precision<float>
+    {
+        /** Returns the highest value of the type. */
+        static float max() { return FLT_MAX; }
+
+        /** Returns the square root of the value. */
+        static float sqrt(float value) { return sqrtf(value); }
+
+        /** Returns the absolute value. */
+        static float abs(float value) { return fabsf(value); }
+
+        /** Returns the sine of the angle. */
+        static float sin(float value) { return sinf(value); }
+
+        /** Returns the cosine of the angle. */
+        static float cos(float value) { return cosf(value); }
+
+        /** Returns e raised to the value. */
+        static float exp(float value) { return expf(value); }
+
+        /** Returns the value raised to the given power. */
+        static float pow(float value, float power)
+        {
+            return powf(value, power);
+        }
+
+        /** Returns the angle of the vector (x, y). */
+        static float atan2(float y, float x) { return atan2f(y, x); }
+
+        /** Returns the remainder of dividing the value by the divisor. */
+        static float mod(float value, float divisor)
+        {
+            return fmodf(value, divisor);
+        }
+    };
+
+    /** Gives the double precision mathematical functions. */
+    template <> struct Precision<double>
+    {
+        /** Returns the highest value of the type. */
+        static double max() { return DBL_MAX; }
+
+        /** Returns the square root of the value. */
+        static double sqrt(double value) { return ::sqrt(value); }
+
+        /** Returns the absolute value. */
+        static double abs(double value) { return fabs(value); }
+
+        /** Returns the sine of the angle. */
+        static double sin(double value) { return ::sin(value); }
+
+        /** Returns the cosine of the angle. */
+        static double cos(double value) { return ::cos(value); }
+
+        /** Returns e raised to the value. */
+        static double exp(double value) { return ::exp(value); }
+
+        /** Returns the value raised to the given power. */
+        static double pow(double value, double power)
+        {
+            return ::pow(value, power);
+        }
+
+        /** Returns the angle of the vector (x, y). */
+        static double atan2(double y, double x) { return ::atan2(y, x); }
+
+        /** Returns the remainder of dividing the value by the divisor. */
+        static double mod(double value, double divisor)
+        {
+            return fmod(value, divisor);
+        }
+    };
+
     /**
      * @name Mathematical Constants
      *
@@ -0,0 +1,262 @@
+/*
+ * Defines the classes used to profile the AI each frame.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds a lightweight scoped profiler, for finding out how much of
+ * each frame goes on steering, pipes, state machines, rules and so
+ * on.
+ *
+ * Code to be measured is marked with a named zone, which lasts until
+ * the end of the enclosing block:
+ *
+ * <pre>
+ * void update()
+ * {
+ *     AICORE_PROFILE_ZONE("update");
+ *     ...
+ * }
+ * </pre>
+ *
+ * Zones can be nested, and can be used from any thread. Each thread
+ * records the zones it finishes into its own ring buffer, stamped
+ * with TimingData::getClock(), without taking a lock. Once a frame,
+ * Profiler::endFrame collects the records from every thread and adds
+ * up the time spent in each zone. The minimum, average, maximum and
+ * 99th percentile of the per-frame time are kept over a window of
+ * recent frames.
+ *
+ * For seeing stalls across threads, ProfileTrace streams every zone
+ * and frame to a file in the Chrome trace format, which can be loaded
+ * into chrome://tracing or Perfetto.
+ *
+ * The library's own zones are only compiled in when AICORE_PROFILE is
+ * defined (see the AICORE_PROFILE option in the CMake build), so
+ * there is no cost when profiling isn't wanted. The classes
+ * themselves are always available.
+ */
+#ifndef AICORE_PROFILER_H
+#define AICORE_PROFILER_H
+
+#include <stdio.h>
+
+namespace aicore
+{
+    /**
+     * Collects the times recorded by ProfileScope objects. All the
+     * methods are static, as there is one set of zones for the whole
+     * program.
+     */
+    class Profiler
+    {
+    public:
+        /** Marks a missing zone, such as the parent of a top zone. */
+        static const unsigned NONE = 0xffffffff;
+
+        /** The number of frames the statistics are taken over. */
+        static const unsigned HISTORY = 128;
+
+        /**
+         * The number of records each thread can hold between calls
+         * to endFrame. Further records in the same frame are dropped.
+         */
+        static const unsigned BUFFER_SIZE = 16384;
+
+        /**
+         * Holds the statistics for one zone. Times are in clock ticks
+         * (see TimingData::getClock) and include the time spent in
+         * nested zones. Only frames in which the zone was entered are
+         * counted.
+         */
+        struct ZoneStats
+        {
+            /** The name of the zone. */
+            const char *name;
+
+            /**
+             * The zone this was last entered from, or NONE if it was
+             * entered outside any other zone.
+             */
+            unsigned parent;
+
+            /** The number of frames the statistics cover. */
+            unsigned frames;
+
+            /** The average number of times the zone was entered. */
+            double callsPerFrame;
+
+            /** The least time spent in the zone in a frame. */
+            double minimum;
+
+            /** The mean time spent in the zone per frame. */
+            double average;
+
+            /** The most time spent in the zone in a frame. */
+            double maximum;
+
+            /**
+             * The time per frame that 99% of frames were at or
+             * below.
+             */
+            double p99;
+        };
+
+        /**
+         * Returns the index for the zone with the given name, adding
+         * it if it hasn't been seen before. The name must stay valid
+         * as long as the profiler is used (normally it is a string
+         * literal). This takes a lock, so its result should be kept:
+         * AICORE_PROFILE_ZONE does this in a static variable.
+         */
+        static unsigned registerZone(const char *name);
+
+        /** Returns the number of zones that have been registered. */
+        static unsigned getZoneCount();
+
+        /**
+         * Collects the records made by every thread since the last
+         * call, and adds this frame's totals to the statistics.
+         * Should be called once per frame, from one thread.
+         */
+        static void endFrame();
+
+        /** Returns the statistics for the given zone. */
+        static ZoneStats getStats(unsigned zone);
+
+        /**
+         * Returns the number of records that were dropped because a
+         * thread's buffer was full.
+         */
+        static unsigned long getDroppedCount();
+
+        /**
+         * Throws away the statistics and any records waiting to be
+         * collected. Zones stay registered.
+         */
+        static void reset();
+
+        /**
+         * Writes a table of the statistics to the given file, in
+         * microseconds, with nested zones indented below the zone
+         * they were entered from.
+         */
+        static void report(FILE *file = stdout);
+
+    private:
+        // There is only one profiler, use the static methods.
+        Profiler();
+    };
+
+    /**
+     * Writes the zones collected by Profiler::endFrame to a file in
+     * the Chrome trace event format, as they happen. Each frame
+     * appears as a "frame" event numbered with TimingData::frameNumber
+     * (once the timing data is initialised), and each zone as an event
+     * on the thread that ran it. Threads are numbered by the profiler
+     * buffer they use, so a thread that starts after another has
+     * finished may share its number.
+     *
+     * The file is written by a background thread. endFrame only
+     * copies the events into a queue, which holds at most a given
+     * number of events: if the writer falls behind, further events
+     * are dropped. When no trace is running, endFrame does no extra
+     * work.
+     */
+    class ProfileTrace
+    {
+    public:
+        /**
+         * Starts writing a trace to the given file, stopping any trace
+         * already running.
+         *
+         * @param maxEvents The most events to queue for writing.
+         *
+         * @return False if the file couldn't be opened.
+         */
+        static bool start(const char *filename, unsigned maxEvents = 1<<20);
+
+        /**
+         * Writes any queued events, finishes the file and closes it.
+         * Does nothing if no trace is running.
+         */
+        static void stop();
+
+        /** Checks if a trace is being written. */
+        static bool isActive();
+
+        /**
+         * Returns the number of events dropped from the current or
+         * last trace because the queue was full.
+         */
+        static unsigned long getDroppedCount();
+
+    private:
+        // There is only one trace, use the static methods.
+        ProfileTrace();
+    };
+
+    /**
+     * Times a zone from when it is created to when it is destroyed.
+     * Create one on the stack at the start of the block to measure,
+     * normally with AICORE_PROFILE_ZONE.
+     */
+    class ProfileScope
+    {
+        /** The zone being timed. */
+        unsigned zone;
+
+        /** The zone that was being timed when this one started. */
+        unsigned parent;
+
+        /** The clock when the zone started. */
+        unsigned long start;
+
+    public:
+        /** Starts timing the zone with the given index. */
+        ProfileScope(unsigned zone);
+
+        /** Stops timing and records the result. */
+        ~ProfileScope();
+
+    private:
+        // A scope marks a block of code, so can't be copied.
+        ProfileScope(const ProfileScope &);
+        ProfileScope& operator=(const ProfileScope &);
+    };
+
+}; // end of namespace
+
+#define AICORE_PROFILE_JOIN2(a, b) a##b
+#define AICORE_PROFILE_JOIN(a, b) AICORE_PROFILE_JOIN2(a, b)
+
+/**
+ * Times the rest of the enclosing block as the zone with the given
+ * name. This always profiles, and is intended for game code.
+ */
+#define AICORE_PROFILE_ZONE(name) \
+    static const unsigned AICORE_PROFILE_JOIN(aicoreZone, __LINE__) = \
+        ::aicore::Profiler::registerZone(name); \
+    ::aicore::ProfileScope AICORE_PROFILE_JOIN(aicoreScope, __LINE__)( \
+        AICORE_PROFILE_JOIN(aicoreZone, __LINE__))
+
+/**
+ * Marks a zone in the library itself, which is only timed when
+ * AICORE_PROFILE is defined.
+ */
+#ifdef AICORE_PROFILE
+#define AICORE_PROFILE_LIBRARY_ZONE(name) AICORE_PROFILE_ZONE(name)
+#else
+#define AICORE_PROFILE_LIBRARY_ZONE(name)
+#endif
+
+#endif // AICORE_PROFILER_H
@@ -15,10 +15,35 @@
  *
  * Holds an implementation of a q-learning algorithm. It uses the
  * learning problem representation from the learning.h file.
+ *
+ * The ParallelQLearner runs several exploration walks at once on
+ * different threads, all updating the same table of q-values.
+ *
+ * A learner's q-values can be saved to a file once they have been
+ * learned. The file is a short header followed by the table exactly
+ * as it is held in memory, so a program that only needs to use the
+ * policy can memory map the file (see MappedFile) and attach the
+ * learner to it without reading or copying anything. Several
+ * processes mapping the same file share the same pages.
+ *
+ * For problems with more states than fit in the cache, the learner
+ * can be put into replay mode (see QLearner::setReplay). Instead of
+ * updating the table after every action, it keeps the most recent
+ * transitions in a buffer, and updates the table from a sample of
+ * them in batches, sorted by state so the updates sweep through the
+ * table in order. Each transition is normally used several times,
+ * so fewer calls to the problem's getResult method are needed.
+ *
+ * The TraceQLearner uses eligibility traces, so each reward is passed
+ * back along the whole chain of actions that led to it rather than
+ * one step at a time, which needs far fewer iterations on problems
+ * where rewards come at the end of long sequences of actions.
  */
 #ifndef AICORE_QLEARNING_H
 #define AICORE_QLEARNING_H
 
+#include <vector>
+
 namespace aicore
 {
 
@@ -30,13 +55,107 @@ namespace aicore
      */
     class QLearner
     {
+    public:
+        /** Holds the start of a saved q-value table. */
+        struct SnapshotHeader
+        {
+            /** Holds the characters 'AIQT'. */
+            char magic[4];
+
+            /** The version of the format. */
+            unsigned version;
+
+            /** The size of a real number, in bytes. */
+            unsigned realSize;
+
+            /** The number of states in the table. */
+            unsigned stateCount;
+
+            /** The number of actions per state in the table. */
+            unsigned stride;
+
+            /** Unused, keeps the table 16-byte aligned. */
+            unsigned reserved[3];
+
+            /** The learning parameters used to learn the table. */
+            double alpha;
+            double gamma;
+            double rho;
+            double nu;
+        };
+
     private:
+
+        /**
+         * Holds a bitmask for each state, with a bit set for each
+         * action that is valid from that state. Each state's mask
+         * takes maskWords words.
+         */
+        std::vector<uint32_t> validActions;
+
+        /** Holds the number of words in the mask for each state. */
+        unsigned maskWords;
+
+        /**
+         * Set if the q-values were allocated by the learner, rather
+         * than attached to read-only memory.
+         */
+        bool ownsValues;
+
+        /**
+         * Checks the given snapshot matches this learner's problem,
+         * and if it does, takes its learning parameters.
+         *
+         * @return The q-values in the snapshot, or null if it doesn't
+         * match.
+         */
+        const real* readSnapshot(const void *data, size_t size);
+
+        /** Holds one transition kept for replay. */
+        struct Transition
+        {
+            LearningProblemState *state;
+            LearningProblemAction *action;
+            LearningProblemActionResult result;
+        };
+
+        /** Orders transitions by their position in the table. */
+        static bool transitionBefore(const Transition &one,
+                                     const Transition &two);
+
+        /**
+         * Holds the most recent transitions, as a ring buffer. This
+         * is empty unless replay is enabled.
+         */
+        std::vector<Transition> replayBuffer;
+
+        /** The number of transitions in the replay buffer. */
+        unsigned replayCount;
+
+        /** The position in the buffer for the next transition. */
+        unsigned replayNext;
+
+        /** The transitions recorded since the last batch. */
+        unsigned replayPending;
+
+        /** The number of new transitions that trigger a batch. */
+        unsigned replayInterval;
+
+        /** The number of transitions replayed in each batch. */
+        unsigned replaySamples;
+
+        /** Holds the transitions sampled for the current batch. */
+        std::vector<Transition> replayBatch;
+
+        /** Applies the update for one transition to the table. */
+        void updateQValue(const Transition &transition);
+
+    protected:
         /**
          * Holds the stride through the qvalue array.
          */
         unsigned stride;
 
-    protected:
         /**
          * References the problem we're trying to learn.
          */
@@ -62,6 +181,13 @@ namespace aicore
          */
         real nu;
 
+        /**
+         * Holds the lowest value that getBestQValue will return. The
+         * original algorithm treats the value of a state as never
+         * being less than zero, which is the default.
+         */
+        real qFloor;
+
         /**
          * Does one iteration of the learning algorithm based on the
          * given state, and returns the new state it has reached.
@@ -69,6 +195,19 @@ namespace aicore
         LearningProblemState*
         doLearningIteration(LearningProblemState * state);
 
+        /**
+         * Picks one of the valid actions from the given state at
+         * random, or returns null if there are none.
+         */
+        LearningProblemAction*
+        getRandomAction(LearningProblemState* state);
+
+        /** Returns the random number generator to use. */
+        RandomEngine& getRandom()
+        {
+            return random ? *random : getRandomEngine();
+        }
+
         /**
          * Retrieves the q value associated with taking the given
          * action at the given state.
@@ -78,7 +217,9 @@ namespace aicore
 
         /**
          * Retrieves the q value associated with the best action from
-         * the given state.
+         * the given state, or the q floor if that is higher. A state
+         * with no valid actions (the end of an episode) is worth
+         * zero, whatever the floor.
          */
         real getBestQValue(LearningProblemState* state);
 
@@ -93,29 +234,306 @@ namespace aicore
     public:
         /**
          * Holds the q-values. This is public so we can peek at its
-         * values.
+         * values. If the learner has been attached to a snapshot,
+         * this points into read-only memory.
          */
         real *qvalues;
 
+        /**
+         * The random number generator used to explore. If this is
+         * null, the calling thread's engine is used. Set it, along
+         * with the problem's own source of random states, to make
+         * learning repeatable.
+         */
+        RandomEngine *random;
+
         /** Creates a new q-learning system to solve the given problem. */
         QLearner(LearningProblem * problem,
                  real alpha, real gamma, real rho, real nu);
 
         /** Deletes the internal store. */
-        ~QLearner();
+        virtual ~QLearner();
 
         /**
-         * Performs the given number of iterations of learning.
+         * Performs the given number of iterations of learning. A
+         * learner that has been attached to a snapshot can't learn.
          */
         void learn(unsigned iterations=1);
 
+        /**
+         * Writes the header and q-values to the given buffer,
+         * replacing its contents.
+         */
+        void write(std::vector<char> *buffer) const;
+
+        /**
+         * Saves the q-values and learning parameters to the given
+         * file.
+         *
+         * @return False if the file couldn't be written.
+         */
+        bool save(const char *filename) const;
+
+        /**
+         * Loads q-values and learning parameters saved by save,
+         * copying them into the learner's own table so it can go on
+         * learning.
+         *
+         * @return False if the file couldn't be read, or was saved
+         * for a problem of a different size or with a different real
+         * type. The learner is unchanged in that case.
+         */
+        bool load(const char *filename);
+
+        /**
+         * Uses the q-values in the given snapshot (normally the
+         * contents of a MappedFile) directly, without copying. The
+         * data must stay valid, and the learner can't learn, until it
+         * is loaded from a file again.
+         *
+         * @return False if the data isn't a snapshot for a problem of
+         * this size. The learner is unchanged in that case.
+         */
+        bool attach(const void *data, size_t size);
+
+        /**
+         * Returns true if the learner is attached to a snapshot, and
+         * so can't learn.
+         */
+        bool isReadOnly() const { return !ownsValues; }
+
+        /**
+         * Turns on replay mode. Each transition the learner makes is
+         * kept in a buffer of the given capacity (the oldest being
+         * replaced once it is full). Every interval transitions, the
+         * given number of samples are picked at random from the
+         * buffer, sorted by state, and used to update the table.
+         *
+         * The states and actions given by the problem must stay
+         * valid while they are in the buffer. A capacity of zero
+         * turns replay off, going back to updating the table after
+         * each action.
+         */
+        void setReplay(unsigned capacity, unsigned interval = 32,
+                       unsigned samples = 64);
+
+        /** Returns true if replay mode is on. */
+        bool isReplaying() const { return !replayBuffer.empty(); }
+
+        /**
+         * Performs one batch of replay updates now. This is called
+         * automatically, and at the end of each call to learn, so
+         * there is normally no need to call it directly.
+         */
+        void replay();
+
+        /**
+         * Sets the lowest value a state can have when its value is
+         * used to update the one before it. Set this to -REAL_MAX to
+         * use the value of the best action, however low.
+         */
+        void setQFloor(real floor) { qFloor = floor; }
+
+        /** Returns the lowest value a state can have. */
+        real getQFloor() const { return qFloor; }
+
+        /**
+         * Asks the problem again which actions are valid from each
+         * state. This is done when the learner is created, and only
+         * needs calling again if the problem changes.
+         */
+        void refreshValidActions();
+
         /**
          * Based on the learning so far, this method returns the
          * algorithms recommendation for the best action in the given
-         * state.
+         * state. Where actions have the same value, the one with the
+         * lowest index is returned. Returns null if there are no
+         * valid actions.
          */
         LearningProblemAction* getBestAction(LearningProblemState* state);
     };
+
+    /**
+     * A q-learner that runs one exploration walk per worker thread,
+     * with all the walks updating the same q-values.
+     *
+     * The q-values are read and written without any locking or
+     * atomic operations, in the style of the Hogwild algorithm. To
+     * the C++ standard this is a data race, so its behaviour is
+     * undefined: the learner relies on the platform instead, where
+     * plain aligned loads and stores of a real don't tear, and the
+     * worst that happens is that two threads updating the same entry
+     * at the same moment lose one of the updates. That holds for the
+     * compilers and processors the library is built for, but race
+     * detectors will report it, and it isn't something the language
+     * promises. Because each walk visits a different part of a large
+     * problem most of the time, clashes are rare, and the table
+     * stays a plain array that the rest of QLearner (and anything
+     * reading qvalues) can use at full speed. The results depend on
+     * how the threads are scheduled, so they won't be the same from
+     * run to run. Use QLearner where that isn't acceptable.
+     *
+     * Each thread uses its own random engine (see getRandomEngine),
+     * so the random member must be left null. Replay mode can't be
+     * used with the parallel learner.
+     *
+     * The problem's methods will be called from several threads at
+     * once, so they must not change the problem.
+     * ArrayBasedLearningProblem is fine; problems that build their
+     * action lists in getActions must override getAction,
+     * getValidActionCount and getValidAction to avoid doing so.
+     */
+    class ParallelQLearner : public QLearner
+    {
+        /** Runs the walks for a range of workers. */
+        class WalkTask : public ParallelTask
+        {
+        public:
+            ParallelQLearner *learner;
+            unsigned iterations;
+            unsigned walks;
+
+            virtual void run(unsigned begin, unsigned end, unsigned worker);
+        };
+
+        /** Holds the threads that run the walks. */
+        JobSystem jobs;
+
+        /** The number of iterations done in the last call to learn. */
+        unsigned long long lastIterations;
+
+        /** The time taken by the last call to learn, in seconds. */
+        double lastSeconds;
+
+    public:
+        /**
+         * Creates a new learner for the given problem, with the given
+         * number of threads (including the calling thread). If this
+         * is zero, one thread per hardware thread is used.
+         */
+        ParallelQLearner(LearningProblem * problem,
+                         real alpha, real gamma, real rho, real nu,
+                         unsigned threads = 0);
+
+        /** Returns the number of threads used for learning. */
+        unsigned getThreadCount() const { return jobs.getWorkerCount(); }
+
+        /**
+         * Performs the given number of iterations of learning in
+         * total, shared out between the threads, and waits for them
+         * all to finish.
+         */
+        void learn(unsigned iterations=1);
+
+        /**
+         * Returns the number of iterations per second achieved by
+         * the last call to learn, or zero if it hasn't been called.
+         */
+        double getIterationsPerSecond() const;
+    };
+
+    /**
+     * A learner that uses eligibility traces, implementing either
+     * Watkins's Q(lambda) or SARSA(lambda). It uses the same table of
+     * q-values as QLearner, so its results can be used, saved and
+     * loaded in the same way.
+     *
+     * Each time an action is taken, the learner marks it as eligible,
+     * and updates every eligible action by the error in the new
+     * action's value, in proportion to its eligibility. Eligibility
+     * then fades by gamma*lambda each step, so actions taken long ago
+     * are hardly changed. Only the actions with a noticeable
+     * eligibility are stored, and those below the trace threshold
+     * are dropped, so the cost of each iteration depends on lambda
+     * rather than on the size of the problem.
+     *
+     * Each walk (between random restarts, given by nu) is treated as
+     * one episode: the traces are cleared when a new walk starts.
+     * Replay mode isn't used by this learner.
+     */
+    class TraceQLearner : public QLearner
+    {
+    public:
+        /** The algorithms the learner can use. */
+        enum Method
+        {
+            /**
+             * Learns the value of the best action (like QLearner),
+             * clearing the traces whenever an exploratory action is
+             * taken.
+             */
+            WATKINS_Q,
+
+            /**
+             * Learns the value of the actions actually taken,
+             * including exploration, so the traces never need
+             * clearing.
+             */
+            SARSA
+        };
+
+    private:
+        /** Marks a table entry with no trace. */
+        static const unsigned NO_TRACE = 0xffffffff;
+
+        /** Holds the table entries that have a trace. */
+        std::vector<unsigned> traceEntries;
+
+        /** Holds the eligibility of each entry in traceEntries. */
+        std::vector<real> traceValues;
+
+        /**
+         * Holds the position in traceEntries of each table entry, or
+         * NO_TRACE.
+         */
+        std::vector<unsigned> traceSlot;
+
+        /** Removes all the traces. */
+        void clearTraces();
+
+        /**
+         * Picks an action from the given state, exploring at random
+         * with probability rho. Sets greedy to say whether the action
+         * is one of the best.
+         */
+        LearningProblemAction* chooseAction(LearningProblemState *state,
+                                            bool *greedy);
+
+    public:
+        /** The algorithm to use. */
+        Method method;
+
+        /**
+         * Holds the lambda parameter: how quickly eligibility fades,
+         * between zero (which behaves like QLearner) and one.
+         */
+        real lambda;
+
+        /**
+         * Traces whose eligibility falls below this value are
+         * dropped.
+         */
+        real traceThreshold;
+
+        /** Creates a new learner to solve the given problem. */
+        TraceQLearner(LearningProblem * problem,
+                      real alpha, real gamma, real rho, real nu,
+                      real lambda, Method method = WATKINS_Q);
+
+        /** Returns the number of table entries with a trace. */
+        unsigned getTraceCount() const
+        {
+            return (unsigned)traceEntries.size();
+        }
+
+        /**
+         * Performs the given number of iterations of learning,
+         * starting from the problem's initial state.
+         */
+        void learn(unsigned iterations=1);
+    };
+
 }; // end of namespace
 
 #endif // AICORE_QLEARNING_H
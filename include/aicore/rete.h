@@ -0,0 +1,237 @@
+/*
+ * Defines the classes used for incremental rule matching.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds a matching network in the style of the Rete algorithm. The
+ * rules defined in rules.h can be checked by calling the matches
+ * method of each rule's if-clause, but this has to walk the whole
+ * database for every rule, every time. When there are hundreds of
+ * rules, most of which are checking the same few items of data, this
+ * does a lot of repeated work.
+ *
+ * The network compiles the if-clauses of a set of rules into a graph
+ * of nodes. Each match on the data (a DataNodeMatch, such as a
+ * RangeMatch or a DataGroupMatch) becomes a leaf node, and matches
+ * that are equivalent are merged, so that they are only checked once
+ * however many rules use them. The boolean matches (AndMatch, OrMatch
+ * and NotMatch) become internal nodes, which are also merged if they
+ * combine the same nodes. An AndMatch or OrMatch whose two sides
+ * share a wildcard can't be split like this, because the data one
+ * side binds the wildcard to limits what the other can match, so it
+ * becomes a single leaf instead. Each node remembers its last result,
+ * and only the nodes that depend on data that has changed are
+ * checked again.
+ */
+#ifndef AICORE_RETE_H
+#define AICORE_RETE_H
+
+#include <map>
+#include <vector>
+
+namespace aicore
+{
+    /**
+     * Compiles a set of rules into a network that keeps track of
+     * which of them are triggered as the database changes.
+     *
+     * Each time the database is changed, the calling code should tell
+     * the network by calling markChanged with the identifier of the
+     * top level data node that was added, removed or changed (for a
+     * change deep inside a group, this is the identifier of the
+     * group's top level ancestor). Then calling update brings the
+     * list of triggered rules up to date, checking only the matches
+     * that could have been affected.
+     *
+     * Matches are looked up by the identifier they are trying to
+     * find at the top level of the database, so matches with a
+     * wildcard identifier, and matches of types the network doesn't
+     * understand (those that return MATCH_OTHER), have to be checked
+     * again whenever anything changes. For the best performance the
+     * top level matches in an if-clause should name their data.
+     *
+     * The network doesn't own the rules or matches it is given, and
+     * they must not be changed after they have been added. A rule is
+     * triggered in the network exactly when Rule::check would return
+     * true, but the network only tracks whether rules are triggered,
+     * and doesn't keep the bindings its matches find. To find the
+     * bindings for a triggered rule before firing it, call
+     * Rule::check.
+     */
+    class ReteNetwork
+    {
+        /** Identifies the different kinds of node in the network. */
+        enum NodeType
+        {
+            NODE_MATCH,
+            NODE_AND,
+            NODE_OR,
+            NODE_NOT
+        };
+
+        /** Holds one node in the network. */
+        struct Node
+        {
+            /** The kind of node. */
+            NodeType type;
+
+            /** For match nodes, the match to perform. */
+            Match *match;
+
+            /**
+             * For match nodes, whether the match is performed with
+             * (initially empty) bindings, as Rule::check does, or
+             * without, as for a match inside a NotMatch.
+             */
+            bool withBindings;
+
+            /** For boolean nodes, the nodes that are combined. */
+            unsigned inputs[2];
+
+            /** The result the last time the node was checked. */
+            bool value;
+
+            /** Set when the node needs to be checked again. */
+            bool dirty;
+
+            /** The nodes that use this one as an input. */
+            std::vector<unsigned> outputs;
+
+            /** The rules whose if-clause is this node. */
+            std::vector<unsigned> rules;
+        };
+
+        /** Holds the state of each rule. */
+        struct RuleEntry
+        {
+            Rule *rule;
+            unsigned root;
+            bool triggered;
+        };
+
+        /**
+         * Holds the nodes. Nodes are only ever added after their
+         * inputs, so checking them in order always checks a node's
+         * inputs before the node itself.
+         */
+        std::vector<Node> nodes;
+
+        /** Holds the rules in the order they were added. */
+        std::vector<RuleEntry> rules;
+
+        /** Holds the rules that are currently triggered. */
+        std::vector<Rule*> triggered;
+
+        /**
+         * Holds the match nodes for each identifier, so the matches
+         * affected by a change can be found quickly.
+         */
+        std::map<id, std::vector<unsigned> > matchesById;
+
+        /**
+         * Holds the match nodes that have to be checked on any
+         * change to the database.
+         */
+        std::vector<unsigned> matchesOnAnything;
+
+        /** Holds the boolean nodes, so they can be merged. */
+        std::map<unsigned long long, unsigned> booleans;
+
+        /** The lowest numbered dirty node, or the node count. */
+        unsigned firstDirty;
+
+        /** Holds the bindings used while checking match nodes. */
+        DataBindings bindings;
+
+        /**
+         * Adds the nodes for the given match, returning its root. The
+         * flag says whether the match is checked with bindings, which
+         * is true except inside a NotMatch.
+         */
+        unsigned compile(Match *match, bool withBindings);
+
+        /** Finds or adds a match node. */
+        unsigned addMatchNode(Match *match, bool byIdentifier,
+                              bool withBindings);
+
+        /** Finds or adds a boolean node. */
+        unsigned addBooleanNode(NodeType type, unsigned one, unsigned two);
+
+        /** Marks the given node as needing to be checked. */
+        void markDirty(unsigned node);
+
+    public:
+        /** Creates an empty network. */
+        ReteNetwork();
+
+        /**
+         * Compiles the given rule into the network. The rule will be
+         * checked on the next update.
+         *
+         * @return The index of the rule in the network.
+         */
+        unsigned addRule(Rule *rule);
+
+        /** Returns the number of rules in the network. */
+        unsigned getRuleCount() const { return (unsigned)rules.size(); }
+
+        /**
+         * Returns the number of nodes in the network. Because matches
+         * are shared, this can be much smaller than the total size of
+         * the rules' if-clauses.
+         */
+        unsigned getNodeCount() const { return (unsigned)nodes.size(); }
+
+        /**
+         * Notes that the top level data node with the given
+         * identifier has been added, removed or changed.
+         */
+        void markChanged(id identifier);
+
+        /**
+         * Notes that the whole database may have changed, so every
+         * match needs checking again.
+         */
+        void markAllChanged();
+
+        /**
+         * Checks the matches affected by the changes since the last
+         * update, and updates the list of triggered rules.
+         *
+         * @return The number of rules that have become triggered or
+         * stopped being triggered.
+         */
+        unsigned update(const Database *database);
+
+        /**
+         * Returns the rules that were triggered at the last update,
+         * in the order they were added.
+         */
+        const std::vector<Rule*>& getTriggeredRules() const
+        {
+            return triggered;
+        }
+
+        /**
+         * Checks if the rule with the given index was triggered at
+         * the last update.
+         */
+        bool isTriggered(unsigned rule) const
+        {
+            return rules[rule].triggered;
+        }
+    };
+
+}; // end of namespace
+
+#endif // AICORE_RETE_H
@@ -22,6 +22,8 @@
 #ifndef AICORE_RULES_H
 #define AICORE_RULES_H
 
+#include <vector>
+
 namespace aicore
 {
 
@@ -79,6 +81,11 @@ namespace aicore
          */
         DataNode *nextSibling;
 
+        /** Creates a data node with no identifier and no siblings. */
+        DataNode() : identifier(0), nextSibling(0) {}
+
+        virtual ~DataNode() {}
+
         /**
          * Allows calling code to determine whether the node it is
          * considering is a group or not.
@@ -96,6 +103,14 @@ namespace aicore
      * Data groups represent a set of data in the database. It holds a
      * list of DataNode instances, which in turn may be DataGroups,
      * producing a tree of data.
+     *
+     * Groups with many children can optionally keep an index of their
+     * children by identifier, so that matches looking for a
+     * particular identifier don't have to walk the whole list. Call
+     * enableIndex to build it. Once a group has an index, children
+     * must be added and removed with addChild and removeChild, rather
+     * than by changing the list directly, so the index stays in step.
+     * If a child's identifier is changed, call rebuildIndex.
      */
     struct DataGroup : public DataNode
     {
@@ -109,8 +124,74 @@ namespace aicore
          */
         DataNode *firstChild;
 
+        /**
+         * Holds the index of the children, as an open addressed hash
+         * table keyed by identifier. Empty slots are null, and slots
+         * whose node has been removed hold a tombstone. This is empty
+         * if the group doesn't keep an index.
+         */
+        std::vector<DataNode*> index;
+
+        /** The number of index slots in use, including tombstones. */
+        unsigned indexUsed;
+
+        /** Creates an empty group with no index. */
+        DataGroup() : firstChild(0), indexUsed(0) {}
+
         /** This is a group. */
         bool isGroup() const { return true; }
+
+        /** Checks if this group keeps an index of its children. */
+        bool hasIndex() const { return !index.empty(); }
+
+        /**
+         * Builds an index of the current children, which will be kept
+         * up to date by addChild and removeChild.
+         */
+        void enableIndex();
+
+        /**
+         * Builds the index again from the list of children. This
+         * should be called if the list or the children's identifiers
+         * have been changed directly.
+         */
+        void rebuildIndex();
+
+        /** Removes the index, so lookups scan the children again. */
+        void disableIndex();
+
+        /**
+         * Adds the given node to the start of the list of children.
+         */
+        void addChild(DataNode *child);
+
+        /**
+         * Removes the given node from the list of children.
+         *
+         * @return False if the node wasn't a child of this group.
+         */
+        bool removeChild(DataNode *child);
+
+        /**
+         * Finds the first child with the given identifier, or returns
+         * null if there is none. This uses the index if there is one.
+         */
+        DataNode* findChild(id identifier) const;
+
+        /**
+         * Finds the next child after the given one with the same
+         * identifier, or returns null if there are no more. This
+         * allows all the children with one identifier to be visited
+         * when identifiers aren't unique within a group.
+         */
+        DataNode* findNextChild(const DataNode *child) const;
+
+    private:
+        /** Finds the first index slot to look in for an identifier. */
+        unsigned indexSlot(id identifier) const;
+
+        /** Adds the given node to the index, growing it if needed. */
+        void indexInsert(DataNode *child);
     };
 
     /**
@@ -160,9 +241,112 @@ namespace aicore
     /* @{ */
 
     /**
-     * Temporary definition: TODO: change this.
+     * Records that a wildcard in a match was matched against a
+     * particular node in the database.
+     */
+    struct DataBinding
+    {
+        /** The wildcard identifier used in the match. */
+        id wildcard;
+
+        /** The data node it was matched against. */
+        const DataNode *node;
+    };
+
+    /**
+     * Holds the set of wildcards that have been bound during a match,
+     * and the data nodes they were bound to.
+     *
+     * The bindings are stored in a single buffer that is reused from
+     * one match to the next, so once it has grown big enough for the
+     * largest match, matching doesn't allocate any memory. Matches
+     * that fail part way through roll the buffer back to a mark they
+     * took before they started, which is how they leave the bindings
+     * unchanged.
+     *
+     * When a wildcard that is already bound is seen again, it only
+     * matches a node with the same identifier as the one it is bound
+     * to. So a match such as <code>(?person (rifle)) and (?person
+     * (ammo 0))</code> finds a single person with both. If the first
+     * person with a rifle has ammo, the match goes back and tries the
+     * next person with a rifle, and so on, so it finds such a person
+     * wherever they are in the database. When several choices would
+     * do, the first (in the order of the database) is bound.
+     */
+    class DataBindings
+    {
+        /** Holds the bindings, only the first count are in use. */
+        std::vector<DataBinding> bindings;
+
+        /** The number of bindings in use. */
+        unsigned count;
+
+    public:
+        /** Creates an empty set of bindings. */
+        DataBindings() : count(0) {}
+
+        /**
+         * Removes all the bindings, keeping the memory for the next
+         * match.
+         */
+        void clear() { count = 0; }
+
+        /** Returns the number of bindings. */
+        unsigned getCount() const { return count; }
+
+        /** Returns the binding with the given index. */
+        const DataBinding& get(unsigned index) const
+        {
+            return bindings[index];
+        }
+
+        /**
+         * Returns a value that can be given to rollback to remove
+         * any bindings added after this point.
+         */
+        unsigned mark() const { return count; }
+
+        /** Removes the bindings added since the given mark. */
+        void rollback(unsigned mark) { count = mark; }
+
+        /** Adds a binding for the given wildcard. */
+        void add(id wildcard, const DataNode *node);
+
+        /**
+         * Returns the node the given wildcard is bound to, or null if
+         * it isn't bound.
+         */
+        const DataNode* find(id wildcard) const;
+
+        /**
+         * Checks if the given wildcard could be bound to the given
+         * node: either it isn't bound yet, or it is bound to a node
+         * with the same identifier.
+         */
+        bool isConsistent(id wildcard, const DataNode *node) const;
+    };
+
+    /**
+     * Holds the part of a match still to be tried, once an earlier
+     * part has been matched. A match that has a choice of nodes in
+     * the database tries the rest after each choice, so that a choice
+     * that binds a wildcard to something the rest can't match is
+     * undone, and the next choice tried. These are made on the stack
+     * while matching, and aren't needed outside match subclasses.
      */
-    typedef void DataBindings;
+    struct MatchContinuation
+    {
+        virtual ~MatchContinuation() {}
+
+        /**
+         * Tries the rest of the match, subject to the given bindings
+         * (which may be null, as for Match::matches).
+         *
+         * @returns True if the rest matched. If it didn't, the
+         * bindings must be left as they were.
+         */
+        virtual bool matchRest(DataBindings *bindings) const = 0;
+    };
 
     /**
      * A match object is used to check against the database. It is an
@@ -179,6 +363,29 @@ namespace aicore
      */
     struct Match
     {
+        /**
+         * Identifies the kind of match, so that tools that compile
+         * matches (such as the ReteNetwork) can look inside them.
+         * Matches of kinds the library doesn't know about should
+         * return MATCH_OTHER.
+         */
+        enum MatchType
+        {
+            MATCH_OTHER,
+            MATCH_NODE,
+            MATCH_AND,
+            MATCH_OR,
+            MATCH_NOT
+        };
+
+        virtual ~Match() {}
+
+        /**
+         * Returns the kind of this match. By default matches are
+         * opaque.
+         */
+        virtual MatchType getMatchType() const { return MATCH_OTHER; }
+
         /**
          * Tries to perform a match on the given database, subject to
          * the given set of data bindings.
@@ -205,6 +412,21 @@ namespace aicore
          */
         virtual bool matches(const Database *database,
                              DataBindings *bindings) = 0;
+
+        /**
+         * Tries this match, then the given rest of the match (if it
+         * isn't null) with the bindings this match made. Matches that
+         * can make a choice between nodes in the database override
+         * this to try the rest after each choice in turn. The default
+         * implementation calls matches, then tries the rest once,
+         * which is all an opaque match can do.
+         *
+         * @returns True if both this match and the rest matched. If
+         * not, the bindings are left as they were.
+         */
+        virtual bool matchesThen(const Database *database,
+                                 DataBindings *bindings,
+                                 const MatchContinuation *rest);
     };
 
     /**
@@ -223,6 +445,12 @@ namespace aicore
      */
     struct DataNodeMatch : public Match
     {
+        /**
+         * The identifier to match. This may also be a wild-card (if
+         * it has its most significant bit set).
+         */
+        id identifier;
+
         /**
          * The next match object in a hierarchy of matches.
          *
@@ -236,6 +464,23 @@ namespace aicore
          */
         DataNodeMatch * nextSibling;
 
+        /**
+         * Creates a data node match for the given identifier.
+         */
+        DataNodeMatch(id identifier = 0);
+
+        /** This is a data node match. */
+        virtual MatchType getMatchType() const { return MATCH_NODE; }
+
+        /**
+         * Checks if the given match would always give the same
+         * result as this one, so that the two can share their work.
+         * This is conservative: returning false when the matches are
+         * equivalent is always safe. The default implementation only
+         * considers a match to be equivalent to itself.
+         */
+        virtual bool isEquivalent(const DataNodeMatch *other) const;
+
         /**
          * Matches the given database, by checking each element in the
          * database against the matchesNode method.
@@ -243,6 +488,14 @@ namespace aicore
         virtual bool matches(const Database *database,
                              DataBindings *bindings);
 
+        /**
+         * Matches the given database, trying the rest of the match
+         * after each element that passes matchesNode.
+         */
+        virtual bool matchesThen(const Database *database,
+                                 DataBindings *bindings,
+                                 const MatchContinuation *rest);
+
         /**
          * Checks all the children of the given group to see if any of
          * them pass the matchesNode test. This is used in the
@@ -254,6 +507,26 @@ namespace aicore
         bool matchesChildren(const DataGroup * group,
                              DataBindings *bindings);
 
+        /**
+         * Checks the children of the given group as matchesChildren
+         * does, but only succeeds for a child after which the given
+         * rest of the match (if it isn't null) also matches.
+         */
+        bool matchesChildrenThen(const DataGroup * group,
+                                 DataBindings *bindings,
+                                 const MatchContinuation *rest);
+
+    protected:
+        /**
+         * Checks if the given node has the identifier this match is
+         * looking for, and if so adds any binding it needs to the
+         * bindings. The binding should be removed if the rest of the
+         * match then fails.
+         */
+        bool bindIdentifier(const DataNode * node,
+                            DataBindings *bindings) const;
+
+    public:
         /**
          * Tries to match the given data node from the database
          * against the criteria in this match. The behaviour and
@@ -264,6 +537,18 @@ namespace aicore
          */
         virtual bool matchesNode(const DataNode * node,
                                  DataBindings *bindings) = 0;
+
+        /**
+         * Tries to match the given data node, then the given rest of
+         * the match (if it isn't null). The default implementation
+         * calls matchesNode and then tries the rest. Matches that
+         * themselves choose between nodes below the given one
+         * override this, so those choices are tried again if the rest
+         * fails.
+         */
+        virtual bool matchesNodeThen(const DataNode * node,
+                                     DataBindings *bindings,
+                                     const MatchContinuation *rest);
     };
 
     /**
@@ -283,18 +568,24 @@ namespace aicore
      */
     struct DataGroupMatch : public DataNodeMatch
     {
-        /**
-         * The identifier to match. This may also be a wild-card (if
-         * it has its most significant bit set).
-         */
-        id identifier;
-
         /**
          * The first sub-match in this group. Additional children are
          * found using the DataMatchGroup's nextSibling member.
          */
         DataNodeMatch * firstChild;
 
+        /**
+         * Creates a group match for the given identifier, with no
+         * children.
+         */
+        DataGroupMatch(id identifier = 0);
+
+        /**
+         * Group matches are equivalent if they have the same
+         * identifier and equivalent children in the same order.
+         */
+        virtual bool isEquivalent(const DataNodeMatch *other) const;
+
         /**
          * Tries to match the given data node from the database
          * against the criteria in this match. This uses a recursive
@@ -304,6 +595,14 @@ namespace aicore
          */
         virtual bool matchesNode(const DataNode * node,
                                  DataBindings *bindings);
+
+        /**
+         * Matches the given node and the children of this match, with
+         * the rest of the match tried after each choice of children.
+         */
+        virtual bool matchesNodeThen(const DataNode * node,
+                                     DataBindings *bindings,
+                                     const MatchContinuation *rest);
     };
 
     /**
@@ -337,12 +636,6 @@ namespace aicore
          */
         T max;
 
-        /**
-         * The identifier to match. This may also be a wild-card (if
-         * it has its most significant bit set).
-         */
-        id identifier;
-
         /**
          * Creates a range match object with the given identifier and
          * range. The max value must be greater than or equal to the
@@ -350,6 +643,12 @@ namespace aicore
          */
         RangeMatch(id identifier, T min, T max);
 
+        /**
+         * Range matches are equivalent if they have the same type,
+         * identifier and range.
+         */
+        virtual bool isEquivalent(const DataNodeMatch *other) const;
+
         /**
          * Matches the given database node. If the match is valid, and
          * the identifier was a wildcard, then the bindings will be
@@ -381,16 +680,28 @@ namespace aicore
          */
         AndMatch(Match *one, Match *two);
 
+        /** This is an and match. */
+        virtual MatchType getMatchType() const { return MATCH_AND; }
+
         /**
          * Matches the given database, by trying its two sub-matches
          * in turn. If either return false, then this method returns
          * false.
          *
          * @note This class shortcuts, so the second sub-match isn't
-         * tried if the first fails.
+         * tried if the first fails. With bindings, the second is tried
+         * after each way the first can match, until one works, so a
+         * wildcard shared by the two finds data that matches both.
+         * If the second never matches, the bindings added by the
+         * first are removed.
          */
         virtual bool matches(const Database *database,
                              DataBindings *bindings);
+
+        /** Tries the first sub-match, then the second, then the rest. */
+        virtual bool matchesThen(const Database *database,
+                                 DataBindings *bindings,
+                                 const MatchContinuation *rest);
     };
 
     /**
@@ -405,6 +716,9 @@ namespace aicore
          */
         OrMatch(Match *one, Match *two);
 
+        /** This is an or match. */
+        virtual MatchType getMatchType() const { return MATCH_OR; }
+
         /**
          * Matches the given database, by trying its two sub-matches
          * in turn. If either return true, then this method returns
@@ -440,6 +754,9 @@ namespace aicore
          */
         NotMatch(Match *match);
 
+        /** This is a not match. */
+        virtual MatchType getMatchType() const { return MATCH_NOT; }
+
         /**
          * Matches the given database, by making sure that its
          * sub-match fails.
@@ -471,17 +788,163 @@ namespace aicore
          */
         Match *ifClause;
 
+        virtual ~Rule() {}
+
+        /**
+         * The bindings found the last time the rule was checked. The
+         * action can use these to find the data that matched the
+         * rule's wildcards.
+         */
+        DataBindings bindings;
+
+        /**
+         * Checks the rule's if-clause against the given database,
+         * replacing the bindings with those of the match.
+         *
+         * @returns True if the rule matches.
+         */
+        bool check(const Database *database);
+
         /**
          * Carries out an action when the rule matches. This is a
          * method rather than some structure defining the action to
          * carry out, because actions can vary dramatically depending
-         * on the application.
+         * on the application. When the rule was matched by check,
+         * the bindings member holds what was matched.
          */
         virtual void action() = 0;
     };
 
     /* @} */
 
+
+    /**
+     * Runs a set of rules against a database, choosing one of the
+     * triggered rules each time and firing it.
+     *
+     * Each pass checks every rule in the order they were added (or
+     * stops at the first that matches, for FIRST_APPLICABLE), then
+     * uses the arbitration strategy to pick which of the triggered
+     * rules to fire. A time budget can be set, so that a long pass is
+     * spread across several frames: when the budget runs out the
+     * system remembers where it got to and carries on from there on
+     * the next update. The results of rules checked earlier in the
+     * pass are kept, so if the database changes part way through a
+     * pass a rule may fire using data that has since changed.
+     */
+    class RuleBasedSystem
+    {
+    public:
+        /** The ways of choosing between triggered rules. */
+        enum Strategy
+        {
+            /** Fires the first rule that matches. */
+            FIRST_APPLICABLE,
+
+            /**
+             * Fires the triggered rule with the highest priority,
+             * taking the first added if several have the same.
+             */
+            PRIORITY,
+
+            /**
+             * Fires the triggered rule that was fired longest ago
+             * (rules that have never fired come first), so that no
+             * triggered rule is starved.
+             */
+            RECENCY,
+
+            /** Fires a random one of the triggered rules. */
+            RANDOM
+        };
+
+    private:
+        /** Holds a rule and its arbitration data. */
+        struct RuleEntry
+        {
+            Rule *rule;
+            int priority;
+
+            /** The pass the rule last fired in, or zero. */
+            unsigned lastFired;
+        };
+
+        /** Holds the rules in the order they were added. */
+        std::vector<RuleEntry> rules;
+
+        /** The index of the next rule to check in this pass. */
+        unsigned cursor;
+
+        /** The best rule found in this pass so far, or NONE. */
+        unsigned best;
+
+        /** The number of triggered rules seen so far this pass. */
+        unsigned triggeredCount;
+
+        /** The number of passes completed. */
+        unsigned passes;
+
+    public:
+        /** Marks no rule. */
+        static const unsigned NONE = 0xffffffff;
+
+        /** The arbitration strategy to use. */
+        Strategy strategy;
+
+        /**
+         * The longest an update should spend checking rules, in
+         * microseconds, or zero for no limit. At least one rule is
+         * checked on every update, so the system always makes
+         * progress.
+         */
+        unsigned budget;
+
+        /**
+         * The random number engine used by the RANDOM strategy. If
+         * this is null then the calling thread's engine is used.
+         */
+        RandomEngine *random;
+
+        /**
+         * Creates an empty rule-based system with the given strategy
+         * and no time budget.
+         */
+        RuleBasedSystem(Strategy strategy = FIRST_APPLICABLE);
+
+        /**
+         * Adds a rule with the given priority. Priorities are only
+         * used by the PRIORITY strategy.
+         */
+        void addRule(Rule *rule, int priority = 0);
+
+        /** Returns the number of rules. */
+        unsigned getRuleCount() const { return (unsigned)rules.size(); }
+
+        /**
+         * Checks if a pass has been started but not finished, because
+         * it ran out of time.
+         */
+        bool isInProgress() const { return cursor > 0; }
+
+        /**
+         * Abandons any pass in progress, so the next update starts
+         * again from the first rule.
+         */
+        void restart();
+
+        /**
+         * Carries on checking rules against the given database until
+         * the pass is complete or the budget runs out. When a pass
+         * completes, the chosen rule's action is called, with its
+         * bindings set to what it matched.
+         *
+         * @returns The rule that was fired, or null if no rule was
+         * fired (either because none was triggered, or the pass
+         * isn't complete yet).
+         */
+        Rule* update(const Database *database);
+    };
+
 }; // end of namespace
 
 #endif // AICORE_RULES_H
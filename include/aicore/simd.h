@@ -0,0 +1,342 @@
+/*
+ * The vectorised mathematics definition file.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds a 16-byte aligned vector with four components, and helpers
+ * for processing arrays of them at once.
+ *
+ * When AICORE_USE_SIMD is defined (see precision.h) and the library
+ * is compiled at single precision for a processor with SSE or NEON
+ * (AArch64) instructions, these are implemented with the processor's
+ * vector instructions. Otherwise they fall back to plain scalar code
+ * that gives the same results as the methods on Vector3.
+ */
+#ifndef AICORE_SIMD_H
+#define AICORE_SIMD_H
+
+#if defined(AICORE_SIMD_SSE)
+    #include <xmmintrin.h>
+#elif defined(AICORE_SIMD_NEON)
+    #include <arm_neon.h>
+#endif
+
+/**
+ * Forces the type or variable that follows to sit on a 16-byte
+ * boundary.
+ */
+#if defined(_MSC_VER)
+    #define AICORE_ALIGN16 __declspec(align(16))
+#else
+    #define AICORE_ALIGN16 __attribute__((aligned(16)))
+#endif
+
+/**
+ * The restrict qualifier tells the compiler that a pointer's array
+ * doesn't overlap any other, which it needs to know before it will
+ * vectorise the loops over batches of characters.
+ */
+#if defined(_MSC_VER)
+    #define AICORE_RESTRICT __restrict
+#elif defined(__GNUC__)
+    #define AICORE_RESTRICT __restrict__
+#else
+    #define AICORE_RESTRICT
+#endif
+
+namespace aicore
+{
+    /**
+     * Holds a vector in 3 dimensions, padded to four components and
+     * aligned on a 16-byte boundary so it can be loaded into a vector
+     * register in one instruction. The padding component is always
+     * kept at zero, so it doesn't disturb the scalar product or
+     * magnitude.
+     *
+     * This supports the subset of the Vector3 interface that the
+     * steering behaviours use. Convert to and from Vector3 at the
+     * edges of a calculation.
+     *
+     * @note Arrays of these should be allocated with new[] or as
+     * std::vector only where the allocator honours the alignment
+     * (which most do for 16 bytes); misaligned vectors will crash
+     * when SIMD is enabled.
+     */
+    class AICORE_ALIGN16 AlignedVector3
+    {
+    public:
+        /** Holds the value along the x axis. */
+        real x;
+
+        /** Holds the value along the y axis. */
+        real y;
+
+        /** Holds the value along the z axis. */
+        real z;
+
+    private:
+        /** Padding to make up four components, always zero. */
+        real w;
+
+#if defined(AICORE_SIMD_SSE)
+        __m128 load() const { return _mm_load_ps(&x); }
+        void store(__m128 value) { _mm_store_ps(&x, value); }
+        AlignedVector3(__m128 value) { store(value); }
+#elif defined(AICORE_SIMD_NEON)
+        float32x4_t load() const { return vld1q_f32(&x); }
+        void store(float32x4_t value) { vst1q_f32(&x, value); }
+        AlignedVector3(float32x4_t value) { store(value); }
+#endif
+
+    public:
+        /** The default constructor creates a zero vector. */
+        AlignedVector3() : x(0), y(0), z(0), w(0) {}
+
+        /** Creates a vector with the given components. */
+        AlignedVector3(const real x, const real y, const real z)
+            : x(x), y(y), z(z), w(0) {}
+
+        /** Creates a copy of the given vector. */
+        explicit AlignedVector3(const Vector3& vector)
+            : x(vector.x), y(vector.y), z(vector.z), w(0) {}
+
+        /** Returns the plain vector equivalent to this one. */
+        Vector3 toVector3() const
+        {
+            return Vector3(x, y, z);
+        }
+
+        /** Writes the components of this vector into the given vector. */
+        void writeTo(Vector3* vector) const
+        {
+            vector->x = x;
+            vector->y = y;
+            vector->z = z;
+        }
+
+        /** Adds the given vector to this. */
+        void operator+=(const AlignedVector3& v)
+        {
+#if defined(AICORE_SIMD_SSE)
+            store(_mm_add_ps(load(), v.load()));
+#elif defined(AICORE_SIMD_NEON)
+            store(vaddq_f32(load(), v.load()));
+#else
+            x += v.x;
+            y += v.y;
+            z += v.z;
+#endif
+        }
+
+        /** Subtracts the given vector from this. */
+        void operator-=(const AlignedVector3& v)
+        {
+#if defined(AICORE_SIMD_SSE)
+            store(_mm_sub_ps(load(), v.load()));
+#elif defined(AICORE_SIMD_NEON)
+            store(vsubq_f32(load(), v.load()));
+#else
+            x -= v.x;
+            y -= v.y;
+            z -= v.z;
+#endif
+        }
+
+        /** Multiplies this vector by the given scalar. */
+        void operator*=(const real value)
+        {
+#if defined(AICORE_SIMD_SSE)
+            store(_mm_mul_ps(load(), _mm_set1_ps(value)));
+#elif defined(AICORE_SIMD_NEON)
+            store(vmulq_n_f32(load(), value));
+#else
+            x *= value;
+            y *= value;
+            z *= value;
+#endif
+        }
+
+        /** Returns the value of the given vector added to this. */
+        AlignedVector3 operator+(const AlignedVector3& v) const
+        {
+            AlignedVector3 result = *this;
+            result += v;
+            return result;
+        }
+
+        /** Returns the value of the given vector subtracted from this. */
+        AlignedVector3 operator-(const AlignedVector3& v) const
+        {
+            AlignedVector3 result = *this;
+            result -= v;
+            return result;
+        }
+
+        /** Returns a copy of this vector scaled by the given value. */
+        AlignedVector3 operator*(const real value) const
+        {
+            AlignedVector3 result = *this;
+            result *= value;
+            return result;
+        }
+
+        /**
+         * Calculates and returns the scalar product of this vector
+         * with the given vector.
+         */
+        real operator*(const AlignedVector3& v) const
+        {
+#if defined(AICORE_SIMD_SSE)
+            __m128 product = _mm_mul_ps(load(), v.load());
+            __m128 swapped = _mm_shuffle_ps(product, product,
+                                            _MM_SHUFFLE(2,3,0,1));
+            __m128 sums = _mm_add_ps(product, swapped);
+            swapped = _mm_movehl_ps(swapped, sums);
+            return _mm_cvtss_f32(_mm_add_ss(sums, swapped));
+#elif defined(AICORE_SIMD_NEON)
+            return vaddvq_f32(vmulq_f32(load(), v.load()));
+#else
+            return x*v.x + y*v.y + z*v.z;
+#endif
+        }
+
+        /** Gets the squared magnitude of this vector. */
+        real squareMagnitude() const
+        {
+            return (*this) * (*this);
+        }
+
+        /** Gets the magnitude of this vector. */
+        real magnitude() const
+        {
+            return real_sqrt(squareMagnitude());
+        }
+
+        /** Turns a non-zero vector into a vector of unit length. */
+        void normalise()
+        {
+            real l = magnitude();
+            if (l > 0)
+            {
+                (*this) *= ((real)1)/l;
+            }
+        }
+
+        /** Returns a unit vector in the direction of this vector. */
+        AlignedVector3 unit() const
+        {
+            AlignedVector3 result = *this;
+            result.normalise();
+            return result;
+        }
+
+        /** Zero all the components of the vector. */
+        void clear()
+        {
+            x = y = z = w = 0;
+        }
+    };
+
+    /**
+     * @name Batch Vector Operations
+     *
+     * These process whole arrays of aligned vectors, several at a
+     * time when SIMD is enabled. Output arrays of reals don't need to
+     * be aligned.
+     */
+    /* @{ */
+
+    /**
+     * Turns each non-zero vector in the given array into a vector of
+     * unit length. Zero vectors are left unchanged.
+     */
+    void normaliseMany(AlignedVector3* vectors, unsigned count);
+
+    /**
+     * Writes the scalar product of each pair of corresponding vectors
+     * in the two given arrays into the results array.
+     */
+    void dotMany(const AlignedVector3* a, const AlignedVector3* b,
+                 real* results, unsigned count);
+
+    /**
+     * Writes the squared magnitude of each vector in the given array
+     * into the results array.
+     */
+    void squareMagnitudeMany(const AlignedVector3* vectors,
+                             real* results, unsigned count);
+
+    /* @} */
+
+    /**
+     * @name Matrix Operations
+     *
+     * These work on plain arrays of reals, which don't need to be
+     * aligned.
+     */
+    /* @{ */
+
+    /**
+     * Multiplies a column vector by a matrix stored in row-major
+     * order, writing result[r] = sum over c of matrix[r*columns+c] *
+     * vector[c]. The result must not overlap the vector.
+     */
+    void multiplyMatrixVector(const real* matrix, const real* vector,
+                              real* result,
+                              unsigned rows, unsigned columns);
+
+    /**
+     * Multiplies each of a set of vectors by the same square matrix
+     * stored in row-major order. The vectors are stored one after
+     * another, as are the results, so this is the matrix product of
+     * the matrix with a matrix whose columns are the vectors. Several
+     * vectors are done together, so each row of the matrix is loaded
+     * once for all of them.
+     *
+     * @param matrix The size-by-size matrix.
+     *
+     * @param vectors The count vectors, each of size values.
+     *
+     * @param results The count result vectors. These must not overlap
+     * the input vectors.
+     */
+    void multiplyMatrixVectors(const real* matrix, const real* vectors,
+                               real* results,
+                               unsigned size, unsigned count);
+
+    /**
+     * Finds the largest of the values whose bit is set in the given
+     * mask. Bit i of the mask (bit i%32 of word i/32) says whether
+     * value i should be considered.
+     *
+     * @param values The values to search.
+     *
+     * @param mask The bitmask, with enough words for count bits. Any
+     * bits beyond count must be clear.
+     *
+     * @param count The number of values.
+     *
+     * @param best If this isn't null, it is set to the largest value
+     * found, or -REAL_MAX if no bits were set.
+     *
+     * @return The index of the first of the largest values, or count
+     * if no bits were set.
+     */
+    unsigned argmaxMasked(const real* values, const uint32_t* mask,
+                          unsigned count, real* best);
+
+    /* @} */
+
+}; // end of namespace
+
+#endif // AICORE_SIMD_H
@@ -14,10 +14,17 @@
  * @file
  *
  * Holds an implementation of a finite state machine.
+ *
+ * A machine made of states and transitions can also be compiled into
+ * a CompiledStateMachine, which holds the structure in flat arrays
+ * and updates a whole population of characters sharing the same
+ * machine in one loop.
  */
 #ifndef AICORE_SM_H
 #define AICORE_SM_H
 
+#include <vector>
+
 namespace aicore
 {
     // Forward declaration (defined below)
@@ -110,7 +117,17 @@ namespace aicore
      */
     class StateMachine
     {
+    protected:
+        /**
+         * Returns true if the current state's transitions need to be
+         * checked in this update. The default implementation always
+         * returns true.
+         */
+        virtual bool shouldCheckTransitions() { return true; }
+
     public:
+        virtual ~StateMachine() {}
+
         /**
          * Holds the initial state (a pointer into the 'state' array).
          */
@@ -124,8 +141,220 @@ namespace aicore
         /**
          * This method runs the state machine - it checks for
          * transitions, applies them and returns a list of actions.
+         *
+         * @note This changes the current state, so a machine must
+         * not be updated from two threads at once. Separate machines
+         * (even ones sharing the same states and transitions) can be
+         * updated in parallel, as long as the transitions' conditions
+         * only read shared data.
          */
         virtual Action * update();
+
+        /**
+         * Writes which state the machine is in, as its position in
+         * the given array of the machine's states.
+         */
+        void writeSnapshot(SnapshotWriter &writer,
+                           StateMachineState *const *states,
+                           unsigned count) const;
+
+        /**
+         * Puts the machine into the state saved by writeSnapshot,
+         * without carrying out any actions. The states must be given
+         * in the same order as when they were written.
+         *
+         * @return False if the reader has failed, in which case the
+         * machine is unchanged.
+         */
+        bool readSnapshot(SnapshotReader &reader,
+                          StateMachineState *const *states,
+                          unsigned count);
+    };
+
+    /**
+     * A state machine that only checks its transitions when
+     * something they depend on has changed (see
+     * BaseTransition::addListener). Transitions that can't say what
+     * they depend on are checked every update, as normal, so this
+     * behaves in the same way as StateMachine as long as the values
+     * the other transitions depend on are only changed through their
+     * sources.
+     *
+     * When a character's inputs don't change, an update just returns
+     * the current state's actions, without checking any conditions.
+     */
+    class EventStateMachine : public StateMachine
+    {
+        /** Keeps track of changes to the current state's transitions. */
+        TransitionWatcher watcher;
+
+    protected:
+        /** Checks if anything has changed since the last check. */
+        virtual bool shouldCheckTransitions();
+
+    public:
+        /** Creates a machine with no states. */
+        EventStateMachine();
+
+        /**
+         * Returns true if the next update will need to check the
+         * transitions from the current state.
+         */
+        bool isDirty();
+    };
+
+    /**
+     * Holds a state machine compiled into flat arrays of states and
+     * transitions, so the same machine can be run for any number of
+     * characters, each of which only needs the index of its current
+     * state.
+     *
+     * Transitions that use ConditionalTransitionMixin with an
+     * IntegerInputMatchCondition or IntegerMatchCondition are stored
+     * as plain data and checked directly, without calling any virtual
+     * functions. For these the transition is assumed to trigger
+     * exactly when its condition passes. Any other transition is
+     * checked by calling its isTriggered method as normal. Only
+     * transitions with a fixed target can be compiled (the target is
+     * found once, when the machine is compiled), and transitions with
+     * no target are left out.
+     *
+     * The compiled machine doesn't own the original states and
+     * transitions, which are still used to get the actions to carry
+     * out, and must stay in existence. Changes to them aren't seen
+     * until the machine is compiled again.
+     */
+    class CompiledStateMachine
+    {
+    public:
+        /** Marks a character that hasn't entered the machine yet. */
+        static const unsigned NOT_STARTED = 0xffffffff;
+
+        /** The kinds of test a compiled transition can make. */
+        enum ConditionKind
+        {
+            /** Checks if one of the character's inputs matches. */
+            CONDITION_INPUT_MATCH,
+
+            /** Checks if a watched integer matches. */
+            CONDITION_WATCH_MATCH,
+
+            /** Calls isTriggered on the original transition. */
+            CONDITION_CUSTOM
+        };
+
+        /** Holds one compiled transition. */
+        struct CompiledTransition
+        {
+            /** The kind of test. */
+            ConditionKind kind;
+
+            /** For input matches, the position of the input. */
+            unsigned input;
+
+            /** For watch matches, the watched integer. */
+            const int *watch;
+
+            /** The value to match. */
+            int value;
+
+            /** The index of the state the transition leads to. */
+            unsigned target;
+
+            /** The original transition. */
+            Transition *transition;
+        };
+
+        /** Holds one compiled state. */
+        struct CompiledState
+        {
+            /** The index of the state's first transition. */
+            unsigned firstTransition;
+
+            /** The number of transitions from the state. */
+            unsigned transitionCount;
+
+            /** The original state. */
+            StateMachineState *state;
+        };
+
+    private:
+        /** Holds the states, with the initial state first. */
+        std::vector<CompiledState> states;
+
+        /**
+         * Holds the transitions, with those from each state together
+         * in the order they are checked.
+         */
+        std::vector<CompiledTransition> transitions;
+
+        /**
+         * Finds the transition that triggers from the given state,
+         * or returns null.
+         */
+        const CompiledTransition* findTransition(unsigned state,
+                                                 const int *inputs) const;
+
+    public:
+        /** Creates an empty machine. */
+        CompiledStateMachine();
+
+        /**
+         * Compiles the machine with the given initial state, along
+         * with every state that can be reached from it, replacing
+         * anything compiled before.
+         */
+        void compile(StateMachineState *initialState);
+
+        /** Returns the number of states in the machine. */
+        unsigned getStateCount() const { return (unsigned)states.size(); }
+
+        /** Returns the compiled state with the given index. */
+        const CompiledState& getState(unsigned index) const
+        {
+            return states[index];
+        }
+
+        /**
+         * Returns the index of the given state, or NOT_STARTED if it
+         * isn't part of the machine.
+         */
+        unsigned getStateIndex(const StateMachineState *state) const;
+
+        /**
+         * Updates one character's machine. This behaves in the same
+         * way as StateMachine::update.
+         *
+         * @param state The index of the character's current state,
+         * or NOT_STARTED. This is updated.
+         *
+         * @param inputs The character's inputs, used by input match
+         * conditions.
+         *
+         * @return The actions to carry out.
+         */
+        Action* update(unsigned *state, const int *inputs) const;
+
+        /**
+         * Updates the machines for a population of characters.
+         *
+         * @param currentStates An array of count state indices, one
+         * for each character, which are updated.
+         *
+         * @param inputs The inputs for the first character.
+         *
+         * @param stride The number of integers from the start of one
+         * character's inputs to the next.
+         *
+         * @param count The number of characters.
+         *
+         * @param actions If this isn't null, an array of count entries
+         * to receive the actions for each character. If it is null,
+         * only the states are changed, and no actions are created.
+         */
+        void updateMany(unsigned *currentStates,
+                        const int *inputs, unsigned stride,
+                        unsigned count, Action **actions = NULL) const;
     };
 
 
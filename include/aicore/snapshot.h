@@ -0,0 +1,248 @@
+/*
+ * Defines the classes used to save and restore the state of the AI.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds a compact binary format for saving the changing state of the
+ * AI, so a character can be moved to another machine or restored
+ * after a crash without rebuilding its behaviours, state machines and
+ * decision trees.
+ *
+ * A snapshot only holds state, not structure: the character's
+ * kinematic, which state its machines are in, what its decisions
+ * remember, its queued actions and its random numbers. The objects
+ * being restored must already have been built in the same way as the
+ * ones that were saved. Classes that can be saved have a
+ * writeSnapshot and readSnapshot method, and the kinematic and
+ * random engine are saved with the functions at the end of this file.
+ *
+ * Whole numbers are written in as few bytes as they need, and real
+ * numbers are written as they are held in memory, so snapshots can
+ * only be read on machines with the same byte order and real type
+ * (this is checked by readHeader).
+ *
+ * Successive snapshots of the same characters are mostly the same, so
+ * encodeSnapshotDelta can turn a snapshot into a list of the bytes
+ * that differ from the one before it, which is usually far smaller.
+ *
+ * <pre>
+ * std::vector<char> buffer;
+ * SnapshotWriter writer(&buffer);
+ * writer.writeHeader();
+ * writeSnapshot(writer, character);
+ * machine.writeSnapshot(writer, states, stateCount);
+ *
+ * SnapshotReader reader(&buffer[0], buffer.size());
+ * bool ok = reader.readHeader() &&
+ *     readSnapshot(reader, &character) &&
+ *     machine.readSnapshot(reader, states, stateCount);
+ * </pre>
+ */
+#ifndef AICORE_SNAPSHOT_H
+#define AICORE_SNAPSHOT_H
+
+#include <stddef.h>
+#include <vector>
+
+namespace aicore
+{
+    /**
+     * Writes values onto the end of a buffer, in the snapshot format.
+     */
+    class SnapshotWriter
+    {
+        /** The buffer being written to. */
+        std::vector<char> *buffer;
+
+    public:
+        /** The version of the format written by this code. */
+        static const unsigned VERSION = 1;
+
+        /**
+         * Creates a writer that adds to the end of the given buffer.
+         * The buffer isn't cleared.
+         */
+        SnapshotWriter(std::vector<char> *buffer);
+
+        /**
+         * Writes the start of a snapshot: its magic number, version
+         * and the size of a real number.
+         */
+        void writeHeader();
+
+        /** Writes a whole number, in as few bytes as possible. */
+        void writeUnsigned(unsigned value);
+
+        /** Writes a signed whole number, in as few bytes as possible. */
+        void writeInt(int value);
+
+        /** Writes a true or false value. */
+        void writeBool(bool value) { writeUnsigned(value ? 1 : 0); }
+
+        /** Writes a real number. */
+        void writeReal(real value) { writeBytes(&value, sizeof(real)); }
+
+        /** Writes the given number of real numbers. */
+        void writeReals(const real *values, unsigned count)
+        {
+            writeBytes(values, sizeof(real) * count);
+        }
+
+        /** Writes a vector. */
+        void writeVector(const Vector3 &value)
+        {
+            writeReal(value.x);
+            writeReal(value.y);
+            writeReal(value.z);
+        }
+
+        /** Writes the given bytes as they are. */
+        void writeBytes(const void *data, size_t size);
+
+        /** Returns the size of the buffer being written to. */
+        size_t getSize() const { return buffer->size(); }
+    };
+
+    /**
+     * Reads values written by a SnapshotWriter. If the data runs out
+     * or isn't valid, the reader fails: every later read gives zero,
+     * and isValid returns false, so a sequence of reads only needs
+     * checking at the end.
+     */
+    class SnapshotReader
+    {
+        /** The next byte to read. */
+        const char *current;
+
+        /** The end of the data. */
+        const char *end;
+
+        /** Set once a read has failed. */
+        bool failed;
+
+    public:
+        /** Creates a reader for the given data, which must stay valid. */
+        SnapshotReader(const void *data, size_t size);
+
+        /**
+         * Reads and checks the start of a snapshot.
+         *
+         * @return False if the data wasn't written by writeHeader
+         * with this version of the format, on a machine with the same
+         * real type and byte order.
+         */
+        bool readHeader();
+
+        /** Reads a whole number. */
+        unsigned readUnsigned();
+
+        /**
+         * Reads a whole number that must be less than the given
+         * limit, such as an index into an array. Larger values make
+         * the reader fail, and give zero.
+         */
+        unsigned readIndex(unsigned limit);
+
+        /** Reads a signed whole number. */
+        int readInt();
+
+        /** Reads a true or false value. */
+        bool readBool() { return readIndex(2) != 0; }
+
+        /** Reads a real number. */
+        real readReal()
+        {
+            real value = 0;
+            readBytes(&value, sizeof(real));
+            return value;
+        }
+
+        /** Reads the given number of real numbers. */
+        void readReals(real *values, unsigned count)
+        {
+            readBytes(values, sizeof(real) * count);
+        }
+
+        /** Reads a vector. */
+        Vector3 readVector()
+        {
+            Vector3 value;
+            value.x = readReal();
+            value.y = readReal();
+            value.z = readReal();
+            return value;
+        }
+
+        /**
+         * Reads the given number of bytes. If there aren't enough
+         * left, the reader fails and the memory is filled with zeros.
+         */
+        void readBytes(void *data, size_t size);
+
+        /** Makes the reader fail, when the data read makes no sense. */
+        void fail();
+
+        /** Returns true if every read so far has succeeded. */
+        bool isValid() const { return !failed; }
+
+        /** Returns the number of bytes not yet read. */
+        size_t getRemaining() const { return (size_t)(end - current); }
+    };
+
+    /** Writes a character's position and movement. */
+    void writeSnapshot(SnapshotWriter &writer, const Kinematic &kinematic);
+
+    /**
+     * Reads a character's position and movement.
+     *
+     * @return False if the reader has failed.
+     */
+    bool readSnapshot(SnapshotReader &reader, Kinematic *kinematic);
+
+    /**
+     * Writes the state of a random number generator, so the restored
+     * character goes on drawing the same numbers.
+     */
+    void writeSnapshot(SnapshotWriter &writer, const RandomEngine &engine);
+
+    /**
+     * Reads the state of a random number generator.
+     *
+     * @return False if the reader has failed.
+     */
+    bool readSnapshot(SnapshotReader &reader, RandomEngine *engine);
+
+    /**
+     * Works out the changes needed to turn one snapshot into another,
+     * replacing the contents of the delta. The delta records a
+     * checksum of the base, so it can only be applied to the same
+     * base it was made from.
+     */
+    void encodeSnapshotDelta(const std::vector<char> &base,
+                             const std::vector<char> &current,
+                             std::vector<char> *delta);
+
+    /**
+     * Applies a delta made by encodeSnapshotDelta to the snapshot it
+     * was made from, giving the later snapshot.
+     *
+     * @return False if the delta is damaged or was made from a
+     * different base. The result is unchanged in that case.
+     */
+    bool applySnapshotDelta(const std::vector<char> &base,
+                            const void *delta, size_t size,
+                            std::vector<char> *result);
+
+}; // end of namespace
+
+#endif // AICORE_SNAPSHOT_H
@@ -0,0 +1,221 @@
+/*
+ * Defines the spatial indexing structures.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds structures for quickly finding the characters near to a
+ * point in space. Many AI techniques, flocking in particular, need to
+ * find the neighbours of each character every frame. Checking every
+ * character against every other is quadratic in the number of
+ * characters, and quickly becomes the dominant cost. The structures
+ * in this file divide space up so that only characters in nearby
+ * regions have to be checked.
+ */
+#ifndef AICORE_SPATIAL_H
+#define AICORE_SPATIAL_H
+
+#include <vector>
+
+namespace aicore
+{
+    /**
+     * A uniform grid of cubic cells, stored as a hash table so that
+     * the world doesn't need to have fixed bounds. Each item in the
+     * grid is identified by an index, which will normally be its
+     * position in some array of characters that the grid is
+     * indexing.
+     *
+     * Each occupied cell holds a doubly linked list of the items in
+     * it, threaded through arrays indexed by item. This means items
+     * can be moved incrementally between cells as they move: only the
+     * items that cross a cell boundary in a frame have any list
+     * manipulation to do. Several cells can share one slot of the
+     * hash table, the grid stores the cell each item is in so
+     * queries can ignore the items that belong to other cells.
+     *
+     * Queries are answered by looking at every cell overlapping the
+     * bounding cube of the query sphere, and then checking the actual
+     * squared distance to the items they contain. For best
+     * performance the cell size should be roughly the same as the
+     * most common query radius.
+     */
+    class SpatialGrid
+    {
+    public:
+        /** Represents the lack of an item in the linked lists. */
+        static const unsigned NONE = 0xffffffff;
+
+    private:
+        /** Holds the width of each cell. */
+        real cellSize;
+
+        /** Holds the reciprocal of the cell size. */
+        real inverseCellSize;
+
+        /**
+         * Holds the number of slots in the hash table. This is always
+         * a power of two.
+         */
+        unsigned tableSize;
+
+        /** Holds the first item in each hash table slot. */
+        std::vector<unsigned> head;
+
+        /** Holds the next item in the same slot for each item. */
+        std::vector<unsigned> next;
+
+        /** Holds the previous item in the same slot for each item. */
+        std::vector<unsigned> previous;
+
+        /**
+         * Holds the cell coordinates of each item, three integers
+         * per item.
+         */
+        std::vector<int> cell;
+
+        /** Holds the position each item was last given. */
+        std::vector<Vector3> positions;
+
+        /** Holds whether each item is currently in the grid. */
+        std::vector<bool> present;
+
+        /** Holds the number of items currently in the grid. */
+        unsigned count;
+
+        /** Finds the cell coordinate for the given position component. */
+        int getCellCoordinate(real value) const;
+
+        /** Finds the hash table slot for the given cell. */
+        unsigned getSlot(int x, int y, int z) const;
+
+        /** Adds the given item to the list for its current cell. */
+        void link(unsigned index);
+
+        /** Removes the given item from the list for its current cell. */
+        void unlink(unsigned index);
+
+        /** Records the cell the given item is in from its position. */
+        void setCell(unsigned index);
+
+        /**
+         * Checks if the given item passes the view cone test.
+         */
+        bool inCone(unsigned index, const Vector3& centre,
+                    const Vector3& look, real minDotProduct) const;
+
+    public:
+        /**
+         * Creates a new grid with the given cell size and the given
+         * number of hash table slots (which will be rounded up to a
+         * power of two).
+         */
+        SpatialGrid(real cellSize = 10, unsigned tableSize = 1024);
+
+        /**
+         * Changes the size of the cells. This requires every item in
+         * the grid to be relocated, so it shouldn't be called often.
+         */
+        void setCellSize(real cellSize);
+
+        /** Returns the width of each cell. */
+        real getCellSize() const { return cellSize; }
+
+        /**
+         * Returns the number of item indices the grid has room for.
+         * Valid indices are from 0 to one less than this value.
+         */
+        unsigned getCapacity() const { return (unsigned)present.size(); }
+
+        /** Returns the number of items currently in the grid. */
+        unsigned getCount() const { return count; }
+
+        /**
+         * Changes the range of item indices the grid can hold. Any
+         * items with indices beyond the new capacity are removed.
+         */
+        void setCapacity(unsigned capacity);
+
+        /** Removes all the items from the grid. */
+        void clear();
+
+        /** Checks if the given item is in the grid. */
+        bool contains(unsigned index) const;
+
+        /**
+         * Adds the given item at the given position. If the item is
+         * already in the grid this is the same as calling update. The
+         * grid will grow if index is beyond its capacity.
+         */
+        void insert(unsigned index, const Vector3& position);
+
+        /**
+         * Moves the given item to the given position. This only
+         * touches the cell lists if the item has changed cell. If the
+         * item isn't in the grid, it is inserted.
+         */
+        void update(unsigned index, const Vector3& position);
+
+        /** Removes the given item from the grid, if it is there. */
+        void remove(unsigned index);
+
+        /** Returns the position the given item was last given. */
+        const Vector3& getPosition(unsigned index) const
+        {
+            return positions[index];
+        }
+
+        /**
+         * Finds all the items within the given distance of the given
+         * point (inclusive), and appends their indices to the given
+         * list.
+         *
+         * @param centre The centre of the query sphere.
+         *
+         * @param radius The radius of the query sphere.
+         *
+         * @param results The list to add the indices to. The list
+         * isn't cleared first.
+         *
+         * @param exclude An item index that shouldn't be returned,
+         * normally the character doing the query.
+         *
+         * @return The number of items added to the results list.
+         */
+        unsigned query(const Vector3& centre, real radius,
+                       std::vector<unsigned>* results,
+                       unsigned exclude = NONE) const;
+
+        /**
+         * Finds all the items within the given distance of the given
+         * point which are also within a view cone, and appends their
+         * indices to the given list. An item is in the cone if the
+         * scalar product of the look direction with the unit vector
+         * from the centre to the item is at least the given minimum.
+         * This check is done without a square root.
+         *
+         * @param look The unit vector along the centre of the cone.
+         *
+         * @param minDotProduct The cosine of the half-angle of the
+         * cone. A value of -1 or less accepts every direction.
+         *
+         * @see query
+         */
+        unsigned query(const Vector3& centre, real radius,
+                       const Vector3& look, real minDotProduct,
+                       std::vector<unsigned>* results,
+                       unsigned exclude = NONE) const;
+    };
+
+}; // end of namespace
+
+#endif // AICORE_SPATIAL_H
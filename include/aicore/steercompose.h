@@ -0,0 +1,323 @@
+/*
+ * Defines the templates used to combine steering behaviours at
+ * compile time.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * Holds versions of BlendedSteering and PrioritySteering whose
+ * behaviours are fixed when the code is compiled. BlendedSteering and
+ * PrioritySteering keep a list of pointers, and make a virtual call
+ * for each behaviour in the list, which the compiler can't see
+ * through. Most characters use a fixed recipe, though ("seek the
+ * goal, but flee the player at half weight"), and for these the
+ * behaviours can be given as template parameters instead:
+ *
+ * <pre>
+ * typedef StaticBlendedSteering<
+ *     Weighted<Seek>,
+ *     Weighted<Flee, std::ratio<1,2> >
+ *     > Recipe;
+ *
+ * Recipe recipe;
+ * recipe.get<0>().target = &goal;
+ * recipe.get<1>().target = &player.position;
+ * </pre>
+ *
+ * The combinators hold their behaviours by value and call each
+ * behaviour's own getSteering directly, rather than through the
+ * virtual table, so the whole recipe can be inlined into one piece of
+ * code. The weights are compile time ratios, so the total weight and
+ * its inverse are worked out by the compiler.
+ *
+ * Both combinators are steering behaviours themselves, so they can be
+ * nested in each other, or handed to anything that takes a
+ * SteeringBehaviour (at the cost of one virtual call for the whole
+ * recipe).
+ */
+#ifndef AICORE_STEERCOMPOSE_H
+#define AICORE_STEERCOMPOSE_H
+
+#include <ratio>
+#include <tuple>
+
+namespace aicore
+{
+    /**
+     * Gives a behaviour in a StaticBlendedSteering recipe its weight,
+     * as a std::ratio. Behaviours given without a weight have a
+     * weight of one.
+     */
+    template <typename Behaviour, typename Weight = std::ratio<1> >
+    struct Weighted
+    {
+    };
+
+    /**
+     * Gives the behaviour type and weight of one entry in a recipe,
+     * whether or not it was given with Weighted.
+     */
+    template <typename Entry>
+    struct StaticSteeringEntry
+    {
+        /** The type of the behaviour. */
+        typedef Entry Behaviour;
+
+        /** Returns the behaviour's weight. */
+        static constexpr real getWeight() { return (real)1; }
+    };
+
+    /** Gives the behaviour type and weight of a weighted entry. */
+    template <typename EntryBehaviour, typename Weight>
+    struct StaticSteeringEntry< Weighted<EntryBehaviour, Weight> >
+    {
+        /** The type of the behaviour. */
+        typedef EntryBehaviour Behaviour;
+
+        /** Returns the behaviour's weight. */
+        static constexpr real getWeight()
+        {
+            return (real)Weight::num / (real)Weight::den;
+        }
+    };
+
+    /** Adds up the weights of the entries in a recipe. */
+    template <typename... Entries>
+    struct StaticSteeringWeight;
+
+    /** The total weight of an empty recipe. */
+    template <>
+    struct StaticSteeringWeight<>
+    {
+        /** Returns the total weight. */
+        static constexpr real getTotal() { return (real)0; }
+    };
+
+    /** The total weight of a recipe with at least one entry. */
+    template <typename First, typename... Rest>
+    struct StaticSteeringWeight<First, Rest...>
+    {
+        /** Returns the total weight. */
+        static constexpr real getTotal()
+        {
+            return StaticSteeringEntry<First>::getWeight() +
+                StaticSteeringWeight<Rest...>::getTotal();
+        }
+    };
+
+    /**
+     * Used to step through the entries of a recipe at compile time.
+     */
+    template <unsigned index>
+    struct StaticSteeringIndex
+    {
+    };
+
+    /**
+     * Holds the behaviours of a compile time recipe, and the common
+     * code for the two kinds of combinator.
+     */
+    template <typename... Entries>
+    class StaticSteeringRecipe : public SteeringBehaviour
+    {
+    public:
+        /** The behaviours, in the order they were given. */
+        typedef std::tuple<
+            typename StaticSteeringEntry<Entries>::Behaviour...
+            > Behaviours;
+
+        /** The number of behaviours in the recipe. */
+        static constexpr unsigned getCount()
+        {
+            return (unsigned)sizeof...(Entries);
+        }
+
+        /**
+         * Returns the behaviour at the given position in the recipe,
+         * so it can be set up. The character of each behaviour is set
+         * from the recipe's own when it is run.
+         */
+        template <unsigned index>
+        typename std::tuple_element<index, Behaviours>::type& get()
+        {
+            return std::get<index>(behaviours);
+        }
+
+        /** Returns the behaviour at the given position in the recipe. */
+        template <unsigned index>
+        const typename std::tuple_element<index, Behaviours>::type& get() const
+        {
+            return std::get<index>(behaviours);
+        }
+
+    protected:
+        /** Holds the behaviours. */
+        Behaviours behaviours;
+
+        /** Creates a recipe with default constructed behaviours. */
+        StaticSteeringRecipe()
+        {
+            character = NULL;
+        }
+
+        /**
+         * Runs the behaviour at the given position for the recipe's
+         * character, calling its getSteering without going through
+         * the virtual table.
+         */
+        template <unsigned index>
+        void run(SteeringOutput *output)
+        {
+            typedef typename std::tuple_element<index, Behaviours>::type
+                Behaviour;
+            Behaviour &behaviour = std::get<index>(behaviours);
+            behaviour.character = character;
+            behaviour.Behaviour::getSteering(output);
+        }
+
+    private:
+        // Behaviours such as Wander point into themselves, so the
+        // recipe can't be copied.
+        StaticSteeringRecipe(const StaticSteeringRecipe &);
+        StaticSteeringRecipe& operator=(const StaticSteeringRecipe &);
+    };
+
+    /**
+     * Blends the behaviours given as template parameters, in the same
+     * way as BlendedSteering. Each parameter is either a behaviour
+     * type, which has a weight of one, or a Weighted behaviour type.
+     *
+     * Each behaviour is run into its own cleared output, so a
+     * behaviour that only gives linear acceleration adds no angular
+     * acceleration to the blend.
+     */
+    template <typename... Entries>
+    class StaticBlendedSteering : public StaticSteeringRecipe<Entries...>
+    {
+        typedef StaticSteeringRecipe<Entries...> Recipe;
+
+        /** Adds the weighted output of each behaviour from index on. */
+        template <unsigned index>
+        void blend(SteeringOutput *output, StaticSteeringIndex<index>)
+        {
+            typedef typename std::tuple_element<
+                index, std::tuple<Entries...> >::type Entry;
+            const real weight = StaticSteeringEntry<Entry>::getWeight();
+
+            SteeringOutput temp;
+            Recipe::template run<index>(&temp);
+            output->linear += temp.linear * weight;
+            output->angular += temp.angular * weight;
+
+            blend(output, StaticSteeringIndex<index+1>());
+        }
+
+        /** Ends the blend after the last behaviour. */
+        void blend(SteeringOutput *,
+                   StaticSteeringIndex<sizeof...(Entries)>)
+        {
+        }
+
+    public:
+        /** Returns the total weight of the behaviours. */
+        static constexpr real getTotalWeight()
+        {
+            return StaticSteeringWeight<Entries...>::getTotal();
+        }
+
+        /**
+         * Works out the desired steering and writes it into the given
+         * steering output structure.
+         */
+        virtual void getSteering(SteeringOutput* output)
+        {
+            output->clear();
+            blend(output, StaticSteeringIndex<0>());
+
+            // Divide by the total weight, worked out when compiling.
+            if (getTotalWeight() > 0)
+            {
+                const real inverse = (real)1.0 / getTotalWeight();
+                output->linear *= inverse;
+                output->angular *= inverse;
+            }
+        }
+    };
+
+    /**
+     * Uses the first of the behaviours given as template parameters
+     * that gives a result, in the same way as PrioritySteering.
+     */
+    template <typename... Behaviours>
+    class StaticPrioritySteering : public StaticSteeringRecipe<Behaviours...>
+    {
+        typedef StaticSteeringRecipe<Behaviours...> Recipe;
+
+        /**
+         * Tries each behaviour from index on, returning the index of
+         * the one used.
+         */
+        template <unsigned index>
+        unsigned choose(SteeringOutput *output, real epSquared,
+                        StaticSteeringIndex<index>)
+        {
+            output->clear();
+            Recipe::template run<index>(output);
+            if (output->squareMagnitude() > epSquared) return index;
+
+            return choose(output, epSquared, StaticSteeringIndex<index+1>());
+        }
+
+        /** Reports that no behaviour gave a result. */
+        unsigned choose(SteeringOutput *, real,
+                        StaticSteeringIndex<sizeof...(Behaviours)>)
+        {
+            return Recipe::getCount();
+        }
+
+    public:
+        /**
+         * After running this behaviour, this holds the position in the
+         * recipe of the behaviour that was used, or getCount() if none
+         * of them gave a result (in which case the output is the last
+         * behaviour's).
+         */
+        unsigned lastUsed;
+
+        /**
+         * The threshold of the steering output magnitude below which a
+         * steering behaviour is considered to have given no output.
+         */
+        real epsilon;
+
+        /** Creates a recipe with the given threshold. */
+        StaticPrioritySteering(real epsilon = (real)0.001)
+            :
+            lastUsed(Recipe::getCount()), epsilon(epsilon)
+        {
+        }
+
+        /**
+         * Works out the desired steering and writes it into the given
+         * steering output structure.
+         */
+        virtual void getSteering(SteeringOutput* output)
+        {
+            output->clear();
+            lastUsed = choose(output, epsilon*epsilon,
+                              StaticSteeringIndex<0>());
+        }
+    };
+
+}; // end of namespace
+
+#endif // AICORE_STEERCOMPOSE_H
@@ -23,10 +23,14 @@
 #ifndef AICORE_STEERING_H
 #define AICORE_STEERING_H
 
+#include <deque>
+#include <list>
 #include <vector>
 
 namespace aicore
 {
+    class SphereHierarchy;
+
     /**
      * The steering behaviour is the base class for all dynamic
      * steering behaviours.
@@ -39,9 +43,20 @@ namespace aicore
          */
         Kinematic *character;
 
+        /**
+         * Behaviours are often owned and deleted through this base
+         * class, so they need to be destroyed through it.
+         */
+        virtual ~SteeringBehaviour() {}
+
         /**
          * Works out the desired steering and writes it into the given
          * steering output structure.
+         *
+         * @note Many behaviours keep working data in their members,
+         * so one behaviour object must not have this called from two
+         * threads at once. Separate behaviour objects can be used in
+         * parallel, see jobs.h.
          */
         virtual void getSteering(SteeringOutput* output) = 0;
     };
@@ -66,6 +81,16 @@ namespace aicore
          */
         real maxAcceleration;
 
+        /**
+         * Set to use the approximations in fastmath.h rather than the
+         * C library. The steering then differs from the exact result
+         * by a few millionths of the acceleration.
+         */
+        bool fastMath;
+
+        /** Creates a behaviour using exact maths. */
+        Seek() : fastMath(false) {}
+
         /**
          * Works out the desired steering and writes it into the given
          * steering output structure.
@@ -87,6 +112,95 @@ namespace aicore
         virtual void getSteering(SteeringOutput* output);
     };
 
+    /**
+     * Holds the positions of moving targets that many characters are
+     * tracking, worked out once a frame rather than once per
+     * character. A squad of units chasing one enemy can point all of
+     * their Seek or Flee behaviours at the same cached position:
+     *
+     * <pre>
+     * const Vector3 *ahead = cache.add(&enemy, (real)0.5);
+     * for (unsigned i = 0; i < squadSize; i++) seeks[i].target = ahead;
+     *
+     * // Then each frame, before the squad's steering is run.
+     * cache.update();
+     * </pre>
+     *
+     * Each target is predicted a fixed time ahead along its velocity,
+     * so a lookahead of zero just tracks its position.
+     */
+    class TargetCache
+    {
+        /** Holds one target being tracked. */
+        struct Entry
+        {
+            /** The character being tracked. */
+            const Kinematic *kinematic;
+
+            /** How far ahead, in seconds, to predict its position. */
+            real lookahead;
+
+            /** The predicted position, which behaviours point at. */
+            Vector3 position;
+        };
+
+        /**
+         * Holds the targets. A deque is used so that adding a target
+         * doesn't move the positions already handed out.
+         */
+        std::deque<Entry> entries;
+
+        /** The frame the positions were last worked out for. */
+        unsigned lastFrame;
+
+        /** Set when the positions have been worked out at least once. */
+        bool updated;
+
+        /** Works out the predicted position of one target. */
+        static void predict(Entry *entry);
+
+    public:
+        /** Creates an empty cache. */
+        TargetCache();
+
+        /**
+         * Starts tracking the given character, and returns the
+         * position behaviours should aim at. The position stays at
+         * the same address until the cache is cleared, and is
+         * already set for the current frame.
+         *
+         * @param lookahead How far ahead, in seconds, to predict the
+         * character's position.
+         */
+        const Vector3* add(const Kinematic *kinematic, real lookahead = 0);
+
+        /** Returns the number of targets being tracked. */
+        unsigned getCount() const { return (unsigned)entries.size(); }
+
+        /**
+         * Stops tracking every target. Behaviours pointing at their
+         * positions must be given new targets.
+         */
+        void clear();
+
+        /**
+         * Works out the positions of the targets for the given frame.
+         * This does nothing if they have already been worked out for
+         * that frame, so it can be called by every system that needs
+         * the targets.
+         */
+        void update(unsigned frame);
+
+        /** Works out the positions of the targets for the current frame. */
+        void update();
+
+        /**
+         * Makes the next update work out the positions again, even
+         * in the same frame, after the targets have been moved.
+         */
+        void invalidate() { updated = false; }
+    };
+
 	/**
 	 * This subclass of seek is only intended as a base class for steering
 	 * behaviours that create their own internal target, rather than having
@@ -115,6 +229,10 @@ namespace aicore
 	 *
 	 * The seek target for this class is created and destroyed by the 
 	 * class, and should not be assigned to.
+	 *
+	 * With fastMath set, the target is moved to the volatility circle
+	 * by scaling the offset to it, rather than going through its angle,
+	 * which gives the same result without any trigonometry.
 	 */
 	class Wander : public SeekWithInternalTarget
 	{
@@ -133,6 +251,23 @@ namespace aicore
 		 */
 		real turnSpeed;
 
+		/**
+		 * The random number generator used to move the target. If
+		 * this is null, the calling thread's engine is used. Give
+		 * each character its own engine for results that can be
+		 * repeated.
+		 */
+		RandomEngine *random;
+
+		/** Creates a behaviour using the calling thread's engine. */
+		Wander() : random(0) {}
+
+		/** Returns the random number generator to use. */
+		RandomEngine& getRandom()
+		{
+			return random ? *random : getRandomEngine();
+		}
+
 		/**
 		 * Works out the desired steering and writes it into the given
 		 * steering output structure.
@@ -171,9 +306,66 @@ namespace aicore
 		virtual void getSteering(SteeringOutput* output);
 	};
 
+	/**
+	 * Avoids any number of spherical obstacles with one behaviour, in
+	 * place of a PrioritySteering over one AvoidSphere per obstacle.
+	 * Of the obstacles the current movement would collide with, the
+	 * one whose closest pass is soonest is avoided, as the first of
+	 * the list in the priority steering would usually be. If there
+	 * is no collision, the steering output will be zero.
+	 */
+	class AvoidSpheres : public SeekWithInternalTarget
+	{
+		/**
+		 * Holds the obstacles returned by the broadphase. This is kept
+		 * between calls so it doesn't need to be reallocated.
+		 */
+		std::vector<Sphere*> candidates;
+
+	public:
+		/**
+		 * Holds the list of obstacles to avoid. This is ignored if a
+		 * broadphase is given.
+		 */
+		std::list<Sphere*> obstacles;
+
+		/**
+		 * Holds an optional hierarchy of the obstacles to avoid. If this
+		 * is set, then only the obstacles in the hierarchy near the
+		 * lookahead are checked, rather than every obstacle in the
+		 * obstacles list. The hierarchy isn't owned by the behaviour,
+		 * so it can be shared between any number of behaviours.
+		 */
+		const SphereHierarchy *broadphase;
+
+		/**
+		 * By how much do we want to avoid the collision?
+		 */
+		real avoidMargin;
+
+		/**
+		 * How far ahead do we want to look for collisions?
+		 */
+		real maxLookahead;
+
+		/** Creates a new behaviour with no obstacles. */
+		AvoidSpheres();
+
+		/**
+		* Works out the desired steering and writes it into the given
+		* steering output structure.
+		*/
+		virtual void getSteering(SteeringOutput* output);
+	};
+
 	/**
 	 * Blended steering takes a set of steering behaviours and generates an
 	 * output by doing a weighted blend of their outputs.
+	 *
+	 * The weighted outputs, and the weights, are always added up in the
+	 * order of the list, one component at a time, so the same list gives
+	 * bit-identical results on every machine built in deterministic mode
+	 * (see the AICORE_DETERMINISTIC build option).
 	 */
 	class BlendedSteering : public SteeringBehaviour
 	{
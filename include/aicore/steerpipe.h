@@ -86,6 +86,12 @@ namespace aicore
 		*/
 		virtual real getMaxPriority();
 
+		/**
+		 * Paths are created by actuators and deleted by the pipe, so they
+		 * need to be destroyed through this base class.
+		 */
+		virtual ~Path() {}
+
 	};
 
 	// Forward declaration.
@@ -100,6 +106,14 @@ namespace aicore
 	protected:
 		friend class SteeringPipe;
 		SteeringPipe *pipe;
+
+	public:
+		/**
+		 * Targeters, decomposers, constraints and actuators may be
+		 * deleted through this base class, so they need to be destroyed
+		 * through it.
+		 */
+		virtual ~SteeringPipeComponent() {}
 	};
 
 	/**
@@ -112,6 +126,17 @@ namespace aicore
 		 * Returns the goal that this targeter is heading for.
 		 */
 		virtual Goal getGoal() = 0;
+
+		/**
+		 * Writes the goal that this targeter is heading for into the given
+		 * goal. The pipe uses this rather than getGoal, so that targeters 
+		 * can avoid building and copying a temporary goal. The default 
+		 * implementation calls getGoal.
+		 */
+		virtual void fillGoal(Goal* goal)
+		{
+			*goal = getGoal();
+		}
 	};
 
 	/**
@@ -124,6 +149,16 @@ namespace aicore
 		 * Decomposes the given goal into a sub-goal.
 		 */
 		virtual Goal decomposeGoal(const Goal& goal) = 0;
+
+		/**
+		 * Decomposes the given goal into a sub-goal, replacing its contents.
+		 * The pipe uses this rather than decomposeGoal. The default 
+		 * implementation calls decomposeGoal.
+		 */
+		virtual void decomposeInPlace(Goal* goal)
+		{
+			*goal = decomposeGoal(*goal);
+		}
 	};
 
 	/**
@@ -162,6 +197,161 @@ namespace aicore
 		 * wouldn't violate this constraint.
 		 */
 		virtual Goal suggest(const Path* path) = 0;
+
+		/**
+		 * Writes a new sub-goal that wouldn't violate this constraint into
+		 * the given goal. The pipe uses this rather than suggest. The 
+		 * default implementation calls suggest.
+		 */
+		virtual void fillSuggestion(const Path* path, Goal* goal)
+		{
+			*goal = suggest(path);
+		}
+	};
+
+	/**
+	 * Remembers the last results of a constraint for each character,
+	 * so that a constraint can skip its test when nothing has changed
+	 * since the last frame. A result is reused while the character and
+	 * the goal of the path are within epsilon of where they were, and
+	 * the obstacles are the same version. A few results are kept for
+	 * each character, one for each goal the pipe tried, so a frame that
+	 * goes through the same suggestions as the last can reuse them all.
+	 *
+	 * Results are held in an array by the pipe's characterIndex, so
+	 * characters should keep the same index from frame to frame, as
+	 * they do when the same batch is steered each frame. A character
+	 * found at an index that held another starts with no results.
+	 *
+	 * Only the character's position and the path's goal are compared,
+	 * so this shouldn't be used by constraints that look at anything
+	 * else in the path, or at the character's velocity.
+	 */
+	class ConstraintCache
+	{
+		/** Holds the last result for one character. */
+		struct Entry
+		{
+			/** The position of the character when it was tested. */
+			Vector3 position;
+
+			/** The goal of the path that was tested. */
+			Goal goal;
+
+			/** The maximum priority that was asked for. */
+			real maxPriority;
+
+			/** The priority given by the constraint. */
+			real priority;
+
+			/** The suggestion of the constraint, if it was violated. */
+			Goal suggestion;
+
+			/** The version of the cache when the result was stored. */
+			unsigned version;
+
+			/** The version of the obstacles given with the result. */
+			unsigned obstacleVersion;
+		};
+
+		/** Holds the results for one character. */
+		struct CharacterEntries
+		{
+			/** The character the results are for. */
+			const Kinematic *character;
+
+			/** The results, in no particular order. */
+			Entry entries[4];
+
+			/** The number of results held. */
+			unsigned count;
+
+			/** The result to replace next, once they are all used. */
+			unsigned next;
+
+			CharacterEntries() : character(0), count(0), next(0) {}
+		};
+
+		/** The results for each character, by its index in the pipe. */
+		std::vector<CharacterEntries> characters;
+
+		/** Counts the calls to invalidate. */
+		unsigned version;
+
+		/** Counts the lookups that found a result. */
+		unsigned long hits;
+
+		/** Counts the lookups that didn't. */
+		unsigned long misses;
+
+		/** Checks if two goals set the same channels to near values. */
+		bool goalsMatch(const Goal &a, const Goal &b) const;
+
+	public:
+		/**
+		 * Set to use the cache. Caching is off by default, as it
+		 * relies on being told when the obstacles change.
+		 */
+		bool enabled;
+
+		/**
+		 * How far the character or the goal can move before a result
+		 * is worked out again. At zero, results are only reused when
+		 * nothing has moved, which gives exactly the same steering as
+		 * no cache.
+		 */
+		real epsilon;
+
+		/** Creates an empty, disabled cache. */
+		ConstraintCache();
+
+		/**
+		 * Looks for a result that can be reused.
+		 *
+		 * @param index The character's index, as given by the pipe's
+		 * characterIndex.
+		 *
+		 * @param obstacleVersion A number that changes whenever the
+		 * obstacles do, such as SphereHierarchy::getVersion.
+		 *
+		 * @return True if a result was found, in which case it is
+		 * written into priority and, if the constraint was violated,
+		 * suggestion.
+		 */
+		bool find(unsigned index, const Kinematic *character,
+			const Path *path, real maxPriority, unsigned obstacleVersion,
+			real *priority, Goal *suggestion);
+
+		/** Stores the result of a test. */
+		void store(unsigned index, const Kinematic *character,
+			const Path *path,
+			real maxPriority, unsigned obstacleVersion,
+			real priority, const Goal &suggestion);
+
+		/**
+		 * Throws away every stored result. Call this when obstacles
+		 * that aren't versioned are moved, added or removed.
+		 */
+		void invalidate()
+		{
+			version++;
+		}
+
+		/**
+		 * Forgets every character. Call this when characters are
+		 * deleted, so a new character at the same address isn't given
+		 * their results.
+		 */
+		void clear()
+		{
+			characters.clear();
+		}
+
+		/** Returns the number of lookups that found a result. */
+		unsigned long getHitCount() const { return hits; }
+
+		/** Returns the number of lookups that didn't find a result. */
+		unsigned long getMissCount() const { return misses; }
 	};
 
 	/**
@@ -189,6 +379,108 @@ namespace aicore
 		virtual void getSteering(SteeringOutput* output, const Path* path) = 0;
 	};
 
+	/**
+	 * Holds one character's progress through time-sliced constraint
+	 * solving, so that a solution can be worked on over several frames
+	 * (see SteeringPipe::getSteering(SteeringOutput*,
+	 * SteeringPipeProgress*, SteeringPipeBudget*)). Each character
+	 * steered in time-sliced mode needs its own progress, which must be
+	 * kept between frames.
+	 */
+	class SteeringPipeProgress
+	{
+	public:
+		/**
+		 * The goal being solved for, which includes the suggestions of
+		 * the constraints so far.
+		 */
+		Goal goal;
+
+		/** The path being checked against the constraints. */
+		Path *working;
+
+		/** The last path that satisfied every constraint. */
+		Path *valid;
+
+		/** The number of constraint steps taken on the current goal. */
+		unsigned steps;
+
+		/**
+		 * Set while a goal is being solved. When this is false the next
+		 * update starts again from the targeters.
+		 */
+		bool solving;
+
+		/** Set if the valid path can be used. */
+		bool hasValid;
+
+		/** Creates progress with no paths, waiting to start. */
+		SteeringPipeProgress();
+
+		/** Releases the paths. */
+		~SteeringPipeProgress();
+
+		/**
+		 * Releases the paths and forgets any progress. This must be
+		 * called if the pipe's actuator is changed, as the paths are
+		 * created by the actuator.
+		 */
+		void clear();
+
+	private:
+		// The progress owns its paths, so can't be copied.
+		SteeringPipeProgress(const SteeringPipeProgress &);
+		SteeringPipeProgress& operator=(const SteeringPipeProgress &);
+	};
+
+	/**
+	 * Holds the number of constraint steps that can be spent in a
+	 * frame, shared between all the characters steered in time-sliced
+	 * mode. Each character can take up to a maximum, so a few difficult
+	 * characters can't use up the whole frame.
+	 */
+	class SteeringPipeBudget
+	{
+		/** The steps left this frame. */
+		unsigned remaining;
+
+	public:
+		/** The number of steps to hand out each frame. */
+		unsigned stepsPerFrame;
+
+		/** The most steps one character can take in one frame. */
+		unsigned maxStepsPerCharacter;
+
+		/** Creates a budget, ready for the first frame. */
+		SteeringPipeBudget(unsigned stepsPerFrame = 256,
+			unsigned maxStepsPerCharacter = 8);
+
+		/** Refills the budget. Call this once at the start of each frame. */
+		void beginFrame()
+		{
+			remaining = stepsPerFrame;
+		}
+
+		/** Returns the number of steps left this frame. */
+		unsigned getRemaining() const
+		{
+			return remaining;
+		}
+
+		/** Returns the most steps the next character can take. */
+		unsigned getAllowance() const
+		{
+			return remaining < maxStepsPerCharacter ? 
+				remaining : maxStepsPerCharacter;
+		}
+
+		/** Takes the given number of steps from the budget. */
+		void spend(unsigned steps)
+		{
+			remaining -= steps < remaining ? steps : remaining;
+		}
+	};
+
 	/**
 	 * The main steering system that processes the steering pipeline and outputs
 	 * a steering requirements. This should be capable of managing any set of 
@@ -200,6 +492,57 @@ namespace aicore
 	{
 		Actuator* actuator;
 
+		/**
+		 * Holds one path object for each character in the last batch. These 
+		 * are kept between calls so they only need creating when the batch 
+		 * grows.
+		 */
+		std::vector<Path*> batchPaths;
+
+		/** Holds the current goal of each character in the batch. */
+		std::vector<Goal> batchGoals;
+
+		/** Holds the characters in the batch still resolving constraints. */
+		std::vector<unsigned> batchPending;
+
+		/**
+		 * Holds the number of heap allocations the pipe has made for its
+		 * own storage.
+		 */
+		unsigned allocations;
+
+		/**
+		 * Holds the position in the last time-sliced batch of the first
+		 * character that ran out of budget, so it goes first next time.
+		 */
+		unsigned sliceStart;
+
+		/** Releases the paths used for batch processing. */
+		void clearBatchPaths();
+
+		/**
+		 * Makes sure the progress has its paths, and if it isn't
+		 * solving, starts on a new goal from the targeters and
+		 * decomposers.
+		 */
+		void beginSolving(SteeringPipeProgress *progress);
+
+		/**
+		 * Takes up to the given number of constraint steps for the
+		 * current character.
+		 *
+		 * @return The number of steps taken.
+		 */
+		unsigned continueSolving(SteeringPipeProgress *progress,
+			unsigned allowance);
+
+		/**
+		 * Works out the steering from the valid path, or the fallback
+		 * if there isn't one.
+		 */
+		void getProgressSteering(SteeringOutput *output,
+			const SteeringPipeProgress *progress);
+
 	public:
 		std::list<Targeter*> targeters;
 		std::list<Decomposer*> decomposers;
@@ -218,10 +561,19 @@ namespace aicore
 
 		/**
 		 * Holds the final path that was generated by the system. This is written
-		 * to each time the code is run.
+		 * to each time the code is run (but not by batch processing).
 		 */
 		Path * path;
 
+		/**
+		 * The position of the current character in the batch being
+		 * steered, so components can keep data for each character in
+		 * an array. Batch processing sets this for each character in
+		 * turn; when steering one character at a time it is left as
+		 * the caller sets it, which is zero to begin with.
+		 */
+		unsigned characterIndex;
+
 		/**
 		 * Creates a new steering pipeline.
 		 */
@@ -238,6 +590,76 @@ namespace aicore
 		 */
 		void getSteering(SteeringOutput* output);
 
+		/**
+		 * Works out the steering output for each of a set of characters
+		 * sharing this pipe's components. This gives the same results as
+		 * setting the character and calling getSteering for each in turn,
+		 * but runs each stage of the pipeline for every character before
+		 * moving on to the next stage: all the targeters run first, then
+		 * all the decomposers, then each round of constraint checking is 
+		 * done for every character still resolving, and finally the 
+		 * actuator runs. This keeps the code and data of each stage in 
+		 * the cache.
+		 *
+		 * Constraints calculate their suggestion when checking for 
+		 * violation, so each character's constraint checks and suggestion 
+		 * are kept together. Because components hold this kind of state, 
+		 * a pipe should only be run from one thread at a time; batches 
+		 * can be processed in parallel using one pipe per thread.
+		 *
+		 * The fallback behaviour has its character set to each character
+		 * that needs it in turn.
+		 *
+		 * The suggestionUsed flag of each constraint is set if its 
+		 * suggestion was used for any character in the batch. The 
+		 * character of the pipe is left unchanged.
+		 *
+		 * @param characters The array of characters to steer.
+		 *
+		 * @param outputs An array of the same size to write the steering
+		 * of each character into.
+		 *
+		 * @param count The number of characters.
+		 */
+		void getSteering(Kinematic** characters, 
+			SteeringOutput* outputs, unsigned count);
+
+		/**
+		 * Works out the steering output in time-sliced mode. Rather than
+		 * resolving the constraints all at once, the current character's
+		 * progress is carried on from where it stopped, for as many
+		 * steps as the budget allows. A new goal is only taken from the
+		 * targeters once the last one has been solved, or has used up
+		 * constraintSteps steps.
+		 *
+		 * While a goal is being solved the character follows the last
+		 * path that satisfied the constraints. If it has none, or the
+		 * last goal couldn't be solved, the fallback is used.
+		 *
+		 * @param progress The current character's progress, which must
+		 * be kept between frames.
+		 *
+		 * @param budget The steps that can be spent this frame, which
+		 * is reduced by the steps taken. If this is null, the goal is
+		 * solved in one go, as by getSteering(SteeringOutput*).
+		 */
+		void getSteering(SteeringOutput* output,
+			SteeringPipeProgress* progress, SteeringPipeBudget* budget);
+
+		/**
+		 * Works out the steering output for each of a set of characters
+		 * in time-sliced mode, sharing the budget between them. If the
+		 * budget runs out, the first character left without steps goes
+		 * first the next time the batch is run, so no character waits
+		 * for ever.
+		 *
+		 * @param progress An array holding the progress of each
+		 * character, which must be kept between frames.
+		 */
+		void getSteering(Kinematic** characters, SteeringOutput* outputs,
+			SteeringPipeProgress* progress, unsigned count, 
+			SteeringPipeBudget* budget);
+
 		/**
 		 * Call this method to initialise all the components after you have
 		 * added them, and before you call getSteering. This only needs to
@@ -245,6 +667,28 @@ namespace aicore
 		 * constraints, or if you change actuator.
 		 */
 		void registerComponents();
+
+		/**
+		 * Makes sure the pipe has all the storage it needs to process 
+		 * batches of up to the given number of characters (or single 
+		 * characters if count is zero). Anything not allocated here will 
+		 * be allocated the first time it is needed, after which the pipe 
+		 * makes no further allocations. This must be called after the 
+		 * actuator is set, and again if it changes.
+		 */
+		void reserve(unsigned count);
+
+		/**
+		 * Returns the number of heap allocations the pipe has made for its 
+		 * paths and working storage. Once the pipe has processed the 
+		 * largest batch it will see, this stops increasing, so it can be 
+		 * checked to make sure the pipe isn't allocating each frame. 
+		 * Allocations made by the components themselves aren't counted.
+		 */
+		unsigned getAllocationCount() const
+		{
+			return allocations;
+		}
 	};
 
 
@@ -260,6 +704,7 @@ namespace aicore
 	public:
 		Goal goal;
 		virtual Goal getGoal();
+		virtual void fillGoal(Goal* goal);
 	};
 
 	/**
@@ -277,6 +722,12 @@ namespace aicore
 		 */
 		Goal suggestion;
 
+		/**
+		 * Holds the obstacles returned by the broadphase. This is kept
+		 * between calls so it doesn't need to be reallocated.
+		 */
+		std::vector<Sphere*> candidates;
+
 		/** 
 		 * Checks for violation on one obstacle.
 		 */
@@ -285,19 +736,48 @@ namespace aicore
 			real maxPriority, 
 			Sphere &obstacle
 			);
+
+		/** Checks for violation on every obstacle, without the cache. */
+		real testObstacles(const Path* path, real maxPriority);
 	public:
 		/**
-		 * Holds the list of obstacles to avoid.
+		 * Holds the list of obstacles to avoid. This is ignored if a
+		 * broadphase is given.
 		 */
 		std::list<Sphere*> obstacles;
 
+		/**
+		 * Holds an optional hierarchy of the obstacles to avoid. If this
+		 * is set, then only the obstacles in the hierarchy that are near
+		 * the path (up to the maximum priority) are checked, rather than
+		 * every obstacle in the obstacles list. The hierarchy isn't
+		 * owned by the constraint, so it can be shared between any
+		 * number of constraints.
+		 */
+		const SphereHierarchy *broadphase;
+
 		/**
 		 * How much margin to avoid the obstacle by.
 		 */
 		real avoidMargin;
 
+		/**
+		 * Holds the results of earlier frames. When enabled, the
+		 * broadphase's version is checked automatically, but if the
+		 * obstacles list is used, or the spheres are moved without
+		 * building the broadphase again, then the cache must be
+		 * invalidated.
+		 */
+		ConstraintCache cache;
+
+		/**
+		 * Creates a new constraint with no obstacles.
+		 */
+		AvoidSpheresConstraint();
+
 		virtual real willViolate(const Path* path, real maxPriority);
 		virtual Goal suggest(const Path* path);
+		virtual void fillSuggestion(const Path* path, Goal* goal);
 	};
 	
 	/**
@@ -17,6 +17,16 @@
  * the components in this file are very likely to need replacing for
  * different platforms, since the implementation relies on operating
  * system-provided timing services.
+ *
+ * All times come from a monotonic clock, so they never jump backwards
+ * when the system clock is changed. The processor clock returned by
+ * getClock is cheap to read but runs at a rate that depends on the
+ * machine: it is calibrated against the monotonic clock when it is
+ * first needed, and getClockFrequency converts between the two.
+ *
+ * The FixedTimestep class runs the AI at a steady rate, however fast
+ * the frames are being drawn. Its ticks can also be driven by hand,
+ * for simulations that must run identically on several machines.
  */
 #ifndef AICORE_TIMING_H
 #define AICORE_TIMING_H
@@ -54,6 +64,17 @@ namespace aicore
          */
         unsigned long lastFrameClockTicks;
 
+        /**
+         * The monotonic time at the end of the last frame, in
+         * nanoseconds since some undefined time.
+         */
+        unsigned long long lastFrameNanostamp;
+
+        /**
+         * The duration of the last frame in nanoseconds.
+         */
+        unsigned long long lastFrameNanoseconds;
+
         /**
          * Keeps track of whether the rendering is paused.
          */
@@ -78,6 +99,11 @@ namespace aicore
          */
         static TimingData& get();
 
+        /**
+         * Checks if init has been called, so get() can be used.
+         */
+        static bool isInitialised();
+
         /**
          * Updates the timing system, should be called once per frame.
          */
@@ -101,16 +127,125 @@ namespace aicore
         static unsigned getTime();
 
         /**
-         * Gets the clock ticks since process start.
+         * Gets the time from the monotonic clock, in nanoseconds since
+         * some undefined time. This is safe to call from any thread.
+         */
+        static unsigned long long getNanoseconds();
+
+        /**
+         * Gets the clock ticks since some undefined time. On x86
+         * processors this reads the time stamp counter, after all
+         * earlier instructions have finished. Elsewhere it is the
+         * monotonic time in nanoseconds. This is safe to call from
+         * any thread.
          */
         static unsigned long getClock();
 
+        /**
+         * Gets the number of clock ticks per second. The first call
+         * measures the clock against the monotonic clock, which takes
+         * a few milliseconds; init makes this call.
+         */
+        static double getClockFrequency();
+
+        /** Converts a number of clock ticks into seconds. */
+        static double clockToSeconds(unsigned long ticks)
+        {
+            return (double)ticks / getClockFrequency();
+        }
+
 
     private:
         // These are private to stop instances being created: use get().
         TimingData() {}
         TimingData(const TimingData &) {}
-        TimingData& operator=(const TimingData &) {}
+        TimingData& operator=(const TimingData &) { return *this; }
+    };
+
+    /**
+     * Turns the time taken by each rendered frame into a whole number
+     * of AI ticks at a fixed rate. Time that doesn't make up a whole
+     * tick is carried over to the next frame, so over many frames the
+     * AI runs at exactly the given rate, and always with the same
+     * step, whatever the frame rate.
+     *
+     * A typical main loop is:
+     *
+     * <pre>
+     * TimingData::update();
+     * for (unsigned n = timestep.update(); n > 0; n--)
+     * {
+     *     runAI(timestep.getStep());
+     * }
+     * render(timestep.getInterpolation());
+     * </pre>
+     */
+    class FixedTimestep
+    {
+        /** The length of a tick in seconds. */
+        double step;
+
+        /** The time that hasn't been used up by ticks yet. */
+        double accumulator;
+
+        /** The most ticks to run for one frame. */
+        unsigned maxTicks;
+
+        /** The number of ticks run so far. */
+        unsigned long long tickCount;
+
+    public:
+        /**
+         * Creates a timestep that runs the given number of ticks per
+         * second. If a frame takes so long that more than maxTicks
+         * ticks are due, the extra time is dropped, so the AI slows
+         * down rather than falling further and further behind.
+         */
+        FixedTimestep(double ticksPerSecond = 30.0, unsigned maxTicks = 5);
+
+        /** Sets the number of ticks per second. */
+        void setRate(double ticksPerSecond);
+
+        /** Returns the length of a tick, in seconds. */
+        double getStep() const { return step; }
+
+        /** Returns the number of ticks run so far. */
+        unsigned long long getTickCount() const { return tickCount; }
+
+        /**
+         * Returns how far the time carried over is through the next
+         * tick, from 0 to 1. This can be used to interpolate between
+         * the last two AI states when drawing.
+         */
+        double getInterpolation() const { return accumulator / step; }
+
+        /** Throws away any time carried over and the tick count. */
+        void reset();
+
+        /**
+         * Adds the given number of seconds, and returns the number of
+         * ticks that should be run for them.
+         */
+        unsigned advance(double seconds);
+
+        /**
+         * Adds the duration of the last frame recorded by
+         * TimingData::update, and returns the number of ticks that
+         * should be run. No time passes while the timing data is
+         * paused.
+         */
+        unsigned update();
+
+        /**
+         * Counts one tick without looking at any clock. This is used
+         * in lockstep simulations, where each node runs a tick when
+         * the inputs for it arrive rather than when its own clock
+         * says so. The tick count can then be used as the frame
+         * number for anything that needs one (see
+         * DecisionBlackboard::frame and UpdateScheduler::schedule), so
+         * every node sees the same frames and the same step.
+         */
+        void tick() { tickCount++; }
     };
 
 
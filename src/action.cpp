@@ -10,10 +10,186 @@
  * software licence.
  */
 #include <stdio.h>
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <atomic>
 #include <aicore/aicore.h>
 
 namespace aicore
 {
+    /** The number of different sizes of object the pool holds. */
+    static const unsigned POOL_CLASSES =
+        ActionPool::MAX_SIZE / ActionPool::GRANULARITY;
+
+    /** Links together the free blocks of one size. */
+    struct PoolBlock
+    {
+        PoolBlock *next;
+    };
+
+    /** The number of chunks taken from the system. */
+    static std::atomic<unsigned> poolChunks(0);
+
+    /**
+     * Holds free blocks given up by threads that have finished, so
+     * their memory can be used by other threads.
+     */
+    static std::mutex poolSharedLock;
+    static PoolBlock *poolShared[POOL_CLASSES];
+
+    /**
+     * Set once the thread's cache has been destroyed, so actions
+     * deleted later in the thread's exit (or during static
+     * destruction, on the main thread) use the shared lists instead.
+     * This has no destructor, so it can still be read then.
+     */
+    static thread_local bool poolCacheDestroyed = false;
+
+    /** Takes a new chunk and adds its blocks to the given list. */
+    static void carveChunk(unsigned sizeClass, PoolBlock **list)
+    {
+        size_t size = (sizeClass + 1) * ActionPool::GRANULARITY;
+        char *chunk = (char*)::operator new(ActionPool::CHUNK_SIZE);
+        poolChunks++;
+        for (size_t offset = 0; offset + size <= ActionPool::CHUNK_SIZE;
+             offset += size)
+        {
+            PoolBlock *block = (PoolBlock*)(chunk + offset);
+            block->next = *list;
+            *list = block;
+        }
+    }
+
+    /** Holds one thread's free lists. */
+    struct PoolCache
+    {
+        PoolBlock *free[POOL_CLASSES];
+
+        PoolCache()
+        {
+            for (unsigned i = 0; i < POOL_CLASSES; i++) free[i] = NULL;
+        }
+
+        /** Hands everything to the shared lists when the thread ends. */
+        ~PoolCache()
+        {
+            poolCacheDestroyed = true;
+            std::lock_guard<std::mutex> guard(poolSharedLock);
+            for (unsigned i = 0; i < POOL_CLASSES; i++)
+            {
+                while (free[i])
+                {
+                    PoolBlock *block = free[i];
+                    free[i] = block->next;
+                    block->next = poolShared[i];
+                    poolShared[i] = block;
+                }
+            }
+        }
+
+        /** Finds more free blocks of the given size class. */
+        void refill(unsigned sizeClass)
+        {
+            // Take anything a finished thread left behind first.
+            {
+                std::lock_guard<std::mutex> guard(poolSharedLock);
+                if (poolShared[sizeClass])
+                {
+                    free[sizeClass] = poolShared[sizeClass];
+                    poolShared[sizeClass] = NULL;
+                    return;
+                }
+            }
+
+            // Otherwise carve up a new chunk.
+            carveChunk(sizeClass, &free[sizeClass]);
+        }
+    };
+
+    static PoolCache& getPoolCache()
+    {
+        static thread_local PoolCache cache;
+        return cache;
+    }
+
+    void* ActionPool::allocate(size_t size)
+    {
+        if (size == 0) size = 1;
+        if (size > MAX_SIZE) return ::operator new(size);
+
+        unsigned sizeClass = (unsigned)((size - 1) / GRANULARITY);
+        if (poolCacheDestroyed)
+        {
+            std::lock_guard<std::mutex> guard(poolSharedLock);
+            if (!poolShared[sizeClass])
+            {
+                carveChunk(sizeClass, &poolShared[sizeClass]);
+            }
+            PoolBlock *block = poolShared[sizeClass];
+            poolShared[sizeClass] = block->next;
+            return block;
+        }
+
+        PoolCache &cache = getPoolCache();
+        if (!cache.free[sizeClass]) cache.refill(sizeClass);
+
+        PoolBlock *block = cache.free[sizeClass];
+        cache.free[sizeClass] = block->next;
+        return block;
+    }
+
+    void ActionPool::release(void *memory, size_t size)
+    {
+        if (!memory) return;
+        if (size == 0) size = 1;
+        if (size > MAX_SIZE)
+        {
+            ::operator delete(memory);
+            return;
+        }
+
+        unsigned sizeClass = (unsigned)((size - 1) / GRANULARITY);
+        PoolBlock *block = (PoolBlock*)memory;
+        if (poolCacheDestroyed)
+        {
+            std::lock_guard<std::mutex> guard(poolSharedLock);
+            block->next = poolShared[sizeClass];
+            poolShared[sizeClass] = block;
+            return;
+        }
+
+        PoolCache &cache = getPoolCache();
+        block->next = cache.free[sizeClass];
+        cache.free[sizeClass] = block;
+    }
+
+    void ActionPool::reserve(size_t size, unsigned count)
+    {
+        if (size == 0 || size > MAX_SIZE) return;
+
+        // Allocate and release the objects, so the blocks end up on
+        // this thread's free list.
+        PoolBlock *taken = NULL;
+        for (unsigned i = 0; i < count; i++)
+        {
+            PoolBlock *block = (PoolBlock*)allocate(size);
+            block->next = taken;
+            taken = block;
+        }
+        while (taken)
+        {
+            PoolBlock *block = taken;
+            taken = block->next;
+            release(block, size);
+        }
+    }
+
+    unsigned ActionPool::getChunkCount()
+    {
+        return poolChunks.load();
+    }
+
     Action* Action::getLast()
     {
         // If we're at the end, then end
@@ -31,26 +207,50 @@ namespace aicore
         return thisAction;
     }
 
-    void Action::deleteList()
+    Action* Action::appendActions(Action *list, Action *more)
     {
-        // Decurse first
-        if (next != NULL) next->deleteList();
+        if (list == NULL) return more;
+        if (more != NULL) list->getLast()->next = more;
+        return list;
+    }
 
-        // Delete ourself
-        delete this;
+    void Action::deleteList()
+    {
+        // Walk along the list rather than recursing, so long lists
+        // can't overflow the stack.
+        Action * action = this;
+        while (action != NULL)
+        {
+            Action * following = action->next;
+            action->next = NULL;
+            delete action;
+            action = following;
+        }
     }
 
+    const real Action::WAIT_FOREVER = REAL_MAX;
+
     void Action::act()
     {
         // Does nothing.
     }
 
+    void Action::actAt(real /*time*/)
+    {
+        act();
+    }
+
+    real Action::getWakeTime() const
+    {
+        return 0;
+    }
+
     bool Action::canInterrupt()
     {
         return false;
     }
 
-    bool Action::canDoBoth(const Action * other) const
+    bool Action::canDoBoth(const Action * /*other*/) const
     {
         return false;
     }
@@ -60,43 +260,222 @@ namespace aicore
         return true;
     }
 
+    unsigned Action::getSnapshotType() const
+    {
+        return SNAPSHOT_NONE;
+    }
+
+    void Action::writeSnapshot(SnapshotWriter &writer) const
+    {
+        writer.writeReal(priority);
+        writer.writeReal(expiryTime);
+    }
+
+    bool Action::readSnapshot(SnapshotReader &reader, ActionFactory &)
+    {
+        priority = reader.readReal();
+        expiryTime = reader.readReal();
+        return reader.isValid();
+    }
+
+    /**
+     * Writes one entry of an action list: the action's type followed
+     * by its state, or nothing if it can't be saved.
+     */
+    static void writeSnapshotEntry(SnapshotWriter &writer,
+                                   const Action *action)
+    {
+        unsigned type = action->getSnapshotType();
+        if (type == Action::SNAPSHOT_NONE) return;
+
+        writer.writeUnsigned(type);
+        action->writeSnapshot(writer);
+    }
+
+    void Action::writeSnapshotList(SnapshotWriter &writer,
+                                   const Action *list)
+    {
+        // Each action is written with its type, and the list ends
+        // with SNAPSHOT_NONE.
+        for (const Action *action = list; action; action = action->next)
+        {
+            writeSnapshotEntry(writer, action);
+        }
+        writer.writeUnsigned(SNAPSHOT_NONE);
+    }
+
+    Action* Action::readSnapshotList(SnapshotReader &reader,
+                                     ActionFactory &factory)
+    {
+        Action *first = NULL, *last = NULL;
+        while (reader.isValid())
+        {
+            unsigned type = reader.readUnsigned();
+            if (type == SNAPSHOT_NONE) break;
+
+            Action *action = factory.create(type);
+            if (action == NULL)
+            {
+                reader.fail();
+                break;
+            }
+
+            if (last) last->next = action;
+            else first = action;
+            last = action;
+
+            action->readSnapshot(reader, factory);
+        }
+
+        if (reader.isValid()) return first;
+        if (first) first->deleteList();
+        return NULL;
+    }
+
+    Action* ActionFactory::create(unsigned type)
+    {
+        switch (type)
+        {
+        case Action::SNAPSHOT_COMBINATION: return new ActionCombination;
+        case Action::SNAPSHOT_SEQUENCE: return new ActionSequence;
+        default: return NULL;
+        }
+    }
+
 
     ActionManager::ActionManager()
             :
+            queueLength(0),
+            scheduler(NULL),
+            asleep(false),
+            sleepCount(0),
             activePriority(0),
             actionQueue(NULL),
-            active(NULL)
+            active(NULL),
+            time(0)
     {
     }
 
     void ActionManager::scheduleAction(Action * newAction)
     {
-        // Find the correct place to insert the new action
-        Action ** previous = &actionQueue;
-        Action * next = actionQueue;
-        while (next != NULL)
+        queueLength++;
+        if (asleep) wake();
+
+        // Find the first bucket that isn't of a higher priority. Note
+        // that new actions go after existing ones of the same
+        // priority, so in the absence of priority ordering the queue
+        // defaults to fifo.
+        unsigned low = 0;
+        unsigned high = (unsigned)buckets.size();
+        while (low < high)
         {
-            // if we've found a lower priority, we go here. Note that
-            // this will be much quicker with a >=, but it means in
-            // the absence of priority ordering the queue defaults to
-            // fifo, which isn't very useful.
-            if (newAction->priority > next->priority)
+            unsigned middle = (low + high) / 2;
+            if (buckets[middle].priority > newAction->priority)
             {
-                break;
+                low = middle + 1;
             }
+            else
+            {
+                high = middle;
+            }
+        }
+
+        // Add to the end of an existing bucket.
+        if (low < buckets.size() &&
+            buckets[low].priority == newAction->priority)
+        {
+            PriorityBucket &bucket = buckets[low];
+            newAction->next = bucket.last->next;
+            bucket.last->next = newAction;
+            bucket.last = newAction;
+            return;
+        }
+
+        // Or start a new bucket, linking it in between its
+        // neighbours.
+        newAction->next = low < buckets.size() ? buckets[low].first : NULL;
+        if (low > 0) buckets[low-1].last->next = newAction;
+        else actionQueue = newAction;
+
+        PriorityBucket bucket;
+        bucket.priority = newAction->priority;
+        bucket.first = newAction;
+        bucket.last = newAction;
+        buckets.insert(buckets.begin() + low, bucket);
+    }
+
+    void ActionManager::removeQueued(Action * previous, Action * action,
+                                     unsigned bucket)
+    {
+        if (previous != NULL) previous->next = action->next;
+        else actionQueue = action->next;
+        queueLength--;
+
+        PriorityBucket &run = buckets[bucket];
+        if (run.first == action && run.last == action)
+        {
+            buckets.erase(buckets.begin() + bucket);
+        }
+        else if (run.first == action)
+        {
+            run.first = action->next;
+        }
+        else if (run.last == action)
+        {
+            run.last = previous;
+        }
+        action->next = NULL;
+    }
 
-            previous = &next->next;
-            next = next->next;
+    void ActionManager::writeSnapshot(SnapshotWriter &writer) const
+    {
+        writer.writeReal(time);
+        writer.writeReal(activePriority);
+        Action::writeSnapshotList(writer, active);
+        Action::writeSnapshotList(writer, actionQueue);
+    }
+
+    bool ActionManager::readSnapshot(SnapshotReader &reader,
+                                     ActionFactory &factory)
+    {
+        if (active != NULL) active->deleteList();
+        if (actionQueue != NULL) actionQueue->deleteList();
+        active = actionQueue = NULL;
+        buckets.clear();
+        queueLength = 0;
+
+        time = reader.readReal();
+        activePriority = reader.readReal();
+        active = Action::readSnapshotList(reader, factory);
+
+        // The queue was written in order, so scheduling each action in
+        // turn puts it back the same way, and rebuilds the buckets.
+        Action *queued = Action::readSnapshotList(reader, factory);
+        while (queued != NULL)
+        {
+            Action *following = queued->next;
+            queued->next = NULL;
+            scheduleAction(queued);
+            queued = following;
         }
 
-        // When we get here, we've either found the location mid-list
-        // or reached the end of the list, so add it on
-        *previous = newAction;
-        newAction->next = next;
+        wake();
+        if (reader.isValid()) return true;
+
+        if (active != NULL) active->deleteList();
+        if (actionQueue != NULL) actionQueue->deleteList();
+        active = actionQueue = NULL;
+        buckets.clear();
+        queueLength = 0;
+        activePriority = 0;
+        return false;
     }
 
-    void ActionManager::execute()
+    void ActionManager::execute(real duration)
     {
+        time += duration;
+        AICORE_LIBRARY_RECORD("ActionManager queue", queueLength);
+
         // Check if we need to interrupt the currently active actions
         checkInterrupts();
 
@@ -108,11 +487,21 @@ namespace aicore
         runActive();
     }
 
+    /*
+     * Both of the following walk the queue, keeping track of which
+     * bucket they are in. An action is in the next bucket once we
+     * have passed the last action of the current one. If an action
+     * is removed, and it was the only one in its bucket, then the
+     * bucket goes, so the next action is in the bucket that now has
+     * the same index.
+     */
+
     void ActionManager::checkInterrupts()
     {
         // Find any new interrupters
-        Action ** previous = &actionQueue;
+        Action * previous = NULL;
         Action * next = actionQueue;
+        unsigned bucket = 0;
         while (next != NULL)
         {
             // If we drop below the active priority, give up
@@ -121,6 +510,20 @@ namespace aicore
                 break;
             }
 
+            bool wasLast = buckets[bucket].last == next;
+            bool wasOnly = wasLast && buckets[bucket].first == next;
+            Action * following = next->next;
+
+            // Throw away actions that have waited too long.
+            if (hasExpired(next))
+            {
+                removeQueued(previous, next, bucket);
+                delete next;
+                if (wasLast && !wasOnly) bucket++;
+                next = following;
+                continue;
+            }
+
             // Otherwise we're beating for priority, so check if we
             // need to interrupt.
             if (next->canInterrupt()) {
@@ -128,6 +531,10 @@ namespace aicore
                 // So we have to interrupt. Initially just replace the
                 // active set.
 
+                // Extract our action from the queue
+                removeQueued(previous, next, bucket);
+                AICORE_LIBRARY_COUNT("ActionManager interrupts", 1);
+
                 // Delete the previous active list
                 if (active != NULL) active->deleteList();
 
@@ -135,54 +542,85 @@ namespace aicore
                 active = next;
                 activePriority = active->priority;
 
-                // Rewire the queue to extract our action
-                *previous = next->next;
-                next->next = NULL;
-
                 // And stop looking (the highest priority interrupter
                 // wins).
                 break;
             }
 
             // Check the next one
-            previous = &next->next;
-            next = next->next;
+            if (wasLast) bucket++;
+            previous = next;
+            next = following;
         }
     }
 
     void ActionManager::addAllToActive()
     {
-        Action ** previous = &actionQueue;
+        Action * previous = NULL;
         Action * next = actionQueue;
+        unsigned bucket = 0;
         while (next != NULL)
         {
+            bool wasLast = buckets[bucket].last == next;
+            bool wasOnly = wasLast && buckets[bucket].first == next;
+            Action * following = next->next;
+
+            // Throw away actions that have waited too long, and move
+            // those that are compatible with everything active.
+            bool expired = hasExpired(next);
+            bool compatible = !expired;
             Action * inActive = active;
-            while (inActive != NULL)
+            while (compatible && inActive != NULL)
             {
                 // Check for compatibility
-                if (!inActive->canDoBoth(next) ||
-                    !next->canDoBoth(inActive)) {
-                    goto nextInQueue;
-                }
+                compatible = inActive->canDoBoth(next) &&
+                    next->canDoBoth(inActive);
+                inActive = inActive->next;
             }
 
-            // We are compatible, so move from the queue to the active set
-            *previous = next->next;
-            next->next = active;
-            active = next;
-
-            // Move the next counter, but keep the previous as is.
-            next = next->next;
+            if (expired || compatible)
+            {
+                removeQueued(previous, next, bucket);
+                if (expired)
+                {
+                    delete next;
+                }
+                else
+                {
+                    next->next = active;
+                    active = next;
+                }
 
-            // Don't fall through, because we don't want to update
-            // previous
-            continue;
+                // Move the next counter, but keep the previous as is.
+                if (wasLast && !wasOnly) bucket++;
+                next = following;
+                continue;
+            }
 
-        nextInQueue:
             // We only get here if there was no compatibility, so chug along
-            previous = &next->next;
-            next = next->next;
+            if (wasLast) bucket++;
+            previous = next;
+            next = following;
+        }
+    }
+
+    real ActionManager::getWakeTime() const
+    {
+        if (actionQueue != NULL) return time;
+
+        real wakeTime = Action::WAIT_FOREVER;
+        for (Action * action = active; action != NULL; action = action->next)
+        {
+            real actionTime = action->getWakeTime();
+            if (actionTime <= time) return time;
+            if (actionTime < wakeTime) wakeTime = actionTime;
         }
+        return wakeTime;
+    }
+
+    void ActionManager::wake()
+    {
+        if (scheduler != NULL) scheduler->wake(this);
     }
 
     void ActionManager::runActive()
@@ -192,8 +630,17 @@ namespace aicore
 
         while (next != NULL)
         {
+            // Leave actions that are waiting: they can't complete
+            // until they have acted.
+            if (next->getWakeTime() > time)
+            {
+                previous = &next->next;
+                next = next->next;
+                continue;
+            }
+
             // Do the action first
-            next->act();
+            next->actAt(time);
 
             // Check if we're done with this action
             if (next->isComplete())
@@ -222,82 +669,326 @@ namespace aicore
 
     bool ActionCompound::canDoBoth(const Action* action) const
     {
-        Action * next = subActions;
-        while (next != NULL)
+        for (unsigned i = 0; i < subActions.size(); i++)
         {
-            if (!next->canDoBoth(action)) return false;
-            next = next->next;
+            if (subActions[i] != NULL && !subActions[i]->canDoBoth(action))
+            {
+                return false;
+            }
         }
         return true;
     }
 
-    void ActionCompound::deleteList()
+    ActionCompound::~ActionCompound()
     {
-        if (subActions != NULL) subActions->deleteList();
-        Action::deleteList();
+        // Take the sub-actions of any compounds out before deleting
+        // them, so nested compounds are deleted in a loop rather than
+        // by each destructor calling the next.
+        std::vector<Action*> pending;
+        pending.swap(subActions);
+        while (!pending.empty())
+        {
+            Action * action = pending.back();
+            pending.pop_back();
+            if (action == NULL) continue;
+
+            ActionCompound * compound = dynamic_cast<ActionCompound*>(action);
+            if (compound != NULL)
+            {
+                pending.insert(pending.end(), compound->subActions.begin(),
+                               compound->subActions.end());
+                compound->subActions.clear();
+            }
+            delete action;
+        }
     }
 
+    void ActionCompound::addSubActions(Action * list)
+    {
+        while (list != NULL)
+        {
+            Action * following = list->next;
+            list->next = NULL;
+            subActions.push_back(list);
+            list = following;
+        }
+    }
 
-    bool ActionCombination::canInterrupt()
+    bool ActionCompound::isComplete()
     {
-        Action * next = subActions;
-        while (next != NULL)
+        return completed == subActions.size();
+    }
+
+    real ActionCompound::getWakeTime() const
+    {
+        real wakeTime = WAIT_FOREVER;
+        for (unsigned i = completed; i < subActions.size(); i++)
         {
-            if (next->canInterrupt()) return true;
-            next = next->next;
+            real actionTime = subActions[i]->getWakeTime();
+            if (actionTime < wakeTime) wakeTime = actionTime;
         }
-        return false;
+        return completed < subActions.size() ? wakeTime : 0;
     }
 
-    bool ActionCombination::isComplete()
+    void ActionCompound::writeSnapshot(SnapshotWriter &writer) const
     {
-        Action * next = subActions;
-        while (next != NULL)
+        // The sub-actions are written as a list, so completed ones
+        // that are still held are read back as not yet run, and are
+        // marked complete again the first time the compound acts.
+        Action::writeSnapshot(writer);
+        for (unsigned i = 0; i < subActions.size(); i++)
         {
-            if (!next->isComplete()) return false;
-            next = next->next;
+            if (subActions[i] != NULL) writeSnapshotEntry(writer, subActions[i]);
         }
-        return true;
+        writer.writeUnsigned(SNAPSHOT_NONE);
+    }
+
+    bool ActionCompound::readSnapshot(SnapshotReader &reader,
+                                      ActionFactory &factory)
+    {
+        for (unsigned i = 0; i < subActions.size(); i++)
+        {
+            delete subActions[i];
+        }
+        subActions.clear();
+        completed = 0;
+
+        Action::readSnapshot(reader, factory);
+        addSubActions(readSnapshotList(reader, factory));
+        return reader.isValid();
+    }
+
+
+    bool ActionCombination::canInterrupt()
+    {
+        for (unsigned i = completed; i < subActions.size(); i++)
+        {
+            if (subActions[i]->canInterrupt()) return true;
+        }
+        return false;
+    }
+
+    unsigned ActionCombination::getSnapshotType() const
+    {
+        return SNAPSHOT_COMBINATION;
     }
 
     void ActionCombination::act()
     {
-        Action * next = subActions;
-        while (next != NULL)
+        actAt(WAIT_FOREVER);
+    }
+
+    void ActionCombination::actAt(real time)
+    {
+        for (unsigned i = completed; i < subActions.size(); i++)
         {
-            if (!next->isComplete()) next->act();
-            next = next->next;
+            // Leave actions that are waiting: they can't complete
+            // until they have acted.
+            Action * action = subActions[i];
+            if (action->getWakeTime() > time) continue;
+
+            if (!action->isComplete()) action->actAt(time);
+            if (!action->isComplete()) continue;
+
+            // Move it up to join the completed actions, shifting the
+            // ones it passes along so they stay in order.
+            for (unsigned j = i; j > completed; j--)
+            {
+                subActions[j] = subActions[j-1];
+            }
+            subActions[completed++] = action;
         }
     }
 
 
 
+    unsigned ActionSequence::getSnapshotType() const
+    {
+        return SNAPSHOT_SEQUENCE;
+    }
+
     bool ActionSequence::canInterrupt()
     {
-        if (subActions != NULL) return subActions->canInterrupt();
+        if (completed < subActions.size())
+        {
+            return subActions[completed]->canInterrupt();
+        }
         else return false;
     }
 
-    bool ActionSequence::isComplete()
+    void ActionSequence::act()
     {
-        return (subActions == NULL);
+        actAt(WAIT_FOREVER);
     }
 
-    void ActionSequence::act()
+    void ActionSequence::actAt(real time)
     {
         // Check if we have anything to do
-        if (subActions == NULL) return;
+        if (completed == subActions.size()) return;
 
         // Run the first action in the list
-        subActions->act();
+        Action * action = subActions[completed];
+        action->actAt(time);
 
         // Then consume it if its done
-        if (subActions->isComplete()) {
+        if (action->isComplete()) {
+            delete action;
+            subActions[completed++] = NULL;
+        }
+    }
+
+    real ActionSequence::getWakeTime() const
+    {
+        if (completed == subActions.size()) return 0;
+        return subActions[completed]->getWakeTime();
+    }
+
+
+    ActionScheduler::ActionScheduler()
+        :
+        staleCount(0), time(0)
+    {
+    }
+
+    ActionScheduler::~ActionScheduler()
+    {
+        for (unsigned i = 0; i < awake.size(); i++)
+        {
+            awake[i]->scheduler = NULL;
+        }
+        for (unsigned i = 0; i < sleeping.size(); i++)
+        {
+            if (isStale(sleeping[i])) continue;
+            sleeping[i].manager->scheduler = NULL;
+            sleeping[i].manager->asleep = false;
+        }
+    }
+
+    bool ActionScheduler::isStale(const Sleeper &sleeper)
+    {
+        return sleeper.manager->sleepCount != sleeper.sleepCount ||
+            !sleeper.manager->asleep;
+    }
+
+    void ActionScheduler::add(ActionManager *manager)
+    {
+        manager->scheduler = this;
+        manager->asleep = false;
+        manager->time = time;
+        awake.push_back(manager);
+    }
+
+    void ActionScheduler::remove(ActionManager *manager)
+    {
+        if (manager->scheduler != this) return;
+
+        // Take every entry for the manager out of the heap, including
+        // out of date ones, since the manager may be deleted.
+        unsigned kept = 0;
+        for (unsigned i = 0; i < sleeping.size(); i++)
+        {
+            if (sleeping[i].manager != manager)
+            {
+                sleeping[kept++] = sleeping[i];
+            }
+            else if (isStale(sleeping[i]))
+            {
+                staleCount--;
+            }
+        }
+        if (kept < sleeping.size())
+        {
+            sleeping.resize(kept);
+            std::make_heap(sleeping.begin(), sleeping.end());
+        }
+
+        if (!manager->asleep)
+        {
+            awake.erase(std::find(awake.begin(), awake.end(), manager));
+        }
+        manager->asleep = false;
+        manager->scheduler = NULL;
+    }
+
+    void ActionScheduler::wake(ActionManager *manager)
+    {
+        if (manager->scheduler != this || !manager->asleep) return;
+
+        manager->asleep = false;
+        staleCount++;
+        awake.push_back(manager);
+        removeStale();
+    }
+
+    void ActionScheduler::sleep(ActionManager *manager, real wakeTime)
+    {
+        manager->asleep = true;
+        manager->sleepCount++;
+
+        Sleeper sleeper;
+        sleeper.wakeTime = wakeTime;
+        sleeper.manager = manager;
+        sleeper.sleepCount = manager->sleepCount;
+        sleeping.push_back(sleeper);
+        std::push_heap(sleeping.begin(), sleeping.end());
+    }
 
-            Action * temp = subActions;
-            subActions = subActions->next;
-            delete temp;
+    void ActionScheduler::removeStale()
+    {
+        // Managers waiting forever are never taken off the top of the
+        // heap, so if they keep being woken the heap would fill with
+        // their old entries. Rebuild it when they are over half.
+        if (staleCount * 2 <= sleeping.size()) return;
+
+        unsigned kept = 0;
+        for (unsigned i = 0; i < sleeping.size(); i++)
+        {
+            if (!isStale(sleeping[i])) sleeping[kept++] = sleeping[i];
+        }
+        sleeping.resize(kept);
+        std::make_heap(sleeping.begin(), sleeping.end());
+        staleCount = 0;
+    }
+
+    void ActionScheduler::execute(real duration)
+    {
+        AICORE_PROFILE_LIBRARY_ZONE("ActionScheduler");
+        time += duration;
+
+        // Wake the managers whose time has come.
+        while (!sleeping.empty() && sleeping.front().wakeTime <= time)
+        {
+            Sleeper sleeper = sleeping.front();
+            std::pop_heap(sleeping.begin(), sleeping.end());
+            sleeping.pop_back();
+
+            if (isStale(sleeper))
+            {
+                staleCount--;
+                continue;
+            }
+            sleeper.manager->asleep = false;
+            awake.push_back(sleeper.manager);
+        }
+
+        // Run the awake managers, keeping those that still have
+        // something to do next time. Any woken while they run are
+        // added to the awake list, for next time.
+        running.swap(awake);
+        awake.clear();
+        for (unsigned i = 0; i < running.size(); i++)
+        {
+            // Setting the manager's clock, rather than moving it on,
+            // keeps it exactly in step with the scheduler's.
+            ActionManager *manager = running[i];
+            manager->time = time;
+            manager->execute(0);
+
+            real wakeTime = manager->getWakeTime();
+            if (wakeTime > time) sleep(manager, wakeTime);
+            else awake.push_back(manager);
         }
+        running.clear();
     }
 
 }; // end of namespace
@@ -11,14 +11,9 @@
 
 namespace aicore
 {
-    const Vector3 Vector3::UP = Vector3(0,1,0);
-    const Vector3 Vector3::RIGHT = Vector3(1,0,0);
-    const Vector3 Vector3::OUT_OF_SCREEN = Vector3(0,0,1);
-    const Vector3 Vector3::DOWN = Vector3(0,-1,0);
-    const Vector3 Vector3::LEFT = Vector3(-1,0,0);
-    const Vector3 Vector3::INTO_SCREEN = Vector3(0,0,-1);
-    const Vector3 Vector3::X = Vector3(1,0,0);
-    const Vector3 Vector3::Y = Vector3(0,1,0);
-    const Vector3 Vector3::Z = Vector3(0,0,1);
+    // Compile the vector at both precisions, so any errors in the
+    // template show up when the library is built.
+    template class BasicVector3<float>;
+    template class BasicVector3<double>;
 
 }; // end of namespace
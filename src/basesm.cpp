@@ -9,6 +9,7 @@
  * implies agreement with all terms and conditions of the accompanying
  * software licence.
  */
+#include <algorithm>
 #include <aicore/aicore.h>
 
 namespace aicore
@@ -18,9 +19,106 @@ namespace aicore
         return NULL;
     }
 
+    bool BaseTransition::addListener(ChangeListener *listener)
+    {
+        ConditionalTransitionMixin *conditional =
+            dynamic_cast<ConditionalTransitionMixin*>(this);
+        if (conditional == NULL || conditional->condition == NULL)
+        {
+            return false;
+        }
+        return conditional->condition->addListener(listener);
+    }
+
     bool ConditionalTransitionMixin::isTriggered()
     {
         return condition->test();
     }
 
+    bool IntegerMatchCondition::addListener(ChangeListener *listener)
+    {
+        if (source == NULL) return false;
+        source->addListener(listener);
+        return true;
+    }
+
+    ChangeListener::~ChangeListener()
+    {
+        stopListening();
+    }
+
+    void ChangeListener::stopListening()
+    {
+        for (unsigned i = 0; i < sources.size(); i++)
+        {
+            std::vector<ChangeListener*> &listeners = sources[i]->listeners;
+            listeners.erase(std::find(listeners.begin(), listeners.end(),
+                                      this));
+        }
+        sources.clear();
+    }
+
+    ChangeSource::~ChangeSource()
+    {
+        for (unsigned i = 0; i < listeners.size(); i++)
+        {
+            std::vector<ChangeSource*> &sources = listeners[i]->sources;
+            sources.erase(std::find(sources.begin(), sources.end(), this));
+        }
+    }
+
+    void ChangeSource::addListener(ChangeListener *listener)
+    {
+        if (std::find(listeners.begin(), listeners.end(), listener) !=
+            listeners.end())
+        {
+            return;
+        }
+        listeners.push_back(listener);
+        listener->sources.push_back(this);
+    }
+
+    void ChangeSource::removeListener(ChangeListener *listener)
+    {
+        std::vector<ChangeListener*>::iterator found =
+            std::find(listeners.begin(), listeners.end(), listener);
+        if (found == listeners.end()) return;
+        listeners.erase(found);
+
+        std::vector<ChangeSource*> &sources = listener->sources;
+        sources.erase(std::find(sources.begin(), sources.end(), this));
+    }
+
+    void ChangeSource::notifyListeners()
+    {
+        // Listeners aren't allowed to change their sources when
+        // notified, so we can use the list directly.
+        for (unsigned i = 0; i < listeners.size(); i++)
+        {
+            listeners[i]->notifyChanged();
+        }
+    }
+
+    TransitionWatcher::TransitionWatcher()
+        :
+        watching(NULL), started(false), dirty(true), polling(true)
+    {
+    }
+
+    void TransitionWatcher::watch(BaseTransition *first)
+    {
+        if (started && first == watching) return;
+
+        stopListening();
+        started = true;
+        watching = first;
+        dirty = true;
+        polling = false;
+        for (BaseTransition *transition = first; transition;
+             transition = transition->next)
+        {
+            if (!transition->addListener(this)) polling = true;
+        }
+    }
+
 }; // end of namespace
@@ -0,0 +1,405 @@
+/*
+ * Defines the structure-of-arrays containers used for batch movement.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <string.h>
+#include <aicore/aicore.h>
+
+namespace aicore
+{
+    /*
+     * Each array in a batch is rounded up to a multiple of this many
+     * entries, so that every array starts on the same alignment as
+     * the block it is carved from.
+     */
+    static const unsigned BATCH_ROUNDING = 4;
+
+    /*
+     * Reallocates a block holding the given number of arrays, each
+     * at least the given length, preserving the first 'keep' entries
+     * of each array and zeroing the rest. Returns the new block and
+     * writes the new per-array capacity.
+     */
+    static real* reallocateArrays(real *old, unsigned oldCapacity,
+                                  unsigned arrays, unsigned count,
+                                  unsigned keep, unsigned *capacity)
+    {
+        unsigned newCapacity =
+            (count + BATCH_ROUNDING - 1) / BATCH_ROUNDING * BATCH_ROUNDING;
+        if (newCapacity == 0) newCapacity = BATCH_ROUNDING;
+
+        real *block = new real[newCapacity * arrays];
+        memset(block, 0, sizeof(real) * newCapacity * arrays);
+
+        if (old != NULL)
+        {
+            for (unsigned a = 0; a < arrays; a++)
+            {
+                memcpy(block + a*newCapacity, old + a*oldCapacity,
+                       sizeof(real) * keep);
+            }
+            delete[] old;
+        }
+
+        *capacity = newCapacity;
+        return block;
+    }
+
+    /*
+     * Wraps an orientation into the range (-2pi, 2pi), in the same
+     * way as the fmod in Kinematic::integrate, but in a form that
+     * compilers can vectorise.
+     */
+    static inline real wrapOrientation(real orientation)
+    {
+        const real inverse2PI = ((real)1.0) / M_2PI;
+        real turns = (real)(long)(orientation * inverse2PI);
+        return orientation - turns * M_2PI;
+    }
+
+    /*
+     * Works out the factor needed to scale a velocity with the given
+     * squared magnitude so it doesn't exceed the given speed.
+     */
+    static inline real trimFactor(real squareSpeed, real maxSpeed)
+    {
+        if (squareSpeed > maxSpeed*maxSpeed)
+        {
+            return maxSpeed / real_sqrt(squareSpeed);
+        }
+        return (real)1.0;
+    }
+
+
+    SteeringBatch::SteeringBatch()
+        :
+        data(NULL), capacity(0), size(0),
+        linearX(NULL), linearY(NULL), linearZ(NULL), angular(NULL)
+    {
+    }
+
+    SteeringBatch::SteeringBatch(unsigned count)
+        :
+        data(NULL), capacity(0), size(0),
+        linearX(NULL), linearY(NULL), linearZ(NULL), angular(NULL)
+    {
+        resize(count);
+    }
+
+    SteeringBatch::~SteeringBatch()
+    {
+        delete[] data;
+    }
+
+    void SteeringBatch::resize(unsigned count)
+    {
+        if (count > capacity || data == NULL)
+        {
+            data = reallocateArrays(data, capacity, 4, count, size, &capacity);
+            linearX = data;
+            linearY = data + capacity;
+            linearZ = data + capacity*2;
+            angular = data + capacity*3;
+        }
+        else if (count > size)
+        {
+            // Zero the entries we're bringing back into use.
+            unsigned extra = count - size;
+            memset(linearX + size, 0, sizeof(real) * extra);
+            memset(linearY + size, 0, sizeof(real) * extra);
+            memset(linearZ + size, 0, sizeof(real) * extra);
+            memset(angular + size, 0, sizeof(real) * extra);
+        }
+        size = count;
+    }
+
+    void SteeringBatch::clear()
+    {
+        if (data) memset(data, 0, sizeof(real) * capacity * 4);
+    }
+
+    void SteeringBatch::set(unsigned index, const SteeringOutput& steer)
+    {
+        linearX[index] = steer.linear.x;
+        linearY[index] = steer.linear.y;
+        linearZ[index] = steer.linear.z;
+        angular[index] = steer.angular;
+    }
+
+    void SteeringBatch::get(unsigned index, SteeringOutput* steer) const
+    {
+        steer->linear.x = linearX[index];
+        steer->linear.y = linearY[index];
+        steer->linear.z = linearZ[index];
+        steer->angular = angular[index];
+    }
+
+
+    KinematicBatch::KinematicBatch()
+        :
+        data(NULL), capacity(0), size(0),
+        positionX(NULL), positionY(NULL), positionZ(NULL),
+        orientation(NULL),
+        velocityX(NULL), velocityY(NULL), velocityZ(NULL),
+        rotation(NULL)
+    {
+    }
+
+    KinematicBatch::KinematicBatch(unsigned count)
+        :
+        data(NULL), capacity(0), size(0),
+        positionX(NULL), positionY(NULL), positionZ(NULL),
+        orientation(NULL),
+        velocityX(NULL), velocityY(NULL), velocityZ(NULL),
+        rotation(NULL)
+    {
+        resize(count);
+    }
+
+    KinematicBatch::~KinematicBatch()
+    {
+        delete[] data;
+    }
+
+    void KinematicBatch::resize(unsigned count)
+    {
+        if (count > capacity || data == NULL)
+        {
+            data = reallocateArrays(data, capacity, 8, count, size, &capacity);
+            positionX = data;
+            positionY = data + capacity;
+            positionZ = data + capacity*2;
+            orientation = data + capacity*3;
+            velocityX = data + capacity*4;
+            velocityY = data + capacity*5;
+            velocityZ = data + capacity*6;
+            rotation = data + capacity*7;
+        }
+        else if (count > size)
+        {
+            // Zero the entries we're bringing back into use.
+            for (unsigned a = 0; a < 8; a++)
+            {
+                memset(data + a*capacity + size, 0,
+                       sizeof(real) * (count - size));
+            }
+        }
+        size = count;
+    }
+
+    void KinematicBatch::clear()
+    {
+        if (data) memset(data, 0, sizeof(real) * capacity * 8);
+    }
+
+    void KinematicBatch::set(unsigned index, const Kinematic& kinematic)
+    {
+        positionX[index] = kinematic.position.x;
+        positionY[index] = kinematic.position.y;
+        positionZ[index] = kinematic.position.z;
+        orientation[index] = kinematic.orientation;
+        velocityX[index] = kinematic.velocity.x;
+        velocityY[index] = kinematic.velocity.y;
+        velocityZ[index] = kinematic.velocity.z;
+        rotation[index] = kinematic.rotation;
+    }
+
+    void KinematicBatch::get(unsigned index, Kinematic* kinematic) const
+    {
+        kinematic->position.x = positionX[index];
+        kinematic->position.y = positionY[index];
+        kinematic->position.z = positionZ[index];
+        kinematic->orientation = orientation[index];
+        kinematic->velocity.x = velocityX[index];
+        kinematic->velocity.y = velocityY[index];
+        kinematic->velocity.z = velocityZ[index];
+        kinematic->rotation = rotation[index];
+    }
+
+    void KinematicBatch::loadFrom(const Kinematic* kinematics, unsigned count)
+    {
+        resize(count);
+        for (unsigned i = 0; i < count; i++) set(i, kinematics[i]);
+    }
+
+    void KinematicBatch::loadFrom(const Kinematic* const* kinematics,
+                                  unsigned count)
+    {
+        resize(count);
+        for (unsigned i = 0; i < count; i++) set(i, *kinematics[i]);
+    }
+
+    void KinematicBatch::storeTo(Kinematic* kinematics) const
+    {
+        for (unsigned i = 0; i < size; i++) get(i, kinematics+i);
+    }
+
+    void KinematicBatch::storeTo(Kinematic* const* kinematics) const
+    {
+        for (unsigned i = 0; i < size; i++) get(i, kinematics[i]);
+    }
+
+    void KinematicBatch::integrate(real duration)
+    {
+        real * AICORE_RESTRICT px = positionX;
+        real * AICORE_RESTRICT py = positionY;
+        real * AICORE_RESTRICT pz = positionZ;
+        real * AICORE_RESTRICT o = orientation;
+        const real * AICORE_RESTRICT vx = velocityX;
+        const real * AICORE_RESTRICT vy = velocityY;
+        const real * AICORE_RESTRICT vz = velocityZ;
+        const real * AICORE_RESTRICT r = rotation;
+
+        for (unsigned i = 0; i < size; i++)
+        {
+            px[i] += vx[i]*duration;
+            py[i] += vy[i]*duration;
+            pz[i] += vz[i]*duration;
+            o[i] = wrapOrientation(o[i] + r[i]*duration);
+        }
+    }
+
+    void KinematicBatch::integrate(const SteeringBatch& steer, real duration)
+    {
+        // Trimming to REAL_MAX never changes the velocity.
+        integrateAndTrim(steer, duration, REAL_MAX);
+    }
+
+    void KinematicBatch::integrate(const SteeringBatch& steer,
+                                   real drag, real duration)
+    {
+        integrateAndTrim(steer, drag, duration, REAL_MAX);
+    }
+
+    void KinematicBatch::integrateAndTrim(const SteeringBatch& steer,
+                                          real duration, real maxSpeed)
+    {
+        real * AICORE_RESTRICT px = positionX;
+        real * AICORE_RESTRICT py = positionY;
+        real * AICORE_RESTRICT pz = positionZ;
+        real * AICORE_RESTRICT o = orientation;
+        real * AICORE_RESTRICT vx = velocityX;
+        real * AICORE_RESTRICT vy = velocityY;
+        real * AICORE_RESTRICT vz = velocityZ;
+        real * AICORE_RESTRICT r = rotation;
+        const real * AICORE_RESTRICT ax = steer.linearX;
+        const real * AICORE_RESTRICT ay = steer.linearY;
+        const real * AICORE_RESTRICT az = steer.linearZ;
+        const real * AICORE_RESTRICT aa = steer.angular;
+
+        for (unsigned i = 0; i < size; i++)
+        {
+            // Apply the current velocity, as SIMPLE_INTEGRATION.
+            px[i] += vx[i]*duration;
+            py[i] += vy[i]*duration;
+            pz[i] += vz[i]*duration;
+            o[i] = wrapOrientation(o[i] + r[i]*duration);
+
+            // Then the acceleration.
+            real x = vx[i] + ax[i]*duration;
+            real y = vy[i] + ay[i]*duration;
+            real z = vz[i] + az[i]*duration;
+            r[i] += aa[i]*duration;
+
+            // And keep within the speed limit.
+            real scale = trimFactor(x*x + y*y + z*z, maxSpeed);
+            vx[i] = x*scale;
+            vy[i] = y*scale;
+            vz[i] = z*scale;
+        }
+    }
+
+    void KinematicBatch::integrateAndTrim(const SteeringBatch& steer,
+                                          real drag, real duration,
+                                          real maxSpeed)
+    {
+        real * AICORE_RESTRICT px = positionX;
+        real * AICORE_RESTRICT py = positionY;
+        real * AICORE_RESTRICT pz = positionZ;
+        real * AICORE_RESTRICT o = orientation;
+        real * AICORE_RESTRICT vx = velocityX;
+        real * AICORE_RESTRICT vy = velocityY;
+        real * AICORE_RESTRICT vz = velocityZ;
+        real * AICORE_RESTRICT r = rotation;
+        const real * AICORE_RESTRICT ax = steer.linearX;
+        const real * AICORE_RESTRICT ay = steer.linearY;
+        const real * AICORE_RESTRICT az = steer.linearZ;
+        const real * AICORE_RESTRICT aa = steer.angular;
+
+        // The drag is the same for everyone, so we only need the
+        // power once.
+        drag = real_pow(drag, duration);
+        real rotationDrag = drag*drag;
+
+        for (unsigned i = 0; i < size; i++)
+        {
+            px[i] += vx[i]*duration;
+            py[i] += vy[i]*duration;
+            pz[i] += vz[i]*duration;
+            o[i] = wrapOrientation(o[i] + r[i]*duration);
+
+            real x = vx[i]*drag + ax[i]*duration;
+            real y = vy[i]*drag + ay[i]*duration;
+            real z = vz[i]*drag + az[i]*duration;
+            r[i] = r[i]*rotationDrag + aa[i]*duration;
+
+            real scale = trimFactor(x*x + y*y + z*z, maxSpeed);
+            vx[i] = x*scale;
+            vy[i] = y*scale;
+            vz[i] = z*scale;
+        }
+    }
+
+    void KinematicBatch::trimMaxSpeed(real maxSpeed)
+    {
+        real * AICORE_RESTRICT vx = velocityX;
+        real * AICORE_RESTRICT vy = velocityY;
+        real * AICORE_RESTRICT vz = velocityZ;
+
+        for (unsigned i = 0; i < size; i++)
+        {
+            real scale = trimFactor(
+                vx[i]*vx[i] + vy[i]*vy[i] + vz[i]*vz[i], maxSpeed
+                );
+            vx[i] *= scale;
+            vy[i] *= scale;
+            vz[i] *= scale;
+        }
+    }
+
+    void KinematicBatch::setOrientationFromVelocity(bool fastMath)
+    {
+        if (fastMath)
+        {
+            const real * AICORE_RESTRICT vx = velocityX;
+            const real * AICORE_RESTRICT vy = velocityY;
+            const real * AICORE_RESTRICT vz = velocityZ;
+            real * AICORE_RESTRICT o = orientation;
+            for (unsigned i = 0; i < size; i++)
+            {
+                real squareSpeed = vx[i]*vx[i] + vy[i]*vy[i] + vz[i]*vz[i];
+                real angle = fast_atan2(vx[i], vz[i]);
+                o[i] = squareSpeed > 0 ? angle : o[i];
+            }
+            return;
+        }
+
+        for (unsigned i = 0; i < size; i++)
+        {
+            // If we haven't got any velocity, then we can do nothing.
+            if (velocityX[i]*velocityX[i] + velocityY[i]*velocityY[i] +
+                velocityZ[i]*velocityZ[i] > 0)
+            {
+                orientation[i] = real_atan2(velocityX[i], velocityZ[i]);
+            }
+        }
+    }
+
+}; // end of namespace
@@ -0,0 +1,1486 @@
+/*
+ * The headless benchmark suite.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "psapi.lib")
+#endif
+#else
+#include <sys/resource.h>
+#endif
+
+#include <aicore/aicore.h>
+
+using namespace aicore;
+
+// The seed used to set up every benchmark, so runs are repeatable.
+#define BENCH_SEED 12345
+
+// The minimum time to spend timing each benchmark, in seconds.
+#define MIN_BENCH_TIME 0.2
+
+// The minimum time, and number of ticks, to run each stress size for.
+#define MIN_STRESS_TIME 1.0
+#define MIN_STRESS_TICKS 5
+
+// Once a benchmark's ticks take longer than this, in seconds, it isn't
+// run at any larger size.
+#define MAX_STRESS_TICK 1.0
+
+// How much worse than the baseline a result can be before the stress
+// run fails, as a fraction.
+#define DEFAULT_THRESHOLD 0.5
+
+/**
+ * The base class for a single benchmark. Each benchmark works on a
+ * population of agents (or a problem of a given size), and measures
+ * the time taken to update the whole population once.
+ */
+class Benchmark
+{
+public:
+    virtual ~Benchmark() {}
+
+    /** Returns the name to report the results under. */
+    virtual const char* getName() const = 0;
+
+    /** Creates the data for the given population size. */
+    virtual void setUp(unsigned population) = 0;
+
+    /** Updates every agent in the population once. */
+    virtual void run() = 0;
+
+    /** Releases the data created in setUp. */
+    virtual void tearDown() {}
+};
+
+// --------------------------------------------------------------------------
+// Steering
+
+/**
+ * Holds a population of characters, with targets scattered around
+ * them, for the steering benchmarks.
+ */
+class SteeringBenchmark : public Benchmark
+{
+protected:
+    std::vector<Kinematic> characters;
+    std::vector<Vector3> targets;
+    std::vector<SteeringOutput> outputs;
+
+public:
+    virtual void setUp(unsigned population)
+    {
+        characters.resize(population);
+        targets.resize(population);
+        outputs.resize(population);
+        for (unsigned i = 0; i < population; i++)
+        {
+            characters[i].position = Vector3(
+                randomBinomial(100), 0, randomBinomial(100));
+            characters[i].velocity = Vector3(
+                randomBinomial(10), 0, randomBinomial(10));
+            characters[i].orientation = randomReal(M_2PI);
+            targets[i] = Vector3(randomBinomial(100), 0, randomBinomial(100));
+        }
+    }
+};
+
+class SeekBenchmark : public SteeringBenchmark
+{
+    Seek seek;
+
+public:
+    virtual const char* getName() const { return "Seek"; }
+
+    virtual void run()
+    {
+        seek.maxAcceleration = 10;
+        for (unsigned i = 0; i < characters.size(); i++)
+        {
+            seek.character = &characters[i];
+            seek.target = &targets[i];
+            seek.getSteering(&outputs[i]);
+        }
+    }
+};
+
+class KinematicSeekBenchmark : public SteeringBenchmark
+{
+    KinematicSeek seek;
+
+public:
+    virtual const char* getName() const { return "KinematicSeek"; }
+
+    virtual void run()
+    {
+        seek.maxSpeed = 10;
+        for (unsigned i = 0; i < characters.size(); i++)
+        {
+            seek.character = &characters[i];
+            seek.target = &targets[i];
+            seek.getSteering(&outputs[i]);
+        }
+    }
+};
+
+/**
+ * Runs the same seek as KinematicSeekBenchmark, with the characters
+ * and targets held in arrays.
+ */
+class KinematicSeekBatchBenchmark : public SteeringBenchmark
+{
+    KinematicSeek seek;
+    KinematicBatch batch;
+    SteeringBatch steering;
+    std::vector<real> targetX, targetY, targetZ;
+
+public:
+    virtual const char* getName() const { return "KinematicSeekBatch"; }
+
+    virtual void setUp(unsigned population)
+    {
+        SteeringBenchmark::setUp(population);
+        batch.loadFrom(&characters[0], population);
+        targetX.resize(population);
+        targetY.resize(population);
+        targetZ.resize(population);
+        for (unsigned i = 0; i < population; i++)
+        {
+            targetX[i] = targets[i].x;
+            targetY[i] = targets[i].y;
+            targetZ[i] = targets[i].z;
+        }
+    }
+
+    virtual void run()
+    {
+        seek.maxSpeed = 10;
+        seek.getSteeringMany(batch, &targetX[0], &targetY[0], &targetZ[0],
+                             &steering);
+    }
+};
+
+class WanderBenchmark : public SteeringBenchmark
+{
+    // Wander points its target at its own member, so these can't be
+    // held in a vector (which would copy them).
+    Wander *wanders;
+    bool fastMath;
+
+public:
+    WanderBenchmark(bool fastMath = false)
+        : wanders(0), fastMath(fastMath) {}
+
+    virtual const char* getName() const
+    {
+        return fastMath ? "Wander (fast math)" : "Wander";
+    }
+
+    virtual void setUp(unsigned population)
+    {
+        SteeringBenchmark::setUp(population);
+        wanders = new Wander[population];
+        for (unsigned i = 0; i < population; i++)
+        {
+            wanders[i].character = &characters[i];
+            wanders[i].maxAcceleration = 10;
+            wanders[i].volatility = 20;
+            wanders[i].turnSpeed = 2;
+            wanders[i].fastMath = fastMath;
+        }
+    }
+
+    virtual void run()
+    {
+        for (unsigned i = 0; i < characters.size(); i++)
+        {
+            wanders[i].getSteering(&outputs[i]);
+        }
+    }
+
+    virtual void tearDown()
+    {
+        delete[] wanders;
+        wanders = 0;
+    }
+};
+
+class AvoidSphereBenchmark : public SteeringBenchmark
+{
+    AvoidSphere avoid;
+    Sphere obstacle;
+
+public:
+    virtual const char* getName() const { return "AvoidSphere"; }
+
+    virtual void run()
+    {
+        obstacle.position = Vector3(0, 0, 0);
+        obstacle.radius = 20;
+        avoid.obstacle = &obstacle;
+        avoid.maxAcceleration = 10;
+        avoid.avoidMargin = 2;
+        avoid.maxLookahead = 50;
+        for (unsigned i = 0; i < characters.size(); i++)
+        {
+            avoid.character = &characters[i];
+            avoid.getSteering(&outputs[i]);
+        }
+    }
+};
+
+class AvoidSpheresBenchmark : public SteeringBenchmark
+{
+    std::vector<Sphere> obstacles;
+    SphereHierarchy hierarchy;
+    AvoidSpheres avoid;
+
+public:
+    virtual const char* getName() const { return "AvoidSpheres (broadphase)"; }
+
+    virtual void setUp(unsigned population)
+    {
+        SteeringBenchmark::setUp(population);
+
+        obstacles.resize(256);
+        for (unsigned i = 0; i < obstacles.size(); i++)
+        {
+            obstacles[i].position = Vector3(
+                randomBinomial(100), 0, randomBinomial(100));
+            obstacles[i].radius = randomReal(5) + 1;
+        }
+        hierarchy.build(&obstacles[0], (unsigned)obstacles.size());
+
+        avoid.broadphase = &hierarchy;
+        avoid.maxAcceleration = 10;
+        avoid.avoidMargin = 2;
+        avoid.maxLookahead = 50;
+    }
+
+    virtual void run()
+    {
+        for (unsigned i = 0; i < characters.size(); i++)
+        {
+            avoid.character = &characters[i];
+            avoid.getSteering(&outputs[i]);
+        }
+    }
+};
+
+class BlendedBenchmark : public SteeringBenchmark
+{
+    Seek seek;
+    Flee flee;
+    BlendedSteering blend;
+
+public:
+    virtual const char* getName() const { return "BlendedSteering"; }
+
+    virtual void setUp(unsigned population)
+    {
+        SteeringBenchmark::setUp(population);
+        seek.maxAcceleration = 10;
+        flee.maxAcceleration = 5;
+        blend.behaviours.clear();
+        blend.behaviours.push_back(
+            BlendedSteering::BehaviourAndWeight(&seek, 1));
+        blend.behaviours.push_back(
+            BlendedSteering::BehaviourAndWeight(&flee, (real)0.5));
+    }
+
+    virtual void run()
+    {
+        for (unsigned i = 0; i < characters.size(); i++)
+        {
+            seek.target = &targets[i];
+            flee.target = &targets[(i+1) % targets.size()];
+            blend.character = &characters[i];
+            blend.getSteering(&outputs[i]);
+        }
+    }
+};
+
+/**
+ * Runs the same blend as BlendedBenchmark, with the recipe fixed at
+ * compile time.
+ */
+class StaticBlendedBenchmark : public SteeringBenchmark
+{
+    StaticBlendedSteering<Seek, Weighted<Flee, std::ratio<1,2> > > blend;
+
+public:
+    virtual const char* getName() const { return "StaticBlendedSteering"; }
+
+    virtual void setUp(unsigned population)
+    {
+        SteeringBenchmark::setUp(population);
+        blend.get<0>().maxAcceleration = 10;
+        blend.get<1>().maxAcceleration = 5;
+    }
+
+    virtual void run()
+    {
+        for (unsigned i = 0; i < characters.size(); i++)
+        {
+            blend.get<0>().target = &targets[i];
+            blend.get<1>().target = &targets[(i+1) % targets.size()];
+            blend.character = &characters[i];
+            blend.getSteering(&outputs[i]);
+        }
+    }
+};
+
+class SteeringPipeBenchmark : public SteeringBenchmark
+{
+    std::vector<Sphere> obstacles;
+    SteeringPipe pipe;
+    FixedGoalTargeter targeter;
+    AvoidSpheresConstraint constraint;
+    BasicActuator actuator;
+    std::vector<Kinematic*> pointers;
+
+public:
+    virtual const char* getName() const { return "SteeringPipe (batch)"; }
+
+    virtual void setUp(unsigned population)
+    {
+        SteeringBenchmark::setUp(population);
+
+        obstacles.resize(32);
+        constraint.obstacles.clear();
+        for (unsigned i = 0; i < obstacles.size(); i++)
+        {
+            obstacles[i].position = Vector3(
+                randomBinomial(100), 0, randomBinomial(100));
+            obstacles[i].radius = randomReal(5) + 1;
+            constraint.obstacles.push_back(&obstacles[i]);
+        }
+        constraint.avoidMargin = 2;
+
+        targeter.goal.position = Vector3(0, 0, 0);
+        targeter.goal.positionSet = true;
+        actuator.maxAcceleration = 10;
+
+        pipe.targeters.clear();
+        pipe.constraints.clear();
+        pipe.targeters.push_back(&targeter);
+        pipe.constraints.push_back(&constraint);
+        pipe.constraintSteps = 4;
+        pipe.setActuator(&actuator);
+        pipe.registerComponents();
+
+        pointers.resize(population);
+        for (unsigned i = 0; i < population; i++) pointers[i] = &characters[i];
+        pipe.reserve(population);
+    }
+
+    virtual void run()
+    {
+        pipe.getSteering(&pointers[0], &outputs[0], (unsigned)pointers.size());
+    }
+};
+
+class FlockingBenchmark : public SteeringBenchmark
+{
+    Flock flock;
+    Separation separation;
+    Cohesion cohesion;
+    VelocityMatchAndAlign vma;
+    BlendedSteering blend;
+
+public:
+    virtual const char* getName() const { return "Flocking"; }
+
+    virtual void setUp(unsigned population)
+    {
+        SteeringBenchmark::setUp(population);
+
+        // Keep the density roughly constant as the flock grows.
+        real size = real_sqrt((real)population) * 2;
+        flock.boids.clear();
+        for (unsigned i = 0; i < population; i++)
+        {
+            characters[i].position = Vector3(
+                randomBinomial(size), 0, randomBinomial(size));
+            flock.boids.push_back(&characters[i]);
+        }
+
+        separation.theFlock = cohesion.theFlock = vma.theFlock = &flock;
+        separation.maxAcceleration = cohesion.maxAcceleration =
+            vma.maxAcceleration = 20;
+        separation.neighbourhoodSize = 5;
+        separation.neighbourhoodMinDP = -1;
+        cohesion.neighbourhoodSize = 10;
+        cohesion.neighbourhoodMinDP = 0;
+        vma.neighbourhoodSize = 10;
+        vma.neighbourhoodMinDP = 0;
+
+        blend.behaviours.clear();
+        blend.behaviours.push_back(
+            BlendedSteering::BehaviourAndWeight(&separation, 1));
+        blend.behaviours.push_back(
+            BlendedSteering::BehaviourAndWeight(&cohesion, 1));
+        blend.behaviours.push_back(
+            BlendedSteering::BehaviourAndWeight(&vma, 2));
+    }
+
+    virtual void run()
+    {
+        flock.update();
+        for (unsigned i = 0; i < characters.size(); i++)
+        {
+            blend.character = &characters[i];
+            blend.getSteering(&outputs[i]);
+        }
+    }
+};
+
+class CrowdBenchmark : public SteeringBenchmark
+{
+    Crowd crowd;
+
+public:
+    virtual const char* getName() const { return "Crowd"; }
+
+    virtual void setUp(unsigned population)
+    {
+        SteeringBenchmark::setUp(population);
+
+        // The same density as the flocking benchmark.
+        real size = real_sqrt((real)population) * 2;
+        crowd.resize(population);
+        KinematicBatch &state = crowd.getState();
+        for (unsigned i = 0; i < population; i++)
+        {
+            state.positionX[i] = randomBinomial(size);
+            state.positionY[i] = 0;
+            state.positionZ[i] = randomBinomial(size);
+        }
+        crowd.settings.alignmentWeight = 2;
+        crowd.settings.wanderWeight = 1;
+    }
+
+    virtual void run()
+    {
+        crowd.step((real)0.1);
+    }
+};
+
+// --------------------------------------------------------------------------
+// Decision making
+
+/** An action that is always returned from the same list. */
+class BenchAction : public Action
+{
+public:
+    BenchAction() { priority = 0; next = NULL; }
+};
+
+/** A state that always returns the same actions. */
+class BenchState : public StateMachineState
+{
+public:
+    BenchAction entry, active, exit;
+
+    BenchState() { firstTransition = NULL; }
+
+    virtual Action * getActions() { active.next = NULL; return &active; }
+    virtual Action * getEntryActions() { entry.next = NULL; return &entry; }
+    virtual Action * getExitActions() { exit.next = NULL; return &exit; }
+};
+
+/** A transition triggered when an integer matches. */
+class BenchTransition :
+    public Transition,
+    public ConditionalTransitionMixin,
+    public FixedTargetTransitionMixin
+{
+public:
+    BenchAction action;
+
+    virtual bool isTriggered()
+    {
+        return ConditionalTransitionMixin::isTriggered();
+    }
+    virtual StateMachineState * getTargetState()
+    {
+        return FixedTargetTransitionMixin::getTargetState();
+    }
+    virtual Action * getActions() { action.next = NULL; return &action; }
+};
+
+class StateMachineBenchmark : public Benchmark
+{
+    BenchState states[2];
+    BenchTransition transitions[2];
+    IntegerMatchCondition conditions[2];
+    std::vector<StateMachine> machines;
+    std::vector<int> inputs;
+    int current;
+
+public:
+    virtual const char* getName() const { return "StateMachine::update"; }
+
+    virtual void setUp(unsigned population)
+    {
+        // Two states that swap when the agent's input changes.
+        for (unsigned i = 0; i < 2; i++)
+        {
+            conditions[i].target = (int)(1-i);
+            transitions[i].condition = &conditions[i];
+            transitions[i].target = &states[1-i];
+            transitions[i].next = NULL;
+            states[i].firstTransition = &transitions[i];
+        }
+
+        machines.resize(population);
+        inputs.resize(population);
+        for (unsigned i = 0; i < population; i++)
+        {
+            machines[i].initialState = &states[0];
+            machines[i].currentState = NULL;
+            inputs[i] = randomInt(2);
+        }
+        current = 0;
+    }
+
+    virtual void run()
+    {
+        for (unsigned i = 0; i < machines.size(); i++)
+        {
+            conditions[0].watch = conditions[1].watch = &inputs[i];
+            machines[i].update();
+            inputs[i] ^= (i + current) & 1;
+        }
+        current++;
+    }
+};
+
+class CompiledStateMachineBenchmark : public Benchmark
+{
+    BenchState states[2];
+    BenchTransition transitions[2];
+    IntegerInputMatchCondition conditions[2];
+    CompiledStateMachine machine;
+    std::vector<unsigned> current;
+    std::vector<int> inputs;
+    std::vector<Action*> actions;
+    unsigned frame;
+
+public:
+    virtual const char* getName() const { return "CompiledStateMachine"; }
+
+    virtual void setUp(unsigned population)
+    {
+        // The same machine as StateMachineBenchmark, with each
+        // agent's input read from its slot in the inputs array.
+        for (unsigned i = 0; i < 2; i++)
+        {
+            conditions[i].inputs = NULL;
+            conditions[i].input = 0;
+            conditions[i].target = (int)(1-i);
+            transitions[i].condition = &conditions[i];
+            transitions[i].target = &states[1-i];
+            transitions[i].next = NULL;
+            states[i].firstTransition = &transitions[i];
+        }
+        machine.compile(&states[0]);
+
+        current.assign(population, CompiledStateMachine::NOT_STARTED);
+        actions.resize(population);
+        inputs.resize(population);
+        for (unsigned i = 0; i < population; i++) inputs[i] = randomInt(2);
+        frame = 0;
+    }
+
+    virtual void run()
+    {
+        machine.updateMany(&current[0], &inputs[0], 1,
+                           (unsigned)current.size(), &actions[0]);
+        for (unsigned i = 0; i < inputs.size(); i++)
+        {
+            inputs[i] ^= (i + frame) & 1;
+        }
+        frame++;
+    }
+};
+
+/** A markov transition that is only used as the default. */
+class BenchMarkovTransition : public FixedMarkovTransition
+{
+public:
+    virtual bool isTriggered() { return false; }
+};
+
+class MarkovBenchmark : public Benchmark
+{
+    enum { STATES = 4 };
+
+    BenchMarkovTransition transition;
+    real matrix[STATES*STATES];
+    std::vector<MarkovStateMachine> machines;
+    std::vector<real> vectors;
+
+public:
+    virtual const char* getName() const { return "MarkovStateMachine::update"; }
+
+    virtual void setUp(unsigned population)
+    {
+        for (unsigned i = 0; i < STATES*STATES; i++) matrix[i] = (real)0.25;
+        transition.setMatrix(matrix, STATES);
+        transition.next = NULL;
+
+        machines.resize(population);
+        vectors.resize(population * STATES);
+        for (unsigned i = 0; i < population; i++)
+        {
+            MarkovStateMachine &m = machines[i];
+            m.stateVector = &vectors[i * STATES];
+            m.stateVectorSize = STATES;
+            for (unsigned j = 0; j < STATES; j++) m.stateVector[j] = 0;
+            m.stateVector[i % STATES] = 1;
+            m.firstTransition = NULL;
+            m.defaultTransition = &transition;
+            m.framesToDefault = 0;
+            m.framesPassed = 0;
+        }
+    }
+
+    virtual void run()
+    {
+        for (unsigned i = 0; i < machines.size(); i++)
+        {
+            machines[i].update();
+        }
+    }
+};
+
+class ActionManagerBenchmark : public Benchmark
+{
+    std::vector<ActionManager> managers;
+
+public:
+    virtual const char* getName() const { return "ActionManager::execute"; }
+
+    virtual void setUp(unsigned population)
+    {
+        managers.clear();
+        managers.resize(population);
+    }
+
+    virtual void run()
+    {
+        // Each manager gets one new action that completes at once.
+        for (unsigned i = 0; i < managers.size(); i++)
+        {
+            Action *action = new Action;
+            action->priority = (real)(i & 3);
+            action->next = NULL;
+            managers[i].scheduleAction(action);
+            managers[i].execute();
+        }
+    }
+};
+
+/** An action that waits up to two seconds between each time it acts. */
+class BenchWaitAction : public Action
+{
+public:
+    const real *clock;
+    real wakeTime;
+
+    BenchWaitAction(const real *clock) : clock(clock), wakeTime(0) {}
+
+    virtual bool isComplete() { return false; }
+    virtual void act() { wakeTime = *clock + randomReal(2); }
+    virtual real getWakeTime() const { return wakeTime; }
+};
+
+class ActionSchedulerBenchmark : public Benchmark
+{
+    ActionScheduler scheduler;
+    std::vector<ActionManager> managers;
+
+public:
+    virtual const char* getName() const { return "ActionScheduler (waiting)"; }
+
+    virtual void setUp(unsigned population)
+    {
+        managers.resize(population);
+        for (unsigned i = 0; i < population; i++)
+        {
+            scheduler.add(&managers[i]);
+            managers[i].scheduleAction(new BenchWaitAction(&managers[i].time));
+        }
+        scheduler.execute(0);
+    }
+
+    virtual void run()
+    {
+        // At 60 frames a second, each agent acts about one frame in 60.
+        scheduler.execute((real)1 / 60);
+    }
+
+    virtual void tearDown()
+    {
+        for (unsigned i = 0; i < managers.size(); i++)
+        {
+            scheduler.remove(&managers[i]);
+            managers[i].active->deleteList();
+        }
+        managers.clear();
+    }
+};
+
+class DecisionTreeBenchmark : public Benchmark
+{
+protected:
+    enum { DEPTH = 4 };
+
+    std::vector<ThresholdDecision> decisions;
+    std::vector<DecisionTreeAction> actions;
+    std::vector<real> values;
+    const real *currentValue;
+
+public:
+    virtual const char* getName() const { return "DecisionTree"; }
+
+    virtual void setUp(unsigned population)
+    {
+        // A complete binary tree, where each level splits the value
+        // range in half again.
+        unsigned internal = (1 << DEPTH) - 1;
+        decisions.resize(internal);
+        actions.resize(internal + 1);
+        for (unsigned i = 0; i < internal; i++)
+        {
+            unsigned level = 0;
+            while (((i+1) >> (level+1)) != 0) level++;
+            unsigned first = (1 << level) - 1;
+            real width = (real)1.0 / (real)(1 << level);
+
+            ThresholdDecision &d = decisions[i];
+            d.inputs = &currentValue;
+            d.input = 0;
+            d.threshold = width * ((real)(i - first) + (real)0.5);
+
+            unsigned left = i*2 + 1, right = i*2 + 2;
+            d.falseBranch = left < internal ?
+                (DecisionTreeNode*)&decisions[left] :
+                (DecisionTreeNode*)&actions[left - internal];
+            d.trueBranch = right < internal ?
+                (DecisionTreeNode*)&decisions[right] :
+                (DecisionTreeNode*)&actions[right - internal];
+        }
+
+        values.resize(population);
+        for (unsigned i = 0; i < population; i++) values[i] = randomReal();
+    }
+
+    virtual void run()
+    {
+        for (unsigned i = 0; i < values.size(); i++)
+        {
+            currentValue = &values[i];
+            decisions[0].makeDecision();
+        }
+    }
+};
+
+class CompiledDecisionTreeBenchmark : public DecisionTreeBenchmark
+{
+    CompiledDecisionTree tree;
+    std::vector<DecisionTreeNode*> results;
+
+public:
+    virtual const char* getName() const { return "CompiledDecisionTree"; }
+
+    virtual void setUp(unsigned population)
+    {
+        DecisionTreeBenchmark::setUp(population);
+        tree.compile(&decisions[0]);
+        results.resize(population);
+    }
+
+    virtual void run()
+    {
+        tree.decideMany(&values[0], 1, (unsigned)values.size(), &results[0]);
+    }
+};
+
+class RulesBenchmark : public Benchmark
+{
+    enum { DATA_PER_AGENT = 8 };
+
+    std::vector<DataGroup> databases;
+    std::vector<IntegerDatum> data;
+    IntegerRangeMatch *health;
+    IntegerRangeMatch *ammo;
+    AndMatch *both;
+
+public:
+    RulesBenchmark() : health(0), ammo(0), both(0) {}
+
+    virtual const char* getName() const { return "Rules matcher"; }
+
+    virtual void setUp(unsigned population)
+    {
+        databases.resize(population);
+        data.resize(population * DATA_PER_AGENT);
+        for (unsigned i = 0; i < population; i++)
+        {
+            DataGroup &db = databases[i];
+            db.identifier = 0;
+            db.nextSibling = NULL;
+            db.firstChild = NULL;
+            for (unsigned j = 0; j < DATA_PER_AGENT; j++)
+            {
+                IntegerDatum &datum = data[i*DATA_PER_AGENT + j];
+                datum.identifier = j + 1;
+                datum.value = randomInt(100);
+                datum.nextSibling = db.firstChild;
+                db.firstChild = &datum;
+            }
+        }
+
+        health = new IntegerRangeMatch(1, 0, 50);
+        health->nextSibling = NULL;
+        ammo = new IntegerRangeMatch(DATA_PER_AGENT, 10, 100);
+        ammo->nextSibling = NULL;
+        both = new AndMatch(health, ammo);
+    }
+
+    virtual void run()
+    {
+        for (unsigned i = 0; i < databases.size(); i++)
+        {
+            both->matches(&databases[i], NULL);
+        }
+    }
+
+    virtual void tearDown()
+    {
+        delete both;
+        delete health;
+        delete ammo;
+    }
+};
+
+/**
+ * Streams a health change for every agent into a database, with a
+ * rule per agent watching for low health, and brings the rules up to
+ * date.
+ */
+class DatabaseStreamBenchmark : public Benchmark
+{
+    enum { HEALTH = 1 };
+
+    struct WatchRule : public Rule
+    {
+        DataGroupMatch agent;
+        IntegerRangeMatch health;
+
+        WatchRule(id identifier)
+            : agent(identifier), health(HEALTH, 0, 30)
+        {
+            health.nextSibling = NULL;
+            agent.firstChild = &health;
+            agent.nextSibling = NULL;
+            ifClause = &agent;
+        }
+
+        virtual void action() {}
+    };
+
+    DataGroup *database;
+    ReteNetwork *network;
+    DatabaseStream *stream;
+    std::vector<WatchRule*> watches;
+    unsigned frame;
+
+public:
+    DatabaseStreamBenchmark()
+        : database(0), network(0), stream(0), frame(0) {}
+
+    virtual const char* getName() const { return "DatabaseStream"; }
+
+    virtual void setUp(unsigned population)
+    {
+        database = new DataGroup;
+        network = new ReteNetwork;
+        stream = new DatabaseStream(database, network, true);
+        watches.resize(population);
+        for (unsigned i = 0; i < population; i++)
+        {
+            watches[i] = new WatchRule(i + 1);
+            network->addRule(watches[i]);
+        }
+        frame = 0;
+    }
+
+    virtual void run()
+    {
+        frame++;
+        unsigned count = (unsigned)watches.size();
+        for (unsigned i = 0; i < count; i++)
+        {
+            id path[] = { i + 1, HEALTH };
+            stream->update(path, 2, (int)((i + frame) % 100));
+        }
+        stream->apply();
+        network->update(database);
+    }
+
+    virtual void tearDown()
+    {
+        // The stream owns the nodes in the database, so goes last.
+        for (unsigned i = 0; i < watches.size(); i++) delete watches[i];
+        watches.clear();
+        delete network;
+        delete database;
+        delete stream;
+    }
+};
+
+class QLearningBenchmark : public Benchmark
+{
+    enum { ACTIONS = 4, ITERATIONS = 1000 };
+
+    std::vector<unsigned> destinations;
+    std::vector<real> rewards;
+    ArrayBasedLearningProblem *problem;
+    QLearner *learner;
+
+public:
+    QLearningBenchmark() : problem(0), learner(0) {}
+
+    virtual const char* getName() const { return "QLearner::learn (states)"; }
+
+    virtual void setUp(unsigned population)
+    {
+        destinations.resize(population * ACTIONS);
+        rewards.resize(population * ACTIONS);
+        for (unsigned i = 0; i < population * ACTIONS; i++)
+        {
+            destinations[i] = randomInt(population);
+            rewards[i] = randomBinomial();
+        }
+        problem = new ArrayBasedLearningProblem(
+            population, ACTIONS, &destinations[0], &rewards[0]);
+        learner = new QLearner(problem, (real)0.3, (real)0.75,
+                               (real)0.2, (real)0.1);
+    }
+
+    virtual void run()
+    {
+        learner->learn(ITERATIONS);
+    }
+
+    virtual void tearDown()
+    {
+        delete learner;
+        delete problem;
+    }
+
+    /** Each run does a fixed number of iterations, not one per state. */
+    unsigned getOperations() const { return ITERATIONS; }
+};
+
+/**
+ * Runs the parallel q-learner on a fixed size problem, with a given
+ * number of threads, to show how learning scales with cores.
+ */
+class ParallelQLearningBenchmark : public Benchmark
+{
+    enum { ACTIONS = 4, ITERATIONS = 200000 };
+
+    std::vector<unsigned> destinations;
+    std::vector<real> rewards;
+    ArrayBasedLearningProblem *problem;
+    ParallelQLearner *learner;
+    unsigned threads;
+    char name[40];
+
+public:
+    ParallelQLearningBenchmark(unsigned threads)
+        : problem(0), learner(0), threads(threads)
+    {
+        snprintf(name, sizeof(name),
+                 "ParallelQLearner (%u thr)", threads);
+    }
+
+    virtual const char* getName() const { return name; }
+
+    virtual void setUp(unsigned population)
+    {
+        destinations.resize(population * ACTIONS);
+        rewards.resize(population * ACTIONS);
+        for (unsigned i = 0; i < population * ACTIONS; i++)
+        {
+            destinations[i] = randomInt(population);
+            rewards[i] = randomBinomial();
+        }
+        problem = new ArrayBasedLearningProblem(
+            population, ACTIONS, &destinations[0], &rewards[0]);
+        learner = new ParallelQLearner(problem, (real)0.3, (real)0.75,
+                                       (real)0.2, (real)0.1, threads);
+    }
+
+    virtual void run()
+    {
+        learner->learn(ITERATIONS);
+    }
+
+    virtual void tearDown()
+    {
+        delete learner;
+        delete problem;
+    }
+
+    /** Each run does a fixed number of iterations in total. */
+    unsigned getOperations() const { return ITERATIONS; }
+};
+
+// --------------------------------------------------------------------------
+// The driver
+
+typedef std::chrono::steady_clock BenchClock;
+
+/**
+ * Times the given benchmark at the given size, and prints the
+ * result. Each run counts as the given number of operations.
+ */
+void runBenchmark(Benchmark *bench, unsigned population, unsigned operations)
+{
+    randomSeed(BENCH_SEED);
+    bench->setUp(population);
+
+    // Warm up once, then repeat until enough time has passed.
+    bench->run();
+    unsigned runs = 0;
+    double elapsed = 0;
+    BenchClock::time_point start = BenchClock::now();
+    do
+    {
+        bench->run();
+        runs++;
+        elapsed = std::chrono::duration<double>(
+            BenchClock::now() - start).count();
+    }
+    while (elapsed < MIN_BENCH_TIME);
+
+    bench->tearDown();
+
+    double nsPerOp = elapsed * 1e9 / ((double)runs * (double)operations);
+    printf("%-28s %8u %12.1f %14.0f\n",
+           bench->getName(), population, nsPerOp, 1e9 / nsPerOp);
+}
+
+// --------------------------------------------------------------------------
+// The stress runner
+
+/** Holds the result of stressing one benchmark at one size. */
+struct StressResult
+{
+    char name[64];
+    unsigned population;
+
+    /** Operations (normally agents updated) per second. */
+    double throughput;
+
+    /** The time 99% of ticks were at or below, in milliseconds. */
+    double p99;
+
+    /**
+     * The largest the process had been in memory after the run, in
+     * kilobytes, or zero if that can't be measured. This includes the
+     * runs before it, so is only comparable between runs of the same
+     * benchmarks.
+     */
+    unsigned long peakMemory;
+};
+
+/** Returns the peak resident memory of the process, in kilobytes. */
+static unsigned long getPeakMemory()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                              sizeof(counters)))
+    {
+        return 0;
+    }
+    return (unsigned long)(counters.PeakWorkingSetSize / 1024);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+    return (unsigned long)(usage.ru_maxrss / 1024);
+#else
+    return (unsigned long)usage.ru_maxrss;
+#endif
+#endif
+}
+
+/**
+ * Runs the given benchmark as a series of ticks at the given size,
+ * timing each one, and fills in the result.
+ */
+void runStress(Benchmark *bench, unsigned population, unsigned operations,
+               StressResult *result)
+{
+    randomSeed(BENCH_SEED);
+    bench->setUp(population);
+
+    bench->run();
+    std::vector<double> ticks;
+    double elapsed = 0;
+    do
+    {
+        BenchClock::time_point start = BenchClock::now();
+        bench->run();
+        double tick = std::chrono::duration<double>(
+            BenchClock::now() - start).count();
+        ticks.push_back(tick);
+        elapsed += tick;
+    }
+    while (elapsed < MIN_STRESS_TIME || ticks.size() < MIN_STRESS_TICKS);
+
+    bench->tearDown();
+
+    std::sort(ticks.begin(), ticks.end());
+    size_t p99 = (ticks.size() * 99 + 99) / 100 - 1;
+
+    snprintf(result->name, sizeof(result->name), "%s", bench->getName());
+    result->population = population;
+    result->throughput =
+        (double)ticks.size() * (double)operations / elapsed;
+    result->p99 = ticks[p99] * 1e3;
+    result->peakMemory = getPeakMemory();
+}
+
+/**
+ * Reads a baseline written by writeBaseline. Each line holds the
+ * size, throughput, p99 and peak memory, then the name.
+ */
+static bool readBaseline(const char *filename,
+                         std::vector<StressResult> *results)
+{
+    FILE *file = fopen(filename, "r");
+    if (!file) return false;
+
+    char line[256];
+    while (fgets(line, sizeof(line), file))
+    {
+        StressResult result;
+        if (sscanf(line, "%u %lf %lf %lu %63[^\n]",
+                   &result.population, &result.throughput, &result.p99,
+                   &result.peakMemory, result.name) == 5)
+        {
+            results->push_back(result);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+/** Writes the results to a file that readBaseline can read. */
+static bool writeBaseline(const char *filename,
+                          const std::vector<StressResult> &results)
+{
+    FILE *file = fopen(filename, "w");
+    if (!file) return false;
+
+    fprintf(file, "# size throughput p99(ms) peak(KB) benchmark\n");
+    for (unsigned i = 0; i < results.size(); i++)
+    {
+        const StressResult &result = results[i];
+        fprintf(file, "%u %.1f %.4f %lu %s\n",
+                result.population, result.throughput, result.p99,
+                result.peakMemory, result.name);
+    }
+    return fclose(file) == 0;
+}
+
+/** Finds the baseline for the given result, or returns null. */
+static const StressResult* findBaseline(
+    const std::vector<StressResult> &baseline, const StressResult &result)
+{
+    for (unsigned i = 0; i < baseline.size(); i++)
+    {
+        if (baseline[i].population == result.population &&
+            strcmp(baseline[i].name, result.name) == 0)
+        {
+            return &baseline[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Returns how much worse the value is than the baseline, as a
+ * fraction, where higher values are better if the flag is set.
+ */
+static double getRegression(double value, double base, bool higherIsBetter)
+{
+    if (base <= 0 || value <= 0) return 0;
+    return higherIsBetter ? 1.0 - value / base : value / base - 1.0;
+}
+
+/**
+ * Ramps each of the scaling benchmarks up through the sizes, then
+ * compares the results with the baseline (if there is one).
+ *
+ * @return The exit code: one if anything regressed.
+ */
+int runStressSuite(const char *filter, unsigned maxPopulation,
+                   const char *baselineFile, const char *saveFile,
+                   double threshold)
+{
+    static const unsigned sizes[] = { 1000, 10000, 100000, 1000000 };
+
+    FlockingBenchmark flocking;
+    SteeringPipeBenchmark pipe;
+    StateMachineBenchmark sm;
+    QLearningBenchmark qlearning;
+
+    Benchmark *benchmarks[] = { &flocking, &pipe, &sm, &qlearning };
+
+    std::vector<StressResult> baseline;
+    if (baselineFile && !readBaseline(baselineFile, &baseline))
+    {
+        fprintf(stderr, "Can't read the baseline %s\n", baselineFile);
+        return 1;
+    }
+
+    printf("%-28s %8s %14s %10s %10s  %s\n",
+           "benchmark", "agents", "ops/sec", "p99 ms", "peak MB",
+           baselineFile ? "vs baseline" : "");
+
+    std::vector<StressResult> results;
+    unsigned regressed = 0;
+    for (unsigned b = 0; b < sizeof(benchmarks) / sizeof(Benchmark*); b++)
+    {
+        Benchmark *bench = benchmarks[b];
+        if (filter && !strstr(bench->getName(), filter)) continue;
+
+        for (unsigned s = 0; s < sizeof(sizes) / sizeof(unsigned); s++)
+        {
+            if (sizes[s] > maxPopulation) break;
+
+            StressResult result;
+            unsigned operations = bench == &qlearning ?
+                qlearning.getOperations() : sizes[s];
+            runStress(bench, sizes[s], operations, &result);
+            results.push_back(result);
+
+            printf("%-28s %8u %14.0f %10.3f %10.1f",
+                   result.name, result.population, result.throughput,
+                   result.p99, result.peakMemory / 1024.0);
+
+            const StressResult *base =
+                baselineFile ? findBaseline(baseline, result) : NULL;
+            if (baselineFile && !base)
+            {
+                printf("  (new)");
+            }
+            else if (base)
+            {
+                double speed = getRegression(
+                    result.throughput, base->throughput, true);
+                double latency = getRegression(result.p99, base->p99, false);
+                double memory = getRegression((double)result.peakMemory,
+                                              (double)base->peakMemory,
+                                              false);
+                printf("  %+5.0f%% ops %+5.0f%% p99 %+5.0f%% mem",
+                       -speed * 100, latency * 100, memory * 100);
+                if (speed > threshold || latency > threshold ||
+                    memory > threshold)
+                {
+                    printf("  REGRESSED");
+                    regressed++;
+                }
+            }
+            printf("\n");
+            fflush(stdout);
+
+            if (result.p99 > MAX_STRESS_TICK * 1e3 &&
+                s + 1 < sizeof(sizes) / sizeof(unsigned) &&
+                sizes[s + 1] <= maxPopulation)
+            {
+                printf("%-28s (stopped, ticks take over %.1fs)\n",
+                       result.name, MAX_STRESS_TICK);
+                break;
+            }
+        }
+    }
+
+    if (saveFile && !writeBaseline(saveFile, results))
+    {
+        fprintf(stderr, "Can't write the baseline %s\n", saveFile);
+        return 1;
+    }
+    if (regressed)
+    {
+        printf("%u results regressed by more than %.0f%%\n",
+               regressed, threshold * 100);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * With no arguments every benchmark is run. Otherwise the arguments
+ * are:
+ *
+ * <pre>
+ * aicore_bench [name]
+ *     Runs only the benchmarks whose name contains the given text.
+ *
+ * aicore_bench --stress [--max size] [--baseline file] [--save file]
+ *              [--threshold fraction] [name]
+ *     Ramps the flocking, steering pipe, state machine and q-learning
+ *     benchmarks from a thousand up to a million agents, measuring
+ *     throughput, 99th percentile tick time and peak memory. A
+ *     benchmark stops ramping once its ticks take over a second. Results
+ *     are compared with the baseline file, if given, and the exit
+ *     code is one if any is worse by more than the threshold (0.5 by
+ *     default). The results can be saved as a new baseline.
+ * </pre>
+ */
+int main(int argc, char** argv)
+{
+    TimingData::init();
+
+    if (argc > 1 && strcmp(argv[1], "--stress") == 0)
+    {
+        const char *filter = NULL;
+        const char *baselineFile = NULL;
+        const char *saveFile = NULL;
+        unsigned maxPopulation = 1000000;
+        double threshold = DEFAULT_THRESHOLD;
+        for (int i = 2; i < argc; i++)
+        {
+            bool hasValue = i + 1 < argc;
+            if (strcmp(argv[i], "--max") == 0 && hasValue)
+            {
+                maxPopulation = (unsigned)strtoul(argv[++i], NULL, 10);
+            }
+            else if (strcmp(argv[i], "--baseline") == 0 && hasValue)
+            {
+                baselineFile = argv[++i];
+            }
+            else if (strcmp(argv[i], "--save") == 0 && hasValue)
+            {
+                saveFile = argv[++i];
+            }
+            else if (strcmp(argv[i], "--threshold") == 0 && hasValue)
+            {
+                threshold = atof(argv[++i]);
+            }
+            else
+            {
+                filter = argv[i];
+            }
+        }
+
+        int code = runStressSuite(filter, maxPopulation,
+                                  baselineFile, saveFile, threshold);
+        TimingData::deinit();
+        return code;
+    }
+
+    // An optional argument runs only benchmarks with that name.
+    const char *filter = argc > 1 ? argv[1] : NULL;
+
+    static const unsigned populations[] = { 100, 1000, 10000 };
+    static const unsigned populationCount =
+        sizeof(populations) / sizeof(unsigned);
+
+    SeekBenchmark seek;
+    KinematicSeekBenchmark kinematicSeek;
+    KinematicSeekBatchBenchmark kinematicSeekBatch;
+    WanderBenchmark wander;
+    WanderBenchmark fastWander(true);
+    AvoidSphereBenchmark avoid;
+    AvoidSpheresBenchmark avoidMany;
+    BlendedBenchmark blended;
+    StaticBlendedBenchmark staticBlended;
+    SteeringPipeBenchmark pipe;
+    FlockingBenchmark flocking;
+    CrowdBenchmark crowd;
+    StateMachineBenchmark sm;
+    CompiledStateMachineBenchmark compiledSm;
+    MarkovBenchmark markov;
+    ActionManagerBenchmark actions;
+    ActionSchedulerBenchmark waiting;
+    DecisionTreeBenchmark dectree;
+    CompiledDecisionTreeBenchmark compiledDectree;
+    RulesBenchmark rules;
+    DatabaseStreamBenchmark databaseStream;
+    QLearningBenchmark qlearning;
+
+    Benchmark *perAgent[] = {
+        &seek, &kinematicSeek, &kinematicSeekBatch, &wander, &fastWander,
+        &avoid, &avoidMany, &blended, &staticBlended, &pipe, &flocking, &crowd,
+        &sm, &compiledSm, &markov, &actions, &waiting, &dectree,
+        &compiledDectree, &rules, &databaseStream
+    };
+
+    printf("%-28s %8s %12s %14s\n", "benchmark", "agents", "ns/op", "agents/sec");
+    for (unsigned b = 0; b < sizeof(perAgent) / sizeof(Benchmark*); b++)
+    {
+        if (filter && !strstr(perAgent[b]->getName(), filter)) continue;
+        for (unsigned p = 0; p < populationCount; p++)
+        {
+            runBenchmark(perAgent[b], populations[p], populations[p]);
+        }
+    }
+
+    if (!filter || strstr(qlearning.getName(), filter))
+    {
+        for (unsigned p = 0; p < populationCount; p++)
+        {
+            runBenchmark(&qlearning, populations[p], qlearning.getOperations());
+        }
+    }
+
+    // The parallel learner is run on the largest problem, doubling
+    // the threads up to the number of hardware threads.
+    unsigned hardware = std::thread::hardware_concurrency();
+    if (hardware == 0) hardware = 1;
+    for (unsigned threads = 1; ; threads *= 2)
+    {
+        if (threads > hardware) threads = hardware;
+
+        ParallelQLearningBenchmark parallel(threads);
+        if (!filter || strstr(parallel.getName(), filter))
+        {
+            runBenchmark(&parallel, populations[populationCount-1],
+                         parallel.getOperations());
+        }
+        if (threads == hardware) break;
+    }
+
+    TimingData::deinit();
+    return 0;
+}
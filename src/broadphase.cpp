@@ -0,0 +1,176 @@
+/*
+ * Defines the structures used to cull obstacles.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <algorithm>
+#include <aicore/aicore.h>
+
+namespace aicore
+{
+    /**
+     * Orders spheres by the position of their centre along one axis.
+     */
+    struct SphereAxisOrder
+    {
+        unsigned axis;
+
+        SphereAxisOrder(unsigned axis) : axis(axis) {}
+
+        bool operator()(const Sphere* a, const Sphere* b) const
+        {
+            switch (axis)
+            {
+            case 0: return a->position.x < b->position.x;
+            case 1: return a->position.y < b->position.y;
+            default: return a->position.z < b->position.z;
+            }
+        }
+    };
+
+    SphereHierarchy::SphereHierarchy()
+        :
+        version(0)
+    {}
+
+    SphereHierarchy::SphereHierarchy(const std::list<Sphere*>& spheres)
+        :
+        version(0)
+    {
+        build(spheres);
+    }
+
+    void SphereHierarchy::build(const std::list<Sphere*>& source)
+    {
+        version++;
+        spheres.assign(source.begin(), source.end());
+        nodes.clear();
+        if (spheres.empty()) return;
+
+        nodes.push_back(Node());
+        buildNode(0, 0, (unsigned)spheres.size());
+    }
+
+    void SphereHierarchy::build(Sphere* source, unsigned count)
+    {
+        version++;
+        spheres.resize(count);
+        for (unsigned i = 0; i < count; i++) spheres[i] = source+i;
+        nodes.clear();
+        if (spheres.empty()) return;
+
+        nodes.push_back(Node());
+        buildNode(0, 0, count);
+    }
+
+    void SphereHierarchy::buildNode(unsigned node, unsigned first,
+                                    unsigned count)
+    {
+        // Find the bounding box of the sphere centres.
+        Vector3 low = spheres[first]->position;
+        Vector3 high = low;
+        for (unsigned i = first+1; i < first+count; i++)
+        {
+            const Vector3 &p = spheres[i]->position;
+            if (p.x < low.x) low.x = p.x;
+            if (p.x > high.x) high.x = p.x;
+            if (p.y < low.y) low.y = p.y;
+            if (p.y > high.y) high.y = p.y;
+            if (p.z < low.z) low.z = p.z;
+            if (p.z > high.z) high.z = p.z;
+        }
+
+        // Bound the spheres with a sphere around the box centre.
+        Vector3 centre = (low + high) * (real)0.5;
+        real radius = 0;
+        for (unsigned i = first; i < first+count; i++)
+        {
+            real reach = (spheres[i]->position - centre).magnitude() +
+                spheres[i]->radius;
+            if (reach > radius) radius = reach;
+        }
+        nodes[node].centre = centre;
+        nodes[node].radius = radius;
+
+        if (count <= LEAF_SIZE)
+        {
+            nodes[node].first = first;
+            nodes[node].count = count;
+            return;
+        }
+
+        // Split at the median along the longest axis of the box.
+        Vector3 extent = high - low;
+        unsigned axis = 0;
+        if (extent.y > extent.x) axis = 1;
+        if (extent.z > (axis ? extent.y : extent.x)) axis = 2;
+
+        unsigned half = count / 2;
+        std::nth_element(spheres.begin() + first,
+                         spheres.begin() + first + half,
+                         spheres.begin() + first + count,
+                         SphereAxisOrder(axis));
+
+        // The children are added as a pair, which may move the node
+        // array, so don't hold references to nodes across this.
+        unsigned child = (unsigned)nodes.size();
+        nodes.resize(child + 2);
+        nodes[node].first = child;
+        nodes[node].count = 0;
+
+        buildNode(child, first, half);
+        buildNode(child+1, first+half, count-half);
+    }
+
+    unsigned SphereHierarchy::querySegment(const Vector3& start,
+                                           const Vector3& direction,
+                                           real length, real margin,
+                                           std::vector<Sphere*>* results) const
+    {
+        if (nodes.empty()) return 0;
+
+        // The tree is balanced, so this is deep enough for any
+        // number of spheres we could store.
+        unsigned stack[64];
+        unsigned stackSize = 0;
+        unsigned found = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0)
+        {
+            const Node &node = nodes[stack[--stackSize]];
+
+            // Find the closest point on the segment to the node.
+            Vector3 offset = node.centre - start;
+            real along = offset * direction;
+            if (along < 0) along = 0;
+            else if (along > length) along = length;
+            offset.addScaledVector(direction, -along);
+
+            real reach = node.radius + margin;
+            if (offset.squareMagnitude() > reach*reach) continue;
+
+            if (node.count > 0)
+            {
+                for (unsigned i = node.first; i < node.first+node.count; i++)
+                {
+                    results->push_back(spheres[i]);
+                }
+                found += node.count;
+            }
+            else
+            {
+                stack[stackSize++] = node.first;
+                stack[stackSize++] = node.first+1;
+            }
+        }
+        return found;
+    }
+
+}; // end of namespace
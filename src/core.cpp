@@ -11,39 +11,107 @@
  */
 #include <aicore/aicore.h>
 
-#include <stdlib.h>
+#include <atomic>
 
 namespace aicore
 {
+    /**
+     * Mixes a 64 bit value, used to spread a seed over the state of
+     * the random engine (this is the splitmix64 generator).
+     */
+    static uint64_t splitMix(uint64_t* x)
+    {
+        uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    RandomEngine::RandomEngine(uint64_t seed, uint64_t stream)
+    {
+        this->seed(seed, stream);
+    }
+
+    void RandomEngine::seed(uint64_t seed, uint64_t stream)
+    {
+        uint64_t x = seed ^ splitMix(&stream);
+        uint64_t a = splitMix(&x);
+        uint64_t b = splitMix(&x);
+        state[0] = (uint32_t)a;
+        state[1] = (uint32_t)(a >> 32);
+        state[2] = (uint32_t)b;
+        state[3] = (uint32_t)(b >> 32);
+
+        // The all zero state would only ever produce zeros.
+        if (!(state[0] | state[1] | state[2] | state[3])) state[0] = 1;
+    }
+
+    void RandomEngine::fillReal(real* values, unsigned count, real max)
+    {
+        const real scale = max * (real)(1.0 / 16777216.0);
+        for (unsigned i = 0; i < count; i++)
+        {
+            values[i] = (real)(next() >> 8) * scale;
+        }
+    }
+
+    void RandomEngine::fillBinomial(real* values, unsigned count, real max)
+    {
+        const real scale = max * (real)(1.0 / 16777216.0);
+        for (unsigned i = 0; i < count; i++)
+        {
+            real a = (real)(next() >> 8);
+            real b = (real)(next() >> 8);
+            values[i] = (a - b) * scale;
+        }
+    }
+
+    void RandomEngine::fillInt(int* values, unsigned count, int max)
+    {
+        if (max <= 0) max = 0;
+        for (unsigned i = 0; i < count; i++)
+        {
+            values[i] = (int)(((uint64_t)next() * (uint32_t)max) >> 32);
+        }
+    }
+
+    /** Counts the threads that have created their engine. */
+    static std::atomic<unsigned> engineCount(0);
+
+    RandomEngine& getRandomEngine()
+    {
+        static thread_local RandomEngine engine(1, engineCount++);
+        return engine;
+    }
 
     void randomSeed(unsigned value)
     {
         if (value == 0) {
-            srand((unsigned)TimingData::get().getClock());
+            getRandomEngine().seed(TimingData::get().getClock());
         } else {
-            srand(value);
+            getRandomEngine().seed(value);
         }
     }
 
     /* Get a random number [0,max[ */
     int randomInt(int max)
     {
-        return rand() % max;
+        return getRandomEngine().randomInt(max);
     }
 
     real randomReal(real max)
     {
-       return max * (real(rand()) / RAND_MAX);
+       return getRandomEngine().randomReal(max);
     }
 
     real randomBinomial(real max)
     {
-       return randomReal(max)-randomReal(max);
+       return getRandomEngine().randomBinomial(max);
     }
 
     bool randomBoolean()
     {
-        return (rand() % 2 == 0);
+        return getRandomEngine().randomBoolean();
     }
 
 }; // end of namespace
@@ -0,0 +1,297 @@
+/*
+ * Defines the classes used to simulate large crowds.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <assert.h>
+#include <aicore/aicore.h>
+
+namespace aicore
+{
+    CrowdSettings::CrowdSettings()
+        :
+        neighbourhoodSize(10),
+        separationWeight(1), cohesionWeight(1), alignmentWeight(1),
+        seekWeight(0), wanderWeight(0),
+        maxAcceleration(1), maxSpeed(5),
+        fastMath(false)
+    {
+    }
+
+    /**
+     * Returns the given direction scaled to the given length, or
+     * zero if it has no length, as Seek does.
+     */
+    static Vector3 scaleTo(Vector3 direction, real length, bool fastMath)
+    {
+        real squareMagnitude = direction.squareMagnitude();
+        if (squareMagnitude > 0)
+        {
+            if (fastMath)
+            {
+                direction *= length * fast_rsqrt(squareMagnitude);
+            }
+            else
+            {
+                direction.normalise();
+                direction *= length;
+            }
+        }
+        return direction;
+    }
+
+    CpuCrowdBackend::CpuCrowdBackend(JobSystem *jobs, unsigned tableSize)
+        :
+        jobs(jobs), grid(10, tableSize)
+    {
+        neighbours.resize(jobs ? jobs->getWorkerCount() : 1);
+    }
+
+    void CpuCrowdBackend::begin(const CrowdStep &step)
+    {
+        AICORE_PROFILE_LIBRARY_ZONE("CpuCrowdBackend");
+        this->step = step;
+
+        const KinematicBatch &current = *step.current;
+        unsigned count = current.getSize();
+        unsigned total = count + step.externalCount;
+
+        // Cells the size of a neighbourhood mean each query only
+        // looks at the cells around the character.
+        if (grid.getCellSize() != step.settings.neighbourhoodSize)
+        {
+            grid.setCellSize(step.settings.neighbourhoodSize);
+        }
+        if (grid.getCapacity() != total) grid.setCapacity(total);
+
+        for (unsigned i = 0; i < count; i++)
+        {
+            grid.update(i, Vector3(current.positionX[i],
+                                   current.positionY[i],
+                                   current.positionZ[i]));
+        }
+        externalVelocity.resize(step.externalCount);
+        for (unsigned e = 0; e < step.externalCount; e++)
+        {
+            grid.update(count + e, step.external[e]->position);
+            externalVelocity[e] = step.external[e]->velocity;
+        }
+
+        StepTask task;
+        task.backend = this;
+        if (jobs)
+        {
+            jobs->parallelFor(&task, count, 256);
+        }
+        else
+        {
+            task.run(0, count, 0);
+        }
+    }
+
+    void CpuCrowdBackend::finish()
+    {
+    }
+
+    void CpuCrowdBackend::StepTask::run(unsigned begin, unsigned end,
+                                        unsigned worker)
+    {
+        std::vector<unsigned> *found = &backend->neighbours[worker];
+        for (unsigned i = begin; i < end; i++)
+        {
+            backend->runCharacter(i, found);
+        }
+    }
+
+    void CpuCrowdBackend::runCharacter(unsigned index,
+                                       std::vector<unsigned> *found)
+    {
+        const KinematicBatch &current = *step.current;
+        const CrowdSettings &settings = step.settings;
+        unsigned count = current.getSize();
+
+        Vector3 position(current.positionX[index],
+                         current.positionY[index],
+                         current.positionZ[index]);
+        Vector3 velocity(current.velocityX[index],
+                         current.velocityY[index],
+                         current.velocityZ[index]);
+
+        // Summarise the neighbourhood, the same way Flock does.
+        found->clear();
+        grid.query(position, settings.neighbourhoodSize, found, index);
+
+        Vector3 center, averageVelocity, separation;
+        for (unsigned n = 0; n < found->size(); n++)
+        {
+            unsigned other = (*found)[n];
+            const Vector3 &otherPosition = grid.getPosition(other);
+            center += otherPosition;
+
+            Vector3 offset = position - otherPosition;
+            real squareDistance = offset.squareMagnitude();
+            if (squareDistance > 0)
+            {
+                separation.addScaledVector(offset, (real)1.0 / squareDistance);
+            }
+
+            if (other < count)
+            {
+                averageVelocity += Vector3(current.velocityX[other],
+                                           current.velocityY[other],
+                                           current.velocityZ[other]);
+            }
+            else
+            {
+                averageVelocity += externalVelocity[other - count];
+            }
+        }
+
+        // Blend the behaviours, as the boid behaviours in
+        // flocking.h and BlendedSteering would.
+        real maxAcceleration = settings.maxAcceleration;
+        bool fastMath = settings.fastMath;
+        Vector3 linear;
+        if (!found->empty())
+        {
+            real scale = (real)1.0 / (real)found->size();
+            center *= scale;
+            averageVelocity *= scale;
+
+            linear.addScaledVector(
+                scaleTo(separation, maxAcceleration, fastMath),
+                settings.separationWeight);
+            linear.addScaledVector(
+                scaleTo(center - position, maxAcceleration, fastMath),
+                settings.cohesionWeight);
+
+            Vector3 match = averageVelocity - velocity;
+            if (match.squareMagnitude() > maxAcceleration*maxAcceleration)
+            {
+                match = scaleTo(match, maxAcceleration, fastMath);
+            }
+            linear.addScaledVector(match, settings.alignmentWeight);
+        }
+
+        if (step.targetX)
+        {
+            Vector3 target(step.targetX[index], step.targetY[index],
+                           step.targetZ[index]);
+            linear.addScaledVector(
+                scaleTo(target - position, maxAcceleration, fastMath),
+                settings.seekWeight);
+        }
+
+        if (settings.wanderWeight != 0)
+        {
+            RandomEngine engine(step.seed + step.number, index);
+            real x = engine.randomBinomial(maxAcceleration);
+            real z = engine.randomBinomial(maxAcceleration);
+            linear.addScaledVector(Vector3(x, 0, z), settings.wanderWeight);
+        }
+
+        real totalWeight =
+            real_abs(settings.separationWeight) +
+            real_abs(settings.cohesionWeight) +
+            real_abs(settings.alignmentWeight) +
+            real_abs(settings.seekWeight) +
+            real_abs(settings.wanderWeight);
+        if (totalWeight > 0) linear *= (real)1.0 / totalWeight;
+
+        // Integrate, as KinematicBatch::integrateAndTrim does, with
+        // each character facing the way it is moving.
+        real duration = step.duration;
+        position.addScaledVector(velocity, duration);
+        velocity.addScaledVector(linear, duration);
+        real maxSpeed = settings.maxSpeed;
+        if (velocity.squareMagnitude() > maxSpeed*maxSpeed)
+        {
+            velocity = scaleTo(velocity, maxSpeed, fastMath);
+        }
+
+        KinematicBatch &next = *step.next;
+        next.positionX[index] = position.x;
+        next.positionY[index] = position.y;
+        next.positionZ[index] = position.z;
+        next.velocityX[index] = velocity.x;
+        next.velocityY[index] = velocity.y;
+        next.velocityZ[index] = velocity.z;
+        next.rotation[index] = 0;
+        if (velocity.x*velocity.x + velocity.z*velocity.z > 0)
+        {
+            next.orientation[index] = fastMath ?
+                fast_atan2(velocity.x, velocity.z) :
+                real_atan2(velocity.x, velocity.z);
+        }
+        else
+        {
+            next.orientation[index] = current.orientation[index];
+        }
+    }
+
+    Crowd::Crowd(CrowdBackend *backend, JobSystem *jobs)
+        :
+        front(0), stepping(false), backend(backend), cpu(jobs),
+        targetX(NULL), targetY(NULL), targetZ(NULL),
+        external(NULL), externalCount(0),
+        steps(0), seed(1)
+    {
+    }
+
+    void Crowd::resize(unsigned count)
+    {
+        assert(!stepping);
+        buffers[0].resize(count);
+        buffers[1].resize(count);
+    }
+
+    void Crowd::setTargets(const real *x, const real *y, const real *z)
+    {
+        targetX = x;
+        targetY = y;
+        targetZ = z;
+    }
+
+    void Crowd::setExternal(const Kinematic * const *characters,
+                            unsigned count)
+    {
+        external = characters;
+        externalCount = count;
+    }
+
+    void Crowd::beginStep(real duration)
+    {
+        assert(!stepping);
+        stepping = true;
+
+        CrowdStep step;
+        step.current = &buffers[front];
+        step.next = &buffers[1 - front];
+        step.targetX = targetX;
+        step.targetY = targetY;
+        step.targetZ = targetZ;
+        step.external = external;
+        step.externalCount = externalCount;
+        step.settings = settings;
+        step.duration = duration;
+        step.seed = seed;
+        step.number = steps++;
+
+        (backend ? backend : &cpu)->begin(step);
+    }
+
+    void Crowd::endStep()
+    {
+        assert(stepping);
+        (backend ? backend : &cpu)->finish();
+        front = 1 - front;
+        stepping = false;
+    }
+
+}; // end of namespace
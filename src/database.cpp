@@ -0,0 +1,773 @@
+/*
+ * Defines the classes used to store and load rule databases.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <aicore/aicore.h>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace aicore
+{
+    /** All allocations are made on boundaries of this many bytes. */
+    static const size_t ARENA_ALIGNMENT = 16;
+
+    static size_t alignSize(size_t size)
+    {
+        return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+    }
+
+    DatabaseArena::DatabaseArena(size_t blockSize)
+        :
+        current(0), used(0), blockSize(alignSize(blockSize))
+    {
+    }
+
+    DatabaseArena::~DatabaseArena()
+    {
+        reset();
+        for (unsigned i = 0; i < blocks.size(); i++)
+        {
+            delete [] blocks[i].memory;
+        }
+    }
+
+    void DatabaseArena::reset()
+    {
+        for (unsigned i = 0; i < groups.size(); i++)
+        {
+            groups[i]->~DataGroup();
+        }
+        groups.clear();
+        current = 0;
+        used = 0;
+    }
+
+    void* DatabaseArena::allocate(size_t size)
+    {
+        size = alignSize(size);
+
+        // Move on through the blocks we have until one has room.
+        while (current < blocks.size() && used + size > blocks[current].size)
+        {
+            current++;
+            used = 0;
+        }
+
+        if (current == blocks.size())
+        {
+            Block block;
+            block.size = size > blockSize ? size : blockSize;
+            // new[] of char is only guaranteed to be aligned for the
+            // largest fundamental type, so allow for realigning.
+            block.memory = new char[block.size + ARENA_ALIGNMENT];
+            blocks.push_back(block);
+            used = 0;
+        }
+
+        char *base = blocks[current].memory;
+        size_t misalign = (size_t)base & (ARENA_ALIGNMENT - 1);
+        char *result = base + (misalign ? ARENA_ALIGNMENT - misalign : 0) + used;
+        used += size;
+        return result;
+    }
+
+    void DatabaseArena::reserve(size_t bytes)
+    {
+        bytes = alignSize(bytes);
+
+        // Is there room in the current block or the ones after it?
+        for (unsigned i = current; i < blocks.size(); i++)
+        {
+            size_t free = blocks[i].size - (i == current ? used : 0);
+            if (free >= bytes) return;
+        }
+
+        // Add a block big enough, after the current one so it is used
+        // next.
+        Block block;
+        block.size = bytes > blockSize ? bytes : blockSize;
+        block.memory = new char[block.size + ARENA_ALIGNMENT];
+        if (current < blocks.size() && used > 0)
+        {
+            blocks.insert(blocks.begin() + current + 1, block);
+        }
+        else
+        {
+            blocks.insert(blocks.begin() + current, block);
+            used = 0;
+        }
+    }
+
+    size_t DatabaseArena::getCapacity() const
+    {
+        size_t total = 0;
+        for (unsigned i = 0; i < blocks.size(); i++) total += blocks[i].size;
+        return total;
+    }
+
+    DataGroup* DatabaseArena::createGroup(id identifier)
+    {
+        DataGroup *group = new (allocate(sizeof(DataGroup))) DataGroup;
+        group->identifier = identifier;
+        groups.push_back(group);
+        return group;
+    }
+
+
+    FlatDatabase::FlatDatabase()
+        :
+        nodes(0), count(0)
+    {
+    }
+
+    const unsigned FlatDatabase::NONE;
+
+    /** The current version of the flat file format. */
+    static const unsigned FLAT_VERSION = 1;
+
+    bool FlatDatabase::attach(const void *data, size_t size)
+    {
+        nodes = 0;
+        count = 0;
+
+        if (!data || size < sizeof(Header)) return false;
+        const Header *header = (const Header*)data;
+        if (memcmp(header->magic, "AIDB", 4) != 0 ||
+            header->version != FLAT_VERSION ||
+            header->realSize != sizeof(real))
+        {
+            return false;
+        }
+
+        size_t available = (size - sizeof(Header)) / sizeof(FlatNode);
+        if (header->nodeCount == 0 || header->nodeCount > available)
+        {
+            return false;
+        }
+
+        // Check the links, so a damaged file can't send us outside
+        // the buffer. Children always come after their parent, so
+        // the tree can't have loops, and each group's children come
+        // after those of the groups before it, so no node can be the
+        // child of two groups.
+        const FlatNode *check = (const FlatNode*)(header + 1);
+        unsigned total = header->nodeCount;
+        if (check[0].type != FLAT_GROUP) return false;
+
+        unsigned nextFree = 1;
+        for (unsigned i = 0; i < total; i++)
+        {
+            const FlatNode &node = check[i];
+            if (node.type > FLAT_VECTOR) return false;
+            if (node.type != FLAT_GROUP || node.childCount == 0) continue;
+            if (node.firstChild <= i ||
+                node.firstChild < nextFree ||
+                node.firstChild >= total ||
+                node.childCount > total - node.firstChild)
+            {
+                return false;
+            }
+            nextFree = node.firstChild + node.childCount;
+        }
+
+        nodes = check;
+        count = total;
+        return true;
+    }
+
+    unsigned FlatDatabase::findChild(unsigned group, id identifier) const
+    {
+        const FlatNode &node = nodes[group];
+        if (node.type != FLAT_GROUP) return NONE;
+
+        unsigned end = node.firstChild + node.childCount;
+        for (unsigned i = node.firstChild; i < end; i++)
+        {
+            if (nodes[i].identifier == identifier) return i;
+        }
+        return NONE;
+    }
+
+    /**
+     * Creates the data node for the given flat node, without any
+     * children.
+     */
+    static DataNode* buildFlatNode(const FlatNode &node, DatabaseArena *arena)
+    {
+        switch (node.type)
+        {
+        case FlatDatabase::FLAT_INTEGER:
+            return arena->createDatum<int>(node.identifier,
+                                           node.value.integer);
+        case FlatDatabase::FLAT_REAL:
+            return arena->createDatum<real>(node.identifier,
+                                            node.value.number);
+        case FlatDatabase::FLAT_VECTOR:
+            return arena->createDatum<Vector3>(node.identifier,
+                                               Vector3(node.value.vector[0],
+                                                       node.value.vector[1],
+                                                       node.value.vector[2]));
+        default:
+            return arena->createGroup(node.identifier);
+        }
+    }
+
+    Database* FlatDatabase::build(DatabaseArena *arena, bool indexGroups) const
+    {
+        if (count == 0) return 0;
+
+        // Work out how much memory we need for the nodes, so the
+        // arena can get it in one go.
+        size_t bytes = 0;
+        for (unsigned i = 0; i < count; i++)
+        {
+            switch (nodes[i].type)
+            {
+            case FLAT_GROUP: bytes += alignSize(sizeof(DataGroup)); break;
+            case FLAT_INTEGER: bytes += alignSize(sizeof(IntegerDatum)); break;
+            case FLAT_REAL: bytes += alignSize(sizeof(RealDatum)); break;
+            default: bytes += alignSize(sizeof(VectorDatum)); break;
+            }
+        }
+        arena->reserve(bytes);
+
+        // Create every node, then link each group to its children.
+        // This is done in two passes rather than by recursing, so a
+        // deep database can't overflow the stack.
+        std::vector<DataNode*> built(count);
+        for (unsigned i = 0; i < count; i++)
+        {
+            built[i] = buildFlatNode(nodes[i], arena);
+        }
+        for (unsigned i = 0; i < count; i++)
+        {
+            const FlatNode &node = nodes[i];
+            if (node.type != FLAT_GROUP) continue;
+
+            // Link the children in backwards, so they end up in order.
+            DataGroup *group = (DataGroup*)built[i];
+            for (unsigned c = node.childCount; c > 0; c--)
+            {
+                DataNode *child = built[node.firstChild + c - 1];
+                child->nextSibling = group->firstChild;
+                group->firstChild = child;
+            }
+            if (indexGroups && node.childCount > 8) group->enableIndex();
+        }
+        return built[0];
+    }
+
+    /**
+     * Fills in the type and value of a flat node from the given data
+     * node, returning false if it isn't a type we can store.
+     */
+    static bool flattenNode(const DataNode *source, FlatNode *node)
+    {
+        memset(node, 0, sizeof(FlatNode));
+        node->identifier = source->identifier;
+
+        if (source->isGroup())
+        {
+            node->type = FlatDatabase::FLAT_GROUP;
+            return true;
+        }
+
+        if (const IntegerDatum *datum =
+            dynamic_cast<const IntegerDatum*>(source))
+        {
+            node->type = FlatDatabase::FLAT_INTEGER;
+            node->value.integer = datum->value;
+            return true;
+        }
+
+        if (const RealDatum *datum = dynamic_cast<const RealDatum*>(source))
+        {
+            node->type = FlatDatabase::FLAT_REAL;
+            node->value.number = datum->value;
+            return true;
+        }
+
+        if (const VectorDatum *datum =
+            dynamic_cast<const VectorDatum*>(source))
+        {
+            node->type = FlatDatabase::FLAT_VECTOR;
+            node->value.vector[0] = datum->value.x;
+            node->value.vector[1] = datum->value.y;
+            node->value.vector[2] = datum->value.z;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool FlatDatabase::write(const Database *database,
+                             std::vector<char> *buffer)
+    {
+        buffer->clear();
+        if (!database) return false;
+
+        // Lay the nodes out breadth first, so each group's children
+        // are next to one another.
+        std::vector<FlatNode> flat;
+        std::vector<const DataNode*> sources;
+        flat.push_back(FlatNode());
+        sources.push_back(database);
+        if (!flattenNode(database, &flat[0])) return false;
+
+        for (unsigned i = 0; i < sources.size(); i++)
+        {
+            if (!sources[i]->isGroup()) continue;
+
+            unsigned first = (unsigned)flat.size();
+            unsigned children = 0;
+            const DataNode *child = ((const DataGroup*)sources[i])->firstChild;
+            for (; child; child = child->nextSibling, children++)
+            {
+                flat.push_back(FlatNode());
+                sources.push_back(child);
+                if (!flattenNode(child, &flat.back())) return false;
+            }
+            flat[i].firstChild = children ? first : NONE;
+            flat[i].childCount = children;
+        }
+
+        Header header;
+        memcpy(header.magic, "AIDB", 4);
+        header.version = FLAT_VERSION;
+        header.realSize = sizeof(real);
+        header.nodeCount = (unsigned)flat.size();
+
+        buffer->resize(sizeof(Header) + flat.size() * sizeof(FlatNode));
+        memcpy(&(*buffer)[0], &header, sizeof(Header));
+        memcpy(&(*buffer)[sizeof(Header)], &flat[0],
+               flat.size() * sizeof(FlatNode));
+        return true;
+    }
+
+    bool FlatDatabase::save(const Database *database, const char *filename)
+    {
+        std::vector<char> buffer;
+        if (!write(database, &buffer)) return false;
+
+        FILE *file = fopen(filename, "wb");
+        if (!file) return false;
+        bool ok = fwrite(&buffer[0], 1, buffer.size(), file) == buffer.size();
+        ok = fclose(file) == 0 && ok;
+        return ok;
+    }
+
+
+    MappedFile::MappedFile()
+        :
+        data(0), size(0), fileHandle(0), mappingHandle(0)
+    {
+    }
+
+    MappedFile::~MappedFile()
+    {
+        close();
+    }
+
+#ifdef _WIN32
+
+    bool MappedFile::open(const char *filename)
+    {
+        close();
+
+        HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ,
+                                  NULL, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+        {
+            CloseHandle(file);
+            return false;
+        }
+
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY,
+                                            0, 0, NULL);
+        if (!mapping)
+        {
+            CloseHandle(file);
+            return false;
+        }
+
+        const void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!view)
+        {
+            CloseHandle(mapping);
+            CloseHandle(file);
+            return false;
+        }
+
+        data = view;
+        size = (size_t)fileSize.QuadPart;
+        fileHandle = file;
+        mappingHandle = mapping;
+        return true;
+    }
+
+    void MappedFile::close()
+    {
+        if (data) UnmapViewOfFile(data);
+        if (mappingHandle) CloseHandle((HANDLE)mappingHandle);
+        if (fileHandle) CloseHandle((HANDLE)fileHandle);
+        data = 0;
+        size = 0;
+        fileHandle = 0;
+        mappingHandle = 0;
+    }
+
+#else
+
+    bool MappedFile::open(const char *filename)
+    {
+        close();
+
+        int file = ::open(filename, O_RDONLY);
+        if (file < 0) return false;
+
+        struct stat info;
+        if (fstat(file, &info) != 0 || info.st_size == 0)
+        {
+            ::close(file);
+            return false;
+        }
+
+        void *view = mmap(0, (size_t)info.st_size, PROT_READ, MAP_PRIVATE,
+                          file, 0);
+
+        // The mapping keeps the file open, so we don't need the
+        // descriptor any more.
+        ::close(file);
+        if (view == MAP_FAILED) return false;
+
+        data = view;
+        size = (size_t)info.st_size;
+        return true;
+    }
+
+    void MappedFile::close()
+    {
+        if (data) munmap((void*)data, size);
+        data = 0;
+        size = 0;
+    }
+
+#endif
+
+
+    DatabaseStream::DatabaseStream(DataGroup *database, ReteNetwork *network,
+                                   bool indexGroups)
+        :
+        database(database), network(network), failed(0),
+        indexGroups(indexGroups)
+    {
+        assert(database);
+    }
+
+    DatabaseStream::Change& DatabaseStream::queue(ChangeType type,
+                                                  unsigned nodeType,
+                                                  const id *path,
+                                                  unsigned length)
+    {
+        Change change;
+        memset(&change, 0, sizeof(Change));
+        change.type = type;
+        change.nodeType = nodeType;
+        change.pathStart = (unsigned)paths.size();
+        change.pathLength = length;
+        paths.insert(paths.end(), path, path + length);
+        changes.push_back(change);
+        return changes.back();
+    }
+
+    void DatabaseStream::insert(const id *path, unsigned length, int value)
+    {
+        queue(CHANGE_INSERT, FlatDatabase::FLAT_INTEGER,
+              path, length).value.integer = value;
+    }
+
+    void DatabaseStream::insert(const id *path, unsigned length, real value)
+    {
+        queue(CHANGE_INSERT, FlatDatabase::FLAT_REAL,
+              path, length).value.number = value;
+    }
+
+    void DatabaseStream::insert(const id *path, unsigned length,
+                                const Vector3 &value)
+    {
+        Change &change = queue(CHANGE_INSERT, FlatDatabase::FLAT_VECTOR,
+                               path, length);
+        change.value.vector[0] = value.x;
+        change.value.vector[1] = value.y;
+        change.value.vector[2] = value.z;
+    }
+
+    void DatabaseStream::insertGroup(const id *path, unsigned length)
+    {
+        queue(CHANGE_INSERT, FlatDatabase::FLAT_GROUP, path, length);
+    }
+
+    void DatabaseStream::update(const id *path, unsigned length, int value)
+    {
+        queue(CHANGE_UPDATE, FlatDatabase::FLAT_INTEGER,
+              path, length).value.integer = value;
+    }
+
+    void DatabaseStream::update(const id *path, unsigned length, real value)
+    {
+        queue(CHANGE_UPDATE, FlatDatabase::FLAT_REAL,
+              path, length).value.number = value;
+    }
+
+    void DatabaseStream::update(const id *path, unsigned length,
+                                const Vector3 &value)
+    {
+        Change &change = queue(CHANGE_UPDATE, FlatDatabase::FLAT_VECTOR,
+                               path, length);
+        change.value.vector[0] = value.x;
+        change.value.vector[1] = value.y;
+        change.value.vector[2] = value.z;
+    }
+
+    void DatabaseStream::remove(const id *path, unsigned length)
+    {
+        queue(CHANGE_REMOVE, FlatDatabase::FLAT_GROUP, path, length);
+    }
+
+    void DatabaseStream::clear()
+    {
+        changes.clear();
+        paths.clear();
+    }
+
+    DataGroup* DatabaseStream::createGroup(id identifier)
+    {
+        if (freeGroups.empty()) return arena.createGroup(identifier);
+
+        DataGroup *group = freeGroups.back();
+        freeGroups.pop_back();
+        group->identifier = identifier;
+        return group;
+    }
+
+    /**
+     * Returns a removed datum from the given list with the given
+     * identifier and value, or creates one in the arena.
+     */
+    template <typename T>
+    static Datum<T>* reuseDatum(std::vector<Datum<T>*> &free,
+                                DatabaseArena &arena,
+                                id identifier, const T &value)
+    {
+        if (free.empty()) return arena.createDatum<T>(identifier, value);
+
+        Datum<T> *datum = free.back();
+        free.pop_back();
+        datum->identifier = identifier;
+        datum->value = value;
+        return datum;
+    }
+
+    DataNode* DatabaseStream::createNode(const Change &change, id identifier)
+    {
+        switch (change.nodeType)
+        {
+        case FlatDatabase::FLAT_INTEGER:
+            return reuseDatum<int>(freeIntegers, arena, identifier,
+                                   change.value.integer);
+        case FlatDatabase::FLAT_REAL:
+            return reuseDatum<real>(freeReals, arena, identifier,
+                                    change.value.number);
+        case FlatDatabase::FLAT_VECTOR:
+            return reuseDatum<Vector3>(freeVectors, arena, identifier,
+                                       Vector3(change.value.vector[0],
+                                               change.value.vector[1],
+                                               change.value.vector[2]));
+        default:
+            return createGroup(identifier);
+        }
+    }
+
+    bool DatabaseStream::setValue(DataNode *node, const Change &change)
+    {
+        switch (change.nodeType)
+        {
+        case FlatDatabase::FLAT_INTEGER:
+            if (IntegerDatum *datum = dynamic_cast<IntegerDatum*>(node))
+            {
+                datum->value = change.value.integer;
+                return true;
+            }
+            return false;
+
+        case FlatDatabase::FLAT_REAL:
+            if (RealDatum *datum = dynamic_cast<RealDatum*>(node))
+            {
+                datum->value = change.value.number;
+                return true;
+            }
+            return false;
+
+        default:
+            if (VectorDatum *datum = dynamic_cast<VectorDatum*>(node))
+            {
+                datum->value = Vector3(change.value.vector[0],
+                                       change.value.vector[1],
+                                       change.value.vector[2]);
+                return true;
+            }
+            return false;
+        }
+    }
+
+    void DatabaseStream::recycle(DataNode *node)
+    {
+        node->nextSibling = 0;
+
+        if (node->isGroup())
+        {
+            DataGroup *group = (DataGroup*)node;
+            DataNode *child = group->firstChild;
+            while (child)
+            {
+                DataNode *next = child->nextSibling;
+                recycle(child);
+                child = next;
+            }
+            group->firstChild = 0;
+            group->disableIndex();
+            freeGroups.push_back(group);
+        }
+        else if (IntegerDatum *datum = dynamic_cast<IntegerDatum*>(node))
+        {
+            freeIntegers.push_back(datum);
+        }
+        else if (RealDatum *datum = dynamic_cast<RealDatum*>(node))
+        {
+            freeReals.push_back(datum);
+        }
+        else if (VectorDatum *datum = dynamic_cast<VectorDatum*>(node))
+        {
+            freeVectors.push_back(datum);
+        }
+
+        // Data of other types can't be reused, so is just let go.
+    }
+
+    bool DatabaseStream::applyChange(const Change &change, bool *modified)
+    {
+        if (change.pathLength == 0) return false;
+        const id *path = &paths[change.pathStart];
+        unsigned last = change.pathLength - 1;
+
+        // Find the group the change is made in, creating any that are
+        // missing on the way unless we're removing.
+        DataGroup *parent = database;
+        for (unsigned i = 0; i < last; i++)
+        {
+            if (indexGroups && !parent->hasIndex()) parent->enableIndex();
+
+            DataNode *child = parent->findChild(path[i]);
+            if (!child)
+            {
+                if (change.type == CHANGE_REMOVE) return false;
+                child = createGroup(path[i]);
+                parent->addChild(child);
+                *modified = true;
+            }
+            else if (!child->isGroup())
+            {
+                return false;
+            }
+            parent = (DataGroup*)child;
+        }
+        if (indexGroups && !parent->hasIndex()) parent->enableIndex();
+
+        DataNode *existing = change.type == CHANGE_INSERT ?
+            0 : parent->findChild(path[last]);
+        switch (change.type)
+        {
+        case CHANGE_REMOVE:
+            if (!existing) return false;
+            parent->removeChild(existing);
+            recycle(existing);
+            *modified = true;
+            return true;
+
+        case CHANGE_UPDATE:
+            if (existing)
+            {
+                if (!setValue(existing, change)) return false;
+                *modified = true;
+                return true;
+            }
+            break;
+
+        default:
+            break;
+        }
+
+        parent->addChild(createNode(change, path[last]));
+        *modified = true;
+        return true;
+    }
+
+    unsigned DatabaseStream::apply()
+    {
+        AICORE_PROFILE_LIBRARY_ZONE("DatabaseStream");
+
+        changed.clear();
+        failed = 0;
+
+        unsigned made = 0;
+        for (unsigned i = 0; i < changes.size(); i++)
+        {
+            bool modified = false;
+            if (applyChange(changes[i], &modified)) made++;
+            else failed++;
+
+            if (modified) changed.push_back(paths[changes[i].pathStart]);
+        }
+        clear();
+
+        // A burst of events often changes the same data many times,
+        // so each identifier is only given to the network once.
+        std::sort(changed.begin(), changed.end());
+        changed.erase(std::unique(changed.begin(), changed.end()),
+                      changed.end());
+        if (network)
+        {
+            for (unsigned i = 0; i < changed.size(); i++)
+            {
+                network->markChanged(changed[i]);
+            }
+        }
+
+        AICORE_LIBRARY_COUNT("DatabaseStream changes", made);
+        return made;
+    }
+
+}; // end of namespace
@@ -9,6 +9,7 @@
  * implies agreement with all terms and conditions of the accompanying
  * software licence.
  */
+#include <map>
 #include <aicore/aicore.h>
 
 namespace aicore
@@ -28,27 +29,154 @@ namespace aicore
         }
     }
 
+    DecisionTreeNode* Decision::makeDecisionFor(DecisionBlackboard *board)
+    {
+        DecisionTreeNode *branch =
+            getBranchFor(board) ? trueBranch : falseBranch;
+        if (branch == NULL) return NULL;
+        else return branch->makeDecisionFor(board);
+    }
+
+    DecisionBlackboard::DecisionBlackboard(unsigned slots)
+        :
+        random(NULL), frame(NULL)
+    {
+        grow(slots);
+    }
+
+    void DecisionBlackboard::writeSnapshot(SnapshotWriter &writer) const
+    {
+        writer.writeUnsigned((unsigned)memory.size());
+        for (unsigned i = 0; i < memory.size(); i++)
+        {
+            writer.writeUnsigned(memory[i].lastFrame);
+            writer.writeUnsigned(memory[i].firstFrame);
+            writer.writeBool(memory[i].decision);
+        }
+    }
+
+    bool DecisionBlackboard::readSnapshot(SnapshotReader &reader)
+    {
+        // Each slot takes at least three bytes, which stops a damaged
+        // count allocating a huge amount of memory.
+        unsigned slots = reader.readUnsigned();
+        if (slots > reader.getRemaining() / 3) reader.fail();
+
+        std::vector<DecisionMemory> loaded(reader.isValid() ? slots : 0);
+        for (unsigned i = 0; i < loaded.size(); i++)
+        {
+            loaded[i].lastFrame = reader.readUnsigned();
+            loaded[i].firstFrame = reader.readUnsigned();
+            loaded[i].decision = reader.readBool();
+        }
+
+        if (!reader.isValid()) return false;
+        memory.swap(loaded);
+        return true;
+    }
+
+    void DecisionBlackboard::grow(unsigned slots)
+    {
+        DecisionMemory empty;
+        empty.lastFrame = 0;
+        empty.firstFrame = 0;
+        empty.decision = false;
+        if (slots > memory.size()) memory.resize(slots, empty);
+    }
+
+    void DecisionBlackboard::reset()
+    {
+        unsigned slots = getSlotCount();
+        memory.clear();
+        grow(slots);
+    }
+
+    unsigned DecisionBlackboard::assignSlots(DecisionTreeNode *root)
+    {
+        // Walk the tree, visiting shared parts once.
+        std::vector<DecisionTreeNode*> open;
+        std::map<DecisionTreeNode*, bool> seen;
+        unsigned slots = 0;
+        if (root) open.push_back(root);
+        while (!open.empty())
+        {
+            DecisionTreeNode *node = open.back();
+            open.pop_back();
+            if (seen[node]) continue;
+            seen[node] = true;
+
+            RandomDecision *random = dynamic_cast<RandomDecision*>(node);
+            if (random) random->slot = slots++;
+
+            Decision *decision = dynamic_cast<Decision*>(node);
+            if (!decision) continue;
+            if (decision->falseBranch) open.push_back(decision->falseBranch);
+            if (decision->trueBranch) open.push_back(decision->trueBranch);
+        }
+        return slots;
+    }
+
     RandomDecision::RandomDecision()
         :
+        lastDecision(false),
         lastDecisionFrame(0),
-        lastDecision(false)
+        slot(0)
     {
     }
 
-    bool RandomDecision::getBranch()
+    bool RandomDecision::decide(DecisionMemory *memory, RandomEngine &random,
+                                unsigned thisFrame) const
     {
-        unsigned thisFrame = TimingData::get().frameNumber;
-
         // If we didn't get here last time, then things may change
-        if (thisFrame > lastDecisionFrame + 1) {
-            lastDecision = randomBoolean();
+        if (thisFrame > memory->lastFrame + 1) {
+            memory->decision = random.randomBoolean();
         }
 
         // In any case, store the frame number
-        lastDecisionFrame = thisFrame;
+        memory->lastFrame = thisFrame;
 
         // And return the stored value
-        return lastDecision;
+        return memory->decision;
+    }
+
+    bool RandomDecision::getBranch()
+    {
+        // Use the memory in this decision.
+        DecisionMemory memory;
+        memory.lastFrame = lastDecisionFrame;
+        memory.firstFrame = 0;
+        memory.decision = lastDecision;
+
+        bool result = decide(&memory, getRandomEngine(),
+                             TimingData::get().frameNumber);
+
+        lastDecisionFrame = memory.lastFrame;
+        lastDecision = memory.decision;
+        return result;
+    }
+
+    bool RandomDecision::getBranchFor(DecisionBlackboard *board)
+    {
+        if (board == NULL) return getBranch();
+        return decide(&board->getMemory(slot), board->getRandom(),
+                      board->getFrame());
+    }
+
+    void RandomDecision::writeSnapshot(SnapshotWriter &writer) const
+    {
+        writer.writeUnsigned(lastDecisionFrame);
+        writer.writeBool(lastDecision);
+    }
+
+    bool RandomDecision::readSnapshot(SnapshotReader &reader)
+    {
+        unsigned frame = reader.readUnsigned();
+        bool decision = reader.readBool();
+        if (!reader.isValid()) return false;
+
+        lastDecisionFrame = frame;
+        lastDecision = decision;
+        return true;
     }
 
     RandomDecisionWithTimeOut::RandomDecisionWithTimeOut()
@@ -58,27 +186,208 @@ namespace aicore
     {
     }
 
-    bool RandomDecisionWithTimeOut::getBranch()
+    bool RandomDecisionWithTimeOut::decide(DecisionMemory *memory,
+                                           RandomEngine &random,
+                                           unsigned thisFrame) const
     {
-        unsigned thisFrame = TimingData::get().frameNumber;
-
         // Check if the stored decision is either too old, or if we
         // timed out.
-        if (thisFrame > lastDecisionFrame + 1 ||
-            thisFrame > firstDecisionFrame + timeOutDuration) {
+        if (thisFrame > memory->lastFrame + 1 ||
+            thisFrame > memory->firstFrame + timeOutDuration) {
 
             // Make a new decision
-            lastDecision = randomBoolean();
+            memory->decision = random.randomBoolean();
 
             // And record that it was just made
-            firstDecisionFrame = thisFrame;
+            memory->firstFrame = thisFrame;
         }
 
         // Update the frame number
-        lastDecisionFrame = thisFrame;
+        memory->lastFrame = thisFrame;
 
         // And return the stored value
-        return lastDecision;
+        return memory->decision;
+    }
+
+    bool RandomDecisionWithTimeOut::getBranch()
+    {
+        // Use the memory in this decision.
+        DecisionMemory memory;
+        memory.lastFrame = lastDecisionFrame;
+        memory.firstFrame = firstDecisionFrame;
+        memory.decision = lastDecision;
+
+        bool result = decide(&memory, getRandomEngine(),
+                             TimingData::get().frameNumber);
+
+        lastDecisionFrame = memory.lastFrame;
+        firstDecisionFrame = memory.firstFrame;
+        lastDecision = memory.decision;
+        return result;
+    }
+
+    void RandomDecisionWithTimeOut::writeSnapshot(SnapshotWriter &writer) const
+    {
+        RandomDecision::writeSnapshot(writer);
+        writer.writeUnsigned(firstDecisionFrame);
+    }
+
+    bool RandomDecisionWithTimeOut::readSnapshot(SnapshotReader &reader)
+    {
+        // Read everything before changing anything, in the order
+        // writeSnapshot gives.
+        unsigned frame = reader.readUnsigned();
+        bool decision = reader.readBool();
+        unsigned first = reader.readUnsigned();
+        if (!reader.isValid()) return false;
+
+        lastDecisionFrame = frame;
+        lastDecision = decision;
+        firstDecisionFrame = first;
+        return true;
+    }
+
+    ThresholdDecision::ThresholdDecision()
+        :
+        inputs(NULL), input(0), threshold(0)
+    {
+    }
+
+    bool ThresholdDecision::getBranch()
+    {
+        return (*inputs)[input] > threshold;
+    }
+
+    RangeDecision::RangeDecision()
+        :
+        inputs(NULL), input(0), minimum(0), maximum(0)
+    {
+    }
+
+    bool RangeDecision::getBranch()
+    {
+        real value = (*inputs)[input];
+        return value >= minimum && value <= maximum;
+    }
+
+    CompiledDecisionTree::CompiledDecisionTree()
+    {
+        compile(NULL);
+    }
+
+    void CompiledDecisionTree::compile(DecisionTreeNode *root)
+    {
+        nodes.clear();
+        results.clear();
+        custom.clear();
+
+        // Give each original node an index in breadth first order,
+        // so the nodes near the root are together in memory.
+        std::vector<DecisionTreeNode*> order;
+        std::map<DecisionTreeNode*, unsigned> indices;
+        order.push_back(root);
+        indices[root] = 0;
+
+        for (unsigned i = 0; i < order.size(); i++)
+        {
+            Decision *decision = dynamic_cast<Decision*>(order[i]);
+            if (!decision) continue;
+
+            DecisionTreeNode *children[2] = {
+                decision->falseBranch, decision->trueBranch
+            };
+            for (unsigned c = 0; c < 2; c++)
+            {
+                if (indices.find(children[c]) != indices.end()) continue;
+                indices[children[c]] = (unsigned)order.size();
+                order.push_back(children[c]);
+            }
+        }
+
+        // Then fill in the nodes.
+        nodes.resize(order.size());
+        for (unsigned i = 0; i < order.size(); i++)
+        {
+            Node &node = nodes[i];
+            node.input = 0;
+            node.minimum = node.maximum = 0;
+            node.branch[0] = node.branch[1] = 0;
+
+            Decision *decision = dynamic_cast<Decision*>(order[i]);
+            if (!decision)
+            {
+                node.kind = NODE_LEAF;
+                node.input = (unsigned)results.size();
+                results.push_back(order[i]);
+                continue;
+            }
+
+            node.branch[0] = indices[decision->falseBranch];
+            node.branch[1] = indices[decision->trueBranch];
+
+            ThresholdDecision *threshold =
+                dynamic_cast<ThresholdDecision*>(decision);
+            RangeDecision *range = dynamic_cast<RangeDecision*>(decision);
+            if (threshold)
+            {
+                node.kind = NODE_THRESHOLD;
+                node.input = threshold->input;
+                node.minimum = threshold->threshold;
+            }
+            else if (range)
+            {
+                node.kind = NODE_RANGE;
+                node.input = range->input;
+                node.minimum = range->minimum;
+                node.maximum = range->maximum;
+            }
+            else
+            {
+                node.kind = NODE_CUSTOM;
+                node.input = (unsigned)custom.size();
+                custom.push_back(decision);
+            }
+        }
+    }
+
+    DecisionTreeNode* CompiledDecisionTree::decide(
+        const real *inputs, DecisionBlackboard *board) const
+    {
+        const Node *node = &nodes[0];
+        for (;;)
+        {
+            bool branch;
+            switch (node->kind)
+            {
+            case NODE_THRESHOLD:
+                branch = inputs[node->input] > node->minimum;
+                break;
+            case NODE_RANGE:
+            {
+                real value = inputs[node->input];
+                branch = value >= node->minimum && value <= node->maximum;
+                break;
+            }
+            case NODE_CUSTOM:
+                branch = custom[node->input]->getBranchFor(board);
+                break;
+            default:
+                return results[node->input];
+            }
+            node = &nodes[node->branch[branch ? 1 : 0]];
+        }
+    }
+
+    void CompiledDecisionTree::decideMany(const real *inputs,
+                                          unsigned stride,
+                                          unsigned count,
+                                          DecisionTreeNode **decisions,
+                                          DecisionBlackboard *boards) const
+    {
+        for (unsigned i = 0; i < count; i++, inputs += stride)
+        {
+            decisions[i] = decide(inputs, boards ? &boards[i] : NULL);
+        }
     }
 
 }; // end of namespace
@@ -16,7 +16,6 @@
 #include <aicore/aicore.h>
 
 #include "../common/gl/app.h"
-#include "flock_steer.h"
 
 // This is the size of the world in both directions from 0 (i.e. from
 // -WORLD_SIZE to +WORLD_SIZE)
@@ -42,7 +41,7 @@ class FlockingDemo : public Application
     aicore::Kinematic *kinematic;
 
 	/** Holds the flock */
-	Flock flock;
+	aicore::Flock flock;
 
 
     /** Holds the enabled state of each behaviour. */
@@ -51,9 +50,9 @@ class FlockingDemo : public Application
     bool velocityMatchOn;
 
     /** Holds the steering behaviours. */
-	Separation *separation;
-	Cohesion *cohesion;
-	VelocityMatchAndAlign *vMA;
+	aicore::Separation *separation;
+	aicore::Cohesion *cohesion;
+	aicore::VelocityMatchAndAlign *vMA;
 	aicore::BlendedSteering *steering;
 
 public:
@@ -95,19 +94,19 @@ FlockingDemo::FlockingDemo()
     }
 
 	// Set up the steering behaviours (we use one for all)
-	separation = new Separation;
+	separation = new aicore::Separation;
 	separation->maxAcceleration = accel;
 	separation->neighbourhoodSize = (aicore::real)5.0;
 	separation->neighbourhoodMinDP = (aicore::real)-1.0;
 	separation->theFlock = &flock;
 
-	cohesion = new Cohesion;
+	cohesion = new aicore::Cohesion;
 	cohesion->maxAcceleration = accel;
 	cohesion->neighbourhoodSize = (aicore::real)10.0;
 	cohesion->neighbourhoodMinDP = (aicore::real)0.0;
 	cohesion->theFlock = &flock;
 
-	vMA = new VelocityMatchAndAlign;
+	vMA = new aicore::VelocityMatchAndAlign;
 	vMA->maxAcceleration = accel;
 	vMA->neighbourhoodSize = (aicore::real)15.0;
 	vMA->neighbourhoodMinDP = (aicore::real)0.0;
@@ -220,6 +219,9 @@ void FlockingDemo::update()
     aicore::SteeringOutput steer;
     aicore::SteeringOutput temp;
 
+    // Bring the flock's neighbourhood index up to date
+    flock.update();
+
     for (unsigned i = 0; i < BOIDS; i++) 
 	{
 		// Get the steering output
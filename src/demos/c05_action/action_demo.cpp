@@ -145,7 +145,7 @@ bool processOption(const char* command, aicore::ActionManager * am)
         action->next = action2;
 
         as = new aicore::ActionSequence;
-        as->subActions = action;
+        as->addSubActions(action);
         am->scheduleAction(as);
 
         printf("Scheduling an action sequence.\n");
@@ -160,7 +160,7 @@ bool processOption(const char* command, aicore::ActionManager * am)
         action->next = action2;
 
         ac = new aicore::ActionCombination;
-        ac->subActions = action;
+        ac->addSubActions(action);
         am->scheduleAction(ac);
 
         printf("Scheduling an action combination.\n");
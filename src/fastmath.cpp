@@ -0,0 +1,51 @@
+/*
+ * Defines the batch approximations to the slower mathematical
+ * functions.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <aicore/aicore.h>
+
+namespace aicore
+{
+    void fastSinCosMany(const real *angles, real *sines, real *cosines,
+                        unsigned count)
+    {
+        const real * AICORE_RESTRICT a = angles;
+        real * AICORE_RESTRICT s = sines;
+        real * AICORE_RESTRICT c = cosines;
+        for (unsigned i = 0; i < count; i++)
+        {
+            fast_sincos(a[i], &s[i], &c[i]);
+        }
+    }
+
+    void fastAtan2Many(const real *y, const real *x, real *results,
+                       unsigned count)
+    {
+        const real * AICORE_RESTRICT ys = y;
+        const real * AICORE_RESTRICT xs = x;
+        real * AICORE_RESTRICT r = results;
+        for (unsigned i = 0; i < count; i++)
+        {
+            r[i] = fast_atan2(ys[i], xs[i]);
+        }
+    }
+
+    void fastRsqrtMany(const real *values, real *results, unsigned count)
+    {
+        // Each result only depends on its own value, so they can
+        // safely be written over the values.
+        for (unsigned i = 0; i < count; i++)
+        {
+            results[i] = fast_rsqrt(values[i]);
+        }
+    }
+
+}; // end of namespace
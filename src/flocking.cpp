@@ -0,0 +1,181 @@
+/*
+ * Defines the classes used for flocking.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <aicore/aicore.h>
+
+namespace aicore
+{
+    Flock::Flock(real cellSize)
+        :
+        grid(cellSize),
+        lastOf(0), lastSize(0), lastMinDotProduct(0),
+        lastGeneration(0), generation(1)
+    {
+        summary.clear();
+    }
+
+    void Flock::setCellSize(real cellSize)
+    {
+        grid.setCellSize(cellSize);
+    }
+
+    void Flock::update()
+    {
+        AICORE_PROFILE_LIBRARY_ZONE("Flock");
+
+        unsigned size = (unsigned)boids.size();
+        if (grid.getCapacity() != size) grid.setCapacity(size);
+        for (unsigned i = 0; i < size; i++)
+        {
+            grid.update(i, boids[i]->position);
+        }
+
+        // Any stored neighbourhood is now out of date.
+        generation++;
+    }
+
+    unsigned Flock::prepareNeighourhood(
+        const Kinematic* of,
+        real size,
+        real minDotProduct /* = -1.0 */)
+    {
+        // Rebuild the index if boids have been added or removed.
+        if (grid.getCount() != boids.size()) update();
+
+        // Check if we've just done this neighbourhood.
+        if (of == lastOf && size == lastSize &&
+            minDotProduct == lastMinDotProduct &&
+            generation == lastGeneration)
+        {
+            return summary.count;
+        }
+        lastOf = of;
+        lastSize = size;
+        lastMinDotProduct = minDotProduct;
+        lastGeneration = generation;
+
+        // Compile the look vector if we need it
+        Vector3 look;
+        if (minDotProduct > -1.0f)
+        {
+            look = of->getOrientationAsVector();
+        }
+
+        neighbours.clear();
+        grid.query(of->position, size, look, minDotProduct, &neighbours);
+
+        // Accumulate everything in one pass, compacting out ourself
+        // as we go.
+        summary.clear();
+        unsigned count = 0;
+        for (unsigned i = 0; i < neighbours.size(); i++)
+        {
+            unsigned index = neighbours[i];
+            const Kinematic *k = boids[index];
+
+            // Ignore ourself
+            if (k == of) continue;
+            neighbours[count++] = index;
+
+            summary.center += k->position;
+            summary.averageVelocity += k->velocity;
+
+            Vector3 offset = of->position - k->position;
+            real squareDistance = offset.squareMagnitude();
+            if (squareDistance > 0)
+            {
+                summary.separation.addScaledVector(
+                    offset, (real)1.0 / squareDistance
+                    );
+            }
+        }
+        neighbours.resize(count);
+
+        summary.count = count;
+        if (count)
+        {
+            real scale = (real)1.0 / (real)count;
+            summary.center *= scale;
+            summary.averageVelocity *= scale;
+        }
+        return count;
+    }
+
+    void Separation::getSteering(SteeringOutput* output)
+    {
+        // Get the neighbourhood of boids
+        unsigned count = theFlock->prepareNeighourhood(
+            character, neighbourhoodSize, neighbourhoodMinDP
+            );
+        if (count <= 0)
+        {
+            output->clear();
+            return;
+        }
+
+        // Work out their center of mass
+        Vector3 cofm = theFlock->getNeighbourhoodCenter();
+
+        // Steer away from it.
+        flee.maxAcceleration = maxAcceleration;
+        flee.character = character;
+        flee.target = &cofm;
+        flee.getSteering(output);
+    }
+
+    void Cohesion::getSteering(SteeringOutput* output)
+    {
+        // Get the neighbourhood of boids
+        unsigned count = theFlock->prepareNeighourhood(
+            character, neighbourhoodSize, neighbourhoodMinDP
+            );
+        if (count <= 0)
+        {
+            output->clear();
+            return;
+        }
+
+        // Work out their center of mass
+        Vector3 cofm = theFlock->getNeighbourhoodCenter();
+
+        // Steer towards it.
+        seek.maxAcceleration = maxAcceleration;
+        seek.character = character;
+        seek.target = &cofm;
+        seek.getSteering(output);
+    }
+
+    void VelocityMatchAndAlign::getSteering(SteeringOutput* output)
+    {
+        // Get the neighbourhood of boids
+        unsigned count = theFlock->prepareNeighourhood(
+            character, neighbourhoodSize, neighbourhoodMinDP
+            );
+        if (count <= 0)
+        {
+            output->clear();
+            return;
+        }
+
+        // Work out their average velocity
+        Vector3 vel = theFlock->getNeighbourhoodAverageVelocity();
+
+        // Try to match it
+        output->linear = vel - character->velocity;
+        output->angular = 0;
+        if (output->linear.squareMagnitude() > maxAcceleration*maxAcceleration)
+        {
+            output->linear.normalise();
+            output->linear *= maxAcceleration;
+        }
+    }
+
+}; // end of namespace
@@ -0,0 +1,352 @@
+/*
+ * Defines the classes used for fuzzy state machines.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <assert.h>
+#include <aicore/aicore.h>
+
+namespace aicore
+{
+    FuzzyRuleSet::FuzzyRuleSet()
+        :
+        inputCount(0), variableCount(0)
+    {
+    }
+
+    unsigned FuzzyRuleSet::addSet(unsigned input, real a, real b, real c, real d)
+    {
+        assert(a <= b && b <= c && c <= d);
+
+        // A slope of zero means the set carries on at one forever on
+        // that side.
+        setInput.push_back(input);
+        setPlateauStart.push_back(b);
+        setPlateauEnd.push_back(c);
+        setRise.push_back(b > a ? 1 / (b - a) : 0);
+        setFall.push_back(d > c ? 1 / (d - c) : 0);
+
+        if (input >= inputCount) inputCount = input + 1;
+        return (unsigned)setInput.size() - 1;
+    }
+
+    unsigned FuzzyRuleSet::addOutput(real value, unsigned variable)
+    {
+        outputValue.push_back(value);
+        outputVariable.push_back(variable);
+
+        if (variable >= variableCount) variableCount = variable + 1;
+        return (unsigned)outputValue.size() - 1;
+    }
+
+    unsigned FuzzyRuleSet::addRule(const unsigned *sets, unsigned setCount,
+                                   unsigned output, real weight)
+    {
+        assert(setCount > 0 && output < outputValue.size());
+
+        ruleFirstTerm.push_back((unsigned)terms.size());
+        ruleTermCount.push_back(setCount);
+        ruleOutput.push_back(output);
+        ruleWeight.push_back(weight);
+        for (unsigned i = 0; i < setCount; i++)
+        {
+            assert(sets[i] < setInput.size());
+            terms.push_back(sets[i]);
+        }
+        return (unsigned)ruleOutput.size() - 1;
+    }
+
+    real FuzzyRuleSet::getMembership(unsigned set, real value) const
+    {
+        real rising = 1 - (setPlateauStart[set] - value) * setRise[set];
+        real falling = 1 - (value - setPlateauEnd[set]) * setFall[set];
+        real degree = rising < falling ? rising : falling;
+        if (degree < 0) degree = 0;
+        if (degree > 1) degree = 1;
+        return degree;
+    }
+
+    void FuzzyRuleSet::defuzzify(const real *degrees, real *crisp) const
+    {
+        for (unsigned v = 0; v < variableCount; v++)
+        {
+            real total = 0, weight = 0;
+            for (unsigned o = 0; o < outputValue.size(); o++)
+            {
+                if (outputVariable[o] != v) continue;
+                total += degrees[o] * outputValue[o];
+                weight += degrees[o];
+            }
+            crisp[v] = weight > 0 ? total / weight : 0;
+        }
+    }
+
+    /** Holds the degree of each set while the rules are evaluated. */
+    static thread_local std::vector<real> setDegrees;
+
+    void FuzzyRuleSet::evaluate(const real *inputs, real *degrees,
+                                real *crisp) const
+    {
+        unsigned sets = getSetCount();
+        if (setDegrees.size() < sets) setDegrees.resize(sets);
+        real *membership = setDegrees.data();
+
+        // Fuzzify the inputs.
+        for (unsigned s = 0; s < sets; s++)
+        {
+            membership[s] = getMembership(s, inputs[setInput[s]]);
+        }
+
+        // Each rule is the AND of its sets, and each output is the OR
+        // of its rules.
+        unsigned outputs = getOutputCount();
+        for (unsigned o = 0; o < outputs; o++) degrees[o] = 0;
+        for (unsigned r = 0; r < ruleOutput.size(); r++)
+        {
+            const unsigned *term = &terms[ruleFirstTerm[r]];
+            real degree = membership[term[0]];
+            for (unsigned t = 1; t < ruleTermCount[r]; t++)
+            {
+                real next = membership[term[t]];
+                if (next < degree) degree = next;
+            }
+            degree *= ruleWeight[r];
+
+            real &output = degrees[ruleOutput[r]];
+            if (degree > output) output = degree;
+        }
+
+        if (crisp) defuzzify(degrees, crisp);
+    }
+
+    void FuzzyRuleSet::evaluateMany(const real *inputs, unsigned stride,
+                                    unsigned count, real *degrees,
+                                    real *crisp) const
+    {
+        unsigned i = 0;
+        unsigned outputs = getOutputCount();
+
+#if defined(AICORE_SIMD_SSE) || defined(AICORE_SIMD_NEON)
+        // Work on four characters at once, with one lane for each
+        // character. The set degrees are followed by the outputs.
+        unsigned sets = getSetCount();
+        unsigned rules = getRuleCount();
+        if (setDegrees.size() < (sets + outputs) * 4)
+        {
+            setDegrees.resize((sets + outputs) * 4);
+        }
+        real *membership = setDegrees.data();
+        real *results = membership + sets * 4;
+
+        for (; i+4 <= count; i += 4)
+        {
+            const real *in0 = inputs + i * stride;
+            const real *in1 = in0 + stride;
+            const real *in2 = in1 + stride;
+            const real *in3 = in2 + stride;
+
+#if defined(AICORE_SIMD_SSE)
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 one = _mm_set1_ps(1.0f);
+            for (unsigned s = 0; s < sets; s++)
+            {
+                unsigned n = setInput[s];
+                __m128 x = _mm_set_ps(in3[n], in2[n], in1[n], in0[n]);
+                __m128 rising = _mm_sub_ps(one, _mm_mul_ps(
+                    _mm_sub_ps(_mm_set1_ps(setPlateauStart[s]), x),
+                    _mm_set1_ps(setRise[s])));
+                __m128 falling = _mm_sub_ps(one, _mm_mul_ps(
+                    _mm_sub_ps(x, _mm_set1_ps(setPlateauEnd[s])),
+                    _mm_set1_ps(setFall[s])));
+                __m128 degree = _mm_min_ps(_mm_max_ps(
+                    _mm_min_ps(rising, falling), zero), one);
+                _mm_storeu_ps(membership + s*4, degree);
+            }
+
+            for (unsigned o = 0; o < outputs; o++)
+            {
+                _mm_storeu_ps(results + o*4, zero);
+            }
+            for (unsigned r = 0; r < rules; r++)
+            {
+                const unsigned *term = &terms[ruleFirstTerm[r]];
+                __m128 degree = _mm_loadu_ps(membership + term[0]*4);
+                for (unsigned t = 1; t < ruleTermCount[r]; t++)
+                {
+                    degree = _mm_min_ps(degree,
+                                        _mm_loadu_ps(membership + term[t]*4));
+                }
+                degree = _mm_mul_ps(degree, _mm_set1_ps(ruleWeight[r]));
+
+                real *output = results + ruleOutput[r]*4;
+                _mm_storeu_ps(output, _mm_max_ps(_mm_loadu_ps(output), degree));
+            }
+#else
+            const float32x4_t zero = vdupq_n_f32(0.0f);
+            const float32x4_t one = vdupq_n_f32(1.0f);
+            for (unsigned s = 0; s < sets; s++)
+            {
+                unsigned n = setInput[s];
+                float32x4_t x = vdupq_n_f32(in0[n]);
+                x = vsetq_lane_f32(in1[n], x, 1);
+                x = vsetq_lane_f32(in2[n], x, 2);
+                x = vsetq_lane_f32(in3[n], x, 3);
+                float32x4_t rising = vsubq_f32(one, vmulq_n_f32(
+                    vsubq_f32(vdupq_n_f32(setPlateauStart[s]), x),
+                    setRise[s]));
+                float32x4_t falling = vsubq_f32(one, vmulq_n_f32(
+                    vsubq_f32(x, vdupq_n_f32(setPlateauEnd[s])),
+                    setFall[s]));
+                float32x4_t degree = vminq_f32(vmaxq_f32(
+                    vminq_f32(rising, falling), zero), one);
+                vst1q_f32(membership + s*4, degree);
+            }
+
+            for (unsigned o = 0; o < outputs; o++)
+            {
+                vst1q_f32(results + o*4, zero);
+            }
+            for (unsigned r = 0; r < rules; r++)
+            {
+                const unsigned *term = &terms[ruleFirstTerm[r]];
+                float32x4_t degree = vld1q_f32(membership + term[0]*4);
+                for (unsigned t = 1; t < ruleTermCount[r]; t++)
+                {
+                    degree = vminq_f32(degree,
+                                       vld1q_f32(membership + term[t]*4));
+                }
+                degree = vmulq_n_f32(degree, ruleWeight[r]);
+
+                real *output = results + ruleOutput[r]*4;
+                vst1q_f32(output, vmaxq_f32(vld1q_f32(output), degree));
+            }
+#endif
+
+            // Put the results back in order for each character.
+            for (unsigned k = 0; k < 4; k++)
+            {
+                real *out = degrees + (i+k) * outputs;
+                for (unsigned o = 0; o < outputs; o++)
+                {
+                    out[o] = results[o*4 + k];
+                }
+                if (crisp) defuzzify(out, crisp + (i+k) * variableCount);
+            }
+        }
+#endif
+
+        for (; i < count; i++)
+        {
+            evaluate(inputs + i * stride, degrees + i * outputs,
+                     crisp ? crisp + i * variableCount : NULL);
+        }
+    }
+
+    FuzzyStateMachine::FuzzyStateMachine(const FuzzyRuleSet *rules,
+                                         real threshold)
+        :
+        rules(NULL), threshold(threshold)
+    {
+        setRules(rules);
+    }
+
+    void FuzzyStateMachine::setRules(const FuzzyRuleSet *rules)
+    {
+        this->rules = rules;
+        unsigned outputs = rules ? rules->getOutputCount() : 0;
+        states.assign(outputs, (StateMachineState*)NULL);
+
+        // Keep one degree even with no outputs, so getDegrees works.
+        degrees.assign(outputs > 0 ? outputs : 1, 0);
+        active.assign(outputs, false);
+    }
+
+    void FuzzyStateMachine::reset()
+    {
+        for (unsigned o = 0; o < active.size(); o++)
+        {
+            degrees[o] = 0;
+            active[o] = false;
+        }
+    }
+
+    Action* FuzzyStateMachine::applyDegrees()
+    {
+        Action *exits = NULL, *entries = NULL, *actions = NULL;
+
+        for (unsigned o = 0; o < active.size(); o++)
+        {
+            bool wasActive = active[o];
+            active[o] = degrees[o] >= threshold;
+
+            StateMachineState *state = states[o];
+            if (state == NULL) continue;
+
+            if (wasActive && !active[o])
+            {
+                exits = Action::appendActions(exits, state->getExitActions());
+            }
+            else if (!wasActive && active[o])
+            {
+                entries = Action::appendActions(entries, state->getEntryActions());
+            }
+            else if (active[o])
+            {
+                actions = Action::appendActions(actions, state->getActions());
+            }
+        }
+
+        return Action::appendActions(Action::appendActions(exits, entries), actions);
+    }
+
+    Action* FuzzyStateMachine::update(const real *inputs)
+    {
+        if (!rules) return NULL;
+
+        rules->evaluate(inputs, &degrees[0]);
+        return applyDegrees();
+    }
+
+    /** Holds the degrees for a batch of machines. */
+    static thread_local std::vector<real> batchDegrees;
+
+    void FuzzyStateMachine::updateMany(FuzzyStateMachine **machines,
+                                       const real *inputs, unsigned stride,
+                                       unsigned count, Action **actions)
+    {
+        if (count == 0) return;
+        const FuzzyRuleSet *rules = machines[0]->rules;
+        if (!rules)
+        {
+            for (unsigned i = 0; i < count; i++) actions[i] = NULL;
+            return;
+        }
+
+        unsigned outputs = rules->getOutputCount();
+        if (batchDegrees.size() < count * outputs)
+        {
+            batchDegrees.resize(count * outputs);
+        }
+        rules->evaluateMany(inputs, stride, count, batchDegrees.data());
+
+        for (unsigned i = 0; i < count; i++)
+        {
+            FuzzyStateMachine *machine = machines[i];
+            assert(machine->rules == rules);
+
+            const real *degree = batchDegrees.data() + i * outputs;
+            for (unsigned o = 0; o < outputs; o++)
+            {
+                machine->degrees[o] = degree[o];
+            }
+            actions[i] = machine->applyDegrees();
+        }
+    }
+
+}; // end of namespace
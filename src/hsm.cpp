@@ -0,0 +1,284 @@
+/*
+ * Defines the classes used for hierarchical state machines.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <assert.h>
+#include <map>
+#include <aicore/aicore.h>
+
+namespace aicore
+{
+    HierarchicalState::HierarchicalState()
+        :
+        parent(NULL), initialState(NULL),
+        entryAction(NULL), activeAction(NULL), exitAction(NULL)
+    {
+        firstTransition = NULL;
+    }
+
+    HierarchicalTransition::HierarchicalTransition()
+        :
+        action(NULL)
+    {
+        condition = NULL;
+        target = NULL;
+        next = NULL;
+    }
+
+    bool HierarchicalTransition::isTriggered()
+    {
+        return ConditionalTransitionMixin::isTriggered();
+    }
+
+    StateMachineState * HierarchicalTransition::getTargetState()
+    {
+        return FixedTargetTransitionMixin::getTargetState();
+    }
+
+    const unsigned StateHierarchy::NONE;
+
+    StateHierarchy::StateHierarchy()
+        :
+        initialEntries(0), initialEntryCount(0)
+    {
+    }
+
+    void StateHierarchy::compile(HierarchicalState *initialState)
+    {
+        states.clear();
+        transitions.clear();
+        paths.clear();
+        initialEntries = initialEntryCount = 0;
+        if (initialState == NULL) return;
+
+        // Find every state, giving each an index.
+        std::vector<HierarchicalState*> order;
+        std::map<StateMachineState*, unsigned> indices;
+        order.push_back(initialState);
+        indices[initialState] = 0;
+        for (unsigned i = 0; i < order.size(); i++)
+        {
+            HierarchicalState *state = order[i];
+            std::vector<StateMachineState*> linked;
+            linked.push_back(state->parent);
+            linked.push_back(state->initialState);
+            for (BaseTransition *t = state->firstTransition; t; t = t->next)
+            {
+                linked.push_back(((Transition*)t)->getTargetState());
+            }
+
+            for (unsigned j = 0; j < linked.size(); j++)
+            {
+                if (!linked[j] || indices.count(linked[j])) continue;
+                assert(dynamic_cast<HierarchicalState*>(linked[j]));
+                indices[linked[j]] = (unsigned)order.size();
+                order.push_back((HierarchicalState*)linked[j]);
+            }
+        }
+
+        // Work out where each state is in the hierarchy.
+        states.resize(order.size());
+        for (unsigned i = 0; i < order.size(); i++)
+        {
+            CompiledState &compiled = states[i];
+            compiled.state = order[i];
+
+            std::vector<unsigned> ancestors;
+            for (HierarchicalState *s = order[i]; s; s = s->parent)
+            {
+                ancestors.push_back(indices[s]);
+            }
+            compiled.depth = (unsigned)ancestors.size() - 1;
+            compiled.ancestors = (unsigned)paths.size();
+            paths.insert(paths.end(), ancestors.rbegin(), ancestors.rend());
+        }
+
+        // Then work out what each transition does.
+        for (unsigned i = 0; i < order.size(); i++)
+        {
+            states[i].firstTransition = (unsigned)transitions.size();
+            states[i].transitionCount = 0;
+
+            BaseTransition *base = order[i]->firstTransition;
+            for (; base; base = base->next)
+            {
+                Transition *transition = (Transition*)base;
+                StateMachineState *targetState = transition->getTargetState();
+                if (targetState == NULL) continue;
+                unsigned target = indices[targetState];
+
+                // Find how many ancestors the two ends share, not
+                // counting the source itself, which is always left.
+                const CompiledState &from = states[i];
+                const CompiledState &to = states[target];
+                unsigned keep = 0;
+                while (keep < from.depth && keep <= to.depth &&
+                       paths[from.ancestors + keep] ==
+                       paths[to.ancestors + keep])
+                {
+                    keep++;
+                }
+                if (keep > to.depth) keep = to.depth;
+
+                HierarchicalTransition *hierarchical =
+                    dynamic_cast<HierarchicalTransition*>(transition);
+
+                CompiledTransition entry;
+                entry.transition = transition;
+                entry.action = hierarchical ? hierarchical->action : NULL;
+                entry.keepDepth = keep;
+                entry.entries = (unsigned)paths.size();
+                entry.target = addEntryPath(keep, target);
+                entry.entryCount = (unsigned)paths.size() - entry.entries;
+
+                transitions.push_back(entry);
+                states[i].transitionCount++;
+            }
+        }
+
+        // Starting is like a transition to the initial state from
+        // outside the hierarchy.
+        initialEntries = (unsigned)paths.size();
+        addEntryPath(0, 0);
+        initialEntryCount = (unsigned)paths.size() - initialEntries;
+    }
+
+    unsigned StateHierarchy::addEntryPath(unsigned keepDepth, unsigned state)
+    {
+        // Enter the target's ancestors below the kept ones.
+        const CompiledState &target = states[state];
+        for (unsigned d = keepDepth; d <= target.depth; d++)
+        {
+            paths.push_back(paths[target.ancestors + d]);
+        }
+
+        // Then follow the initial states down.
+        HierarchicalState *inner = target.state->initialState;
+        while (inner != NULL)
+        {
+            state = getStateIndex(inner);
+            paths.push_back(state);
+            inner = inner->initialState;
+        }
+        return state;
+    }
+
+    unsigned StateHierarchy::getStateIndex(const StateMachineState *state) const
+    {
+        for (unsigned i = 0; i < states.size(); i++)
+        {
+            if (states[i].state == state) return i;
+        }
+        return NONE;
+    }
+
+    HierarchicalStateMachine::HierarchicalStateMachine(
+        const StateHierarchy *hierarchy)
+        :
+        hierarchy(hierarchy), current(StateHierarchy::NONE)
+    {
+    }
+
+    void HierarchicalStateMachine::setHierarchy(const StateHierarchy *hierarchy)
+    {
+        this->hierarchy = hierarchy;
+        reset();
+    }
+
+    void HierarchicalStateMachine::reset()
+    {
+        current = StateHierarchy::NONE;
+        actions.clear();
+    }
+
+    HierarchicalState* HierarchicalStateMachine::getCurrentState() const
+    {
+        if (current == StateHierarchy::NONE) return NULL;
+        return hierarchy->states[current].state;
+    }
+
+    bool HierarchicalStateMachine::isInState(
+        const HierarchicalState *state) const
+    {
+        if (current == StateHierarchy::NONE) return false;
+
+        const StateHierarchy::CompiledState &leaf = hierarchy->states[current];
+        for (unsigned d = 0; d <= leaf.depth; d++)
+        {
+            unsigned index = hierarchy->paths[leaf.ancestors + d];
+            if (hierarchy->states[index].state == state) return true;
+        }
+        return false;
+    }
+
+    const std::vector<Action*>& HierarchicalStateMachine::update()
+    {
+        AICORE_PROFILE_LIBRARY_ZONE("HierarchicalStateMachine");
+        actions.clear();
+        if (!hierarchy || hierarchy->states.empty()) return actions;
+
+        const std::vector<unsigned> &paths = hierarchy->paths;
+
+        // The first update enters the initial states.
+        if (current == StateHierarchy::NONE)
+        {
+            const unsigned *entered = &paths[hierarchy->initialEntries];
+            for (unsigned i = 0; i < hierarchy->initialEntryCount; i++)
+            {
+                addAction(hierarchy->states[entered[i]].state->entryAction);
+                current = entered[i];
+            }
+            return actions;
+        }
+
+        // Look for a transition, from the top of the hierarchy down.
+        const StateHierarchy::CompiledState &leaf = hierarchy->states[current];
+        const unsigned *active = &paths[leaf.ancestors];
+        for (unsigned d = 0; d <= leaf.depth; d++)
+        {
+            const StateHierarchy::CompiledState &state =
+                hierarchy->states[active[d]];
+            const StateHierarchy::CompiledTransition *transition =
+                hierarchy->transitions.data() + state.firstTransition;
+            const StateHierarchy::CompiledTransition *end =
+                transition + state.transitionCount;
+
+            for (; transition < end; transition++)
+            {
+                if (!transition->transition->isTriggered()) continue;
+
+                // Exit from the bottom up to the shared states.
+                for (unsigned e = leaf.depth + 1; e > transition->keepDepth; e--)
+                {
+                    addAction(hierarchy->states[active[e-1]].state->exitAction);
+                }
+
+                addAction(transition->action);
+
+                const unsigned *entered = &paths[transition->entries];
+                for (unsigned i = 0; i < transition->entryCount; i++)
+                {
+                    addAction(hierarchy->states[entered[i]].state->entryAction);
+                }
+
+                current = transition->target;
+                return actions;
+            }
+        }
+
+        // Nothing fired, so carry on with the current states.
+        for (unsigned d = 0; d <= leaf.depth; d++)
+        {
+            addAction(hierarchy->states[active[d]].state->activeAction);
+        }
+        return actions;
+    }
+
+}; // end of namespace
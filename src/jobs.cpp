@@ -0,0 +1,155 @@
+/*
+ * Defines the classes used to run work in parallel.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <aicore/aicore.h>
+
+namespace aicore
+{
+    JobSystem::JobSystem(unsigned workers)
+        :
+        task(0), remaining(0), generation(0), quitting(false)
+    {
+        if (workers == 0) workers = std::thread::hardware_concurrency();
+        if (workers == 0) workers = 1;
+
+        for (unsigned i = 0; i < workers; i++)
+        {
+            queues.push_back(new WorkQueue);
+        }
+
+        // The caller is worker zero, so we need one fewer threads.
+        for (unsigned i = 1; i < workers; i++)
+        {
+            threads.push_back(std::thread(&JobSystem::workerLoop, this, i));
+        }
+    }
+
+    JobSystem::~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> guard(stateLock);
+            quitting = true;
+        }
+        workReady.notify_all();
+
+        for (unsigned i = 0; i < threads.size(); i++) threads[i].join();
+        for (unsigned i = 0; i < queues.size(); i++) delete queues[i];
+    }
+
+    void JobSystem::workerLoop(unsigned worker)
+    {
+        unsigned seen = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> guard(stateLock);
+                while (!quitting && generation == seen) workReady.wait(guard);
+                if (quitting) return;
+                seen = generation;
+            }
+            runChunks(worker);
+        }
+    }
+
+    bool JobSystem::findChunk(unsigned worker, Chunk* chunk)
+    {
+        // Take our own work from the back, which works through our
+        // run of characters in order.
+        {
+            WorkQueue &own = *queues[worker];
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (!own.chunks.empty())
+            {
+                *chunk = own.chunks.back();
+                own.chunks.pop_back();
+                return true;
+            }
+        }
+
+        // Steal from the front of everyone else's.
+        unsigned count = (unsigned)queues.size();
+        for (unsigned i = 1; i < count; i++)
+        {
+            WorkQueue &other = *queues[(worker + i) % count];
+            std::lock_guard<std::mutex> guard(other.lock);
+            if (!other.chunks.empty())
+            {
+                *chunk = other.chunks.front();
+                other.chunks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void JobSystem::runChunks(unsigned worker)
+    {
+        Chunk chunk;
+        while (findChunk(worker, &chunk))
+        {
+            task->run(chunk.begin, chunk.end, worker);
+
+            // The last chunk to finish wakes the caller.
+            if (remaining.fetch_sub(1) == 1)
+            {
+                std::lock_guard<std::mutex> guard(stateLock);
+                workDone.notify_all();
+            }
+        }
+    }
+
+    void JobSystem::parallelFor(ParallelTask* task, unsigned count,
+                                unsigned grainSize)
+    {
+        if (count == 0) return;
+        if (grainSize == 0) grainSize = 1;
+
+        // With no helpers there's no point splitting the work.
+        if (threads.empty())
+        {
+            task->run(0, count, 0);
+            return;
+        }
+
+        unsigned chunks = (count + grainSize - 1) / grainSize;
+        this->task = task;
+        remaining.store(chunks);
+
+        // Deal the chunks out in contiguous runs, so each worker
+        // starts with neighbouring characters.
+        unsigned workers = (unsigned)queues.size();
+        for (unsigned i = 0; i < chunks; i++)
+        {
+            Chunk chunk;
+            chunk.begin = i * grainSize;
+            chunk.end = chunk.begin + grainSize;
+            if (chunk.end > count) chunk.end = count;
+
+            WorkQueue &queue = *queues[(unsigned)((unsigned long long)i *
+                                                  workers / chunks)];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            queue.chunks.push_front(chunk);
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(stateLock);
+            generation++;
+        }
+        workReady.notify_all();
+
+        // Help out, then wait for anything still running elsewhere.
+        runChunks(0);
+
+        std::unique_lock<std::mutex> guard(stateLock);
+        while (remaining.load() > 0) workDone.wait(guard);
+    }
+
+}; // end of namespace
@@ -9,6 +9,7 @@
  * implies agreement with all terms and conditions of the accompanying
  * software licence.
  */
+#include <vector>
 #include <aicore/aicore.h>
 
 namespace aicore
@@ -21,10 +22,18 @@ namespace aicore
         output->linear -= character->position;
 
         // If there is no direction, do nothing
-        if (output->linear.squareMagnitude() > 0)
+        real squareMagnitude = output->linear.squareMagnitude();
+        if (squareMagnitude > 0)
         {
-            output->linear.normalise();
-            output->linear *= maxSpeed;
+            if (fastMath)
+            {
+                output->linear *= maxSpeed * fast_rsqrt(squareMagnitude);
+            }
+            else
+            {
+                output->linear.normalise();
+                output->linear *= maxSpeed;
+            }
         }
     }
 
@@ -35,10 +44,18 @@ namespace aicore
         output->linear -= *target;
 
         // If there is no direction, do nothing
-        if (output->linear.squareMagnitude() > 0)
+        real squareMagnitude = output->linear.squareMagnitude();
+        if (squareMagnitude > 0)
         {
-            output->linear.normalise();
-            output->linear *= maxSpeed;
+            if (fastMath)
+            {
+                output->linear *= maxSpeed * fast_rsqrt(squareMagnitude);
+            }
+            else
+            {
+                output->linear.normalise();
+                output->linear *= maxSpeed;
+            }
         }
     }
 
@@ -70,12 +87,217 @@ namespace aicore
     void KinematicWander::getSteering(SteeringOutput* output) const
     {
         // Move forward in the current direction
-        output->linear = character->getOrientationAsVector();
+        if (fastMath)
+        {
+            real sine, cosine;
+            fast_sincos(character->orientation, &sine, &cosine);
+            output->linear = Vector3(sine, 0, cosine);
+        }
+        else
+        {
+            output->linear = character->getOrientationAsVector();
+        }
         output->linear *= maxSpeed;
 
         // Turn a little
-        real change = randomBinomial();
+        real change = getRandom().randomBinomial();
         output->angular = change * maxRotation;
     }
 
+    /*
+     * Writes the steering for a seek (or, with the sign of the
+     * direction reversed, a flee) for each character. The character
+     * and target members aren't used, so this is shared by both. The
+     * choice of maths is a template parameter, so each version of the
+     * loop has nothing to decide.
+     */
+    template <bool fastMath>
+    static void seekMany(const KinematicBatch& characters,
+                         const real *targetX,
+                         const real *targetY,
+                         const real *targetZ,
+                         real sign, real maxSpeed,
+                         SteeringBatch *output)
+    {
+        unsigned count = characters.getSize();
+        output->resize(count);
+
+        const real * AICORE_RESTRICT px = characters.positionX;
+        const real * AICORE_RESTRICT py = characters.positionY;
+        const real * AICORE_RESTRICT pz = characters.positionZ;
+        const real * AICORE_RESTRICT tx = targetX;
+        const real * AICORE_RESTRICT ty = targetY;
+        const real * AICORE_RESTRICT tz = targetZ;
+        real * AICORE_RESTRICT lx = output->linearX;
+        real * AICORE_RESTRICT ly = output->linearY;
+        real * AICORE_RESTRICT lz = output->linearZ;
+        real * AICORE_RESTRICT la = output->angular;
+
+        for (unsigned i = 0; i < count; i++)
+        {
+            real dx = (tx[i] - px[i]) * sign;
+            real dy = (ty[i] - py[i]) * sign;
+            real dz = (tz[i] - pz[i]) * sign;
+
+            // Normalise then scale, in the same order as getSteering.
+            // Multiplying by one leaves characters on their target
+            // exactly as they were.
+            real squareDistance = dx*dx + dy*dy + dz*dz;
+            bool moving = squareDistance > 0;
+            real unit, speed;
+            if (fastMath)
+            {
+                // Characters on their target have no direction to
+                // scale, so adding one just keeps the result finite,
+                // without a choice the compiler won't vectorise.
+                unit = fast_rsqrt(squareDistance + (moving ? 0 : (real)1));
+                speed = maxSpeed;
+            }
+            else
+            {
+                unit = moving ? (real)1.0 / real_sqrt(squareDistance) : 1;
+                speed = moving ? maxSpeed : 1;
+            }
+
+            lx[i] = dx * unit * speed;
+            ly[i] = dy * unit * speed;
+            lz[i] = dz * unit * speed;
+            la[i] = 0;
+        }
+    }
+
+    void KinematicSeek::getSteeringMany(const KinematicBatch& characters,
+                                        const real *targetX,
+                                        const real *targetY,
+                                        const real *targetZ,
+                                        SteeringBatch *output) const
+    {
+        if (fastMath)
+        {
+            seekMany<true>(characters, targetX, targetY, targetZ,
+                           1, maxSpeed, output);
+        }
+        else
+        {
+            seekMany<false>(characters, targetX, targetY, targetZ,
+                            1, maxSpeed, output);
+        }
+    }
+
+    void KinematicFlee::getSteeringMany(const KinematicBatch& characters,
+                                        const real *targetX,
+                                        const real *targetY,
+                                        const real *targetZ,
+                                        SteeringBatch *output) const
+    {
+        if (fastMath)
+        {
+            seekMany<true>(characters, targetX, targetY, targetZ,
+                           -1, maxSpeed, output);
+        }
+        else
+        {
+            seekMany<false>(characters, targetX, targetY, targetZ,
+                            -1, maxSpeed, output);
+        }
+    }
+
+    void KinematicArrive::getSteeringMany(const KinematicBatch& characters,
+                                          const real *targetX,
+                                          const real *targetY,
+                                          const real *targetZ,
+                                          SteeringBatch *output) const
+    {
+        unsigned count = characters.getSize();
+        output->resize(count);
+
+        const real * AICORE_RESTRICT px = characters.positionX;
+        const real * AICORE_RESTRICT py = characters.positionY;
+        const real * AICORE_RESTRICT pz = characters.positionZ;
+        const real * AICORE_RESTRICT tx = targetX;
+        const real * AICORE_RESTRICT ty = targetY;
+        const real * AICORE_RESTRICT tz = targetZ;
+        real * AICORE_RESTRICT lx = output->linearX;
+        real * AICORE_RESTRICT ly = output->linearY;
+        real * AICORE_RESTRICT lz = output->linearZ;
+        real * AICORE_RESTRICT la = output->angular;
+
+        const real inverseTime = (real)1.0 / timeToTarget;
+        const real squareRadius = radius*radius;
+        const real squareMaxSpeed = maxSpeed*maxSpeed;
+
+        for (unsigned i = 0; i < count; i++)
+        {
+            real dx = tx[i] - px[i];
+            real dy = ty[i] - py[i];
+            real dz = tz[i] - pz[i];
+            real squareDistance = dx*dx + dy*dy + dz*dz;
+
+            // Characters inside the radius stop.
+            real inside = squareDistance < squareRadius ? 0 : 1;
+            dx *= inverseTime;
+            dy *= inverseTime;
+            dz *= inverseTime;
+
+            // Clip to the maximum speed.
+            real squareSpeed = dx*dx + dy*dy + dz*dz;
+            bool tooFast = squareSpeed > squareMaxSpeed;
+            real unit = tooFast ? (real)1.0 / real_sqrt(squareSpeed) : 1;
+            real speed = tooFast ? maxSpeed : 1;
+
+            lx[i] = dx * unit * speed * inside;
+            ly[i] = dy * unit * speed * inside;
+            lz[i] = dz * unit * speed * inside;
+            la[i] = 0;
+        }
+    }
+
+    /** Holds the random turns for a batch of wandering characters. */
+    static thread_local std::vector<real> wanderChanges;
+
+    void KinematicWander::getSteeringMany(const KinematicBatch& characters,
+                                          SteeringBatch *output,
+                                          RandomEngine &engine) const
+    {
+        unsigned count = characters.getSize();
+        output->resize(count);
+        if (count == 0) return;
+
+        if (wanderChanges.size() < count) wanderChanges.resize(count);
+        real *change = wanderChanges.data();
+        engine.fillBinomial(change, count);
+
+        const real * AICORE_RESTRICT o = characters.orientation;
+        real * AICORE_RESTRICT lx = output->linearX;
+        real * AICORE_RESTRICT ly = output->linearY;
+        real * AICORE_RESTRICT lz = output->linearZ;
+        real * AICORE_RESTRICT la = output->angular;
+
+        if (fastMath)
+        {
+            // The sines and cosines go straight into the output, in a
+            // loop that can be vectorised, to be scaled afterwards.
+            fastSinCosMany(o, lx, lz, count);
+            const real * AICORE_RESTRICT c = change;
+            const real speed = maxSpeed;
+            const real rotation = maxRotation;
+            for (unsigned i = 0; i < count; i++)
+            {
+                lx[i] *= speed;
+                ly[i] = 0;
+                lz[i] *= speed;
+                la[i] = c[i] * rotation;
+            }
+            return;
+        }
+
+        for (unsigned i = 0; i < count; i++)
+        {
+            lx[i] = real_sin(o[i]) * maxSpeed;
+            ly[i] = 0;
+            lz[i] = real_cos(o[i]) * maxSpeed;
+            la[i] = change[i] * maxRotation;
+        }
+    }
+
 }; // end of namespace
@@ -16,15 +16,24 @@ namespace aicore
 {
     unsigned LearningProblemAction::getCount()
     {
-        if (next == NULL) return 1;
-        else return next->getCount() + 1;
+        unsigned count = 1;
+        for (LearningProblemAction *action = next; action; action = action->next)
+        {
+            count++;
+        }
+        return count;
     }
 
     LearningProblemAction *
     LearningProblemAction::getAtPositionInList(unsigned pos)
     {
-        if (pos <= 0 || next == NULL) return this;
-        else return next->getAtPositionInList(pos-1);
+        LearningProblemAction *action = this;
+        while (pos > 0 && action->next != NULL)
+        {
+            action = action->next;
+            pos--;
+        }
+        return action;
     }
 
 
@@ -33,33 +42,78 @@ namespace aicore
         return getRandomState();
     }
 
+    LearningProblemAction*
+    LearningProblem::getAction(LearningProblemState* state, unsigned index)
+    {
+        LearningProblemAction* action = getActions(state);
+        while (action != NULL && action->index != index)
+        {
+            action = action->next;
+        }
+        return action;
+    }
+
+    unsigned LearningProblem::getValidActionCount(LearningProblemState* state)
+    {
+        LearningProblemAction* actions = getActions(state);
+        return actions ? actions->getCount() : 0;
+    }
+
+    LearningProblemAction*
+    LearningProblem::getValidAction(LearningProblemState* state,
+                                    unsigned position)
+    {
+        LearningProblemAction* actions = getActions(state);
+        return actions ? actions->getAtPositionInList(position) : NULL;
+    }
+
     ArrayBasedLearningProblem::ArrayBasedLearningProblem(
         unsigned stateCount,
         unsigned actionsPerState,
         unsigned *destination,
         real *rewards)
             :
-            destination(destination),
-            rewards(rewards),
             stateCount(stateCount),
-            actionsPerState(actionsPerState)
+            actionsPerState(actionsPerState),
+            destination(destination),
+            rewards(rewards)
     {
-        // Create the arrays
+        // Create the states, and fill them with their index numbers
         states = new LearningProblemState[stateCount];
-        actions = new LearningProblemAction[actionsPerState];
-
-        // Fill the array values with their index numbers
         for (unsigned i = 0; i < stateCount; i++)
         {
             states[i].index = i;
             states[i].data = NULL;
         }
 
-        for (unsigned i = 0; i < actionsPerState; i++)
+        // Count the valid actions for each state
+        actionStart = new unsigned[stateCount + 1];
+        unsigned total = 0;
+        for (unsigned i = 0; i < stateCount; i++)
+        {
+            actionStart[i] = total;
+            for (unsigned j = 0; j < actionsPerState; j++)
+            {
+                if (destination[i * actionsPerState + j] < 0xffffff) total++;
+            }
+        }
+        actionStart[stateCount] = total;
+
+        // Then fill in the actions, linking each state's into a list
+        actions = new LearningProblemAction[total > 0 ? total : 1];
+        unsigned next = 0;
+        for (unsigned i = 0; i < stateCount; i++)
         {
-            actions[i].index = i;
-            actions[i].action = NULL;
-            actions[i].next = NULL;
+            for (unsigned j = 0; j < actionsPerState; j++)
+            {
+                if (destination[i * actionsPerState + j] >= 0xffffff) continue;
+
+                actions[next].index = j;
+                actions[next].action = NULL;
+                actions[next].next = NULL;
+                if (next > actionStart[i]) actions[next-1].next = &actions[next];
+                next++;
+            }
         }
     }
 
@@ -67,6 +121,7 @@ namespace aicore
     {
         delete[] states;
         delete[] actions;
+        delete[] actionStart;
     }
 
     unsigned ArrayBasedLearningProblem::getStateCount()
@@ -92,20 +147,31 @@ namespace aicore
     LearningProblemAction*
     ArrayBasedLearningProblem::getActions(LearningProblemState* state)
     {
-        LearningProblemAction * action = NULL;
-        for (unsigned i = 0; i < actionsPerState; i++)
+        unsigned first = actionStart[state->index];
+        if (first == actionStart[state->index+1]) return NULL;
+        return &actions[first];
+    }
+
+    LearningProblemAction*
+    ArrayBasedLearningProblem::getAction(LearningProblemState* state,
+                                         unsigned index)
+    {
+        // The actions for a state are in order of index, so we can
+        // do a binary search.
+        unsigned low = actionStart[state->index];
+        unsigned high = actionStart[state->index+1];
+        while (low < high)
         {
-            // Check if we've got a valid destination
-            if (destination[state->index * actionsPerState + i] < 0xffffff)
-            {
-                // Add to the list
-                actions[i].next = action;
-                action = &actions[i];
-            }
+            unsigned middle = (low + high) / 2;
+            if (actions[middle].index < index) low = middle + 1;
+            else high = middle;
         }
 
-        // Return the list
-        return action;
+        if (low < actionStart[state->index+1] && actions[low].index == index)
+        {
+            return &actions[low];
+        }
+        return NULL;
     }
 
     LearningProblemActionResult ArrayBasedLearningProblem::getResult(
@@ -16,42 +16,52 @@ namespace aicore
 {
     /*
      * This is messy, but it saves a function call or code duplication.
+     * Each component is a separate multiply then add, so the results
+     * only depend on the compiler not fusing them, which the
+     * AICORE_DETERMINISTIC build option makes sure of.
      */
     #define SIMPLE_INTEGRATION(duration, velocity, rotation) \
         position.x += (velocity).x*duration; \
         position.y += (velocity).y*duration; \
         position.z += (velocity).z*duration; \
         orientation += (rotation)*duration; \
-        orientation = real_mod_real(orientation, M_2PI);
+        orientation = Precision<T>::mod(orientation, \
+                                        (T)6.28318530717958647692);
 
 
     /*
      * Uses SIMPLE_INTEGRATION(duration), defined above.
      */
-    void Location::integrate(const SteeringOutput& steer, real duration)
+    template <typename T>
+    void BasicLocation<T>::integrate(const BasicSteeringOutput<T>& steer,
+                                     T duration)
     {
         SIMPLE_INTEGRATION(duration, steer.linear, steer.angular);
     }
 
-    void Location::setOrientationFromVelocity(const Vector3& velocity)
+    template <typename T>
+    void BasicLocation<T>::setOrientationFromVelocity(
+        const BasicVector3<T>& velocity)
     {
         // If we haven't got any velocity, then we can do nothing.
         if (velocity.squareMagnitude() > 0) {
-            orientation = real_atan2(velocity.x, velocity.z);
+            orientation = Precision<T>::atan2(velocity.x, velocity.z);
         }
     }
 
-    Vector3 Location::getOrientationAsVector() const
+    template <typename T>
+    BasicVector3<T> BasicLocation<T>::getOrientationAsVector() const
     {
-        return Vector3(real_sin(orientation),
-                       0,
-                       real_cos(orientation));
+        return BasicVector3<T>(Precision<T>::sin(orientation),
+                               0,
+                               Precision<T>::cos(orientation));
     }
 
     /*
      * Uses SIMPLE_INTEGRATION(duration), defined above.
      */
-    void Kinematic::integrate(real duration)
+    template <typename T>
+    void BasicKinematic<T>::integrate(T duration)
     {
         SIMPLE_INTEGRATION(duration, velocity, rotation);
     }
@@ -59,8 +69,9 @@ namespace aicore
     /*
      * Uses SIMPLE_INTEGRATION(duration), defined above.
      */
-    void Kinematic::integrate(const SteeringOutput& steer,
-                              real duration)
+    template <typename T>
+    void BasicKinematic<T>::integrate(const BasicSteeringOutput<T>& steer,
+                                      T duration)
     {
         SIMPLE_INTEGRATION(duration, velocity, rotation);
         velocity.x += steer.linear.x*duration;
@@ -72,14 +83,15 @@ namespace aicore
     /*
      * Uses SIMPLE_INTEGRATION(duration), defined above.
      */
-    void Kinematic::integrate(const SteeringOutput& steer,
-                              real drag,
-                              real duration)
+    template <typename T>
+    void BasicKinematic<T>::integrate(const BasicSteeringOutput<T>& steer,
+                                      T drag,
+                                      T duration)
     {
         SIMPLE_INTEGRATION(duration, velocity, rotation);
 
         // Slowing velocity and rotational velocity
-        drag = real_pow(drag, duration);
+        drag = Precision<T>::pow(drag, duration);
         velocity *= drag;
         rotation *= drag*drag;
 
@@ -92,16 +104,17 @@ namespace aicore
     /*
      * Uses SIMPLE_INTEGRATION(duration), defined above.
      */
-    void Kinematic::integrate(const SteeringOutput& steer,
-                              const SteeringOutput& drag,
-                              real duration)
+    template <typename T>
+    void BasicKinematic<T>::integrate(const BasicSteeringOutput<T>& steer,
+                                      const BasicSteeringOutput<T>& drag,
+                                      T duration)
     {
         SIMPLE_INTEGRATION(duration, velocity, rotation);
 
-        velocity.x *= real_pow(drag.linear.x, duration);
-        velocity.y *= real_pow(drag.linear.y, duration);
-        velocity.z *= real_pow(drag.linear.z, duration);
-        rotation *= real_pow(drag.angular, duration);
+        velocity.x *= Precision<T>::pow(drag.linear.x, duration);
+        velocity.y *= Precision<T>::pow(drag.linear.y, duration);
+        velocity.z *= Precision<T>::pow(drag.linear.z, duration);
+        rotation *= Precision<T>::pow(drag.angular, duration);
 
         velocity.x += steer.linear.x*duration;
         velocity.y += steer.linear.y*duration;
@@ -112,7 +125,8 @@ namespace aicore
 
 
     /* Add and divide used in finding Kinematic means. */
-    void Kinematic::operator += (const Kinematic& other)
+    template <typename T>
+    void BasicKinematic<T>::operator += (const BasicKinematic<T>& other)
     {
         position+=other.position;
         velocity+=other.velocity;
@@ -120,7 +134,8 @@ namespace aicore
         orientation+=other.orientation;
     }
 
-    void Kinematic::operator -= (const Kinematic& other)
+    template <typename T>
+    void BasicKinematic<T>::operator -= (const BasicKinematic<T>& other)
     {
         position-=other.position;
         velocity-=other.velocity;
@@ -128,7 +143,8 @@ namespace aicore
         orientation-=other.orientation;
     }
 
-    void Kinematic::operator *= (real f)
+    template <typename T>
+    void BasicKinematic<T>::operator *= (T f)
     {
         position*=f;
         velocity*=f;
@@ -136,7 +152,8 @@ namespace aicore
         orientation*=f;
     }
 
-    void Kinematic::trimMaxSpeed(real maxSpeed)
+    template <typename T>
+    void BasicKinematic<T>::trimMaxSpeed(T maxSpeed)
     {
         if (velocity.squareMagnitude() > maxSpeed*maxSpeed) {
             velocity.normalise();
@@ -144,12 +161,19 @@ namespace aicore
         }
     }
 
-    void Kinematic::setOrientationFromVelocity()
+    template <typename T>
+    void BasicKinematic<T>::setOrientationFromVelocity()
     {
         // If we haven't got any velocity, then we can do nothing.
         if (velocity.squareMagnitude() > 0) {
-            orientation = real_atan2(velocity.x, velocity.z);
+            orientation = Precision<T>::atan2(velocity.x, velocity.z);
         }
     }
 
+    // Compile the classes at both precisions.
+    template struct BasicLocation<float>;
+    template struct BasicLocation<double>;
+    template struct BasicKinematic<float>;
+    template struct BasicKinematic<double>;
+
 }; // end of namespace
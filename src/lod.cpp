@@ -0,0 +1,130 @@
+/*
+ * Defines the classes used to schedule AI updates by level of detail.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <assert.h>
+#include <aicore/aicore.h>
+
+namespace aicore
+{
+    const unsigned UpdateScheduler::NEVER;
+
+    UpdateScheduler::UpdateScheduler()
+    {
+    }
+
+    unsigned UpdateScheduler::addLevel(real distance, unsigned interval)
+    {
+        assert(interval > 0);
+        assert(levels.empty() ||
+               distance*distance >= levels.back().squareDistance);
+
+        Level level;
+        level.squareDistance = distance*distance;
+        level.interval = interval;
+        levels.push_back(level);
+        return (unsigned)levels.size() - 1;
+    }
+
+    void UpdateScheduler::resize(unsigned count)
+    {
+        agentLevels.resize(count, 0);
+        lastUpdates.resize(count, NEVER);
+        elapsed.resize(count, getInterval(0));
+        due.resize(count, false);
+    }
+
+    unsigned UpdateScheduler::findLevel(real squareDistance) const
+    {
+        unsigned last = (unsigned)levels.size() - 1;
+        for (unsigned l = 0; l < last; l++)
+        {
+            if (squareDistance <= levels[l].squareDistance) return l;
+        }
+        return last;
+    }
+
+    void UpdateScheduler::assignLevels(const Vector3 &viewer,
+                                       const Kinematic *agents)
+    {
+        if (levels.empty()) return;
+
+        for (unsigned i = 0; i < agentLevels.size(); i++)
+        {
+            Vector3 offset = agents[i].position - viewer;
+            agentLevels[i] = findLevel(offset.squareMagnitude());
+        }
+    }
+
+    void UpdateScheduler::assignLevels(const Vector3 &viewer,
+                                       const KinematicBatch &agents)
+    {
+        assert(agents.getSize() == agentLevels.size());
+        if (levels.empty()) return;
+
+        for (unsigned i = 0; i < agentLevels.size(); i++)
+        {
+            real x = agents.positionX[i] - viewer.x;
+            real y = agents.positionY[i] - viewer.y;
+            real z = agents.positionZ[i] - viewer.z;
+            agentLevels[i] = findLevel(x*x + y*y + z*z);
+        }
+    }
+
+    const std::vector<unsigned>& UpdateScheduler::schedule(unsigned frame)
+    {
+        AICORE_PROFILE_LIBRARY_ZONE("UpdateScheduler");
+        dueList.clear();
+        for (unsigned i = 0; i < agentLevels.size(); i++)
+        {
+            due[i] = isDue(i, frame);
+            if (!due[i]) continue;
+
+            elapsed[i] = lastUpdates[i] == NEVER ?
+                getInterval(agentLevels[i]) : frame - lastUpdates[i];
+            lastUpdates[i] = frame;
+            dueList.push_back(i);
+        }
+        return dueList;
+    }
+
+    const std::vector<unsigned>& UpdateScheduler::schedule()
+    {
+        return schedule(TimingData::get().frameNumber);
+    }
+
+    void UpdateScheduler::integrate(Kinematic *agents,
+                                    const SteeringOutput *steering,
+                                    real duration) const
+    {
+        for (unsigned i = 0; i < due.size(); i++)
+        {
+            if (due[i])
+            {
+                agents[i].integrate(steering[i], duration);
+            }
+            else
+            {
+                agents[i].integrate(duration);
+            }
+        }
+    }
+
+    real UpdateScheduler::getExpectedLoad() const
+    {
+        real load = 0;
+        for (unsigned i = 0; i < agentLevels.size(); i++)
+        {
+            load += (real)1.0 / getInterval(agentLevels[i]);
+        }
+        return load;
+    }
+
+}; // end of namespace
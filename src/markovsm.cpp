@@ -9,51 +9,323 @@
  * implies agreement with all terms and conditions of the accompanying
  * software licence.
  */
+#include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <aicore/aicore.h>
 
 namespace aicore
 {
+    const unsigned MarkovPowers::NONE;
+
+    FixedMarkovTransition::FixedMarkovTransition()
+        :
+        matrix(NULL)
+    {
+    }
+
     real * FixedMarkovTransition::getMatrix()
     {
         return matrix;
     }
 
-    void MarkovStateMachine::updateStateVector(real * matrix)
+    void FixedMarkovTransition::setMatrix(real *matrix, unsigned size)
+    {
+        this->matrix = matrix;
+        powers.setMatrix(matrix, size);
+    }
+
+    void FixedMarkovTransition::invalidate()
     {
-        // Create temporary storage and zero it
-        real * tempState = new real[stateVectorSize];
-        memset(tempState, 0, sizeof(real) * stateVectorSize);
+        powers.update();
+    }
 
-        // Now work through each element of the matrix
-        for (unsigned i = 0; i < stateVectorSize*stateVectorSize; i++)
+    void FixedMarkovTransition::applyTransitionRepeatedly(
+        const real *stateVector, real *result, unsigned size, unsigned times)
+    {
+        // The powers are never worked out here, so that transitions
+        // can be shared between threads.
+        if (matrix == NULL ||
+            powers.getMatrix() != matrix || powers.getSize() != size)
         {
-            // Work out which item in the state vector and target
-            // vector we're affecting. Note that if you want the
-            // matrix to be post-multiplied, then change the % and /
-            // operators in these two lines.
-            unsigned stateIndex = i % stateVectorSize;
-            unsigned targetIndex = i / stateVectorSize;
+            MarkovTransition::applyTransitionRepeatedly(stateVector, result,
+                                                        size, times);
+            return;
+        }
+        powers.apply(stateVector, result, times);
+    }
 
-            // Add this component
-            tempState[targetIndex] += matrix[i] * stateVector[stateIndex];
+    void MarkovTransition::applyTransition(const real *stateVector,
+                                           real *result, unsigned size)
+    {
+        // The matrix is pre-multiplied, so each row of the matrix
+        // gives one element of the new vector. If you want the
+        // matrix to be post-multiplied, then transpose it first.
+        multiplyMatrixVector(getMatrix(), stateVector, result, size, size);
+    }
+
+    /** Holds the intermediate state vectors of repeated transitions. */
+    static thread_local std::vector<real> repeatScratch;
+
+    void MarkovTransition::applyTransitionRepeatedly(const real *stateVector,
+                                                     real *result,
+                                                     unsigned size,
+                                                     unsigned times)
+    {
+        if (times == 0)
+        {
+            memcpy(result, stateVector, sizeof(real) * size);
+            return;
         }
+        if (repeatScratch.size() < size) repeatScratch.resize(size);
 
-        // Copy across the new vector's data
-        memcpy(stateVector, tempState, sizeof(real) * stateVectorSize);
+        // Alternate between the scratch space and the result, so the
+        // last application lands in the result.
+        const real *from = stateVector;
+        for (unsigned i = times; i > 0; i--)
+        {
+            real *to = (i % 2 == 1) ? result : &repeatScratch[0];
+            applyTransition(from, to, size);
+            from = to;
+        }
     }
 
-    Action * MarkovStateMachine::update()
+    MarkovPowers::MarkovPowers()
+        :
+        matrix(NULL), size(0), tolerance(0), steady(NONE)
+    {
+    }
+
+    void MarkovPowers::setMatrix(const real *matrix, unsigned size,
+                                 real tolerance)
+    {
+        this->matrix = matrix;
+        this->size = size;
+        this->tolerance = tolerance;
+        compute();
+    }
+
+    void MarkovPowers::update()
+    {
+        compute();
+    }
+
+    void MarkovPowers::compute()
+    {
+        powers.clear();
+        steady = NONE;
+        if (matrix == NULL || size == 0) return;
+
+        powers.push_back(std::vector<real>(matrix, matrix + size * size));
+        while (powers.size() < MAX_POWERS)
+        {
+            square();
+            unsigned index = (unsigned)powers.size() - 2;
+            const real *power = &powers[index][0];
+            const real *squared = &powers[index + 1][0];
+
+            real change = 0;
+            for (unsigned i = 0; i < size * size; i++)
+            {
+                real difference = real_abs(squared[i] - power[i]);
+                if (difference > change) change = difference;
+            }
+            if (change > tolerance) continue;
+
+            // A transition that cycles can have its squares settle
+            // down too (swapping two states squares to doing
+            // nothing), so check that one more step doesn't change
+            // the power either.
+            if (getStepChange(squared) <= tolerance)
+            {
+                steady = index + 1;
+                return;
+            }
+        }
+    }
+
+    void MarkovPowers::square()
+    {
+        powers.push_back(std::vector<real>());
+        std::vector<real> &next = powers.back();
+        const std::vector<real> &last = powers[powers.size() - 2];
+        next.assign(size * size, 0);
+
+        // Go along the rows of both matrices, so the memory is read
+        // in order.
+        for (unsigned r = 0; r < size; r++)
+        {
+            real *row = &next[r * size];
+            for (unsigned k = 0; k < size; k++)
+            {
+                real value = last[r * size + k];
+                if (value == 0) continue;
+
+                const real *other = &last[k * size];
+                for (unsigned c = 0; c < size; c++)
+                {
+                    row[c] += value * other[c];
+                }
+            }
+        }
+    }
+
+    const real * MarkovPowers::getPower(unsigned index) const
+    {
+        assert(index < MAX_POWERS);
+        assert(!powers.empty());
+
+        if (index >= powers.size()) index = (unsigned)powers.size() - 1;
+        return &powers[index][0];
+    }
+
+    /** Holds the intermediate state vector while applying powers. */
+    static thread_local std::vector<real> powersScratch;
+
+    void MarkovPowers::apply(const real *stateVector, real *result,
+                             unsigned times) const
+    {
+        if (times == 0 || size == 0)
+        {
+            memcpy(result, stateVector, sizeof(real) * size);
+            return;
+        }
+
+        // Once the steady state is reached, applying the matrix more
+        // often makes no difference.
+        if (steady != NONE && times >= (1u << steady))
+        {
+            multiplyMatrixVector(&powers[steady][0], stateVector, result,
+                                 size, size);
+            return;
+        }
+
+        if (powersScratch.size() < size) powersScratch.resize(size);
+        unsigned products = 0;
+        for (unsigned bits = times; bits != 0; bits &= bits - 1) products++;
+
+        // Multiply by the power for each bit set, alternating between
+        // the scratch space and the result as applyTransitionRepeatedly
+        // does.
+        const real *from = stateVector;
+        for (unsigned index = 0; index < MAX_POWERS; index++)
+        {
+            if (!(times & (1u << index))) continue;
+
+            real *to = (products % 2 == 1) ? result : &powersScratch[0];
+            multiplyMatrixVector(getPower(index), from, to, size, size);
+            from = to;
+            products--;
+        }
+    }
+
+    real MarkovPowers::getStepChange(const real *power) const
+    {
+        const real *once = &powers[0][0];
+        real change = 0;
+        for (unsigned r = 0; r < size; r++)
+        {
+            for (unsigned c = 0; c < size; c++)
+            {
+                real sum = 0;
+                for (unsigned k = 0; k < size; k++)
+                {
+                    sum += once[r * size + k] * power[k * size + c];
+                }
+                real difference = real_abs(sum - power[r * size + c]);
+                if (difference > change) change = difference;
+            }
+        }
+        return change;
+    }
+
+    bool MarkovPowers::applySteadyState(const real *stateVector,
+                                        real *result) const
+    {
+        if (steady == NONE) return false;
+        multiplyMatrixVector(&powers[steady][0], stateVector, result,
+                             size, size);
+        return true;
+    }
+
+    void SparseMarkovTransition::setMatrix(const real *matrix,
+                                           unsigned size, real threshold)
+    {
+        rowStart.resize(size + 1);
+        columns.clear();
+        values.clear();
+
+        for (unsigned r = 0; r < size; r++)
+        {
+            rowStart[r] = (unsigned)values.size();
+            for (unsigned c = 0; c < size; c++)
+            {
+                real value = matrix[r * size + c];
+                if (real_abs(value) > threshold)
+                {
+                    columns.push_back(c);
+                    values.push_back(value);
+                }
+            }
+        }
+        rowStart[size] = (unsigned)values.size();
+    }
+
+    real * SparseMarkovTransition::getMatrix()
+    {
+        return NULL;
+    }
+
+    void SparseMarkovTransition::applyTransition(const real *stateVector,
+                                                 real *result,
+                                                 unsigned size)
+    {
+        assert(rowStart.size() == size + 1);
+
+        const unsigned *column = columns.empty() ? NULL : &columns[0];
+        const real *value = values.empty() ? NULL : &values[0];
+        for (unsigned r = 0; r < size; r++)
+        {
+            real sum = 0;
+            for (unsigned i = rowStart[r]; i < rowStart[r+1]; i++)
+            {
+                sum += value[i] * stateVector[column[i]];
+            }
+            result[r] = sum;
+        }
+    }
+
+    MarkovStateMachine::MarkovStateMachine()
+        :
+        stateVector(NULL), stateVectorSize(0),
+        firstTransition(NULL), defaultTransition(NULL),
+        framesToDefault(0), framesPassed(0)
+    {
+    }
+
+    void MarkovStateMachine::updateStateVector(MarkovTransition * transition)
     {
-        // The variable to hold the actions to perform
-        Action * actions = NULL;
+        if (stateVectorSize == 0) return;
 
+        // The scratch space is only reallocated if the state vector
+        // grows.
+        if (scratch.size() < stateVectorSize) scratch.resize(stateVectorSize);
+
+        transition->applyTransition(stateVector, &scratch[0],
+                                    stateVectorSize);
+
+        // Copy across the new vector's data
+        memcpy(stateVector, &scratch[0], sizeof(real) * stateVectorSize);
+    }
+
+    MarkovTransition * MarkovStateMachine::findTransition()
+    {
         // Start off with no transition
         MarkovTransition * transition = NULL;
 
         // Check through each transition in the current state.
-        BaseTransition * testTransition = firstTransition;
+        BaseTransition * testTransition = NULL;
+        if (shouldCheckTransitions()) testTransition = firstTransition;
         while (testTransition != NULL) {
             if (testTransition->isTriggered()) {
                 transition = (MarkovTransition*)testTransition;
@@ -68,19 +340,106 @@ namespace aicore
         {
             transition = defaultTransition;
         }
+        return transition;
+    }
 
-        // Check if we found a transition
-        if (transition != NULL) {
+    Action * MarkovStateMachine::finishTransition(
+        MarkovTransition * transition)
+    {
+        // Stop the counting
+        framesPassed = 0;
 
-            // Find the matrix and update the state vector
-            real * matrix = transition->getMatrix();
-            updateStateVector(matrix);
+        // The actions are those given by the transition
+        return transition->getActions();
+    }
 
-            // The actions are those given by the transition
-            actions = transition->getActions();
+    void MarkovStateMachine::applyTransition(MarkovTransition * transition,
+                                             unsigned times)
+    {
+        if (stateVectorSize == 0) return;
+        if (scratch.size() < stateVectorSize) scratch.resize(stateVectorSize);
 
-            // Stop the counting
-            framesPassed = 0;
+        transition->applyTransitionRepeatedly(stateVector, &scratch[0],
+                                              stateVectorSize, times);
+        memcpy(stateVector, &scratch[0], sizeof(real) * stateVectorSize);
+    }
+
+    unsigned MarkovStateMachine::skipFrames(unsigned frames)
+    {
+        if (frames == 0) return 0;
+        if (defaultTransition == NULL)
+        {
+            framesPassed += frames;
+            return 0;
+        }
+
+        // The default transition fires on the first frame that takes
+        // the count past framesToDefault, and then once every period
+        // frames. The sums are done in 64 bits, in case the machine
+        // is set never to default.
+        unsigned long long period = (unsigned long long)framesToDefault + 1;
+        unsigned long long first =
+            framesPassed < period ? period - framesPassed : 1;
+        if (first > frames)
+        {
+            framesPassed += frames;
+            return 0;
+        }
+
+        unsigned fired = (unsigned)(1 + (frames - first) / period);
+        applyTransition(defaultTransition, fired);
+        framesPassed = (unsigned)(frames - first - (fired - 1) * period);
+        return fired;
+    }
+
+    bool EventMarkovStateMachine::shouldCheckTransitions()
+    {
+        watcher.watch(firstTransition);
+        return watcher.check();
+    }
+
+    bool EventMarkovStateMachine::isDirty()
+    {
+        watcher.watch(firstTransition);
+        return watcher.isDirty();
+    }
+
+    void MarkovStateMachine::writeSnapshot(SnapshotWriter &writer) const
+    {
+        writer.writeUnsigned(stateVectorSize);
+        writer.writeReals(stateVector, stateVectorSize);
+        writer.writeUnsigned(framesPassed);
+    }
+
+    bool MarkovStateMachine::readSnapshot(SnapshotReader &reader)
+    {
+        if (reader.readUnsigned() != stateVectorSize) reader.fail();
+        if (stateVectorSize == 0)
+        {
+            unsigned frames = reader.readUnsigned();
+            if (reader.isValid()) framesPassed = frames;
+            return reader.isValid();
+        }
+
+        // Read into the scratch space, so a failed read changes nothing.
+        if (scratch.size() < stateVectorSize) scratch.resize(stateVectorSize);
+        reader.readReals(&scratch[0], stateVectorSize);
+        unsigned frames = reader.readUnsigned();
+        if (!reader.isValid()) return false;
+
+        memcpy(stateVector, &scratch[0], sizeof(real) * stateVectorSize);
+        framesPassed = frames;
+        return true;
+    }
+
+    Action * MarkovStateMachine::update()
+    {
+        MarkovTransition * transition = findTransition();
+
+        // Check if we found a transition
+        if (transition != NULL) {
+            updateStateVector(transition);
+            return finishTransition(transition);
         }
 
         // NB: We don't have an else for what to do if there is no
@@ -90,7 +449,140 @@ namespace aicore
         // their application. One simple possibility would be to have
         // a default action to perform if no transitions were fired.
 
-        return actions;
+        return NULL;
+    }
+
+
+    unsigned MarkovBatch::update(MarkovStateMachine ** machines,
+                                 unsigned count, Action ** actions)
+    {
+        AICORE_PROFILE_LIBRARY_ZONE("MarkovBatch");
+
+        // Find out which machines want to fire, and which of the
+        // transitions each one is using. There are normally only a
+        // few different transitions, so a linear search is fine.
+        chosen.resize(count);
+        groupOf.resize(count);
+        transitions.clear();
+        starts.clear();
+        unsigned fired = 0;
+        unsigned g = 0;
+        for (unsigned i = 0; i < count; i++)
+        {
+            MarkovTransition *transition = machines[i]->findTransition();
+            chosen[i] = transition;
+            if (actions) actions[i] = NULL;
+            if (!transition) continue;
+            fired++;
+
+            // Neighbouring machines often fire the same transition,
+            // so try the last one first.
+            if (g >= transitions.size() || transitions[g] != transition)
+            {
+                for (g = 0; g < transitions.size(); g++)
+                {
+                    if (transitions[g] == transition) break;
+                }
+                if (g == transitions.size())
+                {
+                    transitions.push_back(transition);
+                    starts.push_back(0);
+                }
+            }
+            groupOf[i] = g;
+            starts[g]++;
+        }
+        if (fired == 0) return 0;
+
+        // Turn the counts into starting positions, and group the
+        // machines by transition.
+        unsigned groups = (unsigned)transitions.size();
+        unsigned total = 0;
+        for (g = 0; g < groups; g++)
+        {
+            unsigned size = starts[g];
+            starts[g] = total;
+            total += size;
+        }
+        starts.push_back(total);
+
+        next.assign(starts.begin(), starts.end());
+        order.resize(fired);
+        for (unsigned i = 0; i < count; i++)
+        {
+            if (chosen[i]) order[next[groupOf[i]]++] = i;
+        }
+
+        for (g = 0; g < groups; g++)
+        {
+            applyGroup(machines, transitions[g],
+                       &order[starts[g]], starts[g+1] - starts[g]);
+        }
+
+        // Collect the actions in machine order.
+        for (unsigned i = 0; i < count; i++)
+        {
+            if (!chosen[i]) continue;
+            Action *result = machines[i]->finishTransition(chosen[i]);
+            if (actions) actions[i] = result;
+        }
+        return fired;
+    }
+
+    void MarkovBatch::applyGroup(MarkovStateMachine ** machines,
+                                 MarkovTransition * transition,
+                                 const unsigned * group, unsigned count)
+    {
+        real *matrix = transition->getMatrix();
+        unsigned size = machines[group[0]]->stateVectorSize;
+
+        // Machines of different sizes can't share a product, and
+        // nor can transitions without a dense matrix, so do them one
+        // at a time.
+        bool sameSize = true;
+        for (unsigned i = 1; i < count && sameSize; i++)
+        {
+            sameSize = machines[group[i]]->stateVectorSize == size;
+        }
+        if (!matrix || !sameSize || count == 1 || size == 0)
+        {
+            for (unsigned i = 0; i < count; i++)
+            {
+                MarkovStateMachine *machine = machines[group[i]];
+                if (machine->stateVectorSize == 0) continue;
+
+                if (results.size() < machine->stateVectorSize)
+                {
+                    results.resize(machine->stateVectorSize);
+                }
+                transition->applyTransition(machine->stateVector,
+                                            &results[0],
+                                            machine->stateVectorSize);
+                memcpy(machine->stateVector, &results[0],
+                       sizeof(real) * machine->stateVectorSize);
+            }
+            return;
+        }
+
+        // Gather the vectors, multiply, and scatter the results.
+        unsigned total = size * count;
+        if (gathered.size() < total) gathered.resize(total);
+        if (results.size() < total) results.resize(total);
+
+        for (unsigned i = 0; i < count; i++)
+        {
+            memcpy(&gathered[i * size], machines[group[i]]->stateVector,
+                   sizeof(real) * size);
+        }
+
+        multiplyMatrixVectors(matrix, &gathered[0], &results[0],
+                              size, count);
+
+        for (unsigned i = 0; i < count; i++)
+        {
+            memcpy(machines[group[i]]->stateVector, &results[i * size],
+                   sizeof(real) * size);
+        }
     }
 
 }; // end of namespace
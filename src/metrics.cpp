@@ -0,0 +1,350 @@
+/*
+ * Defines the classes used to count what the AI is doing.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <aicore/aicore.h>
+
+namespace aicore
+{
+    const unsigned Metrics::NONE;
+    const unsigned Metrics::MAX_COUNTERS;
+    const unsigned Metrics::MAX_HISTOGRAMS;
+    const unsigned Metrics::BUCKETS;
+
+    typedef std::atomic<unsigned long long> MetricsValue;
+
+    // Holds one thread's copy of a histogram.
+    struct MetricsHistogram
+    {
+        MetricsValue count;
+        MetricsValue sum;
+        MetricsValue buckets[Metrics::BUCKETS];
+    };
+
+    // Holds one thread's copy of every counter and histogram. Only
+    // the owning thread writes to the values, so they are atomic only
+    // so that other threads can read them while they change.
+    struct MetricsBlock
+    {
+        MetricsValue counters[Metrics::MAX_COUNTERS];
+        MetricsHistogram histograms[Metrics::MAX_HISTOGRAMS];
+        std::atomic<bool> inUse;
+    };
+
+    // Holds everything shared between threads. This is created the
+    // first time it is used, so metrics can be registered from static
+    // initialisers.
+    struct MetricsState
+    {
+        std::mutex lock;
+        std::vector<const char*> counterNames;
+        std::vector<const char*> histogramNames;
+        std::vector<MetricsBlock*> blocks;
+
+        // The totals at the last reset, which are taken off the
+        // totals reported.
+        unsigned long long counterBase[Metrics::MAX_COUNTERS];
+        Metrics::HistogramStats histogramBase[Metrics::MAX_HISTOGRAMS];
+
+        MetricsState()
+        {
+            memset(counterBase, 0, sizeof(counterBase));
+            memset(histogramBase, 0, sizeof(histogramBase));
+        }
+    };
+
+    static MetricsState& getState()
+    {
+        static MetricsState *state = new MetricsState();
+        return *state;
+    }
+
+    // Gives the thread's block back when the thread finishes, so a
+    // later thread can carry on adding to it.
+    struct MetricsBlockOwner
+    {
+        MetricsBlock *block;
+
+        MetricsBlockOwner() : block(NULL) {}
+        ~MetricsBlockOwner()
+        {
+            if (block) block->inUse.store(false, std::memory_order_release);
+        }
+    };
+
+    static thread_local MetricsBlockOwner localBlock;
+
+    static MetricsBlock* getLocalBlock()
+    {
+        if (localBlock.block) return localBlock.block;
+
+        MetricsState &state = getState();
+        std::lock_guard<std::mutex> guard(state.lock);
+
+        for (unsigned i = 0; i < state.blocks.size(); i++)
+        {
+            bool expected = false;
+            if (state.blocks[i]->inUse.compare_exchange_strong(
+                    expected, true, std::memory_order_acquire))
+            {
+                localBlock.block = state.blocks[i];
+                return localBlock.block;
+            }
+        }
+
+        MetricsBlock *block = new MetricsBlock;
+        for (unsigned c = 0; c < Metrics::MAX_COUNTERS; c++)
+        {
+            block->counters[c].store(0);
+        }
+        for (unsigned h = 0; h < Metrics::MAX_HISTOGRAMS; h++)
+        {
+            MetricsHistogram &histogram = block->histograms[h];
+            histogram.count.store(0);
+            histogram.sum.store(0);
+            for (unsigned b = 0; b < Metrics::BUCKETS; b++)
+            {
+                histogram.buckets[b].store(0);
+            }
+        }
+        block->inUse.store(true);
+        state.blocks.push_back(block);
+        localBlock.block = block;
+        return block;
+    }
+
+    // Adds to a value in the calling thread's block. As no other
+    // thread writes to it, a plain load and store is enough, with no
+    // locked instruction.
+    static inline void bump(MetricsValue &value, unsigned long long amount)
+    {
+        value.store(value.load(std::memory_order_relaxed) + amount,
+                    std::memory_order_relaxed);
+    }
+
+    // Returns the histogram bucket for the given value.
+    static unsigned getBucket(unsigned value)
+    {
+        if (value == 0) return 0;
+
+        unsigned bucket = 1;
+        if (value >= 1u << 16) { bucket += 16; value >>= 16; }
+        if (value >= 1u << 8) { bucket += 8; value >>= 8; }
+        if (value >= 1u << 4) { bucket += 4; value >>= 4; }
+        if (value >= 1u << 2) { bucket += 2; value >>= 2; }
+        if (value >= 1u << 1) { bucket += 1; }
+        return bucket;
+    }
+
+    // Finds a name in a list, adding it if there is room.
+    static unsigned registerName(std::vector<const char*> &names,
+                                 const char *name, unsigned limit)
+    {
+        for (unsigned i = 0; i < names.size(); i++)
+        {
+            if (strcmp(names[i], name) == 0) return i;
+        }
+        if (names.size() >= limit) return Metrics::NONE;
+
+        names.push_back(name);
+        return (unsigned)names.size() - 1;
+    }
+
+    unsigned Metrics::registerCounter(const char *name)
+    {
+        MetricsState &state = getState();
+        std::lock_guard<std::mutex> guard(state.lock);
+        return registerName(state.counterNames, name, MAX_COUNTERS);
+    }
+
+    unsigned Metrics::registerHistogram(const char *name)
+    {
+        MetricsState &state = getState();
+        std::lock_guard<std::mutex> guard(state.lock);
+        return registerName(state.histogramNames, name, MAX_HISTOGRAMS);
+    }
+
+    unsigned Metrics::getCounterCount()
+    {
+        MetricsState &state = getState();
+        std::lock_guard<std::mutex> guard(state.lock);
+        return (unsigned)state.counterNames.size();
+    }
+
+    unsigned Metrics::getHistogramCount()
+    {
+        MetricsState &state = getState();
+        std::lock_guard<std::mutex> guard(state.lock);
+        return (unsigned)state.histogramNames.size();
+    }
+
+    const char* Metrics::getCounterName(unsigned counter)
+    {
+        MetricsState &state = getState();
+        std::lock_guard<std::mutex> guard(state.lock);
+        return counter < state.counterNames.size() ?
+            state.counterNames[counter] : NULL;
+    }
+
+    void Metrics::add(unsigned counter, unsigned long long amount)
+    {
+        if (counter >= MAX_COUNTERS) return;
+        bump(getLocalBlock()->counters[counter], amount);
+    }
+
+    void Metrics::record(unsigned histogram, unsigned value,
+                         unsigned long long times)
+    {
+        if (histogram >= MAX_HISTOGRAMS || times == 0) return;
+
+        MetricsHistogram &local = getLocalBlock()->histograms[histogram];
+        bump(local.count, times);
+        bump(local.sum, (unsigned long long)value * times);
+        bump(local.buckets[getBucket(value)], times);
+    }
+
+    // Adds up a counter over every block. Called with the state locked.
+    static unsigned long long sumCounter(MetricsState &state,
+                                         unsigned counter)
+    {
+        unsigned long long total = 0;
+        for (unsigned b = 0; b < state.blocks.size(); b++)
+        {
+            total += state.blocks[b]->counters[counter].load(
+                std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    // Adds up a histogram over every block. Called with the state
+    // locked.
+    static Metrics::HistogramStats sumHistogram(MetricsState &state,
+                                                unsigned histogram)
+    {
+        Metrics::HistogramStats stats;
+        memset(&stats, 0, sizeof(stats));
+        for (unsigned b = 0; b < state.blocks.size(); b++)
+        {
+            const MetricsHistogram &local =
+                state.blocks[b]->histograms[histogram];
+            stats.count += local.count.load(std::memory_order_relaxed);
+            stats.sum += local.sum.load(std::memory_order_relaxed);
+            for (unsigned i = 0; i < Metrics::BUCKETS; i++)
+            {
+                stats.buckets[i] +=
+                    local.buckets[i].load(std::memory_order_relaxed);
+            }
+        }
+        return stats;
+    }
+
+    unsigned long long Metrics::getCounter(unsigned counter)
+    {
+        if (counter >= MAX_COUNTERS) return 0;
+
+        MetricsState &state = getState();
+        std::lock_guard<std::mutex> guard(state.lock);
+        return sumCounter(state, counter) - state.counterBase[counter];
+    }
+
+    Metrics::HistogramStats Metrics::getHistogram(unsigned histogram)
+    {
+        HistogramStats stats;
+        memset(&stats, 0, sizeof(stats));
+        if (histogram >= MAX_HISTOGRAMS) return stats;
+
+        MetricsState &state = getState();
+        std::lock_guard<std::mutex> guard(state.lock);
+        stats = sumHistogram(state, histogram);
+
+        const HistogramStats &base = state.histogramBase[histogram];
+        stats.count -= base.count;
+        stats.sum -= base.sum;
+        for (unsigned i = 0; i < BUCKETS; i++)
+        {
+            stats.buckets[i] -= base.buckets[i];
+        }
+        stats.name = histogram < state.histogramNames.size() ?
+            state.histogramNames[histogram] : NULL;
+        return stats;
+    }
+
+    void Metrics::reset()
+    {
+        // The threads' values can't be cleared while they might be
+        // adding to them, so the totals so far are remembered and
+        // taken off instead.
+        MetricsState &state = getState();
+        std::lock_guard<std::mutex> guard(state.lock);
+        for (unsigned c = 0; c < MAX_COUNTERS; c++)
+        {
+            state.counterBase[c] = sumCounter(state, c);
+        }
+        for (unsigned h = 0; h < MAX_HISTOGRAMS; h++)
+        {
+            state.histogramBase[h] = sumHistogram(state, h);
+        }
+    }
+
+    double Metrics::HistogramStats::getMean() const
+    {
+        return count > 0 ? (double)sum / (double)count : 0.0;
+    }
+
+    unsigned long long Metrics::HistogramStats::getPercentile(
+        double fraction) const
+    {
+        if (count == 0) return 0;
+
+        double wanted = fraction * (double)count;
+        unsigned long long seen = 0;
+        for (unsigned b = 0; b < BUCKETS; b++)
+        {
+            seen += buckets[b];
+            if (buckets[b] > 0 && (double)seen >= wanted)
+            {
+                return b == 0 ? 0 : (1ull << b) - 1;
+            }
+        }
+        return (1ull << (BUCKETS - 1)) - 1;
+    }
+
+    void Metrics::report(FILE *file)
+    {
+        unsigned counters = getCounterCount();
+        fprintf(file, "%-32s %14s\n", "counter", "total");
+        for (unsigned c = 0; c < counters; c++)
+        {
+            // printf doesn't have to cope with null strings.
+            const char *name = getCounterName(c);
+            if (name == NULL) continue;
+            fprintf(file, "%-32s %14llu\n", name, getCounter(c));
+        }
+
+        unsigned histograms = getHistogramCount();
+        if (histograms == 0) return;
+
+        fprintf(file, "%-32s %14s %10s %10s %10s\n",
+                "histogram", "count", "mean", "p50", "p99");
+        for (unsigned h = 0; h < histograms; h++)
+        {
+            HistogramStats stats = getHistogram(h);
+            if (stats.name == NULL) continue;
+            fprintf(file, "%-32s %14llu %10.1f %10llu %10llu\n",
+                    stats.name, stats.count, stats.getMean(),
+                    stats.getPercentile(0.5), stats.getPercentile(0.99));
+        }
+    }
+
+}; // end of namespace
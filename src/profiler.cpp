@@ -0,0 +1,552 @@
+/*
+ * Defines the classes used to profile the AI each frame.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <aicore/aicore.h>
+
+namespace aicore
+{
+    const unsigned Profiler::NONE;
+    const unsigned Profiler::HISTORY;
+    const unsigned Profiler::BUFFER_SIZE;
+
+    // Holds one finished zone.
+    struct ProfileRecord
+    {
+        unsigned zone;
+        unsigned parent;
+        unsigned long start;
+        unsigned long duration;
+    };
+
+    // Holds the records made by one thread. Only the owning thread
+    // moves the head, and only endFrame moves the tail, so no lock is
+    // needed between them.
+    struct ProfileBuffer
+    {
+        ProfileRecord records[Profiler::BUFFER_SIZE];
+        std::atomic<unsigned> head;
+        std::atomic<unsigned> tail;
+        std::atomic<bool> inUse;
+    };
+
+    // Holds the statistics for one zone.
+    struct ProfileZoneRecord
+    {
+        const char *name;
+        unsigned parent;
+
+        // The totals for the frame being collected.
+        unsigned long frameTicks;
+        unsigned frameCalls;
+
+        // The totals for recent frames, as a ring.
+        unsigned long ticks[Profiler::HISTORY];
+        unsigned calls[Profiler::HISTORY];
+        unsigned frames;
+        unsigned next;
+    };
+
+    // Holds everything shared between threads. This is created the
+    // first time it is used, so zones can be registered from static
+    // initialisers.
+    struct ProfilerState
+    {
+        std::mutex lock;
+        std::vector<ProfileZoneRecord> zones;
+        std::vector<ProfileBuffer*> buffers;
+        std::atomic<unsigned long> dropped;
+
+        ProfilerState() : dropped(0) {}
+    };
+
+    static ProfilerState& getState()
+    {
+        static ProfilerState *state = new ProfilerState();
+        return *state;
+    }
+
+    // Holds one event waiting to be written to a trace.
+    struct TraceEvent
+    {
+        const char *name;
+        unsigned thread;
+        unsigned frame;
+        unsigned long start;
+        unsigned long duration;
+    };
+
+    // Holds the trace being written. The queue is guarded by the lock,
+    // the file is only used by the writer thread.
+    struct TraceState
+    {
+        std::mutex lock;
+        std::condition_variable wake;
+        std::vector<TraceEvent> pending;
+        std::thread writer;
+        std::atomic<bool> active;
+        bool stopping;
+        FILE *file;
+        unsigned maxEvents;
+        unsigned long dropped;
+
+        // The clock when the trace started, and at the last frame.
+        unsigned long origin;
+        unsigned long lastFrame;
+
+        TraceState() : active(false), stopping(false), file(NULL),
+                       maxEvents(0), dropped(0), origin(0), lastFrame(0) {}
+    };
+
+    static TraceState& getTraceState()
+    {
+        static TraceState *state = new TraceState();
+        return *state;
+    }
+
+    // Marks zone events, in place of a frame number.
+    static const unsigned TRACE_ZONE = 0xffffffff;
+
+    // Adds an event to the trace queue. Called with the trace locked.
+    static void queueTraceEvent(TraceState &trace, const char *name,
+                                unsigned thread, unsigned frame,
+                                unsigned long start, unsigned long duration)
+    {
+        if (trace.pending.size() >= trace.maxEvents)
+        {
+            trace.dropped++;
+            return;
+        }
+
+        TraceEvent event;
+        event.name = name;
+        event.thread = thread;
+        event.frame = frame;
+        event.start = start;
+        event.duration = duration;
+        trace.pending.push_back(event);
+    }
+
+    // Gives the thread's buffer back when the thread finishes, so a
+    // later thread can use it.
+    struct ProfileBufferOwner
+    {
+        ProfileBuffer *buffer;
+
+        ProfileBufferOwner() : buffer(NULL) {}
+        ~ProfileBufferOwner()
+        {
+            if (buffer) buffer->inUse.store(false, std::memory_order_release);
+        }
+    };
+
+    static thread_local ProfileBufferOwner localBuffer;
+    static thread_local unsigned currentZone = Profiler::NONE;
+
+    static ProfileBuffer* getLocalBuffer()
+    {
+        if (localBuffer.buffer) return localBuffer.buffer;
+
+        ProfilerState &state = getState();
+        std::lock_guard<std::mutex> guard(state.lock);
+
+        for (unsigned i = 0; i < state.buffers.size(); i++)
+        {
+            bool expected = false;
+            if (state.buffers[i]->inUse.compare_exchange_strong(
+                    expected, true, std::memory_order_acquire))
+            {
+                localBuffer.buffer = state.buffers[i];
+                return localBuffer.buffer;
+            }
+        }
+
+        ProfileBuffer *buffer = new ProfileBuffer;
+        buffer->head.store(0);
+        buffer->tail.store(0);
+        buffer->inUse.store(true);
+        state.buffers.push_back(buffer);
+        localBuffer.buffer = buffer;
+        return buffer;
+    }
+
+    unsigned Profiler::registerZone(const char *name)
+    {
+        ProfilerState &state = getState();
+        std::lock_guard<std::mutex> guard(state.lock);
+
+        for (unsigned i = 0; i < state.zones.size(); i++)
+        {
+            if (strcmp(state.zones[i].name, name) == 0) return i;
+        }
+
+        ProfileZoneRecord zone;
+        memset(&zone, 0, sizeof(zone));
+        zone.name = name;
+        zone.parent = NONE;
+        state.zones.push_back(zone);
+        return (unsigned)state.zones.size() - 1;
+    }
+
+    unsigned Profiler::getZoneCount()
+    {
+        ProfilerState &state = getState();
+        std::lock_guard<std::mutex> guard(state.lock);
+        return (unsigned)state.zones.size();
+    }
+
+    void Profiler::endFrame()
+    {
+        ProfilerState &state = getState();
+        std::lock_guard<std::mutex> guard(state.lock);
+
+        // Zones are copied to the trace as they are collected.
+        TraceState &trace = getTraceState();
+        std::unique_lock<std::mutex> traceLock(trace.lock, std::defer_lock);
+        bool tracing = trace.active.load(std::memory_order_acquire);
+        if (tracing)
+        {
+            traceLock.lock();
+
+            unsigned long now = TimingData::getClock();
+            unsigned frame = TimingData::isInitialised() ?
+                TimingData::get().frameNumber : 0;
+            queueTraceEvent(trace, NULL, 0, frame,
+                            trace.lastFrame, now - trace.lastFrame);
+            trace.lastFrame = now;
+        }
+
+        // Collect the records from every thread.
+        for (unsigned b = 0; b < state.buffers.size(); b++)
+        {
+            ProfileBuffer *buffer = state.buffers[b];
+            unsigned head = buffer->head.load(std::memory_order_acquire);
+            unsigned tail = buffer->tail.load(std::memory_order_relaxed);
+            for (; tail != head; tail++)
+            {
+                const ProfileRecord &record =
+                    buffer->records[tail % BUFFER_SIZE];
+                ProfileZoneRecord &zone = state.zones[record.zone];
+                zone.frameTicks += record.duration;
+                zone.frameCalls++;
+                zone.parent = record.parent;
+
+                if (tracing)
+                {
+                    queueTraceEvent(trace, zone.name, b, TRACE_ZONE,
+                                    record.start, record.duration);
+                }
+            }
+            buffer->tail.store(head, std::memory_order_release);
+        }
+
+        if (tracing)
+        {
+            traceLock.unlock();
+            trace.wake.notify_one();
+        }
+
+        // Then add the frame's totals to the history.
+        for (unsigned i = 0; i < state.zones.size(); i++)
+        {
+            ProfileZoneRecord &zone = state.zones[i];
+            if (zone.frameCalls == 0) continue;
+
+            zone.ticks[zone.next] = zone.frameTicks;
+            zone.calls[zone.next] = zone.frameCalls;
+            zone.next = (zone.next + 1) % HISTORY;
+            if (zone.frames < HISTORY) zone.frames++;
+
+            zone.frameTicks = 0;
+            zone.frameCalls = 0;
+        }
+    }
+
+    Profiler::ZoneStats Profiler::getStats(unsigned index)
+    {
+        ProfilerState &state = getState();
+        std::lock_guard<std::mutex> guard(state.lock);
+        const ProfileZoneRecord &zone = state.zones[index];
+
+        ZoneStats stats;
+        stats.name = zone.name;
+        stats.parent = zone.parent;
+        stats.frames = zone.frames;
+        stats.callsPerFrame = 0;
+        stats.minimum = stats.average = stats.maximum = stats.p99 = 0;
+        if (zone.frames == 0) return stats;
+
+        // The oldest frames are overwritten first, so the entries in
+        // use are always the first 'frames' in the ring.
+        unsigned long sorted[HISTORY];
+        unsigned long totalTicks = 0, totalCalls = 0;
+        for (unsigned i = 0; i < zone.frames; i++)
+        {
+            sorted[i] = zone.ticks[i];
+            totalTicks += zone.ticks[i];
+            totalCalls += zone.calls[i];
+        }
+
+        stats.callsPerFrame = (double)totalCalls / zone.frames;
+        stats.average = (double)totalTicks / zone.frames;
+        stats.minimum = (double)*std::min_element(sorted, sorted+zone.frames);
+        stats.maximum = (double)*std::max_element(sorted, sorted+zone.frames);
+
+        unsigned rank = (zone.frames * 99 + 99) / 100 - 1;
+        std::nth_element(sorted, sorted+rank, sorted+zone.frames);
+        stats.p99 = (double)sorted[rank];
+        return stats;
+    }
+
+    unsigned long Profiler::getDroppedCount()
+    {
+        return getState().dropped.load(std::memory_order_relaxed);
+    }
+
+    void Profiler::reset()
+    {
+        ProfilerState &state = getState();
+        std::lock_guard<std::mutex> guard(state.lock);
+
+        for (unsigned b = 0; b < state.buffers.size(); b++)
+        {
+            ProfileBuffer *buffer = state.buffers[b];
+            buffer->tail.store(buffer->head.load(std::memory_order_acquire),
+                               std::memory_order_release);
+        }
+        for (unsigned i = 0; i < state.zones.size(); i++)
+        {
+            ProfileZoneRecord &zone = state.zones[i];
+            zone.parent = NONE;
+            zone.frameTicks = 0;
+            zone.frameCalls = 0;
+            zone.frames = 0;
+            zone.next = 0;
+        }
+        state.dropped.store(0);
+    }
+
+    // Writes the zones entered from the given one, then their own
+    // nested zones.
+    static void reportNested(FILE *file,
+                             const std::vector<Profiler::ZoneStats> &stats,
+                             std::vector<bool> &written,
+                             unsigned parent, unsigned depth,
+                             double micros)
+    {
+        for (unsigned i = 0; i < stats.size(); i++)
+        {
+            if (written[i] || stats[i].parent != parent) continue;
+            if (stats[i].frames == 0) continue;
+            written[i] = true;
+
+            fprintf(file, "%*s%-*s %8.1f %10.1f %10.1f %10.1f %10.1f\n",
+                    depth*2, "", 32 - depth*2, stats[i].name,
+                    stats[i].callsPerFrame, stats[i].minimum * micros,
+                    stats[i].average * micros, stats[i].maximum * micros,
+                    stats[i].p99 * micros);
+            reportNested(file, stats, written, i, depth+1, micros);
+        }
+    }
+
+    void Profiler::report(FILE *file)
+    {
+        std::vector<ZoneStats> stats;
+        unsigned count = getZoneCount();
+        for (unsigned i = 0; i < count; i++) stats.push_back(getStats(i));
+
+        fprintf(file, "%-32s %8s %10s %10s %10s %10s\n",
+                "zone (us per frame)", "calls", "min", "avg", "max", "p99");
+
+        double micros = 1.0e6 / TimingData::getClockFrequency();
+        std::vector<bool> written(count, false);
+        reportNested(file, stats, written, NONE, 0, micros);
+
+        // Zones whose parent has no statistics, or that only appear
+        // inside each other, are written at the top level.
+        for (unsigned i = 0; i < count; i++)
+        {
+            if (written[i] || stats[i].frames == 0) continue;
+            unsigned parent = stats[i].parent;
+            stats[i].parent = NONE;
+            reportNested(file, stats, written, NONE, 0, micros);
+            stats[i].parent = parent;
+        }
+
+        unsigned long dropped = getDroppedCount();
+        if (dropped) fprintf(file, "(%lu records dropped)\n", dropped);
+    }
+
+    // Writes a string as a JSON string.
+    static void writeTraceString(FILE *file, const char *text)
+    {
+        fputc('"', file);
+        for (; *text; text++)
+        {
+            if (*text == '"' || *text == '\\') fputc('\\', file);
+            if ((unsigned char)*text >= ' ') fputc(*text, file);
+        }
+        fputc('"', file);
+    }
+
+    // Runs in the background, writing events until the trace stops.
+    static void runTraceWriter()
+    {
+        TraceState &trace = getTraceState();
+        double micros = 1.0e6 / TimingData::getClockFrequency();
+        bool first = true;
+
+        fprintf(trace.file, "{\"traceEvents\":[\n");
+
+        std::vector<TraceEvent> batch;
+        std::unique_lock<std::mutex> lock(trace.lock);
+        for (;;)
+        {
+            while (!trace.stopping && trace.pending.empty())
+            {
+                trace.wake.wait(lock);
+            }
+            bool finished = trace.stopping;
+            batch.swap(trace.pending);
+            unsigned long origin = trace.origin;
+            lock.unlock();
+
+            for (unsigned i = 0; i < batch.size(); i++)
+            {
+                const TraceEvent &event = batch[i];
+                double start = (double)(long long)(event.start - origin);
+
+                fprintf(trace.file, first ? "" : ",\n");
+                first = false;
+                fprintf(trace.file, "{\"name\":");
+                if (event.frame == TRACE_ZONE)
+                {
+                    writeTraceString(trace.file, event.name);
+                    fprintf(trace.file, ",\"cat\":\"zone\"");
+                }
+                else
+                {
+                    fprintf(trace.file, "\"frame\",\"cat\":\"frame\","
+                            "\"args\":{\"frame\":%u}", event.frame);
+                }
+                fprintf(trace.file,
+                        ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                        "\"ts\":%.3f,\"dur\":%.3f}",
+                        event.thread, start * micros,
+                        (double)event.duration * micros);
+            }
+            batch.clear();
+
+            lock.lock();
+            if (finished && trace.pending.empty()) break;
+        }
+        lock.unlock();
+
+        fprintf(trace.file, "\n]}\n");
+    }
+
+    bool ProfileTrace::start(const char *filename, unsigned maxEvents)
+    {
+        stop();
+
+        FILE *file = fopen(filename, "w");
+        if (!file) return false;
+
+        // Make sure the clock is calibrated before timing starts.
+        TimingData::getClockFrequency();
+
+        ProfilerState &state = getState();
+        std::lock_guard<std::mutex> guard(state.lock);
+        TraceState &trace = getTraceState();
+        {
+            std::lock_guard<std::mutex> traceGuard(trace.lock);
+            trace.file = file;
+            trace.maxEvents = maxEvents;
+            trace.dropped = 0;
+            trace.stopping = false;
+            trace.pending.clear();
+            trace.origin = trace.lastFrame = TimingData::getClock();
+        }
+        trace.writer = std::thread(runTraceWriter);
+        trace.active.store(true, std::memory_order_release);
+        return true;
+    }
+
+    void ProfileTrace::stop()
+    {
+        // Holding the profiler's lock means endFrame isn't adding
+        // events while the trace stops.
+        ProfilerState &state = getState();
+        std::lock_guard<std::mutex> guard(state.lock);
+        TraceState &trace = getTraceState();
+        if (!trace.active.load(std::memory_order_acquire)) return;
+        trace.active.store(false, std::memory_order_release);
+
+        {
+            std::lock_guard<std::mutex> traceGuard(trace.lock);
+            trace.stopping = true;
+        }
+        trace.wake.notify_one();
+        trace.writer.join();
+
+        fclose(trace.file);
+        trace.file = NULL;
+    }
+
+    bool ProfileTrace::isActive()
+    {
+        return getTraceState().active.load(std::memory_order_acquire);
+    }
+
+    unsigned long ProfileTrace::getDroppedCount()
+    {
+        TraceState &trace = getTraceState();
+        std::lock_guard<std::mutex> guard(trace.lock);
+        return trace.dropped;
+    }
+
+    ProfileScope::ProfileScope(unsigned zone)
+        :
+        zone(zone), parent(currentZone)
+    {
+        currentZone = zone;
+        start = TimingData::getClock();
+    }
+
+    ProfileScope::~ProfileScope()
+    {
+        unsigned long end = TimingData::getClock();
+        currentZone = parent;
+
+        ProfileBuffer *buffer = getLocalBuffer();
+        unsigned head = buffer->head.load(std::memory_order_relaxed);
+        unsigned tail = buffer->tail.load(std::memory_order_acquire);
+        if (head - tail >= Profiler::BUFFER_SIZE)
+        {
+            getState().dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        ProfileRecord &record = buffer->records[head % Profiler::BUFFER_SIZE];
+        record.zone = zone;
+        record.parent = parent;
+        record.start = start;
+        record.duration = end - start;
+        buffer->head.store(head + 1, std::memory_order_release);
+    }
+
+}; // end of namespace
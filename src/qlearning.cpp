@@ -9,27 +9,144 @@
  * implies agreement with all terms and conditions of the accompanying
  * software licence.
  */
+#include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
+#include <chrono>
 #include <aicore/aicore.h>
 
 namespace aicore
 {
+    /** The version of the snapshot format written by this code. */
+    static const unsigned SNAPSHOT_VERSION = 1;
 
     QLearner::QLearner(LearningProblem * problem,
                        real alpha, real gamma, real rho, real nu)
             :
-            problem(problem), alpha(alpha), gamma(gamma), rho(rho), nu(nu)
+            ownsValues(true),
+            replayCount(0), replayNext(0), replayPending(0),
+            replayInterval(0), replaySamples(0),
+            problem(problem), alpha(alpha), gamma(gamma), rho(rho), nu(nu),
+            qFloor(0), random(NULL)
     {
         stride = problem->getActionCount();
         unsigned size = problem->getStateCount() * stride;
         qvalues = new real[size];
         memset(qvalues, 0, sizeof(real) * size);
+
+        maskWords = (stride + 31) / 32;
+        refreshValidActions();
+    }
+
+    void QLearner::refreshValidActions()
+    {
+        unsigned states = problem->getStateCount();
+        validActions.assign(states * maskWords, 0);
+
+        for (unsigned s = 0; s < states; s++)
+        {
+            uint32_t *mask = &validActions[s * maskWords];
+            LearningProblemAction *action =
+                problem->getActions(problem->getState(s));
+            while (action != NULL)
+            {
+                mask[action->index >> 5] |= 1u << (action->index & 31);
+                action = action->next;
+            }
+        }
     }
 
     QLearner::~QLearner()
     {
-        delete[] qvalues;
+        if (ownsValues) delete[] qvalues;
+    }
+
+    void QLearner::write(std::vector<char> *buffer) const
+    {
+        SnapshotHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "AIQT", 4);
+        header.version = SNAPSHOT_VERSION;
+        header.realSize = sizeof(real);
+        header.stateCount = problem->getStateCount();
+        header.stride = stride;
+        header.alpha = alpha;
+        header.gamma = gamma;
+        header.rho = rho;
+        header.nu = nu;
+
+        size_t tableSize = (size_t)header.stateCount * stride * sizeof(real);
+        buffer->resize(sizeof(SnapshotHeader) + tableSize);
+        memcpy(&(*buffer)[0], &header, sizeof(SnapshotHeader));
+        if (tableSize > 0)
+        {
+            memcpy(&(*buffer)[sizeof(SnapshotHeader)], qvalues, tableSize);
+        }
+    }
+
+    bool QLearner::save(const char *filename) const
+    {
+        std::vector<char> buffer;
+        write(&buffer);
+
+        FILE *file = fopen(filename, "wb");
+        if (!file) return false;
+        bool ok = fwrite(&buffer[0], 1, buffer.size(), file) == buffer.size();
+        ok = fclose(file) == 0 && ok;
+        return ok;
+    }
+
+    const real* QLearner::readSnapshot(const void *data, size_t size)
+    {
+        if (!data || size < sizeof(SnapshotHeader)) return 0;
+        const SnapshotHeader *header = (const SnapshotHeader*)data;
+        if (memcmp(header->magic, "AIQT", 4) != 0 ||
+            header->version != SNAPSHOT_VERSION ||
+            header->realSize != sizeof(real) ||
+            header->stateCount != problem->getStateCount() ||
+            header->stride != stride)
+        {
+            return 0;
+        }
+
+        size_t tableSize = (size_t)header->stateCount * stride * sizeof(real);
+        if (size - sizeof(SnapshotHeader) < tableSize) return 0;
+
+        alpha = (real)header->alpha;
+        gamma = (real)header->gamma;
+        rho = (real)header->rho;
+        nu = (real)header->nu;
+        return (const real*)(header + 1);
+    }
+
+    bool QLearner::load(const char *filename)
+    {
+        MappedFile file;
+        if (!file.open(filename)) return false;
+
+        const real *values = readSnapshot(file.getData(), file.getSize());
+        if (!values) return false;
+
+        if (!ownsValues)
+        {
+            qvalues = new real[problem->getStateCount() * stride];
+            ownsValues = true;
+        }
+        memcpy(qvalues, values,
+               sizeof(real) * problem->getStateCount() * stride);
+        return true;
+    }
+
+    bool QLearner::attach(const void *data, size_t size)
+    {
+        const real *values = readSnapshot(data, size);
+        if (!values) return false;
+
+        if (ownsValues) delete[] qvalues;
+        qvalues = const_cast<real*>(values);
+        ownsValues = false;
+        return true;
     }
 
     real QLearner::getQValue(LearningProblemState *state,
@@ -47,54 +164,51 @@ namespace aicore
 
     real QLearner::getBestQValue(LearningProblemState *state)
     {
-        real best = (real)0;
-        for (unsigned i = 0; i < stride; i++)
-        {
-            real q = qvalues[state->index*stride + i];
-            if (q > best) best = q;
-        }
-        return best;
+        // A state with no valid actions ends the episode, so there
+        // is nothing more to come from it. The floor only limits the
+        // value of actions, so it doesn't apply.
+        if (maskWords == 0) return 0;
+
+        real best;
+        unsigned index = argmaxMasked(qvalues + state->index*stride,
+                                      &validActions[state->index*maskWords],
+                                      stride, &best);
+        if (index >= stride) return 0;
+        return (best > qFloor) ? best : qFloor;
     }
 
     LearningProblemAction*
     QLearner::getBestAction(LearningProblemState *state)
     {
-        // Get the actions
-        LearningProblemAction* action = problem->getActions(state);
+        if (maskWords == 0) return NULL;
 
-        // Check them in turn
-        real best = (real)0;
-        LearningProblemAction * bestAction = action;
-        while (action != NULL)
-        {
-            real q = getQValue(state, action);
-            if (q > best) {
-                best = q;
-                bestAction = action;
-            }
-
-            action = action->next;
-        }
+        unsigned index = argmaxMasked(qvalues + state->index*stride,
+                                      &validActions[state->index*maskWords],
+                                      stride, NULL);
+        if (index >= stride) return NULL;
+        return problem->getAction(state, index);
+    }
 
-        return bestAction;
+    LearningProblemAction*
+    QLearner::getRandomAction(LearningProblemState *state)
+    {
+        unsigned count = problem->getValidActionCount(state);
+        if (count == 0) return NULL;
+        return problem->getValidAction(state, getRandom().randomInt(count));
     }
 
     LearningProblemState*
     QLearner::doLearningIteration(LearningProblemState * state)
     {
         // Pick a new state once in a while
-        if (randomReal() < nu) {
+        if (getRandom().randomReal() < nu) {
             state = problem->getRandomState();
         }
 
-        // Get the list of actions
-        LearningProblemAction* actions = problem->getActions(state);
-        LearningProblemAction* action = NULL;
-
         // Check if we should use a random action, or the best one
-        if (randomReal() < rho) {
-            unsigned randPos = randomInt(actions->getCount());
-            action = actions->getAtPositionInList(randPos);
+        LearningProblemAction* action = NULL;
+        if (getRandom().randomReal() < rho) {
+            action = getRandomAction(state);
         } else {
             action = getBestAction(state);
         }
@@ -103,22 +217,26 @@ namespace aicore
         if (action != NULL)
         {
             // Carry out the action
-            LearningProblemActionResult result =
-                problem->getResult(state, action);
-
-            // Get the current q value
-            real q = getQValue(state, action);
-
-            // Get the q of the best action from the new state
-            real maxQ = getBestQValue(result.state);
+            Transition transition;
+            transition.state = state;
+            transition.action = action;
+            transition.result = problem->getResult(state, action);
 
-            // recalculate the q
-            q = ((real)1.0-alpha) * q + alpha * (result.reward + gamma * maxQ);
-
-            // Store the new Q value
-            storeQValue(state, action, q);
+            if (replayBuffer.empty())
+            {
+                updateQValue(transition);
+            }
+            else
+            {
+                // Keep the transition, and replay a batch once
+                // enough new ones have built up.
+                replayBuffer[replayNext] = transition;
+                replayNext = (replayNext + 1) % replayBuffer.size();
+                if (replayCount < replayBuffer.size()) replayCount++;
+                if (++replayPending >= replayInterval) replay();
+            }
 
-            return result.state;
+            return transition.result.state;
         }
         // Otherwise we need to get a new state - we've reached the
         // end of the road.
@@ -128,8 +246,70 @@ namespace aicore
         }
     }
 
+    void QLearner::updateQValue(const Transition &transition)
+    {
+        // Get the current q value
+        real q = getQValue(transition.state, transition.action);
+
+        // Get the q of the best action from the new state
+        real maxQ = getBestQValue(transition.result.state);
+
+        // recalculate the q
+        q = ((real)1.0-alpha) * q +
+            alpha * (transition.result.reward + gamma * maxQ);
+
+        // Store the new Q value
+        storeQValue(transition.state, transition.action, q);
+    }
+
+    bool QLearner::transitionBefore(const Transition &one,
+                                    const Transition &two)
+    {
+        if (one.state->index != two.state->index)
+        {
+            return one.state->index < two.state->index;
+        }
+        return one.action->index < two.action->index;
+    }
+
+    void QLearner::setReplay(unsigned capacity, unsigned interval,
+                             unsigned samples)
+    {
+        replayBuffer.assign(capacity, Transition());
+        replayCount = 0;
+        replayNext = 0;
+        replayPending = 0;
+        replayInterval = interval > 0 ? interval : 1;
+        replaySamples = samples > 0 ? samples : 1;
+        replayBatch.clear();
+        replayBatch.reserve(replaySamples);
+    }
+
+    void QLearner::replay()
+    {
+        replayPending = 0;
+        if (replayCount == 0) return;
+
+        // Sample the batch, then sort it so the updates walk through
+        // the table in order.
+        replayBatch.clear();
+        for (unsigned i = 0; i < replaySamples; i++)
+        {
+            replayBatch.push_back(
+                replayBuffer[getRandom().randomInt(replayCount)]);
+        }
+        std::sort(replayBatch.begin(), replayBatch.end(), transitionBefore);
+
+        for (unsigned i = 0; i < replayBatch.size(); i++)
+        {
+            updateQValue(replayBatch[i]);
+        }
+    }
+
     void QLearner::learn(unsigned iterations)
     {
+        assert(ownsValues);
+
         // We choose a random place to start
         LearningProblemState * state = problem->getInitialState();
 
@@ -138,6 +318,195 @@ namespace aicore
         {
             state = doLearningIteration(state);
         }
+
+        // Make sure the last transitions are learned from.
+        if (replayPending > 0) replay();
+        AICORE_LIBRARY_COUNT("QLearner updates", iterations);
+    }
+
+    ParallelQLearner::ParallelQLearner(LearningProblem * problem,
+                                       real alpha, real gamma,
+                                       real rho, real nu,
+                                       unsigned threads)
+            :
+            QLearner(problem, alpha, gamma, rho, nu),
+            jobs(threads),
+            lastIterations(0),
+            lastSeconds(0)
+    {
+    }
+
+    void ParallelQLearner::WalkTask::run(unsigned begin, unsigned end,
+                                         unsigned /*worker*/)
+    {
+        for (unsigned walk = begin; walk < end; walk++)
+        {
+            // Share out the iterations, giving any left over to the
+            // first walks.
+            unsigned count = iterations / walks;
+            if (walk < iterations % walks) count++;
+
+            LearningProblemState * state = learner->problem->getInitialState();
+            for (unsigned i = 0; i < count; i++)
+            {
+                state = learner->doLearningIteration(state);
+            }
+        }
+    }
+
+    void ParallelQLearner::learn(unsigned iterations)
+    {
+        // The walks share the table in whatever order the threads
+        // get to it, so parallel learning is never repeatable, and
+        // they can't share one engine.
+        assert(!isReadOnly() && !isReplaying() && random == NULL);
+
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point start = Clock::now();
+
+        WalkTask task;
+        task.learner = this;
+        task.iterations = iterations;
+        task.walks = jobs.getWorkerCount();
+        jobs.parallelFor(&task, task.walks, 1);
+
+        lastSeconds = std::chrono::duration<double>(
+            Clock::now() - start).count();
+        lastIterations = iterations;
+        AICORE_LIBRARY_COUNT("QLearner updates", iterations);
+    }
+
+    double ParallelQLearner::getIterationsPerSecond() const
+    {
+        if (lastSeconds <= 0) return 0;
+        return (double)lastIterations / lastSeconds;
+    }
+
+    const unsigned TraceQLearner::NO_TRACE;
+
+    TraceQLearner::TraceQLearner(LearningProblem * problem,
+                                 real alpha, real gamma, real rho, real nu,
+                                 real lambda, Method method)
+            :
+            QLearner(problem, alpha, gamma, rho, nu),
+            method(method), lambda(lambda), traceThreshold((real)0.001)
+    {
+        traceSlot.assign(problem->getStateCount() * stride, NO_TRACE);
+    }
+
+    void TraceQLearner::clearTraces()
+    {
+        for (unsigned i = 0; i < traceEntries.size(); i++)
+        {
+            traceSlot[traceEntries[i]] = NO_TRACE;
+        }
+        traceEntries.clear();
+        traceValues.clear();
+    }
+
+    LearningProblemAction*
+    TraceQLearner::chooseAction(LearningProblemState *state, bool *greedy)
+    {
+        LearningProblemAction *best = getBestAction(state);
+        LearningProblemAction *action = best;
+        if (getRandom().randomReal() < rho) action = getRandomAction(state);
+
+        // A random choice that happens to be as good as the best
+        // still counts as greedy.
+        *greedy = action == best ||
+            (action && getQValue(state, action) >= getQValue(state, best));
+        return action;
+    }
+
+    void TraceQLearner::learn(unsigned iterations)
+    {
+        assert(!isReadOnly());
+        clearTraces();
+
+        bool greedy;
+        LearningProblemState *state = problem->getInitialState();
+        LearningProblemAction *action = chooseAction(state, &greedy);
+
+        for (unsigned i = 0; i < iterations; i++)
+        {
+            // Pick a new state once in a while, or when we've reached
+            // the end of the road, starting a new episode.
+            if (action == NULL || getRandom().randomReal() < nu)
+            {
+                clearTraces();
+                state = problem->getRandomState();
+                action = chooseAction(state, &greedy);
+                if (action == NULL) continue;
+            }
+
+            // Carry out the action, and choose the next one
+            LearningProblemActionResult result =
+                problem->getResult(state, action);
+            LearningProblemAction *nextAction =
+                chooseAction(result.state, &greedy);
+
+            // Work out the error in the value of this action
+            real target;
+            if (method == SARSA && nextAction != NULL)
+            {
+                target = getQValue(result.state, nextAction);
+            }
+            else
+            {
+                target = getBestQValue(result.state);
+            }
+            real error = result.reward + gamma * target -
+                getQValue(state, action);
+
+            // Mark this action as fully eligible (replacing any trace
+            // it already has).
+            unsigned entry = state->index*stride + action->index;
+            if (traceSlot[entry] == NO_TRACE)
+            {
+                traceSlot[entry] = (unsigned)traceEntries.size();
+                traceEntries.push_back(entry);
+                traceValues.push_back((real)1);
+            }
+            else
+            {
+                traceValues[traceSlot[entry]] = (real)1;
+            }
+
+            // Update every eligible action, fading the traces and
+            // dropping any that become too small.
+            real step = alpha * error;
+            real fade = gamma * lambda;
+            for (unsigned t = 0; t < traceEntries.size(); )
+            {
+                qvalues[traceEntries[t]] += step * traceValues[t];
+                traceValues[t] *= fade;
+
+                if (traceValues[t] < traceThreshold)
+                {
+                    traceSlot[traceEntries[t]] = NO_TRACE;
+                    unsigned last = (unsigned)traceEntries.size() - 1;
+                    if (t != last)
+                    {
+                        traceEntries[t] = traceEntries[last];
+                        traceValues[t] = traceValues[last];
+                        traceSlot[traceEntries[t]] = t;
+                    }
+                    traceEntries.pop_back();
+                    traceValues.pop_back();
+                }
+                else
+                {
+                    t++;
+                }
+            }
+
+            // Q(lambda) can only pass values back along greedy paths.
+            if (method == WATKINS_Q && !greedy) clearTraces();
+
+            state = result.state;
+            action = nextAction;
+        }
+        AICORE_LIBRARY_COUNT("QLearner updates", iterations);
     }
 
 }; // end of namespace
@@ -0,0 +1,338 @@
+/*
+ * Defines the classes used for incremental rule matching.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <assert.h>
+#include <aicore/aicore.h>
+
+namespace aicore
+{
+    ReteNetwork::ReteNetwork()
+        :
+        firstDirty(0)
+    {
+    }
+
+    unsigned ReteNetwork::addRule(Rule *rule)
+    {
+        assert(rule && rule->ifClause);
+
+        RuleEntry entry;
+        entry.rule = rule;
+        entry.root = compile(rule->ifClause, true);
+
+        unsigned index = (unsigned)rules.size();
+        nodes[entry.root].rules.push_back(index);
+
+        // If the rule shares a node that has already been checked,
+        // then the node will only tell us when its result changes,
+        // so start from its current result.
+        entry.triggered = nodes[entry.root].value;
+        if (entry.triggered) triggered.push_back(rule);
+        rules.push_back(entry);
+        return index;
+    }
+
+    /**
+     * Adds the wildcards the given match can bind or depend on to the
+     * given list. Returns false if the match is of a type we can't
+     * see inside, so it may depend on any of them.
+     */
+    static bool collectWildcards(const Match *match, std::vector<id> &out)
+    {
+        switch (match->getMatchType())
+        {
+        case Match::MATCH_NODE:
+        {
+            const DataNodeMatch *node = (const DataNodeMatch*)match;
+            if (isWildcard(node->identifier)) out.push_back(node->identifier);
+
+            const DataGroupMatch *group =
+                dynamic_cast<const DataGroupMatch*>(node);
+            if (!group) return true;
+            for (const DataNodeMatch *child = group->firstChild;
+                 child; child = child->nextSibling)
+            {
+                if (!collectWildcards(child, out)) return false;
+            }
+            return true;
+        }
+
+        case Match::MATCH_AND:
+        {
+            const AndMatch *andMatch = (const AndMatch*)match;
+            return collectWildcards(andMatch->subMatches[0], out) &&
+                collectWildcards(andMatch->subMatches[1], out);
+        }
+
+        case Match::MATCH_OR:
+        {
+            const OrMatch *orMatch = (const OrMatch*)match;
+            return collectWildcards(orMatch->subMatches[0], out) &&
+                collectWildcards(orMatch->subMatches[1], out);
+        }
+
+        case Match::MATCH_NOT:
+            // Not-matches are checked without bindings, so they
+            // neither bind nor depend on anything.
+            return true;
+
+        default:
+            return false;
+        }
+    }
+
+    /**
+     * Returns true if the two matches could bind or depend on the
+     * same wildcard, so that checking one with bindings affects the
+     * result of the other.
+     */
+    static bool shareWildcards(const Match *one, const Match *two)
+    {
+        std::vector<id> first, second;
+        if (!collectWildcards(one, first)) return true;
+        if (!collectWildcards(two, second)) return true;
+
+        for (unsigned i = 0; i < first.size(); i++)
+        {
+            for (unsigned j = 0; j < second.size(); j++)
+            {
+                if (first[i] == second[j]) return true;
+            }
+        }
+        return false;
+    }
+
+    unsigned ReteNetwork::compile(Match *match, bool withBindings)
+    {
+        switch (match->getMatchType())
+        {
+        case Match::MATCH_NODE:
+            return addMatchNode(match,
+                !isWildcard(((DataNodeMatch*)match)->identifier),
+                withBindings);
+
+        case Match::MATCH_AND:
+        {
+            AndMatch *andMatch = (AndMatch*)match;
+            if (withBindings && shareWildcards(andMatch->subMatches[0],
+                                               andMatch->subMatches[1]))
+            {
+                return addMatchNode(match, false, withBindings);
+            }
+            unsigned one = compile(andMatch->subMatches[0], withBindings);
+            unsigned two = compile(andMatch->subMatches[1], withBindings);
+            return addBooleanNode(NODE_AND, one, two);
+        }
+
+        case Match::MATCH_OR:
+        {
+            // With bindings both sides of an or-match are checked, so
+            // the second sees what the first bound.
+            OrMatch *orMatch = (OrMatch*)match;
+            if (withBindings && shareWildcards(orMatch->subMatches[0],
+                                               orMatch->subMatches[1]))
+            {
+                return addMatchNode(match, false, withBindings);
+            }
+            unsigned one = compile(orMatch->subMatches[0], withBindings);
+            unsigned two = compile(orMatch->subMatches[1], withBindings);
+            return addBooleanNode(NODE_OR, one, two);
+        }
+
+        case Match::MATCH_NOT:
+            return addBooleanNode(NODE_NOT,
+                compile(((NotMatch*)match)->match, false), 0);
+
+        default:
+            // We can't see inside this match, so it has to be
+            // checked whenever anything changes.
+            return addMatchNode(match, false, withBindings);
+        }
+    }
+
+    unsigned ReteNetwork::addMatchNode(Match *match, bool byIdentifier,
+                                       bool withBindings)
+    {
+        std::vector<unsigned> &candidates = byIdentifier ?
+            matchesById[((DataNodeMatch*)match)->identifier] :
+            matchesOnAnything;
+
+        // Look for a node that does the same work.
+        bool isNodeMatch = match->getMatchType() == Match::MATCH_NODE;
+        for (unsigned i = 0; i < candidates.size(); i++)
+        {
+            if (nodes[candidates[i]].withBindings != withBindings) continue;
+
+            Match *existing = nodes[candidates[i]].match;
+            if (existing == match) return candidates[i];
+
+            if (isNodeMatch &&
+                existing->getMatchType() == Match::MATCH_NODE &&
+                ((DataNodeMatch*)match)->isEquivalent(
+                    (DataNodeMatch*)existing))
+            {
+                return candidates[i];
+            }
+        }
+
+        Node node;
+        node.type = NODE_MATCH;
+        node.match = match;
+        node.withBindings = withBindings;
+        node.inputs[0] = node.inputs[1] = 0;
+        node.value = false;
+        node.dirty = false;
+
+        unsigned index = (unsigned)nodes.size();
+        nodes.push_back(node);
+        candidates.push_back(index);
+        markDirty(index);
+        return index;
+    }
+
+    unsigned ReteNetwork::addBooleanNode(NodeType type,
+                                         unsigned one, unsigned two)
+    {
+        // And and or don't care about the order of their inputs.
+        if (type != NODE_NOT && two < one)
+        {
+            unsigned swap = one; one = two; two = swap;
+        }
+
+        unsigned long long key =
+            ((unsigned long long)type << 62) |
+            ((unsigned long long)one << 31) |
+            (unsigned long long)two;
+        std::map<unsigned long long, unsigned>::iterator found =
+            booleans.find(key);
+        if (found != booleans.end()) return found->second;
+
+        Node node;
+        node.type = type;
+        node.match = 0;
+        node.withBindings = false;
+        node.inputs[0] = one;
+        node.inputs[1] = two;
+        node.value = false;
+        node.dirty = false;
+
+        unsigned index = (unsigned)nodes.size();
+        nodes.push_back(node);
+        nodes[one].outputs.push_back(index);
+        if (type != NODE_NOT) nodes[two].outputs.push_back(index);
+        booleans[key] = index;
+        markDirty(index);
+        return index;
+    }
+
+    void ReteNetwork::markDirty(unsigned node)
+    {
+        nodes[node].dirty = true;
+        if (node < firstDirty) firstDirty = node;
+    }
+
+    void ReteNetwork::markChanged(id identifier)
+    {
+        std::map<id, std::vector<unsigned> >::iterator found =
+            matchesById.find(identifier);
+        if (found != matchesById.end())
+        {
+            std::vector<unsigned> &affected = found->second;
+            for (unsigned i = 0; i < affected.size(); i++)
+            {
+                markDirty(affected[i]);
+            }
+        }
+
+        for (unsigned i = 0; i < matchesOnAnything.size(); i++)
+        {
+            markDirty(matchesOnAnything[i]);
+        }
+    }
+
+    void ReteNetwork::markAllChanged()
+    {
+        for (unsigned i = 0; i < nodes.size(); i++)
+        {
+            if (nodes[i].type == NODE_MATCH) markDirty(i);
+        }
+    }
+
+    unsigned ReteNetwork::update(const Database *database)
+    {
+        AICORE_PROFILE_LIBRARY_ZONE("ReteNetwork");
+
+        unsigned changed = 0;
+        unsigned count = (unsigned)nodes.size();
+
+        // Inputs always come before their outputs, so one pass in
+        // order is enough to settle the network.
+        for (unsigned i = firstDirty; i < count; i++)
+        {
+            Node &node = nodes[i];
+            if (!node.dirty) continue;
+            node.dirty = false;
+
+            bool value;
+            switch (node.type)
+            {
+            case NODE_MATCH:
+                if (node.withBindings)
+                {
+                    bindings.clear();
+                    value = node.match->matches(database, &bindings);
+                }
+                else
+                {
+                    value = node.match->matches(database, 0);
+                }
+                break;
+            case NODE_AND:
+                value = nodes[node.inputs[0]].value &&
+                    nodes[node.inputs[1]].value;
+                break;
+            case NODE_OR:
+                value = nodes[node.inputs[0]].value ||
+                    nodes[node.inputs[1]].value;
+                break;
+            default:
+                value = !nodes[node.inputs[0]].value;
+                break;
+            }
+
+            if (value == node.value) continue;
+            node.value = value;
+
+            for (unsigned j = 0; j < node.outputs.size(); j++)
+            {
+                nodes[node.outputs[j]].dirty = true;
+            }
+            for (unsigned j = 0; j < node.rules.size(); j++)
+            {
+                rules[node.rules[j]].triggered = value;
+                changed++;
+            }
+        }
+        firstDirty = count;
+        AICORE_LIBRARY_COUNT("ReteNetwork changes", changed);
+
+        if (changed > 0)
+        {
+            triggered.clear();
+            for (unsigned i = 0; i < rules.size(); i++)
+            {
+                if (rules[i].triggered) triggered.push_back(rules[i].rule);
+            }
+        }
+        return changed;
+    }
+
+}; // end of namespace
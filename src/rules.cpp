@@ -8,6 +8,7 @@
  * software licence.
  */
 #include <assert.h>
+#include <chrono>
 #include <aicore/aicore.h>
 
 namespace aicore
@@ -17,6 +18,219 @@ namespace aicore
         return identifier & 0x80000000;
     }
 
+    void DataBindings::add(id wildcard, const DataNode *node)
+    {
+        if (count == bindings.size()) bindings.push_back(DataBinding());
+        bindings[count].wildcard = wildcard;
+        bindings[count].node = node;
+        count++;
+    }
+
+    const DataNode* DataBindings::find(id wildcard) const
+    {
+        for (unsigned i = 0; i < count; i++)
+        {
+            if (bindings[i].wildcard == wildcard) return bindings[i].node;
+        }
+        return 0;
+    }
+
+    bool DataBindings::isConsistent(id wildcard, const DataNode *node) const
+    {
+        const DataNode *bound = find(wildcard);
+        return !bound || bound->identifier == node->identifier;
+    }
+
+    bool Rule::check(const Database *database)
+    {
+        bindings.clear();
+        return ifClause->matches(database, &bindings);
+    }
+
+    /**
+     * Tries the given rest of a match, which succeeds at once if
+     * there is nothing left to match.
+     */
+    static inline bool tryRest(const MatchContinuation *rest,
+                               DataBindings *bindings)
+    {
+        return !rest || rest->matchRest(bindings);
+    }
+
+    bool Match::matchesThen(const Database *database,
+                            DataBindings *bindings,
+                            const MatchContinuation *rest)
+    {
+        unsigned start = bindings ? bindings->mark() : 0;
+        if (!matches(database, bindings)) return false;
+        if (tryRest(rest, bindings)) return true;
+        if (bindings) bindings->rollback(start);
+        return false;
+    }
+
+    /**
+     * Marks a slot in a group's index where a node has been removed.
+     * Lookups have to carry on past these, but they can be reused
+     * when adding.
+     */
+    static DataNode indexTombstone;
+
+    unsigned DataGroup::indexSlot(id identifier) const
+    {
+        // Fibonacci hashing spreads runs of consecutive identifiers
+        // across the table. The table size is a power of two.
+        return (unsigned)((identifier * 2654435769u) & (index.size() - 1));
+    }
+
+    void DataGroup::indexInsert(DataNode *child)
+    {
+        unsigned mask = (unsigned)index.size() - 1;
+        unsigned slot = indexSlot(child->identifier);
+        while (index[slot] && index[slot] != &indexTombstone)
+        {
+            slot = (slot + 1) & mask;
+        }
+        if (!index[slot]) indexUsed++;
+        index[slot] = child;
+    }
+
+    void DataGroup::enableIndex()
+    {
+        rebuildIndex();
+    }
+
+    void DataGroup::rebuildIndex()
+    {
+        // Size the table for the children we have, with room to grow.
+        unsigned count = 0;
+        for (DataNode *node = firstChild; node; node = node->nextSibling)
+        {
+            count++;
+        }
+        unsigned size = 8;
+        while (size < count * 2) size <<= 1;
+
+        index.assign(size, (DataNode*)0);
+        indexUsed = 0;
+
+        // Insert in list order, so findChild returns the same node
+        // as a scan of the list would.
+        unsigned mask = size - 1;
+        for (DataNode *node = firstChild; node; node = node->nextSibling)
+        {
+            unsigned slot = indexSlot(node->identifier);
+            while (index[slot]) slot = (slot + 1) & mask;
+            index[slot] = node;
+            indexUsed++;
+        }
+    }
+
+    void DataGroup::disableIndex()
+    {
+        index.clear();
+        indexUsed = 0;
+    }
+
+    void DataGroup::addChild(DataNode *child)
+    {
+        assert(child);
+
+        child->nextSibling = firstChild;
+        firstChild = child;
+
+        if (hasIndex())
+        {
+            // The new child goes at the start of the list, so it has
+            // to be found before any others with the same identifier,
+            // which needs the table rebuilding. We also rebuild to
+            // keep the table under three quarters full, counting
+            // tombstones, so probe sequences stay short.
+            if ((indexUsed + 1) * 4 > index.size() * 3 ||
+                findChild(child->identifier))
+            {
+                rebuildIndex();
+            }
+            else
+            {
+                indexInsert(child);
+            }
+        }
+    }
+
+    bool DataGroup::removeChild(DataNode *child)
+    {
+        DataNode **link = &firstChild;
+        while (*link && *link != child) link = &(*link)->nextSibling;
+        if (!*link) return false;
+
+        *link = child->nextSibling;
+        child->nextSibling = 0;
+
+        if (hasIndex())
+        {
+            unsigned mask = (unsigned)index.size() - 1;
+            unsigned slot = indexSlot(child->identifier);
+            while (index[slot] != child) slot = (slot + 1) & mask;
+            index[slot] = &indexTombstone;
+        }
+        return true;
+    }
+
+    DataNode* DataGroup::findChild(id identifier) const
+    {
+        if (!hasIndex())
+        {
+            DataNode *node = firstChild;
+            while (node && node->identifier != identifier)
+            {
+                node = node->nextSibling;
+            }
+            return node;
+        }
+
+        unsigned mask = (unsigned)index.size() - 1;
+        for (unsigned slot = indexSlot(identifier); index[slot];
+             slot = (slot + 1) & mask)
+        {
+            DataNode *node = index[slot];
+            if (node != &indexTombstone && node->identifier == identifier)
+            {
+                return node;
+            }
+        }
+        return 0;
+    }
+
+    DataNode* DataGroup::findNextChild(const DataNode *child) const
+    {
+        if (!hasIndex())
+        {
+            DataNode *node = child->nextSibling;
+            while (node && node->identifier != child->identifier)
+            {
+                node = node->nextSibling;
+            }
+            return node;
+        }
+
+        // Find where the child is, then carry on along its probe
+        // sequence from there.
+        unsigned mask = (unsigned)index.size() - 1;
+        unsigned slot = indexSlot(child->identifier);
+        while (index[slot] != child) slot = (slot + 1) & mask;
+
+        for (slot = (slot + 1) & mask; index[slot]; slot = (slot + 1) & mask)
+        {
+            DataNode *node = index[slot];
+            if (node != &indexTombstone &&
+                node->identifier == child->identifier)
+            {
+                return node;
+            }
+        }
+        return 0;
+    }
+
     AndMatch::AndMatch(Match *one, Match *two)
     {
         subMatches[0] = one;
@@ -30,10 +244,46 @@ namespace aicore
     bool AndMatch::matches(const Database *database,
                            DataBindings *bindings)
     {
-        return
-            subMatches[0]->matches(database, bindings)
-            &&
-            subMatches[1]->matches(database, bindings);
+        if (!bindings)
+        {
+            return
+                subMatches[0]->matches(database, 0)
+                &&
+                subMatches[1]->matches(database, 0);
+        }
+
+        return matchesThen(database, bindings, 0);
+    }
+
+    /**
+     * The rest of an AndMatch once its first sub-match has matched:
+     * the second sub-match, then whatever follows the AndMatch.
+     */
+    struct AndMatchRest : public MatchContinuation
+    {
+        const Database *database;
+        Match *second;
+        const MatchContinuation *rest;
+
+        AndMatchRest(const Database *database, Match *second,
+                     const MatchContinuation *rest)
+            : database(database), second(second), rest(rest)
+        {}
+
+        virtual bool matchRest(DataBindings *bindings) const
+        {
+            return second->matchesThen(database, bindings, rest);
+        }
+    };
+
+    bool AndMatch::matchesThen(const Database *database,
+                               DataBindings *bindings,
+                               const MatchContinuation *rest)
+    {
+        // The first sub-match tries the second after each node it
+        // could match, and undoes its bindings if none work.
+        AndMatchRest second(database, subMatches[1], rest);
+        return subMatches[0]->matchesThen(database, bindings, &second);
     }
 
     OrMatch::OrMatch(Match *one, Match *two)
@@ -72,71 +322,207 @@ namespace aicore
     }
 
     bool NotMatch::matches(const Database *database,
-                           DataBindings *bindings)
+                           DataBindings * /*bindings*/)
     {
         return !match->matches(database, 0);
     }
 
 
+    DataNodeMatch::DataNodeMatch(id identifier)
+        :
+        identifier(identifier), nextSibling(0)
+    {
+    }
+
+    bool DataNodeMatch::isEquivalent(const DataNodeMatch *other) const
+    {
+        return other == this;
+    }
+
     bool DataNodeMatch::matches(const Database *database,
                             DataBindings *bindings)
     {
-        return matchesChildren((const DataGroup*)database, bindings);
+        return matchesChildrenThen((const DataGroup*)database, bindings, 0);
+    }
+
+    bool DataNodeMatch::matchesThen(const Database *database,
+                                    DataBindings *bindings,
+                                    const MatchContinuation *rest)
+    {
+        return matchesChildrenThen((const DataGroup*)database,
+                                   bindings, rest);
     }
 
     bool DataNodeMatch::matchesChildren(const DataGroup * group,
                                         DataBindings *bindings)
     {
+        return matchesChildrenThen(group, bindings, 0);
+    }
+
+    bool DataNodeMatch::matchesChildrenThen(const DataGroup * group,
+                                            DataBindings *bindings,
+                                            const MatchContinuation *rest)
+    {
+        // Without bindings, which node we match can't affect the
+        // rest, so the rest is only tried after the first.
+
+        // If we know what we're looking for we can use the index.
+        // That's either because we have a fixed identifier, or
+        // because we are a wildcard that has already been bound.
+        id lookup = identifier;
+        if (isWildcard(identifier) && bindings)
+        {
+            const DataNode *bound = bindings->find(identifier);
+            if (bound) lookup = bound->identifier;
+        }
+
+        if (group->hasIndex() && !isWildcard(lookup))
+        {
+            const DataNode * node = group->findChild(lookup);
+            while (node)
+            {
+                if (!bindings && matchesNode(node, 0)) return tryRest(rest, 0);
+                if (bindings && matchesNodeThen(node, bindings, rest)) return true;
+                node = group->findNextChild(node);
+            }
+            return false;
+        }
+
         const DataNode * node = group->firstChild;
         while (node)
         {
-            if (matchesNode(node, bindings)) return true;
+            if (!bindings && matchesNode(node, 0)) return tryRest(rest, 0);
+            if (bindings && matchesNodeThen(node, bindings, rest)) return true;
             node = node->nextSibling;
         }
 
         return false;
     }
 
-    bool DataGroupMatch::matchesNode(const DataNode * node,
-                                     DataBindings *bindings)
+    bool DataNodeMatch::matchesNodeThen(const DataNode * node,
+                                        DataBindings *bindings,
+                                        const MatchContinuation *rest)
     {
-        // Check we have a group
-        if (!node->isGroup()) return false;
+        unsigned start = bindings ? bindings->mark() : 0;
+        if (!matchesNode(node, bindings)) return false;
+        if (tryRest(rest, bindings)) return true;
+        if (bindings) bindings->rollback(start);
+        return false;
+    }
 
-        // Does the identifier match?
-        if (!isWildcard(identifier) && identifier != node->identifier) {
-            return false;
+    bool DataNodeMatch::bindIdentifier(const DataNode * node,
+                                       DataBindings *bindings) const
+    {
+        if (!isWildcard(identifier)) return identifier == node->identifier;
+
+        // Wildcards match anything, unless they've already been
+        // bound, in which case they have to match the same thing.
+        if (bindings)
+        {
+            if (!bindings->isConsistent(identifier, node)) return false;
+            if (!bindings->find(identifier)) bindings->add(identifier, node);
         }
+        return true;
+    }
+
+    DataGroupMatch::DataGroupMatch(id identifier)
+        :
+        DataNodeMatch(identifier), firstChild(0)
+    {
+    }
 
-        // Convert to a Data group object
-        DataGroup *group = (DataGroup*)node;
+    bool DataGroupMatch::isEquivalent(const DataNodeMatch *other) const
+    {
+        if (other == this) return true;
+
+        const DataGroupMatch *group =
+            dynamic_cast<const DataGroupMatch*>(other);
+        if (!group || group->identifier != identifier) return false;
 
-        // Check that all the matches children are present
-        DataNodeMatch * match = firstChild;
-        while (match)
+        // Walk both lists of children together.
+        const DataNodeMatch *mine = firstChild;
+        const DataNodeMatch *theirs = group->firstChild;
+        while (mine && theirs)
         {
-            if (!match->matchesChildren(group, bindings)) return false;
-            match = match->nextSibling;
+            if (!mine->isEquivalent(theirs)) return false;
+            mine = mine->nextSibling;
+            theirs = theirs->nextSibling;
         }
+        return mine == theirs;
+    }
+
+    bool DataGroupMatch::matchesNode(const DataNode * node,
+                                     DataBindings *bindings)
+    {
+        return matchesNodeThen(node, bindings, 0);
+    }
+
+    /**
+     * The rest of a DataGroupMatch once some of its children have
+     * matched in a group: the remaining children, in order, then
+     * whatever follows the group match.
+     */
+    struct GroupChildrenRest : public MatchContinuation
+    {
+        const DataGroup *group;
+        DataNodeMatch *child;
+        const MatchContinuation *rest;
 
-        // All our children find matches in the group.
+        GroupChildrenRest(const DataGroup *group, DataNodeMatch *child,
+                          const MatchContinuation *rest)
+            : group(group), child(child), rest(rest)
+        {}
 
-        // Do we need to add to the binding list?
-        if (bindings && isWildcard(identifier))
+        virtual bool matchRest(DataBindings *bindings) const
         {
-            // Add ourself to the bindings list.
+            if (!child) return tryRest(rest, bindings);
+            GroupChildrenRest others(group, child->nextSibling, rest);
+            return child->matchesChildrenThen(group, bindings, &others);
         }
-        return true;
+    };
+
+    bool DataGroupMatch::matchesNodeThen(const DataNode * node,
+                                         DataBindings *bindings,
+                                         const MatchContinuation *rest)
+    {
+        // Check we have a group
+        if (!node->isGroup()) return false;
+
+        // Does the identifier match? This binds us if we are a
+        // wildcard, so we have to undo that if the children fail.
+        unsigned start = bindings ? bindings->mark() : 0;
+        if (!bindIdentifier(node, bindings)) return false;
+
+        // Check that all the matches children are present, trying
+        // later children (and the rest) after each choice for
+        // earlier ones.
+        GroupChildrenRest children((const DataGroup*)node, firstChild, rest);
+        if (children.matchRest(bindings)) return true;
+
+        if (bindings) bindings->rollback(start);
+        return false;
     }
 
 
     template<typename T>
     RangeMatch<T>::RangeMatch(id identifier, T min, T max)
-            : identifier(identifier), min(min), max(max)
+            : DataNodeMatch(identifier), min(min), max(max)
     {
         assert(min <= max);
     }
 
+    template<typename T>
+    bool RangeMatch<T>::isEquivalent(const DataNodeMatch *other) const
+    {
+        if (other == this) return true;
+
+        const RangeMatch<T> *range =
+            dynamic_cast<const RangeMatch<T>*>(other);
+        return range &&
+            range->identifier == identifier &&
+            range->min == min && range->max == max;
+    }
+
     template<typename T>
     bool RangeMatch<T>::matchesNode(const DataNode *node,
                                     DataBindings *bindings)
@@ -152,21 +538,112 @@ namespace aicore
         // Convert to the appropriate type
         Datum<T> *datum = (Datum<T>*)node;
 
-        // Check if we're in bounds
+        // Check if we're in bounds, then bind the wildcard if needed.
         if (min <= datum->value && datum->value <= max)
         {
-            // Check if we need to add a binding
-            if (bindings && isWildcard(identifier))
-            {
-                // Add the bindings
-            }
-            return true;
+            return bindIdentifier(node, bindings);
         }
 
         // We're out of bounds
         return false;
     }
 
+    const unsigned RuleBasedSystem::NONE;
+
+    RuleBasedSystem::RuleBasedSystem(Strategy strategy)
+        :
+        cursor(0), best(NONE), triggeredCount(0), passes(0),
+        strategy(strategy), budget(0), random(0)
+    {
+    }
+
+    void RuleBasedSystem::addRule(Rule *rule, int priority)
+    {
+        assert(rule && rule->ifClause);
+
+        RuleEntry entry;
+        entry.rule = rule;
+        entry.priority = priority;
+        entry.lastFired = 0;
+        rules.push_back(entry);
+    }
+
+    void RuleBasedSystem::restart()
+    {
+        cursor = 0;
+        best = NONE;
+        triggeredCount = 0;
+    }
+
+    Rule* RuleBasedSystem::update(const Database *database)
+    {
+        AICORE_PROFILE_LIBRARY_ZONE("RuleBasedSystem");
+
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point deadline;
+        if (budget > 0)
+        {
+            deadline = Clock::now() + std::chrono::microseconds(budget);
+        }
+
+        unsigned count = (unsigned)rules.size();
+        while (cursor < count)
+        {
+            unsigned index = cursor++;
+            RuleEntry &entry = rules[index];
+
+            if (entry.rule->check(database))
+            {
+                triggeredCount++;
+
+                // Keep the best so far, rather than a list of the
+                // triggered rules, so the pass needs no memory.
+                bool better;
+                switch (strategy)
+                {
+                case PRIORITY:
+                    better = best == NONE ||
+                        entry.priority > rules[best].priority;
+                    break;
+                case RECENCY:
+                    better = best == NONE ||
+                        entry.lastFired < rules[best].lastFired;
+                    break;
+                case RANDOM:
+                    // Reservoir sampling: the nth triggered rule
+                    // replaces the choice with probability 1/n.
+                    better = (random ?
+                              random->randomInt((int)triggeredCount) :
+                              randomInt((int)triggeredCount)) == 0;
+                    break;
+                default:
+                    better = true;
+                    break;
+                }
+                if (better) best = index;
+
+                if (strategy == FIRST_APPLICABLE) break;
+            }
+
+            if (budget > 0 && cursor < count && Clock::now() >= deadline)
+            {
+                return 0;
+            }
+        }
+
+        // The pass is complete.
+        AICORE_LIBRARY_COUNT("RuleBasedSystem matches", triggeredCount);
+        unsigned chosen = best;
+        restart();
+        passes++;
+
+        if (chosen == NONE) return 0;
+        AICORE_LIBRARY_COUNT("RuleBasedSystem fired", 1);
+        rules[chosen].lastFired = passes;
+        rules[chosen].rule->action();
+        return rules[chosen].rule;
+    }
+
     // Explicit template instantiations
     template class RangeMatch<int>;
     template class RangeMatch<real>;
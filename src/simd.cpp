@@ -0,0 +1,385 @@
+/*
+ * Defines the batch vector operations.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <aicore/aicore.h>
+
+namespace aicore
+{
+    /*
+     * Each of the SIMD versions works on blocks of four vectors,
+     * transposing them so that one register holds four x values,
+     * one four y values, and so on. Any vectors left over at the end
+     * are handled one at a time by the scalar code.
+     */
+
+    void normaliseMany(AlignedVector3* vectors, unsigned count)
+    {
+        unsigned i = 0;
+
+#if defined(AICORE_SIMD_SSE)
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (; i+4 <= count; i += 4)
+        {
+            real *data = &vectors[i].x;
+            __m128 x = _mm_load_ps(data);
+            __m128 y = _mm_load_ps(data+4);
+            __m128 z = _mm_load_ps(data+8);
+            __m128 w = _mm_load_ps(data+12);
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+
+            __m128 sm = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x),
+                                              _mm_mul_ps(y, y)),
+                                   _mm_mul_ps(z, z));
+
+            // Zero length vectors get scaled by one.
+            __m128 l = _mm_sqrt_ps(sm);
+            __m128 nonZero = _mm_cmpgt_ps(l, zero);
+            __m128 scale = _mm_div_ps(one, _mm_or_ps(
+                _mm_and_ps(nonZero, l), _mm_andnot_ps(nonZero, one)
+                ));
+
+            x = _mm_mul_ps(x, scale);
+            y = _mm_mul_ps(y, scale);
+            z = _mm_mul_ps(z, scale);
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+            _mm_store_ps(data, x);
+            _mm_store_ps(data+4, y);
+            _mm_store_ps(data+8, z);
+            _mm_store_ps(data+12, w);
+        }
+#elif defined(AICORE_SIMD_NEON)
+        const float32x4_t one = vdupq_n_f32(1.0f);
+        for (; i+4 <= count; i += 4)
+        {
+            real *data = &vectors[i].x;
+            float32x4x4_t v = vld4q_f32(data);
+
+            float32x4_t sm = vmulq_f32(v.val[0], v.val[0]);
+            sm = vfmaq_f32(sm, v.val[1], v.val[1]);
+            sm = vfmaq_f32(sm, v.val[2], v.val[2]);
+
+            // Zero length vectors get scaled by one.
+            float32x4_t l = vsqrtq_f32(sm);
+            uint32x4_t nonZero = vcgtq_f32(l, vdupq_n_f32(0.0f));
+            float32x4_t scale = vdivq_f32(one, vbslq_f32(nonZero, l, one));
+
+            v.val[0] = vmulq_f32(v.val[0], scale);
+            v.val[1] = vmulq_f32(v.val[1], scale);
+            v.val[2] = vmulq_f32(v.val[2], scale);
+            vst4q_f32(data, v);
+        }
+#endif
+
+        for (; i < count; i++)
+        {
+            vectors[i].normalise();
+        }
+    }
+
+    void dotMany(const AlignedVector3* a, const AlignedVector3* b,
+                 real* results, unsigned count)
+    {
+        unsigned i = 0;
+
+#if defined(AICORE_SIMD_SSE)
+        for (; i+4 <= count; i += 4)
+        {
+            const real *da = &a[i].x;
+            const real *db = &b[i].x;
+            __m128 ax = _mm_load_ps(da);
+            __m128 ay = _mm_load_ps(da+4);
+            __m128 az = _mm_load_ps(da+8);
+            __m128 aw = _mm_load_ps(da+12);
+            _MM_TRANSPOSE4_PS(ax, ay, az, aw);
+            __m128 bx = _mm_load_ps(db);
+            __m128 by = _mm_load_ps(db+4);
+            __m128 bz = _mm_load_ps(db+8);
+            __m128 bw = _mm_load_ps(db+12);
+            _MM_TRANSPOSE4_PS(bx, by, bz, bw);
+
+            __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx),
+                                               _mm_mul_ps(ay, by)),
+                                    _mm_mul_ps(az, bz));
+            _mm_storeu_ps(results+i, dot);
+        }
+#elif defined(AICORE_SIMD_NEON)
+        for (; i+4 <= count; i += 4)
+        {
+            float32x4x4_t va = vld4q_f32(&a[i].x);
+            float32x4x4_t vb = vld4q_f32(&b[i].x);
+            float32x4_t dot = vmulq_f32(va.val[0], vb.val[0]);
+            dot = vfmaq_f32(dot, va.val[1], vb.val[1]);
+            dot = vfmaq_f32(dot, va.val[2], vb.val[2]);
+            vst1q_f32(results+i, dot);
+        }
+#endif
+
+        for (; i < count; i++)
+        {
+            results[i] = a[i] * b[i];
+        }
+    }
+
+    void squareMagnitudeMany(const AlignedVector3* vectors,
+                             real* results, unsigned count)
+    {
+        unsigned i = 0;
+
+#if defined(AICORE_SIMD_SSE)
+        for (; i+4 <= count; i += 4)
+        {
+            const real *data = &vectors[i].x;
+            __m128 x = _mm_load_ps(data);
+            __m128 y = _mm_load_ps(data+4);
+            __m128 z = _mm_load_ps(data+8);
+            __m128 w = _mm_load_ps(data+12);
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+
+            __m128 sm = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x),
+                                              _mm_mul_ps(y, y)),
+                                   _mm_mul_ps(z, z));
+            _mm_storeu_ps(results+i, sm);
+        }
+#elif defined(AICORE_SIMD_NEON)
+        for (; i+4 <= count; i += 4)
+        {
+            float32x4x4_t v = vld4q_f32(&vectors[i].x);
+            float32x4_t sm = vmulq_f32(v.val[0], v.val[0]);
+            sm = vfmaq_f32(sm, v.val[1], v.val[1]);
+            sm = vfmaq_f32(sm, v.val[2], v.val[2]);
+            vst1q_f32(results+i, sm);
+        }
+#endif
+
+        for (; i < count; i++)
+        {
+            results[i] = vectors[i].squareMagnitude();
+        }
+    }
+
+    void multiplyMatrixVector(const real* matrix, const real* vector,
+                              real* result,
+                              unsigned rows, unsigned columns)
+    {
+        for (unsigned r = 0; r < rows; r++)
+        {
+            const real *row = matrix + r * columns;
+            unsigned c = 0;
+            real sum = 0;
+
+            // Each row is a dot product with the vector, which can be
+            // done four columns at a time.
+#if defined(AICORE_SIMD_SSE)
+            __m128 acc = _mm_setzero_ps();
+            for (; c+4 <= columns; c += 4)
+            {
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(row+c),
+                                                 _mm_loadu_ps(vector+c)));
+            }
+            AICORE_ALIGN16 real lanes[4];
+            _mm_store_ps(lanes, acc);
+            sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(AICORE_SIMD_NEON)
+            float32x4_t acc = vdupq_n_f32(0.0f);
+            for (; c+4 <= columns; c += 4)
+            {
+                acc = vfmaq_f32(acc, vld1q_f32(row+c), vld1q_f32(vector+c));
+            }
+            sum = vaddvq_f32(acc);
+#else
+            // Four separate sums let the compiler keep them in
+            // registers and overlap the multiplies.
+            real s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+            for (; c+4 <= columns; c += 4)
+            {
+                s0 += row[c] * vector[c];
+                s1 += row[c+1] * vector[c+1];
+                s2 += row[c+2] * vector[c+2];
+                s3 += row[c+3] * vector[c+3];
+            }
+            sum = (s0 + s1) + (s2 + s3);
+#endif
+            for (; c < columns; c++) sum += row[c] * vector[c];
+            result[r] = sum;
+        }
+    }
+
+    void multiplyMatrixVectors(const real* matrix, const real* vectors,
+                               real* results,
+                               unsigned size, unsigned count)
+    {
+        unsigned v = 0;
+
+        // Work on four vectors at once, so each element of the
+        // matrix we load is used four times.
+        for (; v+4 <= count; v += 4)
+        {
+            const real *v0 = vectors + v * size;
+            const real *v1 = v0 + size;
+            const real *v2 = v1 + size;
+            const real *v3 = v2 + size;
+            real *r0 = results + v * size;
+
+            for (unsigned r = 0; r < size; r++)
+            {
+                const real *row = matrix + r * size;
+                unsigned c = 0;
+                real s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+#if defined(AICORE_SIMD_SSE)
+                __m128 a0 = _mm_setzero_ps(), a1 = a0, a2 = a0, a3 = a0;
+                for (; c+4 <= size; c += 4)
+                {
+                    __m128 m = _mm_loadu_ps(row+c);
+                    a0 = _mm_add_ps(a0, _mm_mul_ps(m, _mm_loadu_ps(v0+c)));
+                    a1 = _mm_add_ps(a1, _mm_mul_ps(m, _mm_loadu_ps(v1+c)));
+                    a2 = _mm_add_ps(a2, _mm_mul_ps(m, _mm_loadu_ps(v2+c)));
+                    a3 = _mm_add_ps(a3, _mm_mul_ps(m, _mm_loadu_ps(v3+c)));
+                }
+
+                // Transposing the accumulators lets us add them up
+                // as four vectors, giving all four sums at once.
+                _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+                AICORE_ALIGN16 real sums[4];
+                _mm_store_ps(sums, _mm_add_ps(_mm_add_ps(a0, a1),
+                                              _mm_add_ps(a2, a3)));
+                s0 = sums[0]; s1 = sums[1]; s2 = sums[2]; s3 = sums[3];
+#elif defined(AICORE_SIMD_NEON)
+                float32x4_t a0 = vdupq_n_f32(0.0f), a1 = a0, a2 = a0, a3 = a0;
+                for (; c+4 <= size; c += 4)
+                {
+                    float32x4_t m = vld1q_f32(row+c);
+                    a0 = vfmaq_f32(a0, m, vld1q_f32(v0+c));
+                    a1 = vfmaq_f32(a1, m, vld1q_f32(v1+c));
+                    a2 = vfmaq_f32(a2, m, vld1q_f32(v2+c));
+                    a3 = vfmaq_f32(a3, m, vld1q_f32(v3+c));
+                }
+                s0 = vaddvq_f32(a0); s1 = vaddvq_f32(a1);
+                s2 = vaddvq_f32(a2); s3 = vaddvq_f32(a3);
+#endif
+                for (; c < size; c++)
+                {
+                    real m = row[c];
+                    s0 += m * v0[c];
+                    s1 += m * v1[c];
+                    s2 += m * v2[c];
+                    s3 += m * v3[c];
+                }
+                r0[r] = s0;
+                r0[size + r] = s1;
+                r0[2*size + r] = s2;
+                r0[3*size + r] = s3;
+            }
+        }
+
+        // Do any left over one at a time.
+        for (; v < count; v++)
+        {
+            multiplyMatrixVector(matrix, vectors + v * size,
+                                 results + v * size, size, size);
+        }
+    }
+
+    /** Returns the position of the lowest set bit of a non-zero word. */
+    static inline unsigned lowestBit(uint32_t bits)
+    {
+#if defined(__GNUC__)
+        return (unsigned)__builtin_ctz(bits);
+#else
+        unsigned lowest = 0;
+        while (!(bits & 1)) { bits >>= 1; lowest++; }
+        return lowest;
+#endif
+    }
+
+#if defined(AICORE_SIMD_SSE)
+    /** Turns four bits of a mask into four lanes of all ones or zeros. */
+    static __m128 laneMask(unsigned bits)
+    {
+        static const AICORE_ALIGN16 uint32_t masks[16][4] = {
+            {0,0,0,0}, {~0u,0,0,0}, {0,~0u,0,0}, {~0u,~0u,0,0},
+            {0,0,~0u,0}, {~0u,0,~0u,0}, {0,~0u,~0u,0}, {~0u,~0u,~0u,0},
+            {0,0,0,~0u}, {~0u,0,0,~0u}, {0,~0u,0,~0u}, {~0u,~0u,0,~0u},
+            {0,0,~0u,~0u}, {~0u,0,~0u,~0u}, {0,~0u,~0u,~0u}, {~0u,~0u,~0u,~0u}
+        };
+        return _mm_load_ps((const float*)masks[bits]);
+    }
+#endif
+
+    unsigned argmaxMasked(const real* values, const uint32_t* mask,
+                          unsigned count, real* best)
+    {
+        real result = -REAL_MAX;
+        unsigned any = 0;
+        unsigned c = 0;
+
+        // First find the largest value, treating masked out values as
+        // being as small as possible, so there's no branching.
+#if defined(AICORE_SIMD_SSE)
+        const __m128 fill = _mm_set1_ps(-REAL_MAX);
+        __m128 largest = fill;
+        for (; c+4 <= count; c += 4)
+        {
+            unsigned bits = (mask[c >> 5] >> (c & 31)) & 15;
+            any |= bits;
+            __m128 valid = laneMask(bits);
+            __m128 v = _mm_loadu_ps(values + c);
+            v = _mm_or_ps(_mm_and_ps(valid, v), _mm_andnot_ps(valid, fill));
+            largest = _mm_max_ps(largest, v);
+        }
+        largest = _mm_max_ps(largest, _mm_shuffle_ps(largest, largest,
+                                                     _MM_SHUFFLE(2,3,0,1)));
+        largest = _mm_max_ps(largest, _mm_shuffle_ps(largest, largest,
+                                                     _MM_SHUFFLE(1,0,3,2)));
+        _mm_store_ss(&result, largest);
+#elif defined(AICORE_SIMD_NEON)
+        const float32x4_t fill = vdupq_n_f32(-REAL_MAX);
+        const uint32x4_t lanes = { 1, 2, 4, 8 };
+        float32x4_t largest = fill;
+        for (; c+4 <= count; c += 4)
+        {
+            unsigned bits = (mask[c >> 5] >> (c & 31)) & 15;
+            any |= bits;
+            uint32x4_t valid = vtstq_u32(vdupq_n_u32(bits), lanes);
+            float32x4_t v = vbslq_f32(valid, vld1q_f32(values + c), fill);
+            largest = vmaxq_f32(largest, v);
+        }
+        result = vmaxvq_f32(largest);
+#endif
+        for (; c < count; c++)
+        {
+            unsigned bit = (mask[c >> 5] >> (c & 31)) & 1;
+            any |= bit;
+            real v = bit ? values[c] : -REAL_MAX;
+            result = v > result ? v : result;
+        }
+
+        if (best) *best = result;
+        if (!any) return count;
+
+        // Then find the first valid value that matches it, skipping
+        // through the set bits of the mask a word at a time.
+        unsigned words = (count + 31) >> 5;
+        for (unsigned w = 0; w < words; w++)
+        {
+            uint32_t bits = mask[w];
+            while (bits)
+            {
+                unsigned index = (w << 5) + lowestBit(bits);
+                if (values[index] == result) return index;
+                bits &= bits - 1;
+            }
+        }
+        return count;
+    }
+
+}; // end of namespace
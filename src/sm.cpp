@@ -9,6 +9,8 @@
  * implies agreement with all terms and conditions of the accompanying
  * software licence.
  */
+#include <assert.h>
+#include <map>
 #include <aicore/aicore.h>
 
 namespace aicore
@@ -36,6 +38,8 @@ namespace aicore
 
     Action* StateMachine::update()
     {
+        AICORE_PROFILE_LIBRARY_ZONE("StateMachine");
+
         // The variable to hold the actions to perform
         Action * actions = NULL;
 
@@ -64,7 +68,10 @@ namespace aicore
             Transition * transition = NULL;
 
             // Check through each transition in the current state.
-            BaseTransition * testTransition = currentState->firstTransition;
+            BaseTransition * testTransition = NULL;
+            if (shouldCheckTransitions()) {
+                testTransition = currentState->firstTransition;
+            }
             while (testTransition != NULL) {
                 if (testTransition->isTriggered()) {
                     transition = (Transition*)testTransition;
@@ -78,23 +85,15 @@ namespace aicore
                 // Find our destination
                 StateMachineState * nextState = transition->getTargetState();
 
-                // Accumulate our list of actions
-                Action * tempList = NULL;
-                Action * last = NULL;
-
-                // Add each element to the list in turn
+                // Add each element to the list in turn (any of them
+                // may be empty)
                 actions = currentState->getExitActions();
-                last = actions->getLast();
-
-                tempList = transition->getActions();
-                last->next = tempList;
-                last = tempList->getLast();
-
-                tempList = nextState->getActions();
-                last->next = tempList;
+                actions = Action::appendActions(actions, transition->getActions());
+                actions = Action::appendActions(actions, nextState->getActions());
 
                 // Update the change of state
                 currentState = nextState;
+                AICORE_LIBRARY_COUNT("StateMachine transitions", 1);
             }
 
             // Otherwise our actions to perform are simply those for the
@@ -108,4 +107,226 @@ namespace aicore
         return actions;
     }
 
+    void StateMachine::writeSnapshot(SnapshotWriter &writer,
+                                     StateMachineState *const *states,
+                                     unsigned count) const
+    {
+        // A machine that hasn't started is written as one past the
+        // last state.
+        unsigned index = count;
+        for (unsigned i = 0; i < count; i++)
+        {
+            if (states[i] == currentState) index = i;
+        }
+        assert(currentState == NULL || index < count);
+        writer.writeUnsigned(index);
+    }
+
+    bool StateMachine::readSnapshot(SnapshotReader &reader,
+                                    StateMachineState *const *states,
+                                    unsigned count)
+    {
+        unsigned index = reader.readIndex(count + 1);
+        if (!reader.isValid()) return false;
+        currentState = index < count ? states[index] : NULL;
+        return true;
+    }
+
+    EventStateMachine::EventStateMachine()
+    {
+        initialState = NULL;
+        currentState = NULL;
+    }
+
+    bool EventStateMachine::shouldCheckTransitions()
+    {
+        // Moving to a new state watches its transitions, which are
+        // always checked the first time.
+        watcher.watch(currentState->firstTransition);
+        return watcher.check();
+    }
+
+    bool EventStateMachine::isDirty()
+    {
+        if (currentState == NULL) return true;
+        watcher.watch(currentState->firstTransition);
+        return watcher.isDirty();
+    }
+
+    const unsigned CompiledStateMachine::NOT_STARTED;
+
+    CompiledStateMachine::CompiledStateMachine()
+    {
+    }
+
+    void CompiledStateMachine::compile(StateMachineState *initialState)
+    {
+        states.clear();
+        transitions.clear();
+        if (initialState == NULL) return;
+
+        // Number the states in the order they are found.
+        std::vector<StateMachineState*> order;
+        std::map<StateMachineState*, unsigned> indices;
+        order.push_back(initialState);
+        indices[initialState] = 0;
+
+        for (unsigned i = 0; i < order.size(); i++)
+        {
+            CompiledState compiled;
+            compiled.firstTransition = (unsigned)transitions.size();
+            compiled.transitionCount = 0;
+            compiled.state = order[i];
+
+            BaseTransition *base = order[i]->firstTransition;
+            for (; base != NULL; base = base->next)
+            {
+                Transition *transition = (Transition*)base;
+                StateMachineState *target = transition->getTargetState();
+                if (target == NULL) continue;
+
+                if (indices.find(target) == indices.end())
+                {
+                    indices[target] = (unsigned)order.size();
+                    order.push_back(target);
+                }
+
+                CompiledTransition entry;
+                entry.kind = CONDITION_CUSTOM;
+                entry.input = 0;
+                entry.watch = NULL;
+                entry.value = 0;
+                entry.target = indices[target];
+                entry.transition = transition;
+
+                // Look for conditions we can check directly.
+                ConditionalTransitionMixin *conditional =
+                    dynamic_cast<ConditionalTransitionMixin*>(transition);
+                if (conditional)
+                {
+                    Condition *condition = conditional->condition;
+                    IntegerInputMatchCondition *input =
+                        dynamic_cast<IntegerInputMatchCondition*>(condition);
+                    IntegerMatchCondition *watch =
+                        dynamic_cast<IntegerMatchCondition*>(condition);
+                    if (input)
+                    {
+                        entry.kind = CONDITION_INPUT_MATCH;
+                        entry.input = input->input;
+                        entry.value = input->target;
+                    }
+                    else if (watch)
+                    {
+                        entry.kind = CONDITION_WATCH_MATCH;
+                        entry.watch = watch->watch;
+                        entry.value = watch->target;
+                    }
+                }
+
+                transitions.push_back(entry);
+                compiled.transitionCount++;
+            }
+            states.push_back(compiled);
+        }
+    }
+
+    unsigned CompiledStateMachine::getStateIndex(
+        const StateMachineState *state) const
+    {
+        for (unsigned i = 0; i < states.size(); i++)
+        {
+            if (states[i].state == state) return i;
+        }
+        return NOT_STARTED;
+    }
+
+    const CompiledStateMachine::CompiledTransition*
+    CompiledStateMachine::findTransition(unsigned state,
+                                         const int *inputs) const
+    {
+        const CompiledState &compiled = states[state];
+        const CompiledTransition *transition =
+            transitions.data() + compiled.firstTransition;
+        const CompiledTransition *end =
+            transition + compiled.transitionCount;
+
+        for (; transition < end; transition++)
+        {
+            bool triggered;
+            switch (transition->kind)
+            {
+            case CONDITION_INPUT_MATCH:
+                triggered = inputs[transition->input] == transition->value;
+                break;
+            case CONDITION_WATCH_MATCH:
+                triggered = *transition->watch == transition->value;
+                break;
+            default:
+                triggered = transition->transition->isTriggered();
+                break;
+            }
+            if (triggered) return transition;
+        }
+        return NULL;
+    }
+
+    Action* CompiledStateMachine::update(unsigned *state,
+                                         const int *inputs) const
+    {
+        if (states.empty()) return NULL;
+
+        // Start in the initial state.
+        if (*state == NOT_STARTED)
+        {
+            *state = 0;
+            return states[0].state->getEntryActions();
+        }
+
+        const CompiledTransition *transition = findTransition(*state, inputs);
+        if (transition == NULL)
+        {
+            return states[*state].state->getActions();
+        }
+
+        Action *actions = states[*state].state->getExitActions();
+        actions = Action::appendActions(actions, transition->transition->getActions());
+        actions = Action::appendActions(actions,
+                                states[transition->target].state->getActions());
+        *state = transition->target;
+        return actions;
+    }
+
+    void CompiledStateMachine::updateMany(unsigned *currentStates,
+                                          const int *inputs, unsigned stride,
+                                          unsigned count,
+                                          Action **actions) const
+    {
+        AICORE_PROFILE_LIBRARY_ZONE("CompiledStateMachine batch");
+
+        if (actions)
+        {
+            for (unsigned i = 0; i < count; i++, inputs += stride)
+            {
+                actions[i] = update(&currentStates[i], inputs);
+            }
+            return;
+        }
+
+        // Without actions, we only need to move between states.
+        if (states.empty()) return;
+        for (unsigned i = 0; i < count; i++, inputs += stride)
+        {
+            unsigned &state = currentStates[i];
+            if (state == NOT_STARTED)
+            {
+                state = 0;
+                continue;
+            }
+
+            const CompiledTransition *transition =
+                findTransition(state, inputs);
+            if (transition) state = transition->target;
+        }
+    }
+
 }; // end of namespace
@@ -0,0 +1,298 @@
+/*
+ * Defines the classes used to save and restore the state of the AI.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <string.h>
+#include <aicore/aicore.h>
+
+namespace aicore
+{
+    const unsigned SnapshotWriter::VERSION;
+
+    /**
+     * A value written raw after the version, which only reads back
+     * the same on a machine with the same real type and byte order.
+     */
+    static const real BYTE_ORDER_CHECK = (real)1.5;
+
+    /** The magic number at the start of a delta. */
+    static const char DELTA_MAGIC[4] = {'A', 'I', 'S', 'D'};
+
+    /**
+     * Matching runs shorter than this are kept in the surrounding
+     * literal, as a real number that changes in only a few of its
+     * bytes would otherwise cost more to describe than to copy.
+     */
+    static const unsigned MIN_COPY = 4;
+
+    SnapshotWriter::SnapshotWriter(std::vector<char> *buffer)
+        :
+        buffer(buffer)
+    {
+    }
+
+    void SnapshotWriter::writeHeader()
+    {
+        writeBytes("AISN", 4);
+        writeUnsigned(VERSION);
+        writeReal(BYTE_ORDER_CHECK);
+    }
+
+    void SnapshotWriter::writeUnsigned(unsigned value)
+    {
+        // Seven bits at a time, with the top bit set on all but the
+        // last byte.
+        while (value >= 0x80)
+        {
+            buffer->push_back((char)(value | 0x80));
+            value >>= 7;
+        }
+        buffer->push_back((char)value);
+    }
+
+    void SnapshotWriter::writeInt(int value)
+    {
+        // Interleave the positive and negative numbers, so small
+        // values of either sign stay small.
+        unsigned bits = (unsigned)value;
+        writeUnsigned((bits << 1) ^ (value < 0 ? 0xffffffff : 0));
+    }
+
+    void SnapshotWriter::writeBytes(const void *data, size_t size)
+    {
+        const char *bytes = (const char*)data;
+        buffer->insert(buffer->end(), bytes, bytes + size);
+    }
+
+    SnapshotReader::SnapshotReader(const void *data, size_t size)
+        :
+        current((const char*)data), end((const char*)data + size),
+        failed(false)
+    {
+    }
+
+    bool SnapshotReader::readHeader()
+    {
+        char magic[4];
+        readBytes(magic, 4);
+        if (failed || memcmp(magic, "AISN", 4) != 0)
+        {
+            fail();
+            return false;
+        }
+        if (readUnsigned() != SnapshotWriter::VERSION) fail();
+        if (readReal() != BYTE_ORDER_CHECK) fail();
+        return !failed;
+    }
+
+    unsigned SnapshotReader::readUnsigned()
+    {
+        unsigned value = 0;
+        for (unsigned shift = 0; shift < 35 && !failed; shift += 7)
+        {
+            if (current == end) break;
+
+            unsigned char byte = (unsigned char)*current++;
+            value |= (unsigned)(byte & 0x7f) << shift;
+            if (byte < 0x80) return value;
+        }
+
+        // Ran out of data, or too many bytes for an unsigned.
+        fail();
+        return 0;
+    }
+
+    unsigned SnapshotReader::readIndex(unsigned limit)
+    {
+        unsigned value = readUnsigned();
+        if (value < limit) return value;
+        fail();
+        return 0;
+    }
+
+    int SnapshotReader::readInt()
+    {
+        unsigned bits = readUnsigned();
+        return (int)((bits >> 1) ^ (0 - (bits & 1)));
+    }
+
+    void SnapshotReader::readBytes(void *data, size_t size)
+    {
+        if (failed || size > getRemaining())
+        {
+            fail();
+            memset(data, 0, size);
+            return;
+        }
+        memcpy(data, current, size);
+        current += size;
+    }
+
+    void SnapshotReader::fail()
+    {
+        failed = true;
+        current = end;
+    }
+
+    void writeSnapshot(SnapshotWriter &writer, const Kinematic &kinematic)
+    {
+        writer.writeVector(kinematic.position);
+        writer.writeReal(kinematic.orientation);
+        writer.writeVector(kinematic.velocity);
+        writer.writeReal(kinematic.rotation);
+    }
+
+    bool readSnapshot(SnapshotReader &reader, Kinematic *kinematic)
+    {
+        kinematic->position = reader.readVector();
+        kinematic->orientation = reader.readReal();
+        kinematic->velocity = reader.readVector();
+        kinematic->rotation = reader.readReal();
+        return reader.isValid();
+    }
+
+    void writeSnapshot(SnapshotWriter &writer, const RandomEngine &engine)
+    {
+        uint32_t state[4];
+        engine.getState(state);
+        for (unsigned i = 0; i < 4; i++) writer.writeUnsigned(state[i]);
+    }
+
+    bool readSnapshot(SnapshotReader &reader, RandomEngine *engine)
+    {
+        uint32_t state[4];
+        for (unsigned i = 0; i < 4; i++) state[i] = reader.readUnsigned();
+
+        // The all zero state is never reached, so isn't valid.
+        if (!(state[0] | state[1] | state[2] | state[3])) reader.fail();
+        if (reader.isValid()) engine->setState(state);
+        return reader.isValid();
+    }
+
+    /** Works out the FNV-1a hash of the given bytes. */
+    static unsigned getChecksum(const char *data, size_t size)
+    {
+        unsigned hash = 2166136261u;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= (unsigned char)data[i];
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    /*
+     * A delta is a header followed by a series of runs. Each run
+     * copies a number of bytes from the same position in the base,
+     * then gives a number of new bytes, until the whole of the new
+     * snapshot has been described.
+     */
+
+    void encodeSnapshotDelta(const std::vector<char> &base,
+                             const std::vector<char> &current,
+                             std::vector<char> *delta)
+    {
+        delta->clear();
+        SnapshotWriter writer(delta);
+        writer.writeBytes(DELTA_MAGIC, 4);
+        writer.writeUnsigned(SnapshotWriter::VERSION);
+        writer.writeUnsigned((unsigned)base.size());
+        writer.writeUnsigned(getChecksum(base.data(), base.size()));
+        writer.writeUnsigned((unsigned)current.size());
+        writer.writeUnsigned(getChecksum(current.data(), current.size()));
+
+        size_t size = current.size();
+        size_t shared = base.size() < size ? base.size() : size;
+        size_t i = 0;
+        while (i < size)
+        {
+            // Count the bytes that haven't changed.
+            size_t start = i;
+            while (i < shared && current[i] == base[i]) i++;
+            size_t copy = i - start;
+
+            // Then the bytes that have, up to the next run that is
+            // worth copying.
+            start = i;
+            while (i < size)
+            {
+                size_t same = 0;
+                while (i + same < shared && same < MIN_COPY &&
+                       current[i + same] == base[i + same]) same++;
+                if (same == MIN_COPY || (same > 0 && i + same == size)) break;
+                i += same > 0 ? same : 1;
+            }
+
+            writer.writeUnsigned((unsigned)copy);
+            writer.writeUnsigned((unsigned)(i - start));
+            writer.writeBytes(current.data() + start, i - start);
+        }
+    }
+
+    bool applySnapshotDelta(const std::vector<char> &base,
+                            const void *delta, size_t size,
+                            std::vector<char> *result)
+    {
+        SnapshotReader reader(delta, size);
+        char magic[4];
+        reader.readBytes(magic, 4);
+        if (!reader.isValid() || memcmp(magic, DELTA_MAGIC, 4) != 0 ||
+            reader.readUnsigned() != SnapshotWriter::VERSION ||
+            reader.readUnsigned() != base.size() ||
+            reader.readUnsigned() != getChecksum(base.data(), base.size()))
+        {
+            return false;
+        }
+
+        unsigned total = reader.readUnsigned();
+        unsigned checksum = reader.readUnsigned();
+
+        // Copies come from the same place in the base, so the result
+        // can't be longer than the base plus the literal bytes left.
+        // Check this before reserving, so a damaged total can't make
+        // us allocate more than the delta could ever fill.
+        if (!reader.isValid() ||
+            total > base.size() + reader.getRemaining())
+        {
+            return false;
+        }
+
+        // Build the result separately, so it is untouched on failure.
+        std::vector<char> built;
+        built.reserve(total);
+        while (reader.isValid() && built.size() < total)
+        {
+            size_t position = built.size();
+            unsigned copy = reader.readUnsigned();
+            unsigned literal = reader.readUnsigned();
+            if ((copy == 0 && literal == 0) ||
+                position + copy > total || position + copy > base.size() ||
+                literal > total - position - copy ||
+                literal > reader.getRemaining())
+            {
+                return false;
+            }
+
+            built.insert(built.end(), base.begin() + position,
+                         base.begin() + position + copy);
+            built.resize(position + copy + literal);
+            reader.readBytes(built.data() + position + copy, literal);
+        }
+
+        if (!reader.isValid() || built.size() != total ||
+            getChecksum(built.data(), built.size()) != checksum)
+        {
+            return false;
+        }
+        result->swap(built);
+        return true;
+    }
+
+}; // end of namespace
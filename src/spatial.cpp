@@ -0,0 +1,287 @@
+/*
+ * Defines the spatial indexing structures.
+ *
+ * Part of the Artificial Intelligence for Games system.
+ *
+ * Copyright (c) Ian Millington 2003-2006. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+#include <assert.h>
+#include <aicore/aicore.h>
+
+namespace aicore
+{
+    const unsigned SpatialGrid::NONE;
+
+    SpatialGrid::SpatialGrid(real cellSize, unsigned tableSize)
+        :
+        cellSize(cellSize),
+        inverseCellSize((real)1.0 / cellSize),
+        count(0)
+    {
+        assert(cellSize > 0);
+
+        // Round the table up to a power of two, so we can mask
+        // rather than divide.
+        this->tableSize = 1;
+        while (this->tableSize < tableSize) this->tableSize <<= 1;
+        head.resize(this->tableSize, NONE);
+    }
+
+    int SpatialGrid::getCellCoordinate(real value) const
+    {
+        // Casting truncates towards zero, we need to round down.
+        real scaled = value * inverseCellSize;
+        int result = (int)scaled;
+        if (scaled < (real)result) result--;
+        return result;
+    }
+
+    unsigned SpatialGrid::getSlot(int x, int y, int z) const
+    {
+        // Large primes spread neighbouring cells across the table.
+        unsigned hash =
+            ((unsigned)x * 73856093u) ^
+            ((unsigned)y * 19349663u) ^
+            ((unsigned)z * 83492791u);
+        return hash & (tableSize - 1);
+    }
+
+    void SpatialGrid::setCell(unsigned index)
+    {
+        const Vector3 &p = positions[index];
+        cell[index*3] = getCellCoordinate(p.x);
+        cell[index*3+1] = getCellCoordinate(p.y);
+        cell[index*3+2] = getCellCoordinate(p.z);
+    }
+
+    void SpatialGrid::link(unsigned index)
+    {
+        unsigned slot = getSlot(cell[index*3], cell[index*3+1],
+                                cell[index*3+2]);
+        next[index] = head[slot];
+        previous[index] = NONE;
+        if (head[slot] != NONE) previous[head[slot]] = index;
+        head[slot] = index;
+    }
+
+    void SpatialGrid::unlink(unsigned index)
+    {
+        if (previous[index] != NONE)
+        {
+            next[previous[index]] = next[index];
+        }
+        else
+        {
+            unsigned slot = getSlot(cell[index*3], cell[index*3+1],
+                                    cell[index*3+2]);
+            head[slot] = next[index];
+        }
+        if (next[index] != NONE) previous[next[index]] = previous[index];
+    }
+
+    void SpatialGrid::setCellSize(real size)
+    {
+        assert(size > 0);
+        cellSize = size;
+        inverseCellSize = (real)1.0 / size;
+
+        // Relocate everything into the new cells.
+        for (unsigned i = 0; i < tableSize; i++) head[i] = NONE;
+        for (unsigned i = 0; i < present.size(); i++)
+        {
+            if (!present[i]) continue;
+            setCell(i);
+            link(i);
+        }
+    }
+
+    void SpatialGrid::setCapacity(unsigned capacity)
+    {
+        // Take out anything that won't fit any more.
+        for (unsigned i = capacity; i < present.size(); i++)
+        {
+            remove(i);
+        }
+
+        next.resize(capacity, NONE);
+        previous.resize(capacity, NONE);
+        cell.resize(capacity*3, 0);
+        positions.resize(capacity);
+        present.resize(capacity, false);
+    }
+
+    void SpatialGrid::clear()
+    {
+        for (unsigned i = 0; i < tableSize; i++) head[i] = NONE;
+        for (unsigned i = 0; i < present.size(); i++) present[i] = false;
+        count = 0;
+    }
+
+    bool SpatialGrid::contains(unsigned index) const
+    {
+        return index < present.size() && present[index];
+    }
+
+    void SpatialGrid::insert(unsigned index, const Vector3& position)
+    {
+        if (contains(index))
+        {
+            update(index, position);
+            return;
+        }
+
+        if (index >= present.size()) setCapacity(index+1);
+
+        positions[index] = position;
+        setCell(index);
+        link(index);
+        present[index] = true;
+        count++;
+    }
+
+    void SpatialGrid::update(unsigned index, const Vector3& position)
+    {
+        if (!contains(index))
+        {
+            insert(index, position);
+            return;
+        }
+
+        positions[index] = position;
+
+        // Only relink if we've crossed into another cell.
+        int x = getCellCoordinate(position.x);
+        int y = getCellCoordinate(position.y);
+        int z = getCellCoordinate(position.z);
+        if (x != cell[index*3] || y != cell[index*3+1] || z != cell[index*3+2])
+        {
+            unlink(index);
+            cell[index*3] = x;
+            cell[index*3+1] = y;
+            cell[index*3+2] = z;
+            link(index);
+        }
+    }
+
+    void SpatialGrid::remove(unsigned index)
+    {
+        if (!contains(index)) return;
+        unlink(index);
+        present[index] = false;
+        count--;
+    }
+
+    bool SpatialGrid::inCone(unsigned index, const Vector3& centre,
+                             const Vector3& look, real minDotProduct) const
+    {
+        Vector3 offset = positions[index] - centre;
+        real dot = look * offset;
+        real squareLength = offset.squareMagnitude();
+
+        // Coincident items have no direction: treat them as being at
+        // right angles to the look vector.
+        if (squareLength <= 0) return minDotProduct <= 0;
+
+        // We need dot / length >= minDotProduct, without the sqrt.
+        real limit = minDotProduct*minDotProduct*squareLength;
+        if (minDotProduct >= 0)
+        {
+            return dot >= 0 && dot*dot >= limit;
+        }
+        else
+        {
+            return dot >= 0 || dot*dot <= limit;
+        }
+    }
+
+    unsigned SpatialGrid::query(const Vector3& centre, real radius,
+                                std::vector<unsigned>* results,
+                                unsigned exclude) const
+    {
+        return query(centre, radius, Vector3::ZERO, (real)-1.0,
+                     results, exclude);
+    }
+
+    unsigned SpatialGrid::query(const Vector3& centre, real radius,
+                                const Vector3& look, real minDotProduct,
+                                std::vector<unsigned>* results,
+                                unsigned exclude) const
+    {
+        unsigned found = 0;
+        real squareRadius = radius*radius;
+        bool useCone = minDotProduct > (real)-1.0;
+
+        int minX = getCellCoordinate(centre.x - radius);
+        int maxX = getCellCoordinate(centre.x + radius);
+        int minY = getCellCoordinate(centre.y - radius);
+        int maxY = getCellCoordinate(centre.y + radius);
+        int minZ = getCellCoordinate(centre.z - radius);
+        int maxZ = getCellCoordinate(centre.z + radius);
+
+        // If the query covers more cells than the table has slots,
+        // then every slot would be visited (probably several times),
+        // so it is quicker just to check each item directly.
+        double cells = (double)(maxX-minX+1) *
+            (double)(maxY-minY+1) * (double)(maxZ-minZ+1);
+        if (cells > (double)tableSize)
+        {
+            for (unsigned i = 0; i < present.size(); i++)
+            {
+                if (!present[i] || i == exclude) continue;
+                if ((positions[i] - centre).squareMagnitude() > squareRadius)
+                {
+                    continue;
+                }
+                if (useCone && !inCone(i, centre, look, minDotProduct))
+                {
+                    continue;
+                }
+                results->push_back(i);
+                found++;
+            }
+            return found;
+        }
+
+        for (int x = minX; x <= maxX; x++)
+        {
+            for (int y = minY; y <= maxY; y++)
+            {
+                for (int z = minZ; z <= maxZ; z++)
+                {
+                    unsigned item = head[getSlot(x, y, z)];
+                    while (item != NONE)
+                    {
+                        unsigned i = item;
+                        item = next[item];
+
+                        // Ignore items from other cells in this slot.
+                        if (cell[i*3] != x || cell[i*3+1] != y ||
+                            cell[i*3+2] != z || i == exclude)
+                        {
+                            continue;
+                        }
+
+                        if ((positions[i] - centre).squareMagnitude() >
+                            squareRadius)
+                        {
+                            continue;
+                        }
+                        if (useCone && !inCone(i, centre, look, minDotProduct))
+                        {
+                            continue;
+                        }
+
+                        results->push_back(i);
+                        found++;
+                    }
+                }
+            }
+        }
+        return found;
+    }
+
+}; // end of namespace
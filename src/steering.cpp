@@ -17,29 +17,94 @@ namespace aicore
     void Seek::getSteering(SteeringOutput* output)
     {
         // First work out the direction
-        output->linear = *target;
-        output->linear -= character->position;
+        AlignedVector3 direction(*target);
+        direction -= AlignedVector3(character->position);
 
         // If there is no direction, do nothing
-        if (output->linear.squareMagnitude() > 0)
+        real squareMagnitude = direction.squareMagnitude();
+        if (squareMagnitude > 0)
         {
-            output->linear.normalise();
-            output->linear *= maxAcceleration;
+            if (fastMath)
+            {
+                direction *= maxAcceleration * fast_rsqrt(squareMagnitude);
+            }
+            else
+            {
+                direction.normalise();
+                direction *= maxAcceleration;
+            }
         }
+        direction.writeTo(&output->linear);
     }
 
     void Flee::getSteering(SteeringOutput* output)
     {
         // First work out the direction
-        output->linear = character->position;
-        output->linear -= *target;
+        AlignedVector3 direction(character->position);
+        direction -= AlignedVector3(*target);
 
         // If there is no direction, do nothing
-        if (output->linear.squareMagnitude() > 0)
+        real squareMagnitude = direction.squareMagnitude();
+        if (squareMagnitude > 0)
         {
-            output->linear.normalise();
-            output->linear *= maxAcceleration;
+            if (fastMath)
+            {
+                direction *= maxAcceleration * fast_rsqrt(squareMagnitude);
+            }
+            else
+            {
+                direction.normalise();
+                direction *= maxAcceleration;
+            }
         }
+        direction.writeTo(&output->linear);
+    }
+
+    TargetCache::TargetCache()
+        :
+        lastFrame(0), updated(false)
+    {
+    }
+
+    void TargetCache::predict(Entry *entry)
+    {
+        entry->position = entry->kinematic->position;
+        entry->position.addScaledVector(
+            entry->kinematic->velocity, entry->lookahead);
+    }
+
+    const Vector3* TargetCache::add(const Kinematic *kinematic, real lookahead)
+    {
+        Entry entry;
+        entry.kinematic = kinematic;
+        entry.lookahead = lookahead;
+        predict(&entry);
+        entries.push_back(entry);
+        return &entries.back().position;
+    }
+
+    void TargetCache::clear()
+    {
+        entries.clear();
+        updated = false;
+    }
+
+    void TargetCache::update(unsigned frame)
+    {
+        if (updated && frame == lastFrame) return;
+
+        std::deque<Entry>::iterator entry;
+        for (entry = entries.begin(); entry != entries.end(); entry++)
+        {
+            predict(&*entry);
+        }
+        lastFrame = frame;
+        updated = true;
+    }
+
+    void TargetCache::update()
+    {
+        update(TimingData::get().frameNumber);
     }
 
 	SeekWithInternalTarget::SeekWithInternalTarget()
@@ -57,70 +122,177 @@ namespace aicore
 		}
 
 		Vector3 offset = *target - character->position;
-		real angle;
-		if (offset.x*offset.x + offset.z*offset.z > 0) {
-			// Work out the angle to the target from the character
-			angle = real_atan2(offset.z, offset.x);
+		real squareDistance = offset.x*offset.x + offset.z*offset.z;
+		if (fastMath && squareDistance > 0)
+		{
+			// Scaling the offset onto the volatility circle puts the
+			// target where going through its angle would.
+			real scale = volatility * fast_rsqrt(squareDistance);
+			internal_target = character->position;
+			internal_target.x += offset.x * scale;
+			internal_target.z += offset.z * scale;
 		}
 		else
 		{
-			// We're on top of the target, move it away a little.
-			angle = 0;
-		}
+			real angle;
+			if (squareDistance > 0) {
+				// Work out the angle to the target from the character
+				angle = real_atan2(offset.z, offset.x);
+			}
+			else
+			{
+				// We're on top of the target, move it away a little.
+				angle = 0;
+			}
 
-		// Move the target to the boundary of the volatility circle.
-		internal_target = character->position;
-		internal_target.x += volatility * real_cos(angle);
-		internal_target.z += volatility * real_sin(angle);
+			// Move the target to the boundary of the volatility circle.
+			internal_target = character->position;
+			internal_target.x += volatility * real_cos(angle);
+			internal_target.z += volatility * real_sin(angle);
+		}
 
 		// Add the turn to the target
-		internal_target.x += randomBinomial(turnSpeed);
-		internal_target.z += randomBinomial(turnSpeed);
+		internal_target.x += getRandom().randomBinomial(turnSpeed);
+		internal_target.z += getRandom().randomBinomial(turnSpeed);
 
 		Seek::getSteering(output);
 	}
 
+	/**
+	 * Checks if moving from the given position along the given unit
+	 * vector would pass within the margin of the obstacle, sooner than
+	 * the lookahead. If so the distance to the closest pass is
+	 * returned, and the avoid point is set to the point to steer for.
+	 * Otherwise the lookahead is returned.
+	 */
+	static real findAvoidance(
+		const AlignedVector3 &position,
+		const AlignedVector3 &movementNormal,
+		const Sphere &obstacle,
+		real avoidMargin,
+		real maxLookahead,
+		AlignedVector3 *avoid
+		)
+	{
+		// Find the distance from the line we're moving along to the obstacle.
+		AlignedVector3 obstaclePosition(obstacle.position);
+		AlignedVector3 characterToObstacle = obstaclePosition - position;
+
+		// Find how far along our movement vector the closest pass is
+		real distanceToClosest = characterToObstacle * movementNormal;
+		real distanceSquared = characterToObstacle.squareMagnitude() - 
+			distanceToClosest*distanceToClosest;
+
+		// Check for collision
+		real radius = obstacle.radius + avoidMargin;
+		if (distanceSquared < radius*radius)
+		{
+			// Make sure this isn't behind us and is closer than our lookahead.
+			if (distanceToClosest > 0 && distanceToClosest < maxLookahead)
+			{
+				// Find the closest point
+				AlignedVector3 closestPoint = 
+					position + movementNormal*distanceToClosest;
+
+				// Find the point of avoidance
+				*avoid = 
+					obstaclePosition +
+					(closestPoint - obstaclePosition).unit() * radius;
+				return distanceToClosest;
+			}
+		}
+		return maxLookahead;
+	}
+
 	void AvoidSphere::getSteering(SteeringOutput* output)
 	{
 		// Clear the output, in case we don't write to it later.
 		output->clear();
 
 		// Make sure we're moving
-		if (character->velocity.squareMagnitude() > 0)
+		AlignedVector3 velocity(character->velocity);
+		if (velocity.squareMagnitude() > 0)
 		{
-			// Find the distance from the line we're moving along to the obstacle.
-			Vector3 movementNormal = character->velocity.unit();
-			Vector3 characterToObstacle = obstacle->position - character->position;
+			AlignedVector3 avoid;
+			if (findAvoidance(AlignedVector3(character->position),
+				velocity.unit(), *obstacle, avoidMargin, maxLookahead,
+				&avoid) < maxLookahead)
+			{
+				// Seek the point of avoidance
+				avoid.writeTo(&internal_target);
+				Seek::getSteering(output);
+			}
+		}
+	}
+
+	AvoidSpheres::AvoidSpheres()
+		:
+		broadphase(0),
+		avoidMargin(0),
+		maxLookahead(0)
+	{
+	}
+
+	void AvoidSpheres::getSteering(SteeringOutput* output)
+	{
+		AICORE_PROFILE_LIBRARY_ZONE("AvoidSpheres");
 
-			real distanceSquared = characterToObstacle * movementNormal;
-			distanceSquared = characterToObstacle.squareMagnitude() - 
-				distanceSquared*distanceSquared;
+		// Clear the output, in case we don't write to it later.
+		output->clear();
+
+		// Make sure we're moving
+		AlignedVector3 velocity(character->velocity);
+		if (velocity.squareMagnitude() <= 0) return;
 
-			// Check for collision
-			real radius = obstacle->radius + avoidMargin;
-			if (distanceSquared < radius*radius)
+		AlignedVector3 position(character->position);
+		AlignedVector3 movementNormal = velocity.unit();
+
+		// Anything further than the lookahead is ignored, so each
+		// obstacle only needs to beat the closest collision so far.
+		real closest = maxLookahead;
+		AlignedVector3 avoid, thisAvoid;
+		if (broadphase)
+		{
+			// Only check the obstacles near the lookahead.
+			Vector3 direction;
+			movementNormal.writeTo(&direction);
+			candidates.clear();
+			broadphase->querySegment(
+				character->position, direction, maxLookahead, avoidMargin,
+				&candidates
+				);
+			for (unsigned i = 0; i < candidates.size(); i++)
+			{
+				real distance = findAvoidance(position, movementNormal,
+					*candidates[i], avoidMargin, closest, &thisAvoid);
+				if (distance < closest)
+				{
+					closest = distance;
+					avoid = thisAvoid;
+				}
+			}
+		}
+		else
+		{
+			std::list<Sphere*>::iterator soi;
+			for (soi = obstacles.begin(); soi != obstacles.end(); soi++)
 			{
-				// Find how far along our movement vector the closest pass is
-				real distanceToClosest = characterToObstacle * movementNormal;
-				
-				// Make sure this isn't behind us and is closer than our lookahead.
-				if (distanceToClosest > 0 && distanceToClosest < maxLookahead)
+				real distance = findAvoidance(position, movementNormal,
+					*(*soi), avoidMargin, closest, &thisAvoid);
+				if (distance < closest)
 				{
-					// Find the closest point
-					Vector3 closestPoint = 
-						character->position + movementNormal*distanceToClosest;
-
-					// Find the point of avoidance
-					internal_target = 
-						obstacle->position +
-						(closestPoint - obstacle->position).unit() *
-						(obstacle->radius + avoidMargin);
-
-					// Seek this point
-					Seek::getSteering(output);
+					closest = distance;
+					avoid = thisAvoid;
 				}
 			}
 		}
+
+		if (closest < maxLookahead)
+		{
+			// Seek the point of avoidance
+			avoid.writeTo(&internal_target);
+			Seek::getSteering(output);
+		}
 	}
 
 	void BlendedSteering::getSteering(SteeringOutput *output)
@@ -56,10 +56,10 @@ namespace aicore
 	bool Goal::canMergeGoals(const Goal& goal) const
 	{
 		return !(
-			positionSet && goal.positionSet ||
-			orientationSet && goal.orientationSet ||
-			velocitySet && goal.velocitySet ||
-			rotationSet && goal.rotationSet
+			(positionSet && goal.positionSet) ||
+			(orientationSet && goal.orientationSet) ||
+			(velocitySet && goal.velocitySet) ||
+			(rotationSet && goal.rotationSet)
 			);
 	}
 
@@ -70,15 +70,28 @@ namespace aicore
 
 	SteeringPipe::SteeringPipe()
 		:
-		fallback(0),
+		allocations(0),
+		sliceStart(0),
 		constraintSteps(100),
-		path(0)
+		fallback(0),
+		path(0),
+		characterIndex(0)
 	{
     }
 
 	SteeringPipe::~SteeringPipe()
 	{
 		if (path) delete path;
+		clearBatchPaths();
+	}
+
+	void SteeringPipe::clearBatchPaths()
+	{
+		for (unsigned i = 0; i < batchPaths.size(); i++)
+		{
+			delete batchPaths[i];
+		}
+		batchPaths.clear();
 	}
 
 	void SteeringPipe::setActuator(aicore::Actuator *a)
@@ -86,15 +99,47 @@ namespace aicore
 		actuator = a;
 		if (path) delete path;
 		path = 0;
+		clearBatchPaths();
+	}
+
+	void SteeringPipe::reserve(unsigned count)
+	{
+		if (!path) 
+		{
+			path = actuator->createPathObject();
+			allocations++;
+		}
+		if (batchPaths.capacity() < count)
+		{
+			batchPaths.reserve(count);
+			allocations++;
+		}
+		while (batchPaths.size() < count) 
+		{
+			batchPaths.push_back(actuator->createPathObject());
+			allocations++;
+		}
+		if (batchGoals.capacity() < count)
+		{
+			batchGoals.reserve(count);
+			allocations++;
+		}
+		if (batchPending.capacity() < count)
+		{
+			batchPending.reserve(count);
+			allocations++;
+		}
 	}
 
 	void SteeringPipe::getSteering(SteeringOutput* output)
 	{
+		AICORE_PROFILE_LIBRARY_ZONE("SteeringPipe");
 		Goal goal;
+		Goal targeterResult;
 		std::list<Targeter*>::iterator ti;
 		for (ti = targeters.begin(); ti != targeters.end(); ti++)
 		{
-			Goal targeterResult = (*ti)->getGoal();
+			(*ti)->fillGoal(&targeterResult);
 			if (goal.canMergeGoals(targeterResult)) 
 			{
 				goal.updateGoal(targeterResult);
@@ -104,15 +149,15 @@ namespace aicore
 		std::list<Decomposer*>::iterator di;
 		for (di = decomposers.begin(); di != decomposers.end(); di++)
 		{
-			goal = (*di)->decomposeGoal(goal);
+			(*di)->decomposeInPlace(&goal);
 		}
 
 		// Create an ampty path object of the correct type.
-		if (!path) path = actuator->createPathObject();
+		if (!path) reserve(0);
 
 		std::list<Constraint*>::iterator ci;
 		real shortestViolation, currentViolation, maxViolation;
-		Constraint *violatingConstraint;
+		Constraint *violatingConstraint = 0;
 		for (unsigned i = 0; i < constraintSteps; i++)
 		{
 			// Find the path to this goal
@@ -138,21 +183,358 @@ namespace aicore
 			if (shortestViolation < maxViolation)
 			{
 				// Update the goal and check constraints again.
-				goal = violatingConstraint->suggest(path);
+				violatingConstraint->fillSuggestion(path, &goal);
 				violatingConstraint->suggestionUsed = true;
 			}
 			else
 			{
 				// We've found a solution - use it and return
+				AICORE_LIBRARY_RECORD("SteeringPipe steps", i + 1);
 				actuator->getSteering(output, path);
 				return;
 			}
 		}
 
 		// We've run out of constraint iterations, so use the fallback
+		AICORE_LIBRARY_RECORD("SteeringPipe steps", constraintSteps);
+		AICORE_LIBRARY_COUNT("SteeringPipe fallbacks", 1);
 		if (fallback) fallback->getSteering(output);
 	}
 
+	void SteeringPipe::getSteering(Kinematic** characters, 
+		SteeringOutput* outputs, unsigned count)
+	{
+		AICORE_PROFILE_LIBRARY_ZONE("SteeringPipe batch");
+		Kinematic *original = character;
+		unsigned originalIndex = characterIndex;
+
+		// Make sure we have a path object for each character.
+		reserve(count);
+		batchGoals.resize(count);
+
+		// Run the targeters for everyone.
+		unsigned a;
+		for (a = 0; a < count; a++) batchGoals[a].clear();
+
+		Goal targeterResult;
+		std::list<Targeter*>::iterator ti;
+		for (ti = targeters.begin(); ti != targeters.end(); ti++)
+		{
+			for (a = 0; a < count; a++)
+			{
+				character = characters[a];
+				characterIndex = a;
+				(*ti)->fillGoal(&targeterResult);
+				if (batchGoals[a].canMergeGoals(targeterResult)) 
+				{
+					batchGoals[a].updateGoal(targeterResult);
+				}
+			}
+		}
+
+		// Then the decomposers.
+		std::list<Decomposer*>::iterator di;
+		for (di = decomposers.begin(); di != decomposers.end(); di++)
+		{
+			for (a = 0; a < count; a++)
+			{
+				character = characters[a];
+				characterIndex = a;
+				(*di)->decomposeInPlace(&batchGoals[a]);
+			}
+		}
+
+		// Resolve constraints one round at a time, for those characters
+		// still looking for a solution.
+		std::list<Constraint*>::iterator ci;
+		for (ci = constraints.begin(); ci != constraints.end(); ci++)
+		{
+			(*ci)->suggestionUsed = false;
+		}
+
+		batchPending.resize(count);
+		for (a = 0; a < count; a++) batchPending[a] = a;
+
+		real shortestViolation, currentViolation, maxViolation;
+		Constraint *violatingConstraint = 0;
+		for (unsigned i = 0; i < constraintSteps && !batchPending.empty(); i++)
+		{
+			unsigned stillPending = 0;
+			for (unsigned p = 0; p < batchPending.size(); p++)
+			{
+				a = batchPending[p];
+				character = characters[a];
+				characterIndex = a;
+				Path *agentPath = batchPaths[a];
+
+				// Find the path to this goal
+				actuator->getPath(agentPath, batchGoals[a]);
+
+				// Find the constraint that is violated first
+				maxViolation = shortestViolation = agentPath->getMaxPriority();
+				for (ci = constraints.begin(); ci != constraints.end(); ci++)
+				{	
+					currentViolation = (*ci)->willViolate(agentPath, shortestViolation);
+					if (currentViolation > 0 && currentViolation < shortestViolation)
+					{
+						shortestViolation = currentViolation;
+						violatingConstraint = *ci;
+					}
+				}
+
+				// Check if we found a violation. If so update the goal now, 
+				// while the constraint still holds this character's 
+				// suggestion, and try again next round. Otherwise the path 
+				// is kept for the actuator.
+				if (shortestViolation < maxViolation)
+				{
+					violatingConstraint->fillSuggestion(agentPath, &batchGoals[a]);
+					violatingConstraint->suggestionUsed = true;
+					batchPending[stillPending++] = a;
+				}
+			}
+			AICORE_LIBRARY_RECORD_TIMES("SteeringPipe steps", i + 1,
+				batchPending.size() - stillPending);
+			batchPending.resize(stillPending);
+		}
+		AICORE_LIBRARY_RECORD_TIMES("SteeringPipe steps", constraintSteps,
+			batchPending.size());
+		AICORE_LIBRARY_COUNT("SteeringPipe fallbacks", batchPending.size());
+
+		// Run the actuator for everyone who found a path. Anyone left
+		// pending has run out of constraint iterations, so they use the
+		// fallback. The pending list is still in character order.
+		unsigned next = 0;
+		for (a = 0; a < count; a++)
+		{
+			character = characters[a];
+			characterIndex = a;
+			if (next < batchPending.size() && batchPending[next] == a)
+			{
+				next++;
+				if (fallback) 
+				{
+					fallback->character = character;
+					fallback->getSteering(outputs+a);
+				}
+			}
+			else
+			{
+				actuator->getSteering(outputs+a, batchPaths[a]);
+			}
+		}
+
+		character = original;
+		characterIndex = originalIndex;
+	}
+
+	SteeringPipeProgress::SteeringPipeProgress()
+		:
+		working(0), valid(0), steps(0), solving(false), hasValid(false)
+	{
+	}
+
+	SteeringPipeProgress::~SteeringPipeProgress()
+	{
+		clear();
+	}
+
+	void SteeringPipeProgress::clear()
+	{
+		delete working;
+		delete valid;
+		working = valid = 0;
+		steps = 0;
+		solving = hasValid = false;
+	}
+
+	SteeringPipeBudget::SteeringPipeBudget(unsigned stepsPerFrame,
+		unsigned maxStepsPerCharacter)
+		:
+		remaining(stepsPerFrame),
+		stepsPerFrame(stepsPerFrame),
+		maxStepsPerCharacter(maxStepsPerCharacter)
+	{
+	}
+
+	void SteeringPipe::beginSolving(SteeringPipeProgress *progress)
+	{
+		if (!progress->working) 
+		{
+			progress->working = actuator->createPathObject();
+			allocations++;
+		}
+		if (!progress->valid) 
+		{
+			progress->valid = actuator->createPathObject();
+			allocations++;
+		}
+		if (progress->solving) return;
+
+		Goal &goal = progress->goal;
+		goal.clear();
+
+		Goal targeterResult;
+		std::list<Targeter*>::iterator ti;
+		for (ti = targeters.begin(); ti != targeters.end(); ti++)
+		{
+			(*ti)->fillGoal(&targeterResult);
+			if (goal.canMergeGoals(targeterResult)) 
+			{
+				goal.updateGoal(targeterResult);
+			}
+		}
+
+		std::list<Decomposer*>::iterator di;
+		for (di = decomposers.begin(); di != decomposers.end(); di++)
+		{
+			(*di)->decomposeInPlace(&goal);
+		}
+
+		progress->steps = 0;
+		progress->solving = true;
+	}
+
+	unsigned SteeringPipe::continueSolving(SteeringPipeProgress *progress,
+		unsigned allowance)
+	{
+		std::list<Constraint*>::iterator ci;
+		real shortestViolation, currentViolation, maxViolation;
+		Constraint *violatingConstraint = 0;
+
+		unsigned taken = 0;
+		while (progress->solving && taken < allowance)
+		{
+			Path *working = progress->working;
+			taken++;
+			progress->steps++;
+
+			// Find the path to this goal
+			actuator->getPath(working, progress->goal);
+
+			// Find the constraint that is violated first
+			maxViolation = shortestViolation = working->getMaxPriority();
+			for (ci = constraints.begin(); ci != constraints.end(); ci++)
+			{	
+				currentViolation = (*ci)->willViolate(working, shortestViolation);
+				if (currentViolation > 0 && currentViolation < shortestViolation)
+				{
+					shortestViolation = currentViolation;
+					violatingConstraint = *ci;
+				}
+			}
+
+			if (shortestViolation < maxViolation)
+			{
+				// Update the goal and check again, unless this goal has
+				// had all its steps, in which case there is no solution.
+				violatingConstraint->fillSuggestion(working, &progress->goal);
+				violatingConstraint->suggestionUsed = true;
+				if (progress->steps >= constraintSteps)
+				{
+					progress->solving = false;
+					progress->hasValid = false;
+					AICORE_LIBRARY_RECORD("SteeringPipe steps", progress->steps);
+				}
+			}
+			else
+			{
+				// This path is the new solution.
+				progress->working = progress->valid;
+				progress->valid = working;
+				progress->solving = false;
+				progress->hasValid = true;
+				AICORE_LIBRARY_RECORD("SteeringPipe steps", progress->steps);
+			}
+		}
+		return taken;
+	}
+
+	void SteeringPipe::getProgressSteering(SteeringOutput *output,
+		const SteeringPipeProgress *progress)
+	{
+		if (progress->hasValid)
+		{
+			actuator->getSteering(output, progress->valid);
+		}
+		else
+		{
+			AICORE_LIBRARY_COUNT("SteeringPipe fallbacks", 1);
+			if (fallback)
+			{
+				fallback->character = character;
+				fallback->getSteering(output);
+			}
+		}
+	}
+
+	void SteeringPipe::getSteering(SteeringOutput* output,
+		SteeringPipeProgress* progress, SteeringPipeBudget* budget)
+	{
+		AICORE_PROFILE_LIBRARY_ZONE("SteeringPipe sliced");
+		std::list<Constraint*>::iterator ci;
+		for (ci = constraints.begin(); ci != constraints.end(); ci++)
+		{
+			(*ci)->suggestionUsed = false;
+		}
+
+		beginSolving(progress);
+		if (budget)
+		{
+			budget->spend(continueSolving(progress, budget->getAllowance()));
+		}
+		else
+		{
+			continueSolving(progress, constraintSteps);
+		}
+		getProgressSteering(output, progress);
+	}
+
+	void SteeringPipe::getSteering(Kinematic** characters, 
+		SteeringOutput* outputs, SteeringPipeProgress* progress, 
+		unsigned count, SteeringPipeBudget* budget)
+	{
+		AICORE_PROFILE_LIBRARY_ZONE("SteeringPipe sliced batch");
+		Kinematic *original = character;
+		unsigned originalIndex = characterIndex;
+
+		std::list<Constraint*>::iterator ci;
+		for (ci = constraints.begin(); ci != constraints.end(); ci++)
+		{
+			(*ci)->suggestionUsed = false;
+		}
+
+		// Start with whoever missed out last time.
+		if (sliceStart >= count) sliceStart = 0;
+		unsigned start = sliceStart;
+		bool starved = false;
+		for (unsigned n = 0; n < count; n++)
+		{
+			unsigned a = (start + n) % count;
+			character = characters[a];
+			characterIndex = a;
+			SteeringPipeProgress *agentProgress = progress + a;
+
+			beginSolving(agentProgress);
+			unsigned allowance = budget ? 
+				budget->getAllowance() : constraintSteps;
+			unsigned taken = continueSolving(agentProgress, allowance);
+			if (budget) budget->spend(taken);
+
+			if (!starved && agentProgress->solving && 
+				budget && budget->getRemaining() == 0)
+			{
+				sliceStart = a;
+				starved = true;
+			}
+
+			getProgressSteering(outputs+a, agentProgress);
+		}
+
+		character = original;
+		characterIndex = originalIndex;
+	}
+
 	void SteeringPipe::registerComponents()
 	{
 		std::list<Targeter*>::iterator ti;
@@ -183,17 +565,214 @@ namespace aicore
 		return goal;
 	}
 
+	void FixedGoalTargeter::fillGoal(Goal* goal)
+	{
+		*goal = this->goal;
+	}
+
+	ConstraintCache::ConstraintCache()
+		:
+		version(0), hits(0), misses(0), enabled(false), epsilon(0)
+	{
+	}
+
+	bool ConstraintCache::goalsMatch(const Goal &a, const Goal &b) const
+	{
+		real epSquared = epsilon*epsilon;
+		if (a.positionSet != b.positionSet ||
+			a.orientationSet != b.orientationSet ||
+			a.velocitySet != b.velocitySet ||
+			a.rotationSet != b.rotationSet) return false;
+
+		if (a.positionSet &&
+			(a.position - b.position).squareMagnitude() > epSquared) return false;
+		if (a.orientationSet &&
+			real_abs(a.orientation - b.orientation) > epsilon) return false;
+		if (a.velocitySet &&
+			(a.velocity - b.velocity).squareMagnitude() > epSquared) return false;
+		if (a.rotationSet &&
+			real_abs(a.rotation - b.rotation) > epsilon) return false;
+		return true;
+	}
+
+	bool ConstraintCache::find(unsigned index, const Kinematic *character,
+		const Path *path, real maxPriority, unsigned obstacleVersion,
+		real *priority, Goal *suggestion)
+	{
+		if (index >= characters.size() || 
+			characters[index].character != character) 
+		{
+			misses++;
+			return false;
+		}
+
+		// Find a result for this goal that is still up to date.
+		const CharacterEntries &held = characters[index];
+		const Entry *match = 0;
+		for (unsigned i = 0; i < held.count && !match; i++)
+		{
+			const Entry &entry = held.entries[i];
+			if (entry.version == version &&
+				entry.obstacleVersion == obstacleVersion &&
+				(entry.position - character->position).squareMagnitude() <= 
+					epsilon*epsilon &&
+				goalsMatch(entry.goal, path->goal))
+			{
+				match = &entry;
+			}
+		}
+		if (!match)
+		{
+			misses++;
+			return false;
+		}
+
+		const Entry &entry = *match;
+
+		// A violation is the first along the path, so it holds for any
+		// limit beyond it. No violation only tells us about limits up
+		// to the one that was tested.
+		if (entry.priority < entry.maxPriority)
+		{
+			if (entry.priority < maxPriority)
+			{
+				*priority = entry.priority;
+				*suggestion = entry.suggestion;
+			}
+			else
+			{
+				*priority = REAL_MAX;
+			}
+		}
+		else if (maxPriority <= entry.maxPriority)
+		{
+			*priority = REAL_MAX;
+		}
+		else
+		{
+			misses++;
+			return false;
+		}
+
+		hits++;
+		return true;
+	}
+
+	void ConstraintCache::store(unsigned index, const Kinematic *character,
+		const Path *path, real maxPriority, unsigned obstacleVersion,
+		real priority, const Goal &suggestion)
+	{
+		if (index >= characters.size()) characters.resize(index + 1);
+
+		// A different character at this index gets none of the last
+		// one's results.
+		CharacterEntries &held = characters[index];
+		if (held.character != character)
+		{
+			held.character = character;
+			held.count = 0;
+			held.next = 0;
+		}
+
+		// Replace the result for the same goal if there is one, then
+		// any out of date result, then the oldest.
+		const unsigned slots = sizeof(held.entries) / sizeof(Entry);
+		unsigned slot = slots;
+		for (unsigned i = 0; i < held.count && slot == slots; i++)
+		{
+			if (goalsMatch(held.entries[i].goal, path->goal)) slot = i;
+		}
+		for (unsigned i = 0; i < held.count && slot == slots; i++)
+		{
+			if (held.entries[i].version != version ||
+				held.entries[i].obstacleVersion != obstacleVersion) slot = i;
+		}
+		if (slot == slots)
+		{
+			if (held.count < slots) 
+			{
+				slot = held.count++;
+			}
+			else
+			{
+				slot = held.next;
+				held.next = (held.next + 1) % slots;
+			}
+		}
+
+		Entry &entry = held.entries[slot];
+		entry.position = character->position;
+		entry.goal = path->goal;
+		entry.maxPriority = maxPriority;
+		entry.priority = priority;
+		entry.suggestion = suggestion;
+		entry.version = version;
+		entry.obstacleVersion = obstacleVersion;
+	}
+
+	AvoidSpheresConstraint::AvoidSpheresConstraint()
+		:
+		broadphase(0),
+		avoidMargin(0)
+	{
+	}
+
 	real AvoidSpheresConstraint::willViolate(const Path* path, real maxPriority)
 	{
-		real priority = REAL_MAX;
+		if (!cache.enabled) return testObstacles(path, maxPriority);
+
+		const Kinematic *character = pipe->character;
+		unsigned obstacleVersion = broadphase ? broadphase->getVersion() : 0;
+		real priority;
+		if (cache.find(pipe->characterIndex, character, path, maxPriority, 
+			obstacleVersion, &priority, &suggestion))
+		{
+			return priority;
+		}
+
+		priority = testObstacles(path, maxPriority);
+		cache.store(pipe->characterIndex, character, path, maxPriority, 
+			obstacleVersion, priority, suggestion);
+		return priority;
+	}
+
+	real AvoidSpheresConstraint::testObstacles(const Path* path, real maxPriority)
+	{
+		// Anything further away than the max priority would be ignored 
+		// by the pipe, so use it as our starting point.
+		real priority = maxPriority;
 		real thisPriority;
-		std::list<Sphere*>::iterator soi;
-		for (soi = obstacles.begin(); soi != obstacles.end(); soi++)
+
+		if (!broadphase)
+		{
+			std::list<Sphere*>::iterator soi;
+			for (soi = obstacles.begin(); soi != obstacles.end(); soi++)
+			{
+				thisPriority = willViolate(path, priority, *(*soi));
+				if (thisPriority < priority) priority = thisPriority;
+			}
+			return priority < maxPriority ? priority : REAL_MAX;
+		}
+
+		// Make sure we've got a positional goal and are moving.
+		if (!path->goal.positionSet) return REAL_MAX;
+		const Kinematic *character = pipe->character;
+		Vector3 direction = path->goal.position - character->position;
+		if (direction.squareMagnitude() <= 0) return REAL_MAX;
+		direction.normalise();
+
+		// Only check the obstacles near the path.
+		candidates.clear();
+		broadphase->querySegment(
+			character->position, direction, maxPriority, avoidMargin, 
+			&candidates
+			);
+		for (unsigned i = 0; i < candidates.size(); i++)
 		{
-			thisPriority = willViolate(path, priority, *(*soi));
+			thisPriority = willViolate(path, priority, *candidates[i]);
 			if (thisPriority < priority) priority = thisPriority;
 		}
-		return priority;
+		return priority < maxPriority ? priority : REAL_MAX;
 	}
 
 	real AvoidSpheresConstraint::willViolate(
@@ -251,11 +830,16 @@ namespace aicore
 		return REAL_MAX;
 	}
 
-	Goal AvoidSpheresConstraint::suggest(const Path* path)
+	Goal AvoidSpheresConstraint::suggest(const Path* /*path*/)
 	{
 		return suggestion;
 	}
 
+	void AvoidSpheresConstraint::fillSuggestion(const Path* /*path*/, Goal* goal)
+	{
+		*goal = suggestion;
+	}
+
 	Path* BasicActuator::createPathObject()
 	{
 		return new Path;
@@ -16,6 +16,7 @@
 // Import the high performance timer (c. 4ms).
 #include <windows.h>
 #include <mmsystem.h>
+#include <intrin.h>
 #elif __MACH__
 #include <mach/mach_time.h>  
 #else
@@ -23,58 +24,84 @@
 #include <stdint.h>
 #endif
 
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#define AICORE_HAS_TSC
+#endif
+
 namespace aicore
 {
 
 #ifdef _WIN32
     // Hold internal timing data for the performance counter.
     static bool qpcFlag;
-    static double qpcFrequency;
+    static LONGLONG qpcFrequency;
 #endif
 
     // Internal time and clock access functions
-    unsigned systemTime()
+    unsigned long long systemNanoseconds()
     {
 #ifdef _WIN32
         if(qpcFlag)
         {
-            static LONGLONG qpcMillisPerTick;
-            QueryPerformanceCounter((LARGE_INTEGER*)&qpcMillisPerTick);
-            return (unsigned)(qpcMillisPerTick * qpcFrequency);
+            LONGLONG ticks;
+            QueryPerformanceCounter((LARGE_INTEGER*)&ticks);
+
+            // Split the conversion so it doesn't overflow.
+            LONGLONG seconds = ticks / qpcFrequency;
+            LONGLONG rest = ticks % qpcFrequency;
+            return (unsigned long long)seconds * 1000000000ull +
+                (unsigned long long)(rest * 1000000000ll / qpcFrequency);
         }
         else
         {
-            return unsigned(timeGetTime());
+            return (unsigned long long)timeGetTime() * 1000000ull;
         }
 #elif __MACH__
+        // The timebase is a fraction such as 125/3, so it has to be
+        // applied as a multiply and a divide, not as a whole number.
+        static mach_timebase_info_data_t info = {0,0};
+        if (info.denom == 0) mach_timebase_info(&info);
+
         uint64_t t = mach_absolute_time();
-        mach_timebase_info_data_t info = {0,0};
-        mach_timebase_info(&info);
-        uint64_t timenano = t * (info.numer / info.denom);
-        return timenano/1000000;
+        uint64_t whole = t / info.denom;
+        uint64_t rest = t % info.denom;
+        return whole * info.numer + rest * info.numer / info.denom;
 #else
         struct timespec cur;
-        clock_gettime(CLOCK_REALTIME, &cur);
-        return cur.tv_sec*1000 + cur.tv_nsec/1000000;
+        clock_gettime(CLOCK_MONOTONIC, &cur);
+        return (unsigned long long)cur.tv_sec * 1000000000ull +
+            (unsigned long long)cur.tv_nsec;
 #endif
     }
 
+    unsigned systemTime()
+    {
+        return (unsigned)(systemNanoseconds() / 1000000ull);
+    }
+
     unsigned TimingData::getTime()
     {
         return systemTime();
     }
 
+    unsigned long long TimingData::getNanoseconds()
+    {
+        return systemNanoseconds();
+    }
+
     unsigned long systemClock()
     {
-#ifdef _WIN32
-        __asm {
-            rdtsc;
-        }
-#else
-        volatile uint32_t lo, hi;
-        asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+#if defined(AICORE_HAS_TSC) && defined(_WIN32)
+        // Wait for earlier instructions, so they aren't counted.
+        _mm_lfence();
+        return (unsigned long)__rdtsc();
+#elif defined(AICORE_HAS_TSC)
+        uint32_t lo, hi;
+        asm volatile ("lfence\n\trdtsc" : "=a" (lo), "=d" (hi) :: "memory");
         uint64_t res = ((uint64_t)hi << 32) + lo;
-        return res;
+        return (unsigned long)res;
+#else
+        return (unsigned long)systemNanoseconds();
 #endif
     }
 
@@ -83,6 +110,37 @@ namespace aicore
         return systemClock();
     }
 
+    // Measures the clock against the monotonic time over a short
+    // interval.
+    static double calibrateClock()
+    {
+#ifdef AICORE_HAS_TSC
+        const unsigned long long interval = 20000000ull;
+
+        unsigned long long startTime = systemNanoseconds();
+        unsigned long startClock = systemClock();
+        unsigned long long endTime;
+        do
+        {
+            endTime = systemNanoseconds();
+        }
+        while (endTime - startTime < interval);
+        unsigned long endClock = systemClock();
+
+        return (double)(endClock - startClock) * 1.0e9 /
+            (double)(endTime - startTime);
+#else
+        return 1.0e9;
+#endif
+    }
+
+    double TimingData::getClockFrequency()
+    {
+        // Static initialisation only happens once, even with threads.
+        static const double frequency = calibrateClock();
+        return frequency;
+    }
+
     // Sets up the timing system and registers the performance timer.
     void initTime()
     {
@@ -93,8 +151,10 @@ namespace aicore
 
         // Check if we have access to the performance counter at this
         // resolution.
-        if (qpcFlag) qpcFrequency = 1000.0 / time;
+        if (qpcFlag) qpcFrequency = time;
 #endif
+
+        TimingData::getClockFrequency();
     }
 
 
@@ -107,6 +167,11 @@ namespace aicore
         return (TimingData&)*timingData;
     }
 
+    bool TimingData::isInitialised()
+    {
+        return timingData != NULL;
+    }
+
     // Updates the global frame information. Should be called once per frame.
     void TimingData::update()
     {
@@ -130,6 +195,11 @@ namespace aicore
         thisClock - timingData->lastFrameClockstamp;
         timingData->lastFrameClockstamp = thisClock;
 
+        unsigned long long thisNanos = systemNanoseconds();
+        timingData->lastFrameNanoseconds =
+            thisNanos - timingData->lastFrameNanostamp;
+        timingData->lastFrameNanostamp = thisNanos;
+
         // Update the RWA frame rate if we are able to.
         if (timingData->frameNumber > 1) {
             if (timingData->averageFrameDuration <= 0)
@@ -168,6 +238,9 @@ namespace aicore
         timingData->lastFrameClockstamp = systemClock();
         timingData->lastFrameClockTicks = 0;
 
+        timingData->lastFrameNanostamp = systemNanoseconds();
+        timingData->lastFrameNanoseconds = 0;
+
         timingData->isPaused = false;
 
         timingData->averageFrameDuration = 0;
@@ -180,4 +253,46 @@ namespace aicore
             timingData = NULL;
     }
 
+    FixedTimestep::FixedTimestep(double ticksPerSecond, unsigned maxTicks)
+        :
+        step(1.0 / ticksPerSecond), accumulator(0),
+        maxTicks(maxTicks), tickCount(0)
+    {
+    }
+
+    void FixedTimestep::setRate(double ticksPerSecond)
+    {
+        step = 1.0 / ticksPerSecond;
+    }
+
+    void FixedTimestep::reset()
+    {
+        accumulator = 0;
+        tickCount = 0;
+    }
+
+    unsigned FixedTimestep::advance(double seconds)
+    {
+        accumulator += seconds;
+
+        unsigned ticks = 0;
+        while (accumulator >= step && ticks < maxTicks)
+        {
+            accumulator -= step;
+            ticks++;
+        }
+
+        // If we're still behind, drop the time we can't catch up on.
+        if (accumulator >= step) accumulator = 0;
+
+        tickCount += ticks;
+        return ticks;
+    }
+
+    unsigned FixedTimestep::update()
+    {
+        if (!timingData || timingData->isPaused) return 0;
+        return advance((double)timingData->lastFrameNanoseconds * 1.0e-9);
+    }
+
 }; // end of namespace